@@ -0,0 +1,158 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "../app_config.h"
+
+#include <tpie/tpie.h>
+#include <tpie/pipelining.h>
+#include <tpie/geometry.h>
+#include <iostream>
+#include "testtime.h"
+#include "stat.h"
+#include "testinfo.h"
+#include <boost/random/mersenne_twister.hpp>
+
+using namespace tpie;
+using namespace tpie::pipelining;
+using namespace tpie::test;
+
+// Integer coordinates below 10^9 keep the orientation tests exact, since
+// their products stay below 2^63.
+typedef int64_t coord_t;
+typedef point_2d<coord_t> point_t;
+
+// The full size benchmark is 10^10 points.
+const stream_size_type points_default = 1000000;
+
+void usage() {
+	std::cout << "Parameters: [times] [points] [memory]" << std::endl;
+}
+
+// Pushes points with random integer coordinates in a square.
+template <typename dest_t>
+class random_points_t : public node {
+public:
+	typedef point_t item_type;
+
+	random_points_t(const dest_t & dest, stream_size_type count)
+		: dest(dest)
+		, count(count)
+	{
+		add_push_destination(dest);
+		set_name("Generate points");
+		set_steps(count);
+	}
+
+	virtual void go() override {
+		boost::mt19937 rng;
+		for (stream_size_type i = 0; i < count; ++i) {
+			point_t p;
+			p.x = static_cast<coord_t>(rng() % 1000000000);
+			p.y = static_cast<coord_t>(rng() % 1000000000);
+			dest.push(p);
+			step();
+		}
+	}
+
+private:
+	dest_t dest;
+	stream_size_type count;
+};
+
+class hash_t : public node {
+public:
+	typedef point_t item_type;
+
+	hash_t(stream_size_type & vertices, stream_size_type & hash)
+		: vertices(vertices)
+		, hash(hash)
+	{
+		set_name("Hash hull");
+	}
+
+	void push(const point_t & p) {
+		++vertices;
+		hash = (hash * 13 + static_cast<stream_size_type>(p.x) + static_cast<stream_size_type>(p.y)) % 100000000000000ull;
+	}
+
+private:
+	stream_size_type & vertices;
+	stream_size_type & hash;
+};
+
+void test(stream_size_type count, size_t times) {
+	std::vector<const char *> names;
+	names.resize(3);
+	names[0] = "Hull";
+	names[1] = "Vertices";
+	names[2] = "Hash";
+	tpie::test::stat s(names);
+	for (size_t i = 0; i < times; ++i) {
+		test_realtime_t start;
+		test_realtime_t end;
+		stream_size_type vertices = 0;
+		stream_size_type hash = 0;
+		getTestRealtime(start);
+		pipeline p = pipe_begin<factory_1<random_points_t, stream_size_type> >(count)
+			| convex_hull<coord_t>()
+			| pipe_end<termfactory_2<hash_t, stream_size_type &, stream_size_type &> >(
+				termfactory_2<hash_t, stream_size_type &, stream_size_type &>(vertices, hash));
+		p();
+		getTestRealtime(end);
+		s(testRealtimeDiff(start,end));
+		s(vertices);
+		s(hash);
+	}
+}
+
+int main(int argc, char **argv) {
+	size_t times = 10;
+	stream_size_type count = points_default;
+	size_t memory = 1024;
+
+	if (argc > 1) {
+		if (std::string(argv[1]) == "0") {
+			times = 0;
+		} else {
+			std::stringstream(argv[1]) >> times;
+			if (!times) {
+				usage();
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (argc > 2) {
+		std::stringstream(argv[2]) >> count;
+		if (!count) {
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc > 3) {
+		std::stringstream(argv[3]) >> memory;
+		if (!memory) {
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	testinfo t("Convex hull speed test", memory, static_cast<size_t>(count * sizeof(point_t) / (1024 * 1024)), times);
+	::test(count, times);
+	return EXIT_SUCCESS;
+}
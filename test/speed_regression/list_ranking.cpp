@@ -0,0 +1,141 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "../app_config.h"
+
+#include <tpie/tpie.h>
+#include <tpie/list_ranking.h>
+#include <tpie/euler_tour.h>
+#include <iostream>
+#include "testtime.h"
+#include "stat.h"
+#include "testinfo.h"
+#include <boost/random/mersenne_twister.hpp>
+
+using namespace tpie;
+using namespace tpie::test;
+
+const size_t mb_default=1;
+
+typedef list_ranking_node<stream_size_type> node_t;
+typedef list_ranking_rank<stream_size_type> rank_t;
+
+void usage() {
+	std::cout << "Parameters: [times] [mb] [memory]" << std::endl;
+}
+
+// A prime larger than any list, so that i -> (i * step) mod prime scatters
+// the ids of consecutive nodes.
+const stream_size_type prime = 4294967291ull;
+const stream_size_type step = 104729;
+
+void test(size_t mb, size_t times, size_t memory) {
+	std::vector<const char *> names;
+	names.resize(4);
+	names[0] = "Generate";
+	names[1] = "List rank";
+	names[2] = "Root tree";
+	names[3] = "Hash";
+	tpie::test::stat s(names);
+	stream_size_type count = static_cast<stream_size_type>(mb)*1024*1024/sizeof(node_t);
+	// Half of the memory limit for ranking in internal memory, as list_rank
+	// uses by default; the rest is left for the streams.
+	memory_size_type rankMemory = static_cast<memory_size_type>(memory)*1024*1024/2;
+	boost::mt19937 rng;
+	for (size_t i = 0; i < times; ++i) {
+		test_realtime_t start;
+		test_realtime_t end;
+
+		file_stream<node_t> nodes;
+		file_stream<euler_tour_edge> edges;
+		getTestRealtime(start);
+		nodes.open();
+		edges.open();
+		for (stream_size_type j = 0; j < count; ++j) {
+			node_t u;
+			u.id = (j * step) % prime;
+			u.next = (j + 1 == count) ? list_ranking_end : ((j + 1) * step) % prime;
+			u.weight = 1;
+			nodes.write(u);
+			if (j > 0) edges.write(euler_tour_edge(rng() % j, j));
+		}
+		getTestRealtime(end);
+		s(testRealtimeDiff(start,end));
+
+		stream_size_type hash = 0;
+		getTestRealtime(start);
+		{
+			file_stream<rank_t> ranks;
+			ranks.open();
+			list_rank(nodes, ranks, rankMemory);
+			while (ranks.can_read()) hash = hash * 13 + ranks.read().rank;
+		}
+		getTestRealtime(end);
+		s(testRealtimeDiff(start,end));
+
+		getTestRealtime(start);
+		{
+			file_stream<rooted_tree_vertex> tree;
+			tree.open();
+			root_tree(edges, 0, tree, rankMemory);
+			while (tree.can_read()) hash = hash * 13 + tree.read().depth;
+		}
+		getTestRealtime(end);
+		s(testRealtimeDiff(start,end));
+
+		hash %= 100000000000000ull;
+		s(hash);
+	}
+}
+
+int main(int argc, char **argv) {
+	size_t times = 10;
+	size_t mb = mb_default;
+	size_t memory = 1024;
+
+	if (argc > 1) {
+		if (std::string(argv[1]) == "0") {
+			times = 0;
+		} else {
+			std::stringstream(argv[1]) >> times;
+			if (!times) {
+				usage();
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (argc > 2) {
+		std::stringstream(argv[2]) >> mb;
+		if (!mb) {
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc > 3) {
+		std::stringstream(argv[3]) >> memory;
+		if (!memory) {
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	testinfo t("List ranking speed test", memory, mb, times);
+	::test(mb, times, memory);
+	return EXIT_SUCCESS;
+}
@@ -18,27 +18,197 @@
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 #include "../app_config.h"
 
-#include <tpie/stream.h>
+#include <cstdlib> // exit
+#include <tpie/tpie.h>
+#include <tpie/pipelining.h>
+#include <tpie/progress_indicator_arrow.h>
+#include <tpie/progress_indicator_null.h>
 #include <iostream>
+#include <sstream>
 #include "testtime.h"
-#include <tpie/progress_indicator_arrow.h>
-using namespace tpie::ami;
+
+using namespace tpie;
+using namespace tpie::pipelining;
 using namespace tpie::test;
 
+typedef tpie::uint64_t test_t;
+
+static std::string prog;
+
+static inline void usage() {
+	std::cout << "Usage: " << prog << " [count]\n"
+		<< "count: Number of steps in each measurement"
+		<< std::endl;
+	exit(EXIT_FAILURE);
+}
+
+template <typename dest_t>
+class stepping_generator_t : public node {
+public:
+	typedef test_t item_type;
+
+	stepping_generator_t(const dest_t & dest, stream_size_type count)
+		: dest(dest)
+		, count(count)
+	{
+		add_push_destination(dest);
+		set_name("Generator");
+	}
+
+	virtual void propagate() override {
+		set_steps(count);
+	}
+
+	virtual void go() override {
+		for (stream_size_type i = 0; i < count; ++i) {
+			dest.push(i);
+			step();
+		}
+	}
+
+private:
+	dest_t dest;
+	stream_size_type count;
+};
+
+template <typename dest_t>
+class stepping_identity_t : public node {
+public:
+	typedef test_t item_type;
+
+	stepping_identity_t(const dest_t & dest)
+		: dest(dest)
+	{
+		add_push_destination(dest);
+		set_name("Stepping identity");
+	}
+
+	virtual void propagate() override {
+		set_steps(fetch<stream_size_type>("items"));
+	}
+
+	void push(const test_t & item) {
+		dest.push(item);
+		step();
+	}
+
+private:
+	dest_t dest;
+};
+
+template <typename dest_t>
+class generator_t : public node {
+public:
+	typedef test_t item_type;
+
+	generator_t(const dest_t & dest, stream_size_type count)
+		: dest(dest)
+		, count(count)
+	{
+		add_push_destination(dest);
+		set_name("Generator");
+	}
+
+	virtual void propagate() override {
+		forward<stream_size_type>("items", count);
+	}
+
+	virtual void go() override {
+		for (stream_size_type i = 0; i < count; ++i) dest.push(i);
+	}
+
+private:
+	dest_t dest;
+	stream_size_type count;
+};
+
+class sink_t : public node {
+public:
+	typedef test_t item_type;
+
+	sink_t(test_t & output) : output(output) {}
+
+	void push(const test_t & item) {
+		output += item;
+	}
+
+private:
+	test_t & output;
+};
+
+template <typename pi_t>
+static void test_indicator(const char * name, stream_size_type count) {
+	test_realtime_t start;
+	test_realtime_t end;
+	getTestRealtime(start);
+	pi_t pi("Test", count);
+	pi.init(count);
+	for (stream_size_type i = 0; i < count; ++i) {
+		pi.step();
+	}
+	pi.done();
+	getTestRealtime(end);
+	std::cout << name << ' ' << testRealtimeDiff(start,end) << std::endl;
+}
+
+static void test_pipeline(stream_size_type count) {
+	test_realtime_t start;
+	test_realtime_t end;
+	test_t res = 0;
+	getTestRealtime(start);
+	{
+		pipeline p = make_pipe_begin_1<stepping_generator_t, stream_size_type>(count)
+			| make_pipe_end_1<sink_t, test_t &>(res);
+		p();
+	}
+	getTestRealtime(end);
+	std::cout << "Pipeline " << testRealtimeDiff(start,end) << ' ' << res << std::endl;
+}
+
+static void test_parallel(stream_size_type count) {
+	test_realtime_t start;
+	test_realtime_t end;
+	test_t res = 0;
+	getTestRealtime(start);
+	{
+		pipeline p = make_pipe_begin_1<generator_t, stream_size_type>(count)
+			| parallel(make_pipe_middle_0<stepping_identity_t>())
+			| make_pipe_end_1<sink_t, test_t &>(res);
+		p();
+	}
+	getTestRealtime(end);
+	std::cout << "Parallel " << testRealtimeDiff(start,end) << ' ' << res << std::endl;
+}
+
+// Null indicator that takes a title like progress_indicator_arrow.
+class null_indicator : public progress_indicator_null {
+public:
+	null_indicator(const char *, stream_size_type range)
+		: progress_indicator_null(range)
+	{
+	}
+};
+
+int main(int argc, char **argv) {
+	stream_size_type count = 1024ull*1024ull*1024ull;
+	prog = argv[0];
+
+	if (argc > 1) {
+		std::string arg(argv[1]);
+		if (arg == "--help" || arg == "-h") usage();
+		std::stringstream(arg) >> count;
+		if (!count) usage();
+	}
+
+	tpie::tpie_init();
+	tpie::get_memory_manager().set_limit(128*1024*1024);
+
+	test_indicator<progress_indicator_arrow>("Arrow", count);
+	test_indicator<null_indicator>("Null", count);
+	test_pipeline(count);
+	test_parallel(count);
+
+	tpie::tpie_finish();
 
-uint64_t size= 1024ull*1024ull*1024ull*16ull;
-int main() {
-  test_realtime_t start;
-  test_realtime_t end;
-	
-  getTestRealtime(start);
-  tpie::progress_indicator_arrow pi("Test", size);
-  pi.init(size);
-  for(uint64_t i=0; i < size; ++i) {
-    pi.step();
-  }
-  pi.done();
-
-  getTestRealtime(end);
-  std::cout << "Time " << testRealtimeDiff(start,end) << std::endl;
+	return EXIT_SUCCESS;
 }
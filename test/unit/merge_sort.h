@@ -167,6 +167,12 @@ static bool small_final_fanout_test(double mb) {
 	return sort_test(3,12,7,mb);
 }
 
+// Leaves more runs in the final merge level than the fanout, so that run
+// files hold several runs during the final merge.
+static bool final_level_over_fanout_test() {
+	return sort_test(3,12,7,16);
+}
+
 static bool evacuate_before_merge_test() {
 	return sort_test(20,20,20,8, 0, true, false);
 }
@@ -185,6 +191,7 @@ static tests & add_all(tests & t) {
 		.test(one_run_external_report_test, "one_run_external_report")
 		.test(external_report_test, "external_report")
 		.test(small_final_fanout_test, "small_final_fanout", "mb", 8.0)
+		.test(final_level_over_fanout_test, "final_level_over_fanout")
 		.test(evacuate_before_merge_test, "evacuate_before_merge")
 		.test(evacuate_before_report_test, "evacuate_before_report")
 		;
@@ -0,0 +1,139 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/connected_components.h>
+#include <tpie/pipelining.h>
+#include <boost/random.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace tpie;
+
+typedef connected_components_edge edge_t;
+
+// Random graph on n vertices with sparse shuffled ids. It holds a long path,
+// to give deep hook trees, random edges, and isolated vertices given as
+// self loops. expected[i] is the label of the vertex with id 3i+1.
+void random_graph(size_t n, std::vector<edge_t> & edges, std::vector<stream_size_type> & expected) {
+	boost::mt19937 rng(23);
+	std::vector<stream_size_type> ids(n);
+	for (size_t i = 0; i < n; ++i) ids[i] = 3 * i + 1;
+	std::random_shuffle(ids.begin(), ids.end());
+
+	disjoint_sets<size_t> sets(n);
+	for (size_t i = 0; i < n; ++i) sets.make_set(i);
+	edges.clear();
+	for (size_t i = 1; i < n / 4; ++i) edges.push_back(edge_t(ids[i-1], ids[i]));
+	for (size_t i = 0; i < n / 3; ++i) {
+		stream_size_type u = ids[n / 4 + rng() % (n - n / 4)];
+		stream_size_type v = ids[n / 4 + rng() % (n - n / 4)];
+		edges.push_back(edge_t(u, v));
+	}
+	// Every vertex not yet in an edge is isolated.
+	std::vector<bool> seen(n, false);
+	for (size_t i = 0; i < edges.size(); ++i) {
+		size_t u = edges[i].first / 3;
+		size_t v = edges[i].second / 3;
+		seen[u] = seen[v] = true;
+		sets.union_set(u, v);
+	}
+	for (size_t i = 0; i < n; ++i)
+		if (!seen[i]) edges.push_back(edge_t(3 * i + 1, 3 * i + 1));
+	std::random_shuffle(edges.begin(), edges.end());
+
+	// The least vertex of a component has the least index.
+	std::vector<stream_size_type> least(n, n);
+	for (size_t i = 0; i < n; ++i) {
+		size_t r = sets.find_set(i);
+		if (least[r] == n) least[r] = i;
+	}
+	expected.resize(n);
+	for (size_t i = 0; i < n; ++i) expected[i] = 3 * least[sets.find_set(i)] + 1;
+}
+
+bool check_labels(const std::vector<connected_component> & labels,
+				  const std::vector<stream_size_type> & expected) {
+	TEST_ENSURE_EQUALITY(expected.size(), labels.size(), "Wrong number of vertices");
+	for (size_t i = 0; i < labels.size(); ++i) {
+		TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(3 * i + 1), labels[i].vertex, "Vertices are not sorted");
+		if (labels[i].component != expected[i]) {
+			log_error() << "Vertex " << labels[i].vertex << " has label " << labels[i].component
+						<< ", expected " << expected[i] << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool connected_components_test(size_t n, memory_size_type memory) {
+	std::vector<edge_t> e;
+	std::vector<stream_size_type> expected;
+	random_graph(n, e, expected);
+	file_stream<edge_t> edges;
+	edges.open();
+	edges.write(e.begin(), e.end());
+	file_stream<connected_component> out;
+	out.open();
+	connected_components(edges, out, memory);
+	std::vector<connected_component> labels;
+	while (out.can_read()) labels.push_back(out.read());
+	return check_labels(labels, expected);
+}
+
+bool semi_external_test(size_t n) {
+	return connected_components_test(n, 0);
+}
+
+// The vertices only fit in memory after a round of contraction.
+bool external_test(size_t n) {
+	return connected_components_test(n, 16*1024*1024);
+}
+
+// Memory bounds below what a sort needs are raised to it.
+bool low_memory_test(size_t n) {
+	file_stream<edge_t> edges;
+	edges.open();
+	file_stream<connected_component> out;
+	out.open();
+	connected_components(edges, out, 100000);
+	TEST_ENSURE(out.size() == 0, "Labels of an empty graph");
+	return connected_components_test(n, 100000)
+		&& connected_components_test(n, 3000000);
+}
+
+bool pipeline_test(size_t n) {
+	std::vector<edge_t> edges;
+	std::vector<stream_size_type> expected;
+	random_graph(n, edges, expected);
+	std::vector<connected_component> labels;
+	pipelining::pipeline p = pipelining::input_vector(edges)
+		| pipelining::connected_components()
+		| pipelining::output_vector(labels);
+	p();
+	return check_labels(labels, expected);
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(semi_external_test, "semi_external", "n", static_cast<size_t>(100000))
+		.test(external_test, "external", "n", static_cast<size_t>(800000))
+		.test(low_memory_test, "low_memory", "n", static_cast<size_t>(4000))
+		.test(pipeline_test, "pipeline", "n", static_cast<size_t>(100000));
+}
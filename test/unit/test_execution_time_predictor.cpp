@@ -0,0 +1,228 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2026, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/execution_time_predictor.h>
+#include <tpie/prime.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace tpie;
+
+namespace {
+
+// The execution time log is stored in the home directory of the user.
+// The tests point HOME to a fresh directory so they neither read nor
+// modify the log of the user running them.
+
+const char * log_header = "TPIE execution time log 1\n";
+
+// Layout of a record in the execution time log.
+struct log_record {
+	boost::uint64_t id;
+	boost::uint64_t n;
+	boost::uint64_t memory;
+	boost::uint64_t time;
+};
+
+class scratch_home {
+public:
+	scratch_home()
+		: m_dir(boost::filesystem::current_path() / "execution_time_predictor_home")
+	{
+		const char * home = getenv("HOME");
+		m_hadHome = home != 0;
+		if (m_hadHome) m_oldHome = home;
+
+		finish_execution_time_db();
+		boost::filesystem::remove_all(m_dir);
+		boost::filesystem::create_directory(m_dir);
+		setenv("HOME", m_dir.string().c_str(), 1);
+		init_execution_time_db();
+	}
+
+	~scratch_home() {
+		finish_execution_time_db();
+		if (m_hadHome) setenv("HOME", m_oldHome.c_str(), 1);
+		else unsetenv("HOME");
+		boost::filesystem::remove_all(m_dir);
+		init_execution_time_db();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Store the measurements of this process and read the log again, as a
+	/// new process would.
+	///////////////////////////////////////////////////////////////////////////
+	void reload() {
+		finish_execution_time_db();
+		init_execution_time_db();
+	}
+
+	std::string log_path() {
+		std::string name = ".tpie_execution_time_log";
+#ifndef TPIE_NDEBUG
+		name += "_debug";
+#endif
+		return (m_dir / name).string();
+	}
+
+	stream_size_type log_records() {
+		if (!boost::filesystem::exists(log_path())) return 0;
+		return (boost::filesystem::file_size(log_path()) - strlen(log_header)) / sizeof(log_record);
+	}
+
+private:
+	boost::filesystem::path m_dir;
+	bool m_hadHome;
+	std::string m_oldHome;
+};
+
+time_type measure(const std::string & id, stream_size_type n) {
+	execution_time_predictor p(id);
+	p.start_execution(n);
+	return p.end_execution();
+}
+
+bool has_estimate(const std::string & id, stream_size_type n, time_type expect) {
+	execution_time_predictor p(id);
+	double confidence;
+	time_type t = p.estimate_execution_time(n, confidence);
+	if (confidence != 1.0 || t != expect) {
+		log_error() << "Estimate of " << id << " at " << n << " is " << t
+					<< " with confidence " << confidence << ", expected " << expect << std::endl;
+		return false;
+	}
+	return true;
+}
+
+} // unnamed namespace
+
+bool append_test() {
+#ifndef WIN32
+	scratch_home home;
+	time_type t1 = measure("etp_test_append", 1000);
+	home.reload();
+	TEST_ENSURE(home.log_records() == 1, "Wrong number of records after the first store");
+	if (!has_estimate("etp_test_append", 1000, t1)) return false;
+
+	time_type t2 = measure("etp_test_append", 2000);
+	home.reload();
+	TEST_ENSURE(home.log_records() == 2, "The log was not appended to");
+	if (!has_estimate("etp_test_append", 1000, t1)) return false;
+	if (!has_estimate("etp_test_append", 2000, t2)) return false;
+#endif
+	return true;
+}
+
+bool two_writers_test() {
+#ifndef WIN32
+	scratch_home home;
+	measure("etp_test_writers", 500);
+	home.reload();
+
+	// Both processes have loaded the log. The child stores its measurement
+	// first; the parent must keep it when storing its own.
+	pid_t pid = fork();
+	if (pid == 0) {
+		measure("etp_test_child", 1000);
+		finish_execution_time_db();
+		_exit(0);
+	}
+	TEST_ENSURE(pid > 0, "fork failed");
+	int status;
+	waitpid(pid, &status, 0);
+	TEST_ENSURE(WIFEXITED(status) && WEXITSTATUS(status) == 0, "Child failed");
+	TEST_ENSURE(home.log_records() == 2, "The child did not append its record");
+
+	measure("etp_test_parent", 2000);
+	home.reload();
+	TEST_ENSURE(home.log_records() == 3, "A record was lost");
+
+	double confidence;
+	execution_time_predictor child("etp_test_child");
+	child.estimate_execution_time(1000, confidence);
+	TEST_ENSURE(confidence == 1.0, "The measurement of the child was lost");
+	execution_time_predictor parent("etp_test_parent");
+	parent.estimate_execution_time(2000, confidence);
+	TEST_ENSURE(confidence == 1.0, "The measurement of the parent was lost");
+#endif
+	return true;
+}
+
+bool compaction_test() {
+#ifndef WIN32
+	scratch_home home;
+	const size_t records = 5000;
+	const size_t sizes = 5;
+	{
+		// A log written by many earlier runs.
+		finish_execution_time_db();
+		std::ofstream f(home.log_path().c_str(), std::ofstream::binary);
+		f.write(log_header, strlen(log_header));
+		for (size_t i = 0; i < records; ++i) {
+			log_record r;
+			r.id = prime_hash("etp_test_compact");
+			r.n = (i % sizes + 1) * 1000;
+			r.memory = (i % 2) ? (1 << 20) : 0;
+			r.time = (i % sizes + 1) * 10;
+			f.write(reinterpret_cast<const char *>(&r), sizeof(r));
+		}
+		f.close();
+		init_execution_time_db();
+	}
+
+	const stream_size_type queries[] = {1000, 1500, 3000, 5000, 7000};
+	const size_t nQueries = sizeof(queries) / sizeof(queries[0]);
+	std::vector<time_type> before(nQueries);
+	std::vector<double> beforeConfidence(nQueries);
+	execution_time_predictor p("etp_test_compact");
+	for (size_t i = 0; i < nQueries; ++i)
+		before[i] = p.estimate_execution_time(queries[i], 1 << 20, beforeConfidence[i]);
+
+	// Storing a new measurement compacts the oversized log.
+	measure("etp_test_compact_trigger", 1000);
+	home.reload();
+	TEST_ENSURE(home.log_records() < records / 10, "The log was not compacted");
+
+	for (size_t i = 0; i < nQueries; ++i) {
+		double confidence;
+		time_type t = p.estimate_execution_time(queries[i], 1 << 20, confidence);
+		TEST_ENSURE(t == before[i], "Estimate changed by compaction");
+		TEST_ENSURE(confidence == beforeConfidence[i], "Confidence changed by compaction");
+	}
+	TEST_ENSURE(before[2] == 30 && beforeConfidence[2] == 1.0, "Wrong estimate from the log");
+#endif
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(append_test, "append")
+		.test(two_writers_test, "two_writers")
+		.test(compaction_test, "compaction");
+}
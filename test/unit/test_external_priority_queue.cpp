@@ -18,6 +18,9 @@
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 #include "common.h"
 #include <tpie/priority_queue.h>
+#include <tpie/keyed_priority_queue.h>
+#include <map>
+#include <set>
 #include <vector>
 #include "priority_queue.h"
 #include "../test_portability.h"
@@ -286,6 +289,187 @@ bool remove_group_buffer_test(memory_size_type mmAvail, double blockFact, stream
 	return cyclic_pq_test(pq, items, iterations);
 }
 
+bool batch_test(bool background) {
+	const memory_size_type mmAvail = 4*1024*1024;
+	const size_t batch = 100000;
+	ami::priority_queue<boost::uint64_t> pq(mmAvail);
+	pq.set_background_merging(background);
+	std::priority_queue<boost::uint64_t, vector<boost::uint64_t>, std::greater<boost::uint64_t> > pq2;
+	boost::rand48 rng;
+	vector<boost::uint64_t> items(batch);
+	vector<boost::uint64_t> popped(batch);
+	for (size_t round = 0; round < 20; ++round) {
+		for (size_t i = 0; i < batch; ++i) {
+			items[i] = rng() % 1000000;
+			pq2.push(items[i]);
+		}
+		pq.push_batch(items.begin(), items.end());
+		if (pq.size() != pq2.size()) {
+			log_error() << "Round " << round << ": size " << pq.size()
+						<< ", expected " << pq2.size() << std::endl;
+			return false;
+		}
+		size_t n = (round % 2) ? batch/2 : batch/3;
+		if (pq.pop_batch(popped.begin(), n) != n) {
+			log_error() << "pop_batch returned too few items" << std::endl;
+			return false;
+		}
+		for (size_t i = 0; i < n; ++i) {
+			if (popped[i] != pq2.top()) {
+				log_error() << "Round " << round << " item " << i << ": got " << popped[i]
+							<< ", expected " << pq2.top() << std::endl;
+				return false;
+			}
+			pq2.pop();
+		}
+	}
+	while (!pq.empty()) {
+		size_t n = static_cast<size_t>(pq.pop_batch(popped.begin(), batch));
+		for (size_t i = 0; i < n; ++i) {
+			if (popped[i] != pq2.top()) {
+				log_error() << "Draining: got " << popped[i] << ", expected " << pq2.top() << std::endl;
+				return false;
+			}
+			pq2.pop();
+		}
+	}
+	if (!pq2.empty()) {
+		log_error() << "Priority queue is missing items" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Background merging falls back to synchronous merging without a job
+// manager.
+bool no_job_manager_test() {
+	tpie_finish(JOB_MANAGER);
+	bool result = batch_test(true);
+	tpie_init(JOB_MANAGER);
+	return result;
+}
+
+struct collect_pairs {
+	collect_pairs(vector<pair<uint64_t, uint64_t> > & out) : out(&out) {}
+	void operator()(uint64_t k, uint64_t p) { out->push_back(make_pair(k, p)); }
+	vector<pair<uint64_t, uint64_t> > * out;
+};
+
+bool decrease_key_test(stream_size_type operations) {
+	typedef pair<uint64_t, uint64_t> kp_t;
+	keyed_priority_queue<uint64_t, uint64_t> pq(static_cast<memory_size_type>(4*1024*1024));
+	std::map<uint64_t, uint64_t> priority;
+	std::set<pair<uint64_t, uint64_t> > reference; // (priority, key)
+	boost::rand48 rng;
+	uint64_t nextKey = 0;
+	vector<kp_t> popped;
+	for (stream_size_type i = 0; i < operations; ++i) {
+		uint64_t op = rng() % 10;
+		if (op < 4 || priority.empty()) {
+			uint64_t p = rng() % 100000;
+			pq.push(nextKey, p);
+			priority[nextKey] = p;
+			reference.insert(make_pair(p, nextKey));
+			++nextKey;
+		} else if (op < 7) {
+			std::map<uint64_t, uint64_t>::iterator j = priority.lower_bound(rng() % nextKey);
+			if (j == priority.end()) continue;
+			uint64_t p = j->second / 2;
+			pq.decrease_key(j->first, j->second, p);
+			reference.erase(make_pair(j->second, j->first));
+			reference.insert(make_pair(p, j->first));
+			j->second = p;
+		} else if (op < 8) {
+			std::map<uint64_t, uint64_t>::iterator j = priority.lower_bound(rng() % nextKey);
+			if (j == priority.end()) continue;
+			pq.erase(j->first, j->second);
+			reference.erase(make_pair(j->second, j->first));
+			priority.erase(j);
+		} else {
+			popped.clear();
+			if (op == 8) pq.pop_bulk(std::back_inserter(popped), 10);
+			else pq.pop_all_equal(collect_pairs(popped));
+			for (size_t j = 0; j < popped.size(); ++j) {
+				if (reference.empty() || popped[j].first != reference.begin()->second
+					|| popped[j].second != reference.begin()->first) {
+					log_error() << "Operation " << i << ": popped (" << popped[j].first << ", "
+								<< popped[j].second << ")" << std::endl;
+					return false;
+				}
+				priority.erase(popped[j].first);
+				reference.erase(reference.begin());
+			}
+			if (op == 9 && !reference.empty() && !popped.empty()
+				&& reference.begin()->first == popped[0].second) {
+				log_error() << "pop_all_equal left an item of equal priority" << std::endl;
+				return false;
+			}
+		}
+		if (pq.size() != reference.size()) {
+			log_error() << "Operation " << i << ": size " << pq.size() << ", expected " << reference.size() << std::endl;
+			return false;
+		}
+	}
+	while (!pq.empty()) {
+		kp_t top = pq.top();
+		if (top.first != reference.begin()->second || top.second != reference.begin()->first) {
+			log_error() << "Draining: got (" << top.first << ", " << top.second << ")" << std::endl;
+			return false;
+		}
+		pq.pop();
+		reference.erase(reference.begin());
+	}
+	return reference.empty();
+}
+
+// Orders priorities ascending or descending, to check that the instance is
+// passed on.
+struct flip_less : public std::binary_function<uint64_t, uint64_t, bool> {
+	flip_less(bool descending = false) : descending(descending) {}
+	bool operator()(uint64_t a, uint64_t b) const { return descending ? b < a : a < b; }
+	bool descending;
+};
+
+// Tombstones cancel against their pairs when the insertion buffer is
+// written and in the merges, long before they reach the top.
+bool cancel_test(size_t n) {
+	keyed_priority_queue<uint64_t, uint64_t, flip_less> pq(static_cast<memory_size_type>(4*1024*1024),
+														   0.0625, flip_less(true));
+	boost::rand48 rng;
+	vector<uint64_t> priority(n);
+	for (size_t i = 0; i < n; ++i) {
+		priority[i] = rng() % 1000000;
+		pq.push(i, priority[i]);
+		// Update keys pushed a while ago.
+		for (size_t round = 0; round < 3; ++round) {
+			size_t j = i - rng() % std::min(i+1, static_cast<size_t>(1000));
+			uint64_t p = priority[j] + 1 + rng() % 1000;
+			pq.decrease_key(j, priority[j], p);
+			priority[j] = p;
+		}
+	}
+	log_debug() << pq.entries() << " entries for " << pq.size() << " pairs" << std::endl;
+	TEST_ENSURE(pq.entries() < 2 * n, "Too few tombstones were cancelled");
+
+	std::set<pair<uint64_t, uint64_t> > reference;
+	for (size_t i = 0; i < n; ++i) reference.insert(make_pair(priority[i], i));
+	vector<pair<uint64_t, uint64_t> > popped;
+	while (!pq.empty()) {
+		popped.clear();
+		pq.pop_bulk(std::back_inserter(popped), 1000);
+		for (size_t j = 0; j < popped.size(); ++j) {
+			std::set<pair<uint64_t, uint64_t> >::iterator top = --reference.end();
+			if (popped[j].second != top->first) {
+				log_error() << "Popped priority " << popped[j].second << ", expected " << top->first << std::endl;
+				return false;
+			}
+			reference.erase(top);
+		}
+	}
+	TEST_ENSURE(reference.empty(), "Pairs are missing");
+	return true;
+}
+
 int main(int argc, char **argv) {
 	return tpie::tests(argc, argv, 128)
 		.test(basic_test, "basic")
@@ -293,6 +477,10 @@ int main(int argc, char **argv) {
 		.test(large_instance<false>, "large")
 		.test(large_cycle, "large_cycle")
 		.test(memory_test, "memory")
+		.test(batch_test, "batch", "background", true)
+		.test(no_job_manager_test, "no_job_manager")
+		.test(decrease_key_test, "decrease_key", "operations", static_cast<stream_size_type>(2000000))
+		.test(cancel_test, "cancel", "n", static_cast<size_t>(500000))
 		.test(very_large_test<4294967311, uint64_t>, "very_large")
 		.test(overflow_test, "overflow")
 		.test(parameter_test<uint64_t>, "parameters", "kb", 50000.0, "bs_kb", 128.0)
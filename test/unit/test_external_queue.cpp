@@ -20,6 +20,7 @@
 #include <queue>
 #include <boost/filesystem.hpp>
 #include <tpie/queue.h>
+#include <tpie/stats.h>
 
 using namespace tpie;
 
@@ -111,7 +112,23 @@ bool named_test(uint64_t items) {
 			log_error() << "Wrong size after open" << std::endl;
 			return false;
 		}
-		for (uint64_t i = 0; i < items; ++i) {
+		for (uint64_t i = 0; i < items / 2; ++i) {
+			if (q.front() != i) {
+				log_error() << "Wrong front in position " << i << std::endl;
+				return false;
+			}
+			q.pop();
+		}
+		for (uint64_t i = items; i < items + 1000; ++i) q.push(i);
+		q.close();
+	}
+	{
+		queue<uint64_t> q(tf.path(), 1.0);
+		if (q.size() != items - items / 2 + 1000) {
+			log_error() << "Wrong size after reopen" << std::endl;
+			return false;
+		}
+		for (uint64_t i = items / 2; i < items + 1000; ++i) {
 			if (q.front() != i) {
 				log_error() << "Wrong front in position " << i << std::endl;
 				return false;
@@ -127,10 +144,149 @@ bool named_test(uint64_t items) {
 	return true;
 }
 
+// Check that the named queue file holds the items [first, last).
+bool check_named(const std::string & path, uint64_t first, uint64_t last) {
+	file_stream<uint64_t> in;
+	in.open(path, access_read, sizeof(stream_size_type));
+	stream_size_type begin;
+	in.read_user_data(begin);
+	in.seek(begin);
+	if (in.size() - begin != last - first) {
+		log_error() << "Size " << in.size() - begin << ", expected " << last - first << std::endl;
+		return false;
+	}
+	for (uint64_t i = first; i < last; ++i) {
+		if (in.read() != i) {
+			log_error() << "Wrong item in position " << i << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Closing a named queue appends the items pushed to its file, and only
+// rewrites the file once most of it has been popped.
+bool named_compact_test(uint64_t items) {
+	tpie::temp_file tf;
+	boost::filesystem::remove(tf.path());
+	{
+		queue<uint64_t> q(tf.path(), 1.0);
+		for (uint64_t i = 0; i < items; ++i) q.push(i);
+	}
+	boost::uintmax_t initialSize = boost::filesystem::file_size(tf.path());
+	{
+		queue<uint64_t> q(tf.path(), 1.0);
+		for (uint64_t i = 0; i < 10; ++i) q.pop();
+		for (uint64_t i = items; i < items + 10; ++i) q.push(i);
+	}
+	boost::uintmax_t appendedSize = boost::filesystem::file_size(tf.path());
+	if (appendedSize != initialSize + 10 * sizeof(uint64_t)) {
+		log_error() << "File grew from " << initialSize << " to " << appendedSize
+					<< " bytes; expected the pushed items to be appended" << std::endl;
+		return false;
+	}
+	if (!check_named(tf.path(), 10, items + 10)) return false;
+	{
+		queue<uint64_t> q(tf.path(), 1.0);
+		for (uint64_t i = 10; i < items - items / 10; ++i) q.pop();
+	}
+	if (boost::filesystem::file_size(tf.path()) >= appendedSize / 2) {
+		log_error() << "The popped prefix of the file was not reclaimed" << std::endl;
+		return false;
+	}
+	if (!check_named(tf.path(), items - items / 10, items + 10)) return false;
+	tf.free();
+	return true;
+}
+
+// A persistent temporary queue leaves its items in a file in the temporary
+// directory when it is closed.
+bool persistent_temporary_test() {
+	const uint64_t items = 100000;
+	std::string oldPath = tempname::get_default_path();
+	std::string dir = tempname::tpie_dir_name();
+	boost::filesystem::create_directory(dir);
+	tempname::set_default_path(dir);
+	{
+		queue<uint64_t> q;
+		q.persist(PERSIST_PERSISTENT);
+		for (uint64_t i = 0; i < items; ++i) q.push(i);
+		for (uint64_t i = 0; i < 10; ++i) q.pop();
+	}
+	tempname::set_default_path(oldPath);
+	std::vector<std::string> files;
+	boost::filesystem::directory_iterator end;
+	for (boost::filesystem::directory_iterator it(dir); it != end; ++it)
+		files.push_back(it->path().string());
+	bool result = true;
+	if (files.size() != 1) {
+		log_error() << "Found " << files.size() << " files, expected one" << std::endl;
+		result = false;
+	} else {
+		result = check_named(files[0], 10, items);
+	}
+	boost::filesystem::remove_all(dir);
+	return result;
+}
+
+// Keep a bounded number of items in the queue while pushing many items
+// through it, and check that the disk space of consumed items is reclaimed.
+bool reclaim_test(uint64_t items) {
+	const uint64_t window = 1024*1024;
+	stream_size_type usageBefore = get_temp_file_usage();
+	stream_size_type maxUsage = 0;
+	queue<uint64_t> q;
+	uint64_t popped = 0;
+	for (uint64_t i = 0; i < items; ++i) {
+		q.push(i);
+		if (q.size() > window) {
+			if (q.pop() != popped) {
+				log_error() << "Wrong item in position " << popped << std::endl;
+				return false;
+			}
+			++popped;
+		}
+		maxUsage = std::max(maxUsage, get_temp_file_usage() - usageBefore);
+	}
+	while (!q.empty()) {
+		if (q.pop() != popped) {
+			log_error() << "Wrong item in position " << popped << std::endl;
+			return false;
+		}
+		++popped;
+	}
+	if (popped != items) {
+		log_error() << "Popped " << popped << " items, expected " << items << std::endl;
+		return false;
+	}
+	// The window, plus one segment being written and one being read.
+	const stream_size_type bound = window * sizeof(uint64_t)
+		+ 2 * queue<uint64_t>::segmentBlocks * file_stream<uint64_t>::block_size(1.0)
+		+ 4 * 1024*1024;
+	log_debug() << "Peak temp usage " << maxUsage << ", bound " << bound << std::endl;
+	if (maxUsage > bound) {
+		log_error() << "Temp usage " << maxUsage << " exceeds " << bound << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool no_job_manager_test() {
+	// Without a job manager, blocks are read when they are needed.
+	tpie_finish(JOB_MANAGER);
+	bool result = queue_test();
+	tpie_init(JOB_MANAGER);
+	return result;
+}
+
 int main(int argc, char ** argv) {
 	return tpie::tests(argc, argv, 32)
 		.test(basic_test, "basic")
 		.test(queue_test, "sized", "n", static_cast<size_t>(32*1024*1024/sizeof(uint64_t)))
 		.test(named_test, "named", "n", static_cast<uint64_t>(32*1024*1024/sizeof(uint64_t)))
+		.test(named_compact_test, "named_compact", "n", static_cast<uint64_t>(1000000))
+		.test(persistent_temporary_test, "persistent_temporary")
+		.test(reclaim_test, "reclaim", "n", static_cast<uint64_t>(8*1024*1024))
+		.test(no_job_manager_test, "no_job_manager")
 		;
 }
@@ -249,6 +249,66 @@ bool tall_test(size_t n) {
 	return sort_test(n, pi);
 }
 
+bool less_fn(const uint64_t & a, const uint64_t & b) {
+	return a < b;
+}
+
+// Opts in to marking, but has state, so it must still not be marked.
+struct modulo_less {
+	modulo_less(uint64_t m) : m(m) {}
+	bool operator()(const uint64_t & a, const uint64_t & b) const {
+		return a % m < b % m;
+	}
+	uint64_t m;
+};
+
+namespace tpie {
+template <>
+struct sortedness_predicate<modulo_less> : public boost::true_type {};
+} // namespace tpie
+
+bool is_sorted_stream(tpie::file_stream<uint64_t> & fs) {
+	fs.seek(0);
+	uint64_t prev = 0;
+	while (fs.can_read()) {
+		uint64_t x = fs.read();
+		if (x < prev) return false;
+		prev = x;
+	}
+	return true;
+}
+
+bool sortedness_test() {
+	using namespace tpie;
+	const uint64_t items = 10000;
+	file_stream<uint64_t> fs;
+	fs.open(sizeof(sortedness_header));
+	for (uint64_t i = 0; i < items; ++i) fs.write(items - i);
+	sort(fs);
+	TEST_ENSURE(is_marked_sorted(fs, std::less<uint64_t>()), "Sorted stream was not marked");
+
+	// Overwriting an item in place must remove the mark, so that sorting
+	// again is not skipped.
+	fs.seek(0);
+	fs.write(items + 1);
+	fs.seek(0);
+	TEST_ENSURE(!is_marked_sorted(fs, std::less<uint64_t>()), "Mark survived an overwrite");
+	sort(fs);
+	TEST_ENSURE(is_sorted_stream(fs), "Overwritten stream was not sorted again");
+	TEST_ENSURE(is_marked_sorted(fs, std::less<uint64_t>()), "Sorted stream was not marked");
+
+	// Function pointers and stateful predicates are never marked.
+	progress_indicator_null pi;
+	file_stream<uint64_t> fp;
+	fp.open(sizeof(sortedness_header));
+	for (uint64_t i = 0; i < items; ++i) fp.write(items - i);
+	sort(fp, &less_fn, pi);
+	TEST_ENSURE(fp.user_data_size() == 0, "Sorted by a function pointer was marked");
+	sort(fp, modulo_less(7), pi);
+	TEST_ENSURE(fp.user_data_size() == 0, "Sorted by a stateful predicate was marked");
+	return true;
+}
+
 int main(int argc, char **argv) {
 	return tpie::tests(argc, argv)
 		.multi_test(tiny_test, "tiny", "n", 5)
@@ -256,6 +316,7 @@ int main(int argc, char **argv) {
 		.test(tall_test, "tall", "n", 22*1024*1024)
 		.test(large_test, "large", "n", 128*1024*1024)
 		.test(ami_sort_test, "amismall", "n", 8*1024*1024)
+		.test(sortedness_test, "sortedness")
 		.test(ami_sort_test, "amilarge", "n", 128*1024*1024)
 		.test(test2, "very_large", "n", 1024ull*1024*1024*3);
 }
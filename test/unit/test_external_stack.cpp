@@ -26,6 +26,8 @@
 #include <tpie/tempname.h>
 #include "common.h"
 #include <boost/filesystem.hpp>
+#include <boost/random.hpp>
+#include <vector>
 
 using namespace tpie;
 
@@ -178,11 +180,100 @@ bool io_test() {
 	return true;
 }
 
+// Pops across the block boundaries that were refilled, alternating with
+// pushes, must not read any block more than once.
+bool io_read_test() {
+	typedef uint64_t test_t;
+	stack<test_t> s;
+
+	const size_t items = 16*1024*1024/sizeof(test_t);
+	for (size_t i = 0; i < items; ++i) s.push(i);
+
+	const stream_size_type before = get_bytes_read();
+	for (size_t i = 0; i < items/2; ++i) {
+		test_t x = s.pop();
+		ASSERT(x == items-1-i, "Wrong item popped: Expected " << items-1-i << ", got " << x);
+	}
+	const stream_size_type read = get_bytes_read()-before;
+	ASSERT(read > 0, "Popping half of the stack did not read from the file");
+
+	for (size_t i = 0; i < 1000; ++i) {
+		s.pop();
+		s.push(test_t());
+		s.pop();
+		s.pop();
+		s.push(test_t());
+		s.push(test_t());
+	}
+	const stream_size_type total = get_bytes_read()-before;
+	tpie::log_info() << "Popping half of the stack read " << read << " bytes, "
+					 << total << " bytes in total" << std::endl;
+	// The pops may have started reading the next block in the background
+	// after the first snapshot, so one block is allowed.
+	if (total > read + file_stream<test_t>::block_size(1.0)) {
+		tpie::log_error() << "Alternating pushes and pops read from the file" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Random pushes and pops on a stack with small blocks, with long runs of
+// pops using the read ahead, compared to a stack in memory.
+bool random_test(size_t size) {
+	boost::mt19937 rng(17);
+	stack<size_t> s(0.01);
+	std::vector<size_t> expected;
+	for (size_t round = 0; round < 20; ++round) {
+		size_t pushes = rng() % size;
+		for (size_t i = 0; i < pushes; ++i) {
+			size_t x = rng();
+			s.push(x);
+			expected.push_back(x);
+		}
+		size_t pops = rng() % (expected.size() + 1);
+		for (size_t i = 0; i < pops; ++i) {
+			ASSERT(s.top() == expected.back(), "Wrong item on top");
+			size_t x = s.pop();
+			ASSERT(x == expected.back(), "Wrong item popped");
+			expected.pop_back();
+			if (rng() % 64 == 0) {
+				s.push(i);
+				ASSERT(s.pop() == i, "Wrong item popped after push");
+			}
+		}
+		ASSERT(s.size() == expected.size(), "Wrong size");
+	}
+	while (!expected.empty()) {
+		ASSERT(s.pop() == expected.back(), "Wrong item popped at the end");
+		expected.pop_back();
+	}
+	ASSERT(s.empty(), "Stack is not empty");
+	bool thrown = false;
+	try {
+		s.pop();
+	} catch (const end_of_stream_exception &) {
+		thrown = true;
+	}
+	ASSERT(thrown, "Popping an empty stack did not throw");
+	return true;
+}
+
+// Without a job manager the pops read the blocks synchronously.
+bool no_job_manager_test(size_t size) {
+	tpie_finish(JOB_MANAGER);
+	bool result = random_test(size);
+	tpie_init(JOB_MANAGER);
+	return result;
+}
+
 int main(int argc, char **argv) {
 	return tpie::tests(argc, argv)
 		.test(ami_stack_test, "ami", "size", 1024*1024*3)
 		.test(ami_named_stack_test, "named-ami")
 		.test(stack_test, "new", "size", 1024*1024*3)
 		.test(named_stack_test, "named-new")
-		.test(io_test, "io");
+		.test(io_test, "io")
+		.test(io_read_test, "io-read")
+		.test(random_test, "random", "size", 100000)
+		.test(no_job_manager_test, "no_job_manager", "size", 100000);
 }
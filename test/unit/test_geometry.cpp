@@ -0,0 +1,125 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/geometry.h>
+#include <tpie/pipelining.h>
+#include <boost/random.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace tpie;
+using namespace tpie::pipelining;
+
+typedef point_2d<double> point_t;
+
+point_t make_point(double x, double y) {
+	point_t p;
+	p.x = x;
+	p.y = y;
+	return p;
+}
+
+// Monotone chain in memory.
+std::vector<point_t> expected_hull(std::vector<point_t> points) {
+	std::sort(points.begin(), points.end(), point_2d_less<double>());
+	points.erase(std::unique(points.begin(), points.end()), points.end());
+	std::vector<point_t> upper;
+	std::vector<point_t> lower;
+	for (size_t i = 0; i < points.size(); ++i) {
+		while (upper.size() >= 2 && orientation(upper[upper.size() - 2], upper.back(), points[i]) >= 0)
+			upper.pop_back();
+		upper.push_back(points[i]);
+		while (lower.size() >= 2 && orientation(lower[lower.size() - 2], lower.back(), points[i]) <= 0)
+			lower.pop_back();
+		lower.push_back(points[i]);
+	}
+	std::vector<point_t> hull(upper);
+	for (size_t i = lower.size(); i > 0; --i)
+		if (i != 1 && i != lower.size()) hull.push_back(lower[i - 1]);
+	return hull;
+}
+
+bool check_hull(const std::vector<point_t> & points, size_t threads) {
+	std::vector<point_t> hull;
+	pipeline p = input_vector(points) | convex_hull<double>(threads) | output_vector(hull);
+	p();
+	std::vector<point_t> expected = expected_hull(points);
+	if (hull != expected) {
+		log_error() << "Hull has " << hull.size() << " vertices, expected "
+					<< expected.size() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Integer coordinates, so that the orientation tests are exact.
+void random_points(size_t n, unsigned int seed, std::vector<point_t> & points) {
+	boost::mt19937 rng(seed);
+	points.resize(n);
+	for (size_t i = 0; i < n; ++i)
+		points[i] = make_point(static_cast<double>(rng() % 100000), static_cast<double>(rng() % 100000));
+}
+
+bool hull_random_test(size_t n) {
+	std::vector<point_t> points;
+	random_points(n, 107, points);
+	return check_hull(points, 4);
+}
+
+// Every point is a vertex, and the batches keep all their points.
+bool hull_circle_test(size_t n) {
+	std::vector<point_t> points(n);
+	for (size_t i = 0; i < n; ++i) {
+		double a = 2 * 3.14159265358979 * i / n;
+		points[i] = make_point(std::floor(1e6 * std::cos(a)), std::floor(1e6 * std::sin(a)));
+	}
+	std::random_shuffle(points.begin(), points.end());
+	return check_hull(points, 3);
+}
+
+bool hull_degenerate_test() {
+	std::vector<point_t> points;
+	if (!check_hull(points, 2)) return false;
+	points.push_back(make_point(3, 4));
+	if (!check_hull(points, 2)) return false;
+	points.push_back(make_point(3, 4));
+	if (!check_hull(points, 2)) return false;
+	// Collinear points, and vertical edges at both ends.
+	for (int i = 0; i < 10; ++i) points.push_back(make_point(i, 2 * i));
+	if (!check_hull(points, 2)) return false;
+	for (int i = 0; i < 10; ++i) points.push_back(make_point(0, i));
+	for (int i = 0; i < 10; ++i) points.push_back(make_point(9, i));
+	return check_hull(points, 2);
+}
+
+bool hull_single_thread_test(size_t n) {
+	std::vector<point_t> points;
+	random_points(n, 109, points);
+	return check_hull(points, 1);
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(hull_random_test, "hull_random", "n", static_cast<size_t>(200000))
+		.test(hull_circle_test, "hull_circle", "n", static_cast<size_t>(20000))
+		.test(hull_degenerate_test, "hull_degenerate")
+		.test(hull_single_thread_test, "hull_single_thread", "n", static_cast<size_t>(50000));
+}
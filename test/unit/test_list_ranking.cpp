@@ -0,0 +1,213 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/list_ranking.h>
+#include <tpie/euler_tour.h>
+#include <boost/random.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace tpie;
+
+typedef list_ranking_node<stream_size_type> node_t;
+typedef list_ranking_rank<stream_size_type> rank_t;
+
+// Ranks the given number of lists of random lengths holding n nodes with
+// shuffled sparse ids. The memory is small enough that the lists are ranked
+// externally unless internal is set.
+bool list_rank_test(size_t n, size_t lists, bool internal) {
+	boost::mt19937 rng(17);
+	std::vector<stream_size_type> ids(n);
+	for (size_t i = 0; i < n; ++i) ids[i] = 3 * i + 1;
+	std::random_shuffle(ids.begin(), ids.end());
+
+	// The list holding position i of ids ends where a cut follows it.
+	std::vector<bool> cut(n, false);
+	for (size_t i = 1; i < lists; ++i) cut[rng() % n] = true;
+	cut[n-1] = true;
+
+	std::vector<stream_size_type> expected(3 * n + 1);
+	file_stream<node_t> in;
+	in.open();
+	std::vector<node_t> nodes(n);
+	stream_size_type sum = 0;
+	for (size_t i = 0; i < n; ++i) {
+		nodes[i].id = ids[i];
+		nodes[i].next = cut[i] ? list_ranking_end : ids[i+1];
+		nodes[i].weight = 1 + rng() % 10;
+		expected[ids[i]] = sum;
+		sum = cut[i] ? 0 : sum + nodes[i].weight;
+	}
+	std::random_shuffle(nodes.begin(), nodes.end());
+	in.write(nodes.begin(), nodes.end());
+
+	file_stream<rank_t> out;
+	out.open();
+	list_rank(in, out, internal ? 0 : 64*1024);
+
+	TEST_ENSURE_EQUALITY(n, out.size(), "Wrong number of ranks");
+	stream_size_type prev = 0;
+	while (out.can_read()) {
+		const rank_t & r = out.read();
+		TEST_ENSURE(r.id >= prev, "Ranks are not sorted by id");
+		prev = r.id;
+		if (r.rank != expected[r.id]) {
+			log_error() << "Node " << r.id << " has rank " << r.rank
+						<< ", expected " << expected[r.id] << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool internal_test() {
+	return list_rank_test(10000, 1, true);
+}
+
+bool external_test(size_t n) {
+	return list_rank_test(n, 1, false);
+}
+
+bool multiple_test(size_t n) {
+	return list_rank_test(n, 100, false);
+}
+
+bool cycle_test() {
+	file_stream<node_t> in;
+	in.open();
+	const stream_size_type n = 20000;
+	for (stream_size_type i = 0; i < n; ++i) {
+		node_t u;
+		u.id = i;
+		u.next = (i + 1) % n;
+		u.weight = 1;
+		in.write(u);
+	}
+	file_stream<rank_t> out;
+	out.open();
+	try {
+		list_rank(in, out, 64*1024);
+	} catch (const exception &) {
+		return true;
+	}
+	log_error() << "No exception on cyclic input" << std::endl;
+	return false;
+}
+
+// Random tree where the parent of vertex i is a random earlier vertex.
+void random_tree(size_t n, std::vector<stream_size_type> & parent, file_stream<euler_tour_edge> & edges) {
+	boost::mt19937 rng(19);
+	parent.resize(n);
+	parent[0] = 0;
+	std::vector<euler_tour_edge> e;
+	for (size_t i = 1; i < n; ++i) {
+		// Favour recent vertices to get deep trees.
+		parent[i] = (rng() % 2) ? i - 1 - rng() % std::min<size_t>(i, 10) : rng() % i;
+		e.push_back(rng() % 2 ? euler_tour_edge(i, parent[i]) : euler_tour_edge(parent[i], i));
+	}
+	std::random_shuffle(e.begin(), e.end());
+	edges.write(e.begin(), e.end());
+}
+
+// Check the Euler tour, ranking the tour with the given memory.
+bool tour_test(size_t n, memory_size_type memory) {
+	std::vector<stream_size_type> parent;
+	file_stream<euler_tour_edge> edges;
+	edges.open();
+	random_tree(n, parent, edges);
+	file_stream<euler_tour_edge> tour;
+	tour.open();
+	euler_tour(edges, 0, tour, memory);
+	TEST_ENSURE_EQUALITY(2 * (n - 1), tour.size(), "Wrong tour length");
+
+	// The tour is a closed walk from the root using each edge once in each
+	// direction, and every vertex is entered from its parent first.
+	std::vector<bool> visited(n, false);
+	visited[0] = true;
+	stream_size_type at = 0;
+	while (tour.can_read()) {
+		const euler_tour_edge & a = tour.read();
+		TEST_ENSURE_EQUALITY(at, a.first, "Tour is not a walk");
+		if (!visited[a.second]) {
+			TEST_ENSURE_EQUALITY(parent[a.second], a.first, "Vertex entered from a non-parent");
+			visited[a.second] = true;
+		} else {
+			TEST_ENSURE_EQUALITY(parent[a.first], a.second, "Returned to a non-parent");
+		}
+		at = a.second;
+	}
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(0), at, "Tour does not end at the root");
+	return true;
+}
+
+// Check the rooted tree, ranking the tour with the given memory.
+bool rooted_test(size_t n, memory_size_type memory) {
+	std::vector<stream_size_type> parent;
+	file_stream<euler_tour_edge> edges;
+	edges.open();
+	random_tree(n, parent, edges);
+
+	// Parents precede their children, so depths and sizes follow by scans.
+	std::vector<stream_size_type> depth(n, 0);
+	std::vector<stream_size_type> size(n, 1);
+	for (size_t i = 1; i < n; ++i) depth[i] = depth[parent[i]] + 1;
+	for (size_t i = n - 1; i > 0; --i) size[parent[i]] += size[i];
+
+	file_stream<rooted_tree_vertex> out;
+	out.open();
+	root_tree(edges, 0, out, memory);
+	TEST_ENSURE_EQUALITY(n, out.size(), "Wrong number of vertices");
+	for (size_t i = 0; i < n; ++i) {
+		const rooted_tree_vertex & v = out.read();
+		TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(i), v.id, "Vertices are not sorted");
+		TEST_ENSURE_EQUALITY(parent[i], v.parent, "Wrong parent");
+		TEST_ENSURE_EQUALITY(depth[i], v.depth, "Wrong depth");
+		TEST_ENSURE_EQUALITY(size[i], v.size, "Wrong subtree size");
+	}
+	return true;
+}
+
+bool euler_tour_test(size_t n) {
+	return tour_test(n, 0);
+}
+
+bool euler_tour_external_test(size_t n) {
+	return tour_test(n, 64*1024);
+}
+
+bool root_tree_test(size_t n) {
+	return rooted_test(n, 0);
+}
+
+bool root_tree_external_test(size_t n) {
+	return rooted_test(n, 64*1024);
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(internal_test, "internal")
+		.test(external_test, "external", "n", static_cast<size_t>(200000))
+		.test(multiple_test, "multiple", "n", static_cast<size_t>(200000))
+		.test(cycle_test, "cycle")
+		.test(euler_tour_test, "euler_tour", "n", static_cast<size_t>(100000))
+		.test(root_tree_test, "root_tree", "n", static_cast<size_t>(100000))
+		.test(euler_tour_external_test, "euler_tour_external", "n", static_cast<size_t>(100000))
+		.test(root_tree_external_test, "root_tree_external", "n", static_cast<size_t>(100000));
+}
@@ -0,0 +1,233 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/matrix.h>
+#include <tpie/tempname.h>
+#include <tpie/stats.h>
+#include <boost/random.hpp>
+#include <vector>
+
+using namespace tpie;
+
+typedef matrix<double> matrix_t;
+
+// Small integers, so that the products are exact.
+void random_values(unsigned int seed, size_t n, std::vector<double> & values) {
+	boost::mt19937 rng(seed);
+	values.resize(n);
+	for (size_t i = 0; i < n; ++i) values[i] = static_cast<double>(rng() % 19) - 9;
+}
+
+void fill(matrix_t & m, const std::vector<double> & values) {
+	m.write_block(0, 0, static_cast<memory_size_type>(m.rows()), static_cast<memory_size_type>(m.cols()), &values[0]);
+}
+
+std::vector<double> contents(matrix_t & m) {
+	std::vector<double> values(static_cast<size_t>(m.rows() * m.cols()));
+	m.read_block(0, 0, static_cast<memory_size_type>(m.rows()), static_cast<memory_size_type>(m.cols()), &values[0]);
+	return values;
+}
+
+bool blocks_test() {
+	const size_t rows = 37;
+	const size_t cols = 29;
+	std::vector<double> values;
+	random_values(73, rows * cols, values);
+	matrix_t m(8);
+	m.open(rows, cols);
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(5), m.tile_rows(), "Wrong number of tile rows");
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(4), m.tile_cols(), "Wrong number of tile columns");
+	TEST_ENSURE(contents(m) == std::vector<double>(rows * cols, 0), "New matrix is not zero");
+	fill(m, values);
+	// Blocks crossing tile borders.
+	for (size_t r = 0; r + 11 <= rows; r += 5) {
+		for (size_t c = 0; c + 13 <= cols; c += 3) {
+			std::vector<double> block(11 * 13);
+			m.read_block(r, c, 11, 13, &block[0]);
+			for (size_t i = 0; i < 11; ++i)
+				for (size_t j = 0; j < 13; ++j)
+					TEST_ENSURE_EQUALITY(values[(r + i) * cols + c + j], block[i * 13 + j], "Wrong element");
+		}
+	}
+	bool thrown = false;
+	try {
+		std::vector<double> block(4);
+		m.read_block(rows - 1, 0, 2, 2, &block[0]);
+	} catch (const exception &) {
+		thrown = true;
+	}
+	TEST_ENSURE(thrown, "Block outside the matrix was read");
+	return true;
+}
+
+bool multiply_test(size_t n, size_t threads, memory_size_type memory, bool tightLimit = false) {
+	const size_t rows = n + 3;
+	const size_t inner = n - 5;
+	const size_t cols = n + 7;
+	std::vector<double> va;
+	std::vector<double> vb;
+	random_values(79, rows * inner, va);
+	random_values(83, inner * cols, vb);
+	matrix_t a(16);
+	matrix_t b(16);
+	matrix_t c(16);
+	a.open(rows, inner);
+	b.open(inner, cols);
+	c.open(rows, cols);
+	fill(a, va);
+	fill(b, vb);
+	if (tightLimit) {
+		// Leave room for little more than the blocks the product would
+		// take if it ignored the tile buffers and streams.
+		memory_manager & mm = get_memory_manager();
+		size_t oldLimit = mm.limit();
+		memory_manager::enforce_t oldEnforce = mm.enforcement();
+		mm.set_limit(mm.used() + 3 * 48 * 48 * sizeof(double) + 1024);
+		mm.set_enforcement(memory_manager::ENFORCE_THROW);
+		try {
+			matrix_multiply(a, b, c, memory, threads);
+		} catch (const out_of_memory_error & e) {
+			log_error() << "Out of memory: " << e.what() << std::endl;
+			mm.set_enforcement(oldEnforce);
+			mm.set_limit(oldLimit);
+			return false;
+		}
+		mm.set_enforcement(oldEnforce);
+		mm.set_limit(oldLimit);
+	} else {
+		matrix_multiply(a, b, c, memory, threads);
+	}
+	std::vector<double> vc = contents(c);
+	for (size_t i = 0; i < rows; ++i) {
+		for (size_t j = 0; j < cols; ++j) {
+			double expected = 0;
+			for (size_t k = 0; k < inner; ++k) expected += va[i * inner + k] * vb[k * cols + j];
+			if (vc[i * cols + j] != expected) {
+				log_error() << "Element (" << i << ", " << j << ") is " << vc[i * cols + j]
+							<< ", expected " << expected << std::endl;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// The blocks hold a few tiles, so every product takes several blocks.
+bool multiply_blocks_test(size_t n) {
+	return multiply_test(n, 4, 3 * 40 * 40 * sizeof(double));
+}
+
+bool multiply_single_block_test(size_t n) {
+	return multiply_test(n, 1, 0);
+}
+
+// With no memory given, the blocks leave room for the tile buffers and
+// streams of the matrices.
+bool multiply_available_memory_test(size_t n) {
+	return multiply_test(n, 1, 0, true);
+}
+
+// Without a job manager, the blocks are multiplied in the calling thread.
+bool multiply_no_job_manager_test(size_t n) {
+	tpie_finish(JOB_MANAGER);
+	bool result = multiply_test(n, 4, 3 * 40 * 40 * sizeof(double));
+	tpie_init(JOB_MANAGER);
+	return result;
+}
+
+// Each tile of an operand block is read once per block product.
+bool multiply_io_test() {
+	const size_t n = 128;
+	const memory_size_type side = 64;
+	std::vector<double> values;
+	random_values(101, n * n, values);
+	matrix_t a(16);
+	matrix_t b(16);
+	matrix_t c(16);
+	a.open(n, n);
+	b.open(n, n);
+	c.open(n, n);
+	fill(a, values);
+	fill(b, values);
+	stream_size_type before = get_bytes_read();
+	matrix_multiply(a, b, c, 3 * side * side * sizeof(double), 1);
+	stream_size_type read = get_bytes_read() - before;
+	// (n/side)^2 blocks of c, each the sum of n/side products of two blocks.
+	stream_size_type expected = (n / side) * (n / side) * (n / side) * 2 * side * side * sizeof(double);
+	log_debug() << "Read " << read << " bytes, expected " << expected << std::endl;
+	TEST_ENSURE(read <= expected + expected / 4, "Tiles were read more than once per block");
+	return true;
+}
+
+bool transpose_test() {
+	const size_t rows = 45;
+	const size_t cols = 21;
+	std::vector<double> values;
+	random_values(89, rows * cols, values);
+	matrix_t a(8);
+	matrix_t t(8);
+	a.open(rows, cols);
+	t.open(cols, rows);
+	fill(a, values);
+	matrix_transpose(a, t);
+	std::vector<double> vt = contents(t);
+	for (size_t i = 0; i < rows; ++i)
+		for (size_t j = 0; j < cols; ++j)
+			TEST_ENSURE_EQUALITY(values[i * cols + j], vt[j * rows + i], "Wrong element");
+	return true;
+}
+
+bool persistent_test() {
+	std::vector<double> values;
+	random_values(97, 30 * 40, values);
+	temp_file tmp;
+	{
+		matrix_t m(8);
+		m.open(tmp.path(), 30, 40);
+		fill(m, values);
+	}
+	matrix_t m(8);
+	m.open(tmp.path());
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(30), m.rows(), "Wrong number of rows");
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(40), m.cols(), "Wrong number of columns");
+	TEST_ENSURE(contents(m) == values, "Wrong contents after reopening");
+	m.close();
+	bool thrown = false;
+	try {
+		matrix_t other(16);
+		other.open(tmp.path());
+	} catch (const exception &) {
+		thrown = true;
+	}
+	TEST_ENSURE(thrown, "Opened with a different tile side");
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(blocks_test, "blocks")
+		.test(multiply_blocks_test, "multiply_blocks", "n", static_cast<size_t>(100))
+		.test(multiply_single_block_test, "multiply_single_block", "n", static_cast<size_t>(60))
+		.test(multiply_available_memory_test, "multiply_available_memory", "n", static_cast<size_t>(100))
+		.test(multiply_no_job_manager_test, "multiply_no_job_manager", "n", static_cast<size_t>(100))
+		.test(multiply_io_test, "multiply_io")
+		.test(transpose_test, "transpose")
+		.test(persistent_test, "persistent");
+}
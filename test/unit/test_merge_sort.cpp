@@ -70,10 +70,325 @@ bool sort_upper_bound_test() {
 	return io == get_bytes_written();
 }
 
+bool presorted_test() {
+	typedef use_merge_sort Traits;
+	typedef Traits::sorter sorter;
+	typedef Traits::test_t test_t;
+
+	memory_size_type m1 = 8  *1024*1024;
+	memory_size_type m2 = 20 *1024*1024;
+	memory_size_type m3 = 20 *1024*1024;
+	stream_size_type items = 24 *1024*1024 / sizeof(test_t);
+
+	sorter s;
+	s.set_available_memory(m1, m2, m3);
+	s.set_presorted();
+	s.begin();
+	for (stream_size_type i = 0; i < items; ++i) {
+		s.push(i / 3);
+	}
+	s.end();
+	Traits::merge_runs(s);
+	stream_size_type itemsRead = 0;
+	while (s.can_pull()) {
+		if (s.pull() != itemsRead / 3) {
+			log_error() << "Wrong item at position " << itemsRead << std::endl;
+			return false;
+		}
+		++itemsRead;
+	}
+	if (itemsRead != items) {
+		log_error() << "Read " << itemsRead << " items, expected " << items << std::endl;
+		return false;
+	}
+	return true;
+}
+
+enum input_order {
+	ORDER_RANDOM,
+	ORDER_NEARLY_SORTED,
+	ORDER_REVERSE
+};
+
+bool replacement_selection_test(input_order order, memory_size_type m2) {
+	typedef use_merge_sort Traits;
+	typedef Traits::sorter sorter;
+	typedef Traits::test_t test_t;
+
+	memory_size_type m1 = 4 *1024*1024;
+	m2 *= 1024*1024;
+	stream_size_type items = 24 *1024*1024 / sizeof(test_t);
+
+	boost::rand48 rng;
+	sorter s;
+	s.set_available_memory(m1, m2, m2);
+	s.set_replacement_selection(true);
+	s.begin();
+	test_t sum = 0;
+	for (stream_size_type i = 0; i < items; ++i) {
+		test_t x;
+		switch (order) {
+			case ORDER_RANDOM: x = rng(); break;
+			case ORDER_NEARLY_SORTED: x = i + rng() % 1000; break;
+			default: x = items - i; break;
+		}
+		sum += x;
+		s.push(x);
+	}
+	s.end();
+	Traits::merge_runs(s);
+	test_t prev = 0;
+	stream_size_type itemsRead = 0;
+	while (s.can_pull()) {
+		test_t x = s.pull();
+		if (x < prev) {
+			log_error() << "Out of order at position " << itemsRead << std::endl;
+			return false;
+		}
+		prev = x;
+		sum -= x;
+		++itemsRead;
+	}
+	if (itemsRead != items) {
+		log_error() << "Read " << itemsRead << " items, expected " << items << std::endl;
+		return false;
+	}
+	if (sum != 0) {
+		log_error() << "Output is not a permutation of the input" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool replacement_selection_random_test() {
+	return replacement_selection_test(ORDER_RANDOM, 20);
+}
+
+bool replacement_selection_nearly_sorted_test() {
+	return replacement_selection_test(ORDER_NEARLY_SORTED, 20);
+}
+
+bool replacement_selection_reverse_test() {
+	return replacement_selection_test(ORDER_REVERSE, 20);
+}
+
+bool replacement_selection_small_fanout_test() {
+	return replacement_selection_test(ORDER_RANDOM, 7);
+}
+
+bool limit_test(stream_size_type k, bool presorted) {
+	typedef use_merge_sort Traits;
+	typedef Traits::sorter sorter;
+	typedef Traits::test_t test_t;
+
+	memory_size_type m1 = 4 *1024*1024;
+	memory_size_type m2 = 20 *1024*1024;
+	stream_size_type items = 24 *1024*1024 / sizeof(test_t);
+
+	boost::rand48 rng;
+	std::vector<test_t> expected;
+	sorter s;
+	s.set_available_memory(m1, m2, m2);
+	s.set_limit(k);
+	if (presorted) s.set_presorted();
+	s.begin();
+	for (stream_size_type i = 0; i < items; ++i) {
+		test_t x = presorted ? i : rng();
+		expected.push_back(x);
+		s.push(x);
+	}
+	s.end();
+	Traits::merge_runs(s);
+	std::sort(expected.begin(), expected.end());
+	if (s.item_count() != k) {
+		log_error() << "Item count " << s.item_count() << ", expected " << k << std::endl;
+		return false;
+	}
+	stream_size_type itemsRead = 0;
+	while (s.can_pull()) {
+		test_t x = s.pull();
+		if (itemsRead >= k || x != expected[itemsRead]) {
+			log_error() << "Wrong item at position " << itemsRead << std::endl;
+			return false;
+		}
+		++itemsRead;
+	}
+	if (itemsRead != k) {
+		log_error() << "Read " << itemsRead << " items, expected " << k << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool limit_internal_test() {
+	return limit_test(1000, false);
+}
+
+bool limit_external_test() {
+	return limit_test(1024*1024, false);
+}
+
+bool limit_presorted_test() {
+	return limit_test(1024*1024, true);
+}
+
+bool parallel_merges_test(bool replacementSelection) {
+	typedef use_merge_sort Traits;
+	typedef Traits::sorter sorter;
+	typedef Traits::test_t test_t;
+
+	stream_size_type items = 123457;
+
+	boost::rand48 rng;
+	sorter s;
+	s.set_parameters(1000, 4);
+	s.set_parallel_merges(3);
+	s.set_replacement_selection(replacementSelection);
+	s.begin();
+	test_t sum = 0;
+	for (stream_size_type i = 0; i < items; ++i) {
+		test_t x = rng();
+		sum += x;
+		s.push(x);
+	}
+	s.end();
+	Traits::merge_runs(s);
+	test_t prev = 0;
+	stream_size_type itemsRead = 0;
+	while (s.can_pull()) {
+		test_t x = s.pull();
+		if (x < prev) {
+			log_error() << "Out of order at position " << itemsRead << std::endl;
+			return false;
+		}
+		prev = x;
+		sum -= x;
+		++itemsRead;
+	}
+	if (itemsRead != items) {
+		log_error() << "Read " << itemsRead << " items, expected " << items << std::endl;
+		return false;
+	}
+	if (sum != 0) {
+		log_error() << "Output is not a permutation of the input" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool parallel_merges_fixed_runs_test() {
+	return parallel_merges_test(false);
+}
+
+bool parallel_merges_variable_runs_test() {
+	return parallel_merges_test(true);
+}
+
+// Without a job manager, the merge jobs run in the calling thread.
+bool parallel_merges_no_job_manager_test() {
+	tpie_finish(JOB_MANAGER);
+	bool result = parallel_merges_test(false);
+	tpie_init(JOB_MANAGER);
+	return result;
+}
+
+// Restores the temporary file limit and enforcement policy on destruction.
+class temp_limit_guard {
+public:
+	temp_limit_guard()
+		: m_limit(get_temp_file_limit())
+		, m_enforcement(get_temp_file_enforcement())
+	{
+	}
+
+	~temp_limit_guard() {
+		set_temp_file_limit(m_limit);
+		set_temp_file_enforcement(m_enforcement);
+	}
+
+private:
+	stream_size_type m_limit;
+	temp_file_enforce_t m_enforcement;
+};
+
+// Sort with the given temporary file limit relative to the predicted peak
+// usage, enforcing the limit by exceptions. Returns true if the sort
+// completes, and false if it runs out of temporary space while merging.
+bool sort_with_temp_limit(double peakFraction, bool & ok) {
+	typedef use_merge_sort Traits;
+	typedef Traits::sorter sorter;
+	typedef Traits::test_t test_t;
+
+	stream_size_type items = 200000;
+
+	boost::rand48 rng;
+	sorter s;
+	s.set_parameters(1000, 4);
+	stream_size_type peak = s.predicted_peak_temp_usage(items);
+	if (peak < 2*items*sizeof(test_t)) {
+		log_error() << "Predicted peak " << peak << " for " << items << " items" << std::endl;
+		ok = false;
+		return false;
+	}
+	temp_limit_guard guard;
+	// Allow for file headers.
+	set_temp_file_limit(get_temp_file_usage() + static_cast<stream_size_type>(peakFraction * peak) + 1024*1024);
+	set_temp_file_enforcement(TEMP_FILE_ENFORCE_THROW);
+	s.begin();
+	for (stream_size_type i = 0; i < items; ++i) s.push(rng());
+	s.end();
+	stream_size_type written = get_bytes_written();
+	try {
+		Traits::merge_runs(s);
+	} catch (const out_of_space_exception &) {
+		// The sorter must give up before doing any merging.
+		ok = written == get_bytes_written();
+		if (!ok) log_error() << "Merged before running out of space" << std::endl;
+		return false;
+	}
+	test_t prev = 0;
+	stream_size_type itemsRead = 0;
+	while (s.can_pull()) {
+		test_t x = s.pull();
+		if (x < prev) ok = false;
+		prev = x;
+		++itemsRead;
+	}
+	if (itemsRead != items) ok = false;
+	if (!ok) log_error() << "Wrong sort output" << std::endl;
+	return true;
+}
+
+bool temp_limit_test() {
+	bool ok = true;
+	if (!sort_with_temp_limit(1.0, ok)) {
+		log_error() << "Sort exceeded the predicted peak temporary usage" << std::endl;
+		return false;
+	}
+	if (!ok) return false;
+	if (sort_with_temp_limit(0.3, ok)) {
+		log_error() << "Sort did not run out of temporary space" << std::endl;
+		return false;
+	}
+	return ok;
+}
+
 int main(int argc, char ** argv) {
 	tests t(argc, argv);
 	return
 		sort_tester<use_merge_sort>::add_all(t)
 		.test(sort_upper_bound_test, "sort_upper_bound")
+		.test(presorted_test, "presorted")
+		.test(replacement_selection_random_test, "replacement_selection_random")
+		.test(replacement_selection_nearly_sorted_test, "replacement_selection_nearly_sorted")
+		.test(replacement_selection_reverse_test, "replacement_selection_reverse")
+		.test(replacement_selection_small_fanout_test, "replacement_selection_small_fanout")
+		.test(limit_internal_test, "limit_internal")
+		.test(limit_external_test, "limit_external")
+		.test(limit_presorted_test, "limit_presorted")
+		.test(parallel_merges_fixed_runs_test, "parallel_merges_fixed_runs")
+		.test(parallel_merges_variable_runs_test, "parallel_merges_variable_runs")
+		.test(parallel_merges_no_job_manager_test, "parallel_merges_no_job_manager")
+		.test(temp_limit_test, "temp_limit")
 		;
 }
@@ -22,6 +22,8 @@
 #include <tpie/file_stream.h>
 #include <boost/filesystem.hpp>
 #include <algorithm>
+#include <string>
+#include <boost/random.hpp>
 #include <tpie/pipelining/graph.h>
 #include <tpie/sysinfo.h>
 #include <tpie/pipelining/virtual.h>
@@ -353,6 +355,256 @@ bool sort_test_large() {
 	return sort_test(300*1024);
 }
 
+template <typename dest_t>
+struct complement_t : public node {
+	typedef test_t item_type;
+
+	complement_t(const dest_t & dest)
+		: dest(dest)
+	{
+		add_push_destination(dest);
+	}
+
+	void push(const test_t & item) {
+		dest.push(~item);
+	}
+
+	dest_t dest;
+};
+
+bool check_sorted_file(file_stream<test_t> & fs, stream_size_type items) {
+	if (fs.size() != items) {
+		log_error() << "Got " << fs.size() << " items, expected " << items << std::endl;
+		return false;
+	}
+	fs.seek(0);
+	test_t prev = 0;
+	while (fs.can_read()) {
+		test_t x = fs.read();
+		if (x < prev) {
+			log_error() << "Out of order" << std::endl;
+			return false;
+		}
+		prev = x;
+	}
+	return true;
+}
+
+bool sort_presorted_test() {
+	const stream_size_type items = 100000;
+	const memory_size_type udsz = sizeof(sortedness_header);
+	file_stream<test_t> in;
+	in.open();
+	for (stream_size_type i = 0; i < items; ++i) in.write(items - i);
+	in.seek(0);
+
+	file_stream<test_t> mid;
+	mid.open(udsz);
+	{
+		pipeline p = input(in) | pipesort() | output(mid);
+		p();
+	}
+	TEST_ENSURE(is_marked_sorted(mid, std::less<test_t>()), "Sorted output was not marked");
+	TEST_ENSURE(!is_marked_sorted(mid, std::greater<test_t>()), "Marked with wrong predicate");
+	if (!check_sorted_file(mid, items)) return false;
+
+	// Sorting a marked stream must pass the items through in order.
+	file_stream<test_t> out;
+	out.open(udsz);
+	mid.seek(0);
+	{
+		pipeline p = input(mid) | pipesort() | output(out);
+		p();
+	}
+	if (!check_sorted_file(out, items)) return false;
+	TEST_ENSURE(is_marked_sorted(out, std::less<test_t>()), "Presorted output was not marked");
+
+	// Sortedness must not be trusted through an order-changing node.
+	file_stream<test_t> out2;
+	out2.open(udsz);
+	mid.seek(0);
+	{
+		pipeline p = input(mid) | make_pipe_middle_0<complement_t>() | pipesort() | output(out2);
+		p();
+	}
+	if (!check_sorted_file(out2, items)) return false;
+
+	// Appending to a marked stream invalidates the mark.
+	out.seek(0, file_stream<test_t>::end);
+	out.write(0);
+	TEST_ENSURE(!is_marked_sorted(out, std::less<test_t>()), "Mark survived append");
+	return true;
+}
+
+bool top_k_test() {
+	const size_t n = 100000;
+	const size_t k = 100;
+	inputvector.resize(n);
+	for (size_t i = 0; i < n; ++i) inputvector[i] = (i * 7919) % n;
+	expectvector = inputvector;
+	std::sort(expectvector.begin(), expectvector.end(), std::greater<test_t>());
+	expectvector.resize(k);
+	pipeline p = input_vector(inputvector) | top_k(k, std::greater<test_t>()) | output_vector(outputvector);
+	p.plot(log_info());
+	p();
+	return check_test_vectors();
+}
+
+// Longest weighted path ending in each vertex of a DAG.
+struct longest_path {
+	typedef test_t vertex_type;
+	typedef test_t message_type;
+
+	test_t operator()(const test_t & weight, const test_t * begin, const test_t * end) const {
+		test_t best = 0;
+		for (; begin != end; ++begin) best = std::max(best, *begin);
+		return best + weight;
+	}
+};
+
+bool time_forward_check(const std::vector<time_forward_edge> & edges, size_t threads) {
+	const size_t n = inputvector.size();
+	expectvector.resize(n);
+	std::vector<test_t> best(n, 0);
+	for (size_t i = 0, e = 0; i < n; ++i) {
+		expectvector[i] = best[i] + inputvector[i];
+		for (; e < edges.size() && edges[e].first == i; ++e)
+			best[edges[e].second] = std::max(best[edges[e].second], expectvector[i]);
+	}
+	pipeline p = input_vector(inputvector)
+		| time_forward(pull_input_iterator(edges.begin(), edges.end()), longest_path(), threads)
+		| output_vector(outputvector);
+	p.plot(log_info());
+	p();
+	return check_test_vectors();
+}
+
+bool time_forward_test(size_t threads) {
+	const size_t n = 50000;
+	boost::mt19937 rng(42);
+	std::vector<time_forward_edge> edges;
+	inputvector.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		inputvector[i] = rng() % 100;
+		size_t degree = rng() % 4;
+		for (size_t j = 0; j < degree; ++j) {
+			// With several threads, only use long edges so that large
+			// batches of independent vertices form.
+			size_t to = i + (threads == 1 ? 1 + rng() % 5000 : 5000 + rng() % 5000);
+			if (to >= n) continue;
+			edges.push_back(time_forward_edge(i, to));
+		}
+	}
+	return time_forward_check(edges, threads);
+}
+
+// The last vertex receives more messages than the message buffer holds.
+bool time_forward_fan_in_test(size_t threads) {
+	const size_t n = 20000;
+	boost::mt19937 rng(42);
+	std::vector<time_forward_edge> edges;
+	inputvector.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		inputvector[i] = rng() % 100;
+		if (i + 5000 < n - 1) edges.push_back(time_forward_edge(i, i + 5000));
+		if (i < n - 1) edges.push_back(time_forward_edge(i, n - 1));
+	}
+	return time_forward_check(edges, threads);
+}
+
+// Without a job manager, batches are evaluated in the calling thread.
+bool time_forward_no_job_manager_test() {
+	tpie_finish(JOB_MANAGER);
+	bool result = time_forward_fan_in_test(4);
+	tpie_init(JOB_MANAGER);
+	return result;
+}
+
+class batch_counter_t : public node {
+public:
+	typedef test_t item_type;
+
+	batch_counter_t(size_t & batches)
+		: batches(batches)
+	{
+		set_name("Batch counter");
+	}
+
+	void push(const test_t & item) {
+		outputvector.push_back(item);
+	}
+
+	void push_batch(array_view<const test_t> items) {
+		++batches;
+		for (size_t i = 0; i < items.size(); ++i) push(items[i]);
+	}
+
+private:
+	size_t & batches;
+};
+
+bool push_batch_test() {
+	const size_t n = 100000;
+	file_stream<test_t> in;
+	in.open();
+	expectvector.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		in.write(i);
+		expectvector[i] = 3*i+1;
+	}
+
+	size_t batches = 0;
+	in.seek(0);
+	{
+		pipeline p = input(in) | linear<test_t>(3, 1)
+			| make_pipe_end_1<batch_counter_t, size_t &>(batches);
+		p();
+	}
+	if (!check_test_vectors()) return false;
+	TEST_ENSURE(batches > 0 && batches < n, "Items were not pushed in batches");
+
+	// Batches cross virtual chunk boundaries.
+	batches = 0;
+	outputvector.clear();
+	in.seek(0);
+	{
+		pipeline p = virtual_chunk_begin<test_t>(input(in))
+			| virtual_chunk<test_t, test_t>(linear<test_t>(3, 1))
+			| virtual_chunk_end<test_t>(make_pipe_end_1<batch_counter_t, size_t &>(batches));
+		p();
+	}
+	if (!check_test_vectors()) return false;
+	TEST_ENSURE(batches > 0 && batches < n, "Items were not pushed in batches through virtual chunks");
+
+	// Items pushed one at a time are batched at virtual chunk joints.
+	batches = 0;
+	outputvector.clear();
+	inputvector.resize(n);
+	for (size_t i = 0; i < n; ++i) inputvector[i] = 3*i+1;
+	{
+		pipeline p = virtual_chunk_begin<test_t>(input_vector(inputvector))
+			| virtual_chunk_end<test_t>(make_pipe_end_1<batch_counter_t, size_t &>(batches));
+		p();
+	}
+	if (!check_test_vectors()) return false;
+	TEST_ENSURE(batches > 0 && batches < n, "Items were not batched at the virtual chunk joint");
+
+	// Batches into file output.
+	file_stream<test_t> out;
+	out.open();
+	in.seek(0);
+	{
+		pipeline p = input(in) | linear<test_t>(3, 1) | output(out);
+		p();
+	}
+	TEST_ENSURE(out.size() == n, "Wrong output size");
+	out.seek(0);
+	for (size_t i = 0; i < n; ++i) {
+		TEST_ENSURE(out.read() == expectvector[i], "Wrong item in output");
+	}
+	return true;
+}
+
 // This tests that pipe_middle | pipe_middle -> pipe_middle,
 // and that pipe_middle | pipe_end -> pipe_end.
 // The other tests already test that pipe_begin | pipe_middle -> pipe_middle,
@@ -733,6 +985,19 @@ bool virtual_test() {
 	return check_test_vectors();
 }
 
+bool virtual_nonpod_test() {
+	// Items that are not POD are forwarded through virtual chunk joints
+	// without being copied into a buffer.
+	std::vector<std::string> in, out;
+	for (size_t i = 0; i < 10000; ++i) in.push_back(std::string(i % 50, 'a'));
+	pipeline p = virtual_chunk_begin<std::string>(input_vector(in))
+		| virtual_chunk<std::string, std::string>()
+		| virtual_chunk_end<std::string>(output_vector(out));
+	p();
+	TEST_ENSURE(in == out, "Wrong output");
+	return true;
+}
+
 struct prepare_result {
 	prepare_result()
 		: t(0)
@@ -1609,6 +1874,13 @@ int main(int argc, char ** argv) {
 	.test(sort_test_trivial, "sorttrivial")
 	.test(sort_test_small, "sort")
 	.test(sort_test_large, "sortbig")
+	.test(sort_presorted_test, "sort_presorted")
+	.test(top_k_test, "top_k")
+	.test(push_batch_test, "push_batch")
+	.test(time_forward_test, "time_forward", "threads", static_cast<size_t>(1))
+	.test(time_forward_test, "time_forward_parallel", "threads", static_cast<size_t>(4))
+	.test(time_forward_fan_in_test, "time_forward_fan_in", "threads", static_cast<size_t>(4))
+	.test(time_forward_no_job_manager_test, "time_forward_no_job_manager")
 	.test(operator_test, "operators")
 	.test(uniq_test, "uniq")
 	.multi_test(memory_test_multi, "memory")
@@ -1617,6 +1889,7 @@ int main(int argc, char ** argv) {
 	.test(fetch_forward_test, "fetch_forward")
 	.test(virtual_ref_test, "virtual_ref")
 	.test(virtual_test, "virtual")
+	.test(virtual_nonpod_test, "virtual_nonpod")
 	.test(virtual_cref_item_type_test, "virtual_cref_item_type")
 	.test(prepare_test, "prepare")
 	.test(end_time::test, "end_time")
@@ -0,0 +1,206 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/rtree.h>
+#include <tpie/pipelining.h>
+#include <tpie/pipelining/rtree.h>
+#include <tpie/tempname.h>
+#include <boost/random.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace tpie;
+using namespace tpie::pipelining;
+
+typedef rtree<double, 16> tree_t;
+typedef tree_t::rectangle_type rect_t;
+typedef tree_t::entry_type entry_t;
+
+rect_t make_rect(double x, double y, double w, double h) {
+	rect_t r;
+	r.xlo = x;
+	r.ylo = y;
+	r.xhi = x + w;
+	r.yhi = y + h;
+	return r;
+}
+
+rect_t unit_square() {
+	return make_rect(0, 0, 1, 1);
+}
+
+void random_entries(size_t n, std::vector<entry_t> & entries) {
+	boost::mt19937 rng(29);
+	boost::uniform_real<> u(0, 1);
+	entries.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		entries[i].mbr = make_rect(u(rng), u(rng), u(rng) / 100, u(rng) / 100);
+		entries[i].id = i;
+	}
+}
+
+void random_windows(size_t n, std::vector<rect_t> & windows) {
+	boost::mt19937 rng(31);
+	boost::uniform_real<> u(0, 1);
+	windows.resize(n);
+	for (size_t i = 0; i < n; ++i) windows[i] = make_rect(u(rng), u(rng), u(rng) / 10, u(rng) / 10);
+}
+
+void bulk_load(tree_t & tree, const std::vector<entry_t> & entries, size_t threads) {
+	pipeline p = input_vector(entries) | rtree_bulk_load(tree, unit_square(), threads);
+	p();
+}
+
+// Collects the ids found by a batch of queries.
+struct collector {
+	collector(size_t windows) : found(windows) {}
+
+	void operator()(memory_size_type window, const entry_t & e) {
+		found[window].push_back(e.id);
+	}
+
+	std::vector<std::vector<stream_size_type> > found;
+};
+
+struct single_collector {
+	void operator()(const entry_t & e) {
+		found.push_back(e.id);
+	}
+
+	std::vector<stream_size_type> found;
+};
+
+bool check_query(const std::vector<entry_t> & entries, const rect_t & window,
+				 std::vector<stream_size_type> found) {
+	std::vector<stream_size_type> expected;
+	for (size_t i = 0; i < entries.size(); ++i)
+		if (window.intersects(entries[i].mbr)) expected.push_back(entries[i].id);
+	std::sort(found.begin(), found.end());
+	if (found != expected) {
+		log_error() << "Query found " << found.size() << " entries, expected "
+					<< expected.size() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool basic_test(size_t n) {
+	std::vector<entry_t> entries;
+	random_entries(n, entries);
+	tree_t tree(8);
+	tree.open();
+	bulk_load(tree, entries, 4);
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(n), tree.size(), "Wrong size");
+	// Full nodes in every level.
+	stream_size_type nodes = 0;
+	for (stream_size_type level = n; level > 1; level = (level + 15) / 16)
+		nodes += (level + 15) / 16;
+	TEST_ENSURE_EQUALITY(nodes, tree.node_count(), "Nodes are not packed");
+
+	std::vector<rect_t> windows;
+	random_windows(50, windows);
+	for (size_t i = 0; i < windows.size(); ++i) {
+		single_collector c;
+		tree.window_query(windows[i], c);
+		if (!check_query(entries, windows[i], c.found)) return false;
+	}
+	return true;
+}
+
+bool batch_test(size_t n) {
+	std::vector<entry_t> entries;
+	random_entries(n, entries);
+	tree_t tree(4);
+	tree.open();
+	bulk_load(tree, entries, 1);
+	std::vector<rect_t> windows;
+	random_windows(200, windows);
+	collector c(windows.size());
+	stream_size_type missesBefore = tree.cache_misses();
+	tree.window_queries(windows.begin(), windows.end(), c);
+	for (size_t i = 0; i < windows.size(); ++i)
+		if (!check_query(entries, windows[i], c.found[i])) return false;
+	// Every node is read at most once by the batch.
+	TEST_ENSURE(tree.cache_misses() - missesBefore <= tree.node_count(), "Nodes read more than once");
+	return true;
+}
+
+bool persistent_test(size_t n) {
+	std::vector<entry_t> entries;
+	random_entries(n, entries);
+	temp_file tmp;
+	{
+		tree_t tree;
+		tree.open(tmp.path());
+		TEST_ENSURE(tree.empty(), "New tree is not empty");
+		bulk_load(tree, entries, 2);
+	}
+	tree_t tree;
+	tree.open(tmp.path());
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(n), tree.size(), "Wrong size after reopening");
+	rect_t window = make_rect(0.25, 0.25, 0.5, 0.5);
+	single_collector c;
+	tree.window_query(window, c);
+	return check_query(entries, window, c.found);
+}
+
+bool empty_test() {
+	std::vector<entry_t> entries;
+	tree_t tree;
+	tree.open();
+	bulk_load(tree, entries, 1);
+	TEST_ENSURE(tree.empty(), "Tree is not empty");
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(0), tree.height(), "Empty tree has nodes");
+	single_collector c;
+	tree.window_query(unit_square(), c);
+	TEST_ENSURE(c.found.empty(), "Empty tree reported entries");
+	return true;
+}
+
+bool hilbert_test() {
+	// The curve visits every cell of the grid once, moving between
+	// neighbouring cells.
+	const stream_size_type side = 64;
+	std::vector<std::pair<stream_size_type, stream_size_type> > cells(side * side);
+	std::vector<bool> seen(side * side, false);
+	for (stream_size_type x = 0; x < side; ++x) {
+		for (stream_size_type y = 0; y < side; ++y) {
+			stream_size_type h = hilbert_value(x, y, side);
+			TEST_ENSURE(h < side * side && !seen[h], "Hilbert values are not a permutation");
+			seen[h] = true;
+			cells[h] = std::make_pair(x, y);
+		}
+	}
+	for (size_t i = 1; i < cells.size(); ++i) {
+		stream_size_type dx = cells[i].first > cells[i-1].first ? cells[i].first - cells[i-1].first : cells[i-1].first - cells[i].first;
+		stream_size_type dy = cells[i].second > cells[i-1].second ? cells[i].second - cells[i-1].second : cells[i-1].second - cells[i].second;
+		TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(1), dx + dy, "Consecutive cells are not adjacent");
+	}
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(hilbert_test, "hilbert")
+		.test(basic_test, "basic", "n", static_cast<size_t>(20000))
+		.test(batch_test, "batch", "n", static_cast<size_t>(20000))
+		.test(persistent_test, "persistent", "n", static_cast<size_t>(5000))
+		.test(empty_test, "empty");
+}
@@ -306,6 +306,98 @@ bool stream_reverse_test() {
 	return result;
 }
 
+struct in_place_string {
+	std::string s;
+};
+
+// Serialize the length and payload of a string in place.
+template <typename D>
+void serialize(D & dst, const in_place_string & v) {
+	size_t n = v.s.size();
+	char * p = dst.reserve(sizeof(n) + n);
+	std::copy(reinterpret_cast<const char *>(&n), reinterpret_cast<const char *>(&n) + sizeof(n), p);
+	std::copy(v.s.begin(), v.s.end(), p + sizeof(n));
+}
+
+std::string in_place_test_string(memory_size_type i) {
+	return std::string((i * 7919) % 5000, static_cast<char>('a' + i % 26));
+}
+
+template <typename reader_t>
+bool check_in_place_string(reader_t & rd, memory_size_type i) {
+	array_view<const char> v = rd.template unserialize_view<char>();
+	std::string expect = in_place_test_string(i);
+	if (v.size() != expect.size() || !std::equal(expect.begin(), expect.end(), v.begin())) {
+		log_error() << "Wrong string view #" << i << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool stream_in_place_test() {
+	// Enough strings to span several blocks.
+	const memory_size_type N = 2000;
+	if (serialized_size(in_place_string()) != sizeof(size_t)) {
+		log_error() << "Wrong serialized size" << std::endl;
+		return false;
+	}
+	temp_file f;
+	{
+		serialization_writer wr;
+		wr.open(f);
+		in_place_string v;
+		for (memory_size_type i = 0; i < N; ++i) {
+			v.s = in_place_test_string(i);
+			wr.serialize(v);
+			wr.serialize(static_cast<tpie::uint32_t>(i));
+		}
+		wr.close();
+	}
+	{
+		serialization_reader rd;
+		rd.open(f);
+		for (memory_size_type i = 0; i < N; ++i) {
+			if (!check_in_place_string(rd, i)) return false;
+			// An empty view may be read at any position.
+			if (rd.read_array_view<tpie::uint32_t>(0).size() != 0) {
+				log_error() << "Expected an empty view after string view #" << i << std::endl;
+				return false;
+			}
+			array_view<const tpie::uint32_t> n = rd.read_array_view<tpie::uint32_t>(1);
+			if (n[0] != i) {
+				log_error() << "Wrong number " << n[0] << " after string view #" << i << std::endl;
+				return false;
+			}
+		}
+		if (rd.can_read()) {
+			log_error() << "Expected !can_read()" << std::endl;
+			return false;
+		}
+		rd.close();
+	}
+
+	temp_file g;
+	{
+		serialization_reverse_writer wr;
+		wr.open(g);
+		in_place_string v;
+		for (memory_size_type i = 0; i < N; ++i) {
+			v.s = in_place_test_string(i);
+			wr.serialize(v);
+		}
+		wr.close();
+	}
+	{
+		serialization_reverse_reader rd;
+		rd.open(g);
+		for (memory_size_type i = N; i--;) {
+			if (!check_in_place_string(rd, i)) return false;
+		}
+		rd.close();
+	}
+	return true;
+}
+
 bool stream_temp_test() {
 	stream_size_type tmpUsage1, tmpUsage2, tmpUsage3, tmpUsage4;
 	tmpUsage1 = get_temp_file_usage();
@@ -349,5 +441,6 @@ int main(int argc, char ** argv) {
 		.test(stream_reopen_test, "stream_reopen")
 		.test(stream_reverse_test, "stream_reverse")
 		.test(stream_temp_test, "stream_temp")
+		.test(stream_in_place_test, "stream_in_place")
 		;
 }
@@ -22,6 +22,9 @@
 #include <tpie/serialization_sort.h>
 #include <tpie/sysinfo.h>
 #include <boost/random.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using namespace tpie;
 
@@ -37,9 +40,76 @@ public:
 	}
 };
 
+// Strings sharing long prefixes, so key prefixes often tie.
+std::string prefix_test_string(boost::rand48 & rng) {
+	std::stringstream ss;
+	ss << "key" << (rng() % 4) << "/shared/" << rng();
+	return ss.str();
+}
+
+template <typename pred_t>
+bool string_prefix_test(memory_size_type mb, memory_size_type items, bool parallelRuns = true) {
+	boost::rand48 rng;
+	std::vector<std::string> expect(items);
+	serialization_sort<std::string, pred_t> s;
+	s.set_parallel_run_formation(parallelRuns);
+	s.set_available_memory(mb*1024*1024);
+	s.begin();
+	for (memory_size_type i = 0; i < items; ++i) {
+		expect[i] = prefix_test_string(rng);
+		s.push(expect[i]);
+	}
+	s.end();
+	s.merge_runs();
+	std::sort(expect.begin(), expect.end(), pred_t());
+	for (memory_size_type i = 0; i < items; ++i) {
+		if (!s.can_pull()) {
+			log_error() << "Expected can_pull" << std::endl;
+			return false;
+		}
+		std::string item = s.pull();
+		if (item != expect[i]) {
+			log_error() << "Got " << item << ", expected " << expect[i] << std::endl;
+			return false;
+		}
+	}
+	if (s.can_pull()) {
+		log_error() << "Expected !can_pull" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool string_prefix_internal_test() {
+	return string_prefix_test<std::less<std::string> >(20, 10000)
+		&& string_prefix_test<std::greater<std::string> >(20, 10000);
+}
+
+bool string_prefix_external_test() {
+	return string_prefix_test<std::less<std::string> >(10, 300000)
+		&& string_prefix_test<std::greater<std::string> >(10, 300000);
+}
+
+bool parallel_runs_test() {
+	return string_prefix_test<std::less<std::string> >(10, 600000, true)
+		&& string_prefix_test<std::less<std::string> >(10, 600000, false);
+}
+
+// Without a job manager, the runs are written in the calling thread.
+bool parallel_runs_no_job_manager_test() {
+	tpie_finish(JOB_MANAGER);
+	bool result = string_prefix_test<std::less<std::string> >(10, 600000, true);
+	tpie_init(JOB_MANAGER);
+	return result;
+}
+
 int main(int argc, char ** argv) {
 	tests t(argc, argv);
 	return
 		sort_tester<use_serialization_sort>::add_all(t)
+		.test(string_prefix_internal_test, "string_prefix_internal")
+		.test(string_prefix_external_test, "string_prefix_external")
+		.test(parallel_runs_test, "parallel_runs")
+		.test(parallel_runs_no_job_manager_test, "parallel_runs_no_job_manager")
 		;
 }
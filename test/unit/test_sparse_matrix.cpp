@@ -0,0 +1,194 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/sparse_matrix.h>
+#include <boost/random.hpp>
+#include <cmath>
+#include <vector>
+
+using namespace tpie;
+
+typedef sparse_matrix_entry<double> entry_t;
+
+// Random entries with small integer values, so that the products are exact.
+// Positions may repeat, and some rows and columns are empty.
+void random_entries(size_t rows, size_t cols, size_t n, std::vector<entry_t> & entries) {
+	boost::mt19937 rng(101);
+	entries.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		entries[i].row = rng() % (rows - rows / 10);
+		entries[i].col = rng() % cols;
+		entries[i].value = static_cast<double>(rng() % 9) - 4;
+	}
+}
+
+void write(file_stream<entry_t> & out, const std::vector<entry_t> & entries) {
+	out.open();
+	for (size_t i = 0; i < entries.size(); ++i) out.write(entries[i]);
+}
+
+bool check_product(sparse_matrix<double> & m, const std::vector<entry_t> & entries,
+				   size_t rows, size_t cols, unsigned int seed) {
+	boost::mt19937 rng(seed);
+	std::vector<double> x(cols);
+	file_stream<double> xs;
+	xs.open();
+	for (size_t i = 0; i < cols; ++i) {
+		x[i] = static_cast<double>(rng() % 7);
+		xs.write(x[i]);
+	}
+	std::vector<double> expected(rows, 0);
+	for (size_t i = 0; i < entries.size(); ++i)
+		expected[entries[i].row] += entries[i].value * x[entries[i].col];
+
+	file_stream<double> ys;
+	ys.open();
+	m.multiply(xs, ys);
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(rows), ys.size(), "Wrong size of the product");
+	ys.seek(0);
+	for (size_t i = 0; i < rows; ++i) {
+		double y = ys.read();
+		if (y != expected[i]) {
+			log_error() << "Element " << i << " is " << y << ", expected " << expected[i] << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool multiply_test(size_t rows, size_t cols, memory_size_type memory, size_t threads) {
+	std::vector<entry_t> entries;
+	random_entries(rows, cols, 5 * (rows + cols), entries);
+	file_stream<entry_t> es;
+	write(es, entries);
+	sparse_matrix<double> m(memory, threads);
+	m.assign(es, rows, cols);
+	log_debug() << "Bands: " << m.bands() << std::endl;
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(entries.size()), m.nonzeros(), "Wrong number of entries");
+	// The sorted bands are reused by every product.
+	return check_product(m, entries, rows, cols, 1)
+		&& check_product(m, entries, rows, cols, 2);
+}
+
+bool single_band_test(size_t n) {
+	return multiply_test(n, n / 2, 0, 4);
+}
+
+// Many bands, so that the partial results are merged in several passes.
+bool bands_test(size_t n) {
+	return multiply_test(n / 2, n, 800, 3);
+}
+
+// All entries are in the first of 12 bands.
+bool empty_bands_test() {
+	const size_t rows = 500;
+	const size_t cols = 1200;
+	std::vector<entry_t> entries;
+	random_entries(rows, cols / 12, 2000, entries);
+	file_stream<entry_t> es;
+	write(es, entries);
+	sparse_matrix<double> m(2 * sizeof(double) * (cols / 12), 2);
+	m.assign(es, rows, cols);
+	TEST_ENSURE(m.bands() == 12, "Wrong number of bands");
+	return check_product(m, entries, rows, cols, 1);
+}
+
+bool pagerank_test(size_t n) {
+	// Every vertex links to the next, and to a few random ones; vertex 0
+	// has no links.
+	boost::mt19937 rng(103);
+	std::vector<std::vector<size_t> > links(n);
+	for (size_t u = 1; u < n; ++u) {
+		links[u].push_back((u + 1) % n);
+		for (size_t k = rng() % 4; k > 0; --k) links[u].push_back(rng() % n);
+	}
+	file_stream<entry_t> es;
+	es.open();
+	for (size_t u = 0; u < n; ++u) {
+		for (size_t k = 0; k < links[u].size(); ++k) {
+			entry_t e;
+			e.row = links[u][k];
+			e.col = u;
+			e.value = 1.0 / links[u].size();
+			es.write(e);
+		}
+	}
+	sparse_matrix<double> m(4000, 2);
+	m.assign(es, n, n);
+	file_stream<double> ranks;
+	ranks.open();
+	const size_t iterations = 20;
+	const double damping = 0.85;
+	pagerank(m, ranks, iterations, damping);
+
+	std::vector<double> expected(n, 1.0 / n);
+	for (size_t it = 0; it < iterations; ++it) {
+		std::vector<double> next(n, 0);
+		double linked = 0;
+		for (size_t u = 0; u < n; ++u) {
+			for (size_t k = 0; k < links[u].size(); ++k) {
+				next[links[u][k]] += damping * expected[u] / links[u].size();
+				linked += damping * expected[u] / links[u].size();
+			}
+		}
+		for (size_t v = 0; v < n; ++v) next[v] += (1.0 - linked) / n;
+		expected.swap(next);
+	}
+
+	TEST_ENSURE_EQUALITY(static_cast<stream_size_type>(n), ranks.size(), "Wrong number of ranks");
+	ranks.seek(0);
+	double sum = 0;
+	for (size_t v = 0; v < n; ++v) {
+		double r = ranks.read();
+		sum += r;
+		if (std::fabs(r - expected[v]) > 1e-12) {
+			log_error() << "Rank of " << v << " is " << r << ", expected " << expected[v] << std::endl;
+			return false;
+		}
+	}
+	TEST_ENSURE(std::fabs(sum - 1) < 1e-9, "Ranks do not sum to one");
+	return true;
+}
+
+bool outside_test() {
+	std::vector<entry_t> entries;
+	random_entries(10, 10, 20, entries);
+	entries[7].col = 10;
+	file_stream<entry_t> es;
+	write(es, entries);
+	sparse_matrix<double> m;
+	bool thrown = false;
+	try {
+		m.assign(es, 10, 10);
+	} catch (const exception &) {
+		thrown = true;
+	}
+	TEST_ENSURE(thrown, "Entry outside the matrix was accepted");
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(single_band_test, "single_band", "n", static_cast<size_t>(2000))
+		.test(bands_test, "bands", "n", static_cast<size_t>(2000))
+		.test(empty_bands_test, "empty_bands")
+		.test(pagerank_test, "pagerank", "n", static_cast<size_t>(1000))
+		.test(outside_test, "outside");
+}
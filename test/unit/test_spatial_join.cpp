@@ -0,0 +1,184 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/pipelining.h>
+#include <boost/random.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace tpie;
+using namespace tpie::pipelining;
+
+typedef rtree_entry<double> entry_t;
+typedef rtree_rectangle<double> rect_t;
+typedef std::pair<stream_size_type, stream_size_type> id_pair;
+
+rect_t make_rect(double x, double y, double w, double h) {
+	rect_t r;
+	r.xlo = x;
+	r.ylo = y;
+	r.xhi = x + w;
+	r.yhi = y + h;
+	return r;
+}
+
+rect_t unit_square() {
+	return make_rect(0, 0, 1, 1);
+}
+
+// n rectangles with corners in [lo, lo+span)^2 and sides up to size.
+void random_entries(unsigned int seed, size_t n, double lo, double span, double size,
+					std::vector<entry_t> & entries) {
+	boost::mt19937 rng(seed);
+	boost::uniform_real<> u(0, 1);
+	entries.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		entries[i].mbr = make_rect(lo + span * u(rng), lo + span * u(rng), size * u(rng), size * u(rng));
+		entries[i].id = i;
+	}
+}
+
+bool check_join(const std::vector<entry_t> & left, const std::vector<entry_t> & right,
+				size_t partitions, size_t tiles, size_t threads) {
+	spatial_join<double> j(unit_square(), partitions, tiles, threads);
+	std::vector<spatial_join_result> results;
+	pipeline p1 = input_vector(left) | j.left();
+	pipeline p2 = input_vector(right) | j.right();
+	pipeline p3 = j.output() | output_vector(results);
+	// The inputs are partitioned in the phases preceding the join.
+	p3();
+
+	std::vector<id_pair> found(results.size());
+	for (size_t i = 0; i < results.size(); ++i)
+		found[i] = id_pair(results[i].left, results[i].right);
+	std::sort(found.begin(), found.end());
+
+	std::vector<id_pair> expected;
+	for (size_t a = 0; a < left.size(); ++a)
+		for (size_t b = 0; b < right.size(); ++b)
+			if (left[a].mbr.intersects(right[b].mbr))
+				expected.push_back(id_pair(left[a].id, right[b].id));
+
+	if (found != expected) {
+		log_error() << "Join found " << found.size() << " pairs, expected "
+					<< expected.size() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool basic_test(size_t n) {
+	std::vector<entry_t> left;
+	std::vector<entry_t> right;
+	random_entries(37, n, 0, 1, 0.02, left);
+	random_entries(41, n, 0, 1, 0.02, right);
+	return check_join(left, right, 16, 32, 4);
+}
+
+// Rectangles spanning many tiles are replicated to several partitions and
+// must be reported once.
+bool large_rectangles_test(size_t n) {
+	std::vector<entry_t> left;
+	std::vector<entry_t> right;
+	random_entries(43, n, 0, 1, 0.3, left);
+	random_entries(47, n, 0, 1, 0.05, right);
+	return check_join(left, right, 7, 20, 3);
+}
+
+bool outside_bounds_test(size_t n) {
+	std::vector<entry_t> left;
+	std::vector<entry_t> right;
+	random_entries(53, n, -0.5, 2, 0.1, left);
+	random_entries(59, n, -0.5, 2, 0.1, right);
+	return check_join(left, right, 5, 8, 2);
+}
+
+bool single_thread_test(size_t n) {
+	std::vector<entry_t> left;
+	std::vector<entry_t> right;
+	random_entries(61, n, 0, 1, 0.05, left);
+	random_entries(67, n, 0, 1, 0.05, right);
+	return check_join(left, right, 1, 1, 1);
+}
+
+// Without a job manager, the partitions are joined in the calling thread.
+bool no_job_manager_test(size_t n) {
+	std::vector<entry_t> left;
+	std::vector<entry_t> right;
+	random_entries(83, n, 0, 1, 0.05, left);
+	random_entries(89, n, 0, 1, 0.05, right);
+	tpie_finish(JOB_MANAGER);
+	bool result = check_join(left, right, 4, 4, 2);
+	tpie_init(JOB_MANAGER);
+	return result;
+}
+
+bool empty_test() {
+	std::vector<entry_t> left;
+	std::vector<entry_t> right;
+	random_entries(71, 100, 0, 1, 0.1, left);
+	return check_join(left, right, 4, 4, 2);
+}
+
+class failing_output_t : public node {
+public:
+	typedef spatial_join_result item_type;
+
+	failing_output_t(stream_size_type limit) : m_limit(limit), m_items(0) {}
+
+	void push(const item_type &) {
+		if (++m_items > m_limit) throw exception("Output failed");
+	}
+
+private:
+	stream_size_type m_limit;
+	stream_size_type m_items;
+};
+
+// The join must wait for the partitions being swept when the destination
+// throws.
+bool push_exception_test(size_t n) {
+	std::vector<entry_t> left;
+	std::vector<entry_t> right;
+	random_entries(73, n, 0, 1, 0.05, left);
+	random_entries(79, n, 0, 1, 0.05, right);
+	spatial_join<double> j(unit_square(), 32, 32, 4);
+	pipeline p1 = input_vector(left) | j.left();
+	pipeline p2 = input_vector(right) | j.right();
+	pipeline p3 = j.output() | pipe_end<termfactory_1<failing_output_t, stream_size_type> >(100);
+	try {
+		p3();
+	} catch (const exception &) {
+		return true;
+	}
+	log_error() << "The exception of the destination was not thrown" << std::endl;
+	return false;
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(basic_test, "basic", "n", static_cast<size_t>(3000))
+		.test(large_rectangles_test, "large_rectangles", "n", static_cast<size_t>(1000))
+		.test(outside_bounds_test, "outside_bounds", "n", static_cast<size_t>(1000))
+		.test(single_thread_test, "single_thread", "n", static_cast<size_t>(1000))
+		.test(no_job_manager_test, "no_job_manager", "n", static_cast<size_t>(1000))
+		.test(empty_test, "empty")
+		.test(push_exception_test, "push_exception", "n", static_cast<size_t>(3000));
+}
@@ -66,7 +66,35 @@ bool simple_test(size_type size) {
 	return true;
 }
 
+bool temp_limit_test() {
+	const stream_size_type limit = 1024*1024;
+	stream_size_type usage = get_temp_file_usage();
+	temp_file_enforce_t enforcement = get_temp_file_enforcement();
+	set_temp_file_limit(usage + limit);
+	set_temp_file_enforcement(TEMP_FILE_ENFORCE_THROW);
+	bool thrown = false;
+	stream_size_type usageAtThrow = 0;
+	{
+		file_stream<uint64_t> s;
+		s.open();
+		try {
+			for (size_t i = 0; i < 8*limit/sizeof(uint64_t); ++i) s.write(i);
+		} catch (const out_of_space_exception &) {
+			thrown = true;
+			usageAtThrow = get_temp_file_usage();
+		}
+		// Flushing and closing the stream must not throw.
+	}
+	set_temp_file_limit(0);
+	set_temp_file_enforcement(enforcement);
+	TEST_ENSURE(thrown, "Temporary file limit was not enforced");
+	TEST_ENSURE(usageAtThrow <= usage + limit, "Usage exceeded the limit before throwing");
+	TEST_ENSURE(get_temp_file_usage() == usage, "Temporary file usage was not released");
+	return true;
+}
+
 int main(int argc, char ** argv) {
 	return tpie::tests(argc, argv)
-		.test(simple_test, "simple", "size", 1024*1024*10);
+		.test(simple_test, "simple", "size", 1024*1024*10)
+		.test(temp_limit_test, "temp_limit");
 }
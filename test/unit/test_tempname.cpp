@@ -0,0 +1,158 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/tempname.h>
+#include <tpie/serialization_sort.h>
+#include <boost/filesystem.hpp>
+#include <boost/random.hpp>
+#include <sstream>
+
+using namespace tpie;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Creates a number of temporary directories and uses them as the default
+/// temporary paths for the lifetime of the object.
+///////////////////////////////////////////////////////////////////////////////
+class temp_dirs {
+public:
+	temp_dirs(size_t n, tempname::placement_policy policy)
+		: m_oldPath(tempname::get_default_path())
+	{
+		m_base = tempname::tpie_dir_name();
+		boost::filesystem::create_directory(m_base);
+		for (size_t i = 0; i < n; ++i) {
+			std::stringstream ss;
+			ss << m_base << "/dev" << i;
+			boost::filesystem::create_directory(ss.str());
+			m_paths.push_back(ss.str());
+		}
+		tempname::set_default_paths(m_paths, policy);
+	}
+
+	~temp_dirs() {
+		tempname::set_default_path(m_oldPath);
+		boost::filesystem::remove_all(m_base);
+	}
+
+	const std::vector<std::string> & paths() const {
+		return m_paths;
+	}
+
+	// Index of the directory containing the given file, or paths().size().
+	size_t index_of(const std::string & file) const {
+		std::string dir = boost::filesystem::path(file).parent_path().string();
+		for (size_t i = 0; i < m_paths.size(); ++i)
+			if (boost::filesystem::path(m_paths[i]).string() == dir) return i;
+		return m_paths.size();
+	}
+
+	// Number of regular files below the i'th directory.
+	size_t files_in(size_t i) const {
+		size_t n = 0;
+		boost::filesystem::recursive_directory_iterator end;
+		for (boost::filesystem::recursive_directory_iterator it(m_paths[i]); it != end; ++it)
+			if (boost::filesystem::is_regular_file(it->status())) ++n;
+		return n;
+	}
+
+private:
+	std::string m_oldPath;
+	std::string m_base;
+	std::vector<std::string> m_paths;
+};
+
+bool placement_test(tempname::placement_policy policy) {
+	const size_t dirs = 3;
+	const size_t files = 12;
+	temp_dirs d(dirs, policy);
+	std::vector<size_t> counts(dirs);
+	for (size_t i = 0; i < files; ++i) {
+		temp_file f;
+		size_t idx = d.index_of(f.path());
+		if (idx == dirs) {
+			log_error() << f.path() << " is not in a default path" << std::endl;
+			return false;
+		}
+		if (policy == tempname::placement_round_robin && idx != i % dirs) {
+			log_error() << "File " << i << " placed in directory " << idx << std::endl;
+			return false;
+		}
+		++counts[idx];
+	}
+	// All directories are on the same device, so capacity weighting
+	// should spread the files evenly as well.
+	for (size_t i = 0; i < dirs; ++i) {
+		if (counts[i] + 1 < files / dirs || counts[i] > files / dirs + 1) {
+			log_error() << counts[i] << " files in directory " << i << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool round_robin_test() {
+	return placement_test(tempname::placement_round_robin);
+}
+
+bool capacity_weighted_test() {
+	return placement_test(tempname::placement_capacity_weighted);
+}
+
+bool serialization_sort_test() {
+	const size_t dirs = 2;
+	temp_dirs d(dirs, tempname::placement_round_robin);
+	boost::rand48 rng;
+	serialization_sort<uint64_t, std::less<uint64_t> > s;
+	s.set_available_memory(8*1024*1024);
+	s.begin();
+	const stream_size_type items = 2*1024*1024;
+	for (stream_size_type i = 0; i < items; ++i) s.push(rng());
+	s.end();
+	for (size_t i = 0; i < dirs; ++i) {
+		if (d.files_in(i) == 0) {
+			log_error() << "No runs in directory " << i << std::endl;
+			return false;
+		}
+	}
+	s.merge_runs();
+	uint64_t prev = 0;
+	stream_size_type read = 0;
+	while (s.can_pull()) {
+		uint64_t x = s.pull();
+		if (x < prev) {
+			log_error() << "Out of order" << std::endl;
+			return false;
+		}
+		prev = x;
+		++read;
+	}
+	if (read != items) {
+		log_error() << "Read " << read << " items, expected " << items << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(round_robin_test, "round_robin")
+		.test(capacity_weighted_test, "capacity_weighted")
+		.test(serialization_sort_test, "serialization_sort");
+}
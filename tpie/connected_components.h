@@ -0,0 +1,429 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __TPIE_CONNECTED_COMPONENTS_H__
+#define __TPIE_CONNECTED_COMPONENTS_H__
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file connected_components.h
+/// \brief External memory connected components of undirected graphs.
+///
+/// A graph is given as a stream of its edges (u, v) in any order, and its
+/// vertices are the endpoints of the edges; an isolated vertex is given by
+/// the edge (v, v). Every vertex is labelled with the least vertex of its
+/// component.
+///
+/// When the vertices fit in memory, the edges are streamed through
+/// disjoint_sets (semi-external union-find). Otherwise each vertex is
+/// hooked to its least neighbour. The hooks form trees of at least two
+/// vertices rooted at the least vertex of the tree, so contracting each
+/// tree to its root, which is found by pointer jumping, at least halves the
+/// number of vertices that still have edges. The contracted graph is
+/// labelled recursively until it fits in memory. Each round is a number of
+/// sorts with merge_sorter.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <tpie/file_stream.h>
+#include <tpie/array.h>
+#include <tpie/disjoint_sets.h>
+#include <tpie/memory.h>
+#include <tpie/dummy_progress.h>
+#include <tpie/parallel_sort.h>
+#include <tpie/pipelining/merge_sorter.h>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+namespace tpie {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief An undirected edge between two vertices.
+///////////////////////////////////////////////////////////////////////////////
+typedef std::pair<stream_size_type, stream_size_type> connected_components_edge;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A vertex and the component it belongs to.
+///////////////////////////////////////////////////////////////////////////////
+struct connected_component {
+	stream_size_type vertex;
+	/** The least vertex of the component. */
+	stream_size_type component;
+};
+
+namespace connected_components_bits {
+
+typedef connected_components_edge edge_t;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A vertex and the vertex it is hooked to, stored the same way as
+/// a labelled vertex.
+///////////////////////////////////////////////////////////////////////////////
+typedef connected_component pointer_t;
+
+struct second_less {
+	bool operator()(const edge_t & a, const edge_t & b) const {
+		if (a.second != b.second) return a.second < b.second;
+		return a.first < b.first;
+	}
+};
+
+struct vertex_less {
+	bool operator()(const pointer_t & a, const pointer_t & b) const {
+		return a.vertex < b.vertex;
+	}
+};
+
+struct component_less {
+	bool operator()(const pointer_t & a, const pointer_t & b) const {
+		return a.component < b.component;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sort the items of in into out, which must be empty.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename pred_t>
+void sort(file_stream<T> & in, file_stream<T> & out, const pred_t & pred, memory_size_type memory) {
+	merge_sorter<T, false, pred_t> sorter(pred);
+	sorter.set_available_memory(memory);
+	sorter.begin();
+	in.seek(0);
+	while (in.can_read()) sorter.push(in.read());
+	sorter.end();
+	dummy_progress_indicator pi;
+	sorter.calc(pi);
+	while (sorter.can_pull()) out.write(sorter.pull());
+	out.seek(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The memory given to a sort, leaving room for the streams that are
+/// open around it.
+///////////////////////////////////////////////////////////////////////////////
+inline memory_size_type sort_memory(memory_size_type memory) {
+	memory_size_type streams = 4 * file_stream<edge_t>::memory_usage();
+	return memory > streams ? memory - streams : memory / 2;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The memory used to label the given number of vertices by
+/// union-find.
+///////////////////////////////////////////////////////////////////////////////
+inline stream_size_type semi_external_memory_usage(stream_size_type vertices) {
+	return array<stream_size_type>::memory_usage(vertices)
+		+ disjoint_sets<memory_size_type>::memory_usage(vertices)
+		+ 2 * file_stream<edge_t>::memory_usage();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The least memory to label with: a sort with the streams open
+/// around it, and union-find of no vertices, which ends the recursion.
+///////////////////////////////////////////////////////////////////////////////
+inline memory_size_type minimum_memory() {
+	typedef merge_sorter<edge_t, false, std::less<edge_t> > sorter_t;
+	memory_size_type sortMemory = std::max(sorter_t::minimum_memory_phase_1(),
+										   std::max(sorter_t::minimum_memory_phase_2(),
+													sorter_t::minimum_memory_phase_3()));
+	memory_size_type streams = 4 * file_stream<edge_t>::memory_usage();
+	return std::max(sortMemory + streams,
+					static_cast<memory_size_type>(semi_external_memory_usage(0)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Label the vertices of the given arcs, which hold both directions
+/// of every edge sorted by source, by union-find in internal memory.
+///
+/// \param vertexCount  The number of distinct sources of the arcs.
+///////////////////////////////////////////////////////////////////////////////
+inline void label_semi_external(file_stream<edge_t> & arcs, memory_size_type vertexCount,
+								file_stream<pointer_t> & out) {
+	array<stream_size_type> vertices(vertexCount);
+	disjoint_sets<memory_size_type> sets(vertexCount);
+	memory_size_type n = 0;
+	arcs.seek(0);
+	while (arcs.can_read()) {
+		const edge_t & a = arcs.read();
+		if (n > 0 && vertices[n-1] == a.first) continue;
+		vertices[n] = a.first;
+		sets.make_set(n);
+		++n;
+	}
+
+	arcs.seek(0);
+	memory_size_type u = 0;
+	while (arcs.can_read()) {
+		const edge_t & a = arcs.read();
+		while (vertices[u] != a.first) ++u;
+		// Each edge is seen in both directions.
+		if (a.second <= a.first) continue;
+		memory_size_type v = std::lower_bound(vertices.begin(), vertices.end(), a.second) - vertices.begin();
+		memory_size_type x = sets.find_set(u);
+		memory_size_type y = sets.find_set(v);
+		// The vertices are sorted, so linking to the least index makes the
+		// least vertex the representative.
+		sets.link(std::min(x, y), std::max(x, y));
+	}
+
+	for (memory_size_type i = 0; i < n; ++i) {
+		pointer_t l;
+		l.vertex = vertices[i];
+		l.component = vertices[sets.find_set(i)];
+		out.write(l);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Replace the pointer of every vertex by the pointer of the vertex
+/// it points to, until every vertex points to a root.
+///
+/// The pointers are sorted by vertex. In the first round, two vertices
+/// pointing to each other are made to point to the lesser of them.
+///////////////////////////////////////////////////////////////////////////////
+inline void jump_pointers(temp_file & pointersFile, memory_size_type memory) {
+	for (bool firstRound = true, changed = true; changed; firstRound = false) {
+		changed = false;
+		temp_file jumpedFile;
+		{
+			file_stream<pointer_t> pointers;
+			pointers.open(pointersFile, access_read);
+			file_stream<pointer_t> byTarget;
+			byTarget.open();
+			sort(pointers, byTarget, component_less(), memory);
+			file_stream<pointer_t> jumped;
+			jumped.open(jumpedFile);
+			pointers.seek(0);
+			pointer_t target = pointers.read();
+			while (byTarget.can_read()) {
+				pointer_t p = byTarget.read();
+				// Every target is a vertex.
+				while (target.vertex != p.component) target = pointers.read();
+				stream_size_type next = target.component;
+				if (firstRound && next == p.vertex) next = std::min(p.vertex, p.component);
+				if (next != p.component) changed = true;
+				p.component = next;
+				jumped.write(p);
+			}
+		}
+		file_stream<pointer_t> jumped;
+		jumped.open(jumpedFile, access_read);
+		file_stream<pointer_t> pointers;
+		pointers.open(pointersFile);
+		pointers.truncate(0);
+		sort(jumped, pointers, vertex_less(), memory);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Label the vertices of the edges in the file edgesFile and write
+/// the labels to the file outFile sorted by vertex.
+///
+/// Only the temporary files of a round are kept while the next round runs,
+/// so the memory used by open streams does not grow with the recursion.
+///////////////////////////////////////////////////////////////////////////////
+inline void label(temp_file & edgesFile, temp_file & outFile, memory_size_type memory) {
+	memory_size_type sortMemory = sort_memory(memory);
+
+	// Both directions of every edge sorted by source, so the neighbours of
+	// a vertex are consecutive and sorted.
+	temp_file arcsFile;
+	{
+		file_stream<edge_t> arcs;
+		arcs.open(arcsFile);
+		{
+			file_stream<edge_t> edges;
+			edges.open(edgesFile, access_read);
+			file_stream<edge_t> unsorted;
+			unsorted.open();
+			while (edges.can_read()) {
+				const edge_t & e = edges.read();
+				unsorted.write(e);
+				if (e.first != e.second) unsorted.write(edge_t(e.second, e.first));
+			}
+			sort(unsorted, arcs, std::less<edge_t>(), sortMemory);
+		}
+		stream_size_type vertexCount = 0;
+		stream_size_type previous = 0;
+		while (arcs.can_read()) {
+			const edge_t & a = arcs.read();
+			if (vertexCount > 0 && a.first == previous) continue;
+			previous = a.first;
+			++vertexCount;
+		}
+		if (vertexCount == 0 || semi_external_memory_usage(vertexCount) <= memory) {
+			file_stream<pointer_t> out;
+			out.open(outFile);
+			label_semi_external(arcs, static_cast<memory_size_type>(vertexCount), out);
+			return;
+		}
+	}
+
+	// Hook every vertex to its least neighbour, or to itself if it has none.
+	temp_file pointersFile;
+	{
+		file_stream<edge_t> arcs;
+		arcs.open(arcsFile, access_read);
+		file_stream<pointer_t> pointers;
+		pointers.open(pointersFile);
+		pointer_t p;
+		bool hasVertex = false;
+		while (arcs.can_read()) {
+			const edge_t & a = arcs.read();
+			if (!hasVertex || a.first != p.vertex) {
+				if (hasVertex) pointers.write(p);
+				p.vertex = p.component = a.first;
+				hasVertex = true;
+			}
+			if (p.component == p.vertex) p.component = a.second;
+		}
+		if (hasVertex) pointers.write(p);
+	}
+	jump_pointers(pointersFile, sortMemory);
+
+	// Contract every tree to its root, dropping the edges inside trees and
+	// duplicate edges.
+	temp_file contractedFile;
+	{
+		file_stream<pointer_t> pointers;
+		pointers.open(pointersFile, access_read);
+		file_stream<edge_t> halfContracted;
+		halfContracted.open();
+		{
+			file_stream<edge_t> arcs;
+			arcs.open(arcsFile, access_read);
+			file_stream<edge_t> unsorted;
+			unsorted.open();
+			pointer_t p = pointers.read();
+			while (arcs.can_read()) {
+				const edge_t & a = arcs.read();
+				if (a.second <= a.first) continue;
+				while (p.vertex != a.first) p = pointers.read();
+				unsorted.write(edge_t(p.component, a.second));
+			}
+			sort(unsorted, halfContracted, second_less(), sortMemory);
+		}
+		arcsFile.free();
+		file_stream<edge_t> unsorted;
+		unsorted.open();
+		pointers.seek(0);
+		pointer_t p = pointers.read();
+		while (halfContracted.can_read()) {
+			const edge_t & e = halfContracted.read();
+			while (p.vertex != e.second) p = pointers.read();
+			if (e.first == p.component) continue;
+			unsorted.write(edge_t(std::min(e.first, p.component), std::max(e.first, p.component)));
+		}
+		halfContracted.close();
+		pointers.close();
+		file_stream<edge_t> sorted;
+		sorted.open();
+		sort(unsorted, sorted, std::less<edge_t>(), sortMemory);
+		unsorted.close();
+		file_stream<edge_t> contracted;
+		contracted.open(contractedFile);
+		edge_t previous;
+		bool first = true;
+		while (sorted.can_read()) {
+			const edge_t & e = sorted.read();
+			if (!first && e == previous) continue;
+			contracted.write(e);
+			previous = e;
+			first = false;
+		}
+	}
+
+	temp_file contractedLabelsFile;
+	label(contractedFile, contractedLabelsFile, memory);
+	contractedFile.free();
+
+	// A vertex is in the component of its root. A root without edges after
+	// contraction is a component by itself.
+	{
+		file_stream<pointer_t> byRoot;
+		byRoot.open();
+		{
+			file_stream<pointer_t> pointers;
+			pointers.open(pointersFile, access_read);
+			sort(pointers, byRoot, component_less(), sortMemory);
+		}
+		pointersFile.free();
+		file_stream<pointer_t> unsorted;
+		unsorted.open();
+		{
+			file_stream<pointer_t> labels;
+			labels.open(contractedLabelsFile, access_read);
+			bool hasLabel = labels.can_read();
+			pointer_t l;
+			if (hasLabel) l = labels.read();
+			while (byRoot.can_read()) {
+				pointer_t p = byRoot.read();
+				while (hasLabel && l.vertex < p.component) {
+					hasLabel = labels.can_read();
+					if (hasLabel) l = labels.read();
+				}
+				if (hasLabel && l.vertex == p.component) p.component = l.component;
+				unsorted.write(p);
+			}
+		}
+		contractedLabelsFile.free();
+		byRoot.close();
+		file_stream<pointer_t> out;
+		out.open(outFile);
+		sort(unsorted, out, vertex_less(), sortMemory);
+	}
+}
+
+} // namespace connected_components_bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Compute the connected components of an undirected graph.
+///
+/// \param edges  The edges of the graph in any order. An isolated vertex v
+/// is given by the edge (v, v).
+/// \param out  Receives every vertex of the graph along with the least
+/// vertex of its component, sorted by vertex.
+/// \param memory  Number of bytes to use. If the vertices fit in this
+/// memory, they are labelled by union-find in internal memory. If zero,
+/// half the memory available in the memory manager is used. Less than
+/// the few blocks that a sort needs is raised to that.
+///////////////////////////////////////////////////////////////////////////////
+inline void connected_components(file_stream<connected_components_edge> & edges,
+								 file_stream<connected_component> & out,
+								 memory_size_type memory = 0) {
+	using namespace connected_components_bits;
+	if (memory == 0) memory = get_memory_manager().available() / 2;
+	memory = std::max(memory, minimum_memory());
+	temp_file edgesFile;
+	temp_file labelsFile;
+	{
+		file_stream<edge_t> copy;
+		copy.open(edgesFile);
+		edges.seek(0);
+		while (edges.can_read()) copy.write(edges.read());
+	}
+	label(edgesFile, labelsFile, memory);
+	edgesFile.free();
+	file_stream<connected_component> labels;
+	labels.open(labelsFile, access_read);
+	while (labels.can_read()) out.write(labels.read());
+	out.seek(0);
+}
+
+} // namespace tpie
+
+#endif // __TPIE_CONNECTED_COMPONENTS_H__
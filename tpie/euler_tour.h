@@ -0,0 +1,288 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __TPIE_EULER_TOUR_H__
+#define __TPIE_EULER_TOUR_H__
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file euler_tour.h
+/// \brief External memory Euler tours of trees.
+///
+/// A tree is given as a stream of its edges (u, v) in any order. Each edge
+/// is traversed once in each direction by the tour. The arc following
+/// (u, v) is (v, w), where w is the neighbour of v after u in the order of
+/// ids, wrapping around, so the tour is a cycle which is cut open at the
+/// root and ranked with list_rank. Computing the tour costs O(sort(N))
+/// I/Os.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <tpie/list_ranking.h>
+#include <utility>
+
+namespace tpie {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief An edge of a tree, or an arc from first to second of its tour.
+///////////////////////////////////////////////////////////////////////////////
+typedef std::pair<stream_size_type, stream_size_type> euler_tour_edge;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A vertex of a rooted tree computed by root_tree.
+///////////////////////////////////////////////////////////////////////////////
+struct rooted_tree_vertex {
+	stream_size_type id;
+	/** Id of the parent, or the vertex itself for the root. */
+	stream_size_type parent;
+	/** Number of edges on the path to the root. */
+	stream_size_type depth;
+	/** Number of vertices in the subtree rooted at the vertex. */
+	stream_size_type size;
+};
+
+namespace euler_tour_bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief An arc of the tour along with its rank, or its successor.
+///////////////////////////////////////////////////////////////////////////////
+struct arc {
+	stream_size_type from;
+	stream_size_type to;
+	stream_size_type rank;
+	/** For a down arc, the size of the subtree of to. */
+	stream_size_type size;
+	bool down;
+};
+
+struct edge_less {
+	bool operator()(const euler_tour_edge & a, const euler_tour_edge & b) const {
+		return a < b;
+	}
+};
+
+struct arc_less {
+	bool operator()(const arc & a, const arc & b) const {
+		if (a.from != b.from) return a.from < b.from;
+		return a.to < b.to;
+	}
+};
+
+struct rank_less {
+	bool operator()(const arc & a, const arc & b) const {
+		return a.rank < b.rank;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Orders the two arcs of an edge next to each other, by rank.
+///////////////////////////////////////////////////////////////////////////////
+struct edge_rank_less {
+	bool operator()(const arc & a, const arc & b) const {
+		stream_size_type aMin = std::min(a.from, a.to);
+		stream_size_type bMin = std::min(b.from, b.to);
+		if (aMin != bMin) return aMin < bMin;
+		stream_size_type aMax = std::max(a.from, a.to);
+		stream_size_type bMax = std::max(b.from, b.to);
+		if (aMax != bMax) return aMax < bMax;
+		return a.rank < b.rank;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Write the arcs of the tour to out sorted by rank.
+///////////////////////////////////////////////////////////////////////////////
+inline void ranked_tour(file_stream<euler_tour_edge> & edges, stream_size_type root,
+						file_stream<arc> & out, memory_size_type memory) {
+	typedef list_ranking_node<stream_size_type> node_t;
+	typedef list_ranking_rank<stream_size_type> rank_t;
+
+	// Arcs sorted by source, so the arcs leaving a vertex are consecutive
+	// and sorted by target. The position of an arc is its id in the list.
+	file_stream<euler_tour_edge> arcs;
+	arcs.open();
+	{
+		file_stream<euler_tour_edge> unsorted;
+		unsorted.open();
+		edges.seek(0);
+		while (edges.can_read()) {
+			const euler_tour_edge & e = edges.read();
+			unsorted.write(e);
+			unsorted.write(euler_tour_edge(e.second, e.first));
+		}
+		list_ranking_bits::sort(unsorted, arcs, edge_less());
+	}
+
+	// The arc (a_i, v) is followed by (v, a_{i+1}), where a_0, ..., a_{k-1}
+	// are the neighbours of v. The arc (a_{k-1}, root) ends the tour.
+	file_stream<node_t> nodes;
+	nodes.open();
+	{
+		file_stream<arc> successors;
+		successors.open();
+		list_ranking_bits::peeking_stream<euler_tour_edge> in(arcs);
+		stream_size_type position = 0;
+		while (in.can_read()) {
+			stream_size_type v = in.peek().first;
+			stream_size_type begin = position;
+			arc s;
+			s.size = 0;
+			s.down = false;
+			while (in.can_read() && in.peek().first == v) {
+				if (position != begin) successors.write(s);
+				euler_tour_edge e = in.read();
+				s.from = e.second;
+				s.to = v;
+				s.rank = ++position;
+			}
+			// The last arc into v is followed by the first arc out of v.
+			s.rank = (v == root) ? list_ranking_end : begin;
+			successors.write(s);
+		}
+		file_stream<arc> sorted;
+		sorted.open();
+		list_ranking_bits::sort(successors, sorted, arc_less());
+		for (stream_size_type id = 0; sorted.can_read(); ++id) {
+			node_t n;
+			n.id = id;
+			n.next = sorted.read().rank;
+			n.weight = 1;
+			nodes.write(n);
+		}
+	}
+
+	file_stream<rank_t> ranks;
+	ranks.open();
+	list_rank(nodes, ranks, memory);
+	nodes.close();
+
+	file_stream<arc> unsorted;
+	unsorted.open();
+	arcs.seek(0);
+	while (ranks.can_read()) {
+		const euler_tour_edge & e = arcs.read();
+		arc a;
+		a.from = e.first;
+		a.to = e.second;
+		a.rank = ranks.read().rank;
+		a.size = 0;
+		a.down = false;
+		unsorted.write(a);
+	}
+	list_ranking_bits::sort(unsorted, out, rank_less());
+}
+
+} // namespace euler_tour_bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Compute the Euler tour of a tree.
+///
+/// \param edges  The edges of the tree, each given once in either direction.
+/// \param root  The vertex where the tour starts and ends.
+/// \param tour  Receives the 2(N-1) arcs of the tour in order.
+/// \param memory  Number of bytes to use for ranking the tour in internal
+/// memory, as in list_rank. If zero, the memory available in the memory
+/// manager is used.
+///////////////////////////////////////////////////////////////////////////////
+inline void euler_tour(file_stream<euler_tour_edge> & edges, stream_size_type root,
+					   file_stream<euler_tour_edge> & tour, memory_size_type memory = 0) {
+	using namespace euler_tour_bits;
+	file_stream<arc> arcs;
+	arcs.open();
+	ranked_tour(edges, root, arcs, memory);
+	while (arcs.can_read()) {
+		const arc & a = arcs.read();
+		tour.write(euler_tour_edge(a.from, a.to));
+	}
+	tour.seek(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Root a tree and compute the parent, depth and subtree size of each
+/// vertex using its Euler tour.
+///
+/// The arc of an edge that comes first in the tour leads from the parent to
+/// the child. The depth of a vertex is the number of such arcs minus the
+/// number of the opposite arcs before it in the tour, and the subtree size
+/// of a vertex follows from the distance in the tour between the two arcs
+/// of the edge to its parent.
+///
+/// \param edges  The edges of the tree, each given once in either direction.
+/// \param root  The root of the tree.
+/// \param out  Receives every vertex of the tree sorted by id.
+/// \param memory  Number of bytes to use for ranking the tour in internal
+/// memory, as in list_rank. If zero, the memory available in the memory
+/// manager is used.
+///////////////////////////////////////////////////////////////////////////////
+inline void root_tree(file_stream<euler_tour_edge> & edges, stream_size_type root,
+					  file_stream<rooted_tree_vertex> & out, memory_size_type memory = 0) {
+	using namespace euler_tour_bits;
+	typedef rooted_tree_vertex vertex_t;
+
+	// Label the arcs of each edge as down or up.
+	file_stream<arc> labelled;
+	labelled.open();
+	{
+		file_stream<arc> tour;
+		tour.open();
+		ranked_tour(edges, root, tour, memory);
+		file_stream<arc> paired;
+		paired.open();
+		list_ranking_bits::sort(tour, paired, edge_rank_less());
+		tour.close();
+		file_stream<arc> unsorted;
+		unsorted.open();
+		while (paired.can_read()) {
+			arc down = paired.read();
+			arc up = paired.read();
+			// The tour between the two arcs visits the subtree of the child
+			// and traverses each of its edges twice.
+			down.size = (up.rank - down.rank + 1) / 2;
+			down.down = true;
+			unsorted.write(down);
+			unsorted.write(up);
+		}
+		list_ranking_bits::sort(unsorted, labelled, rank_less());
+	}
+
+	file_stream<vertex_t> unsorted;
+	unsorted.open();
+	vertex_t r;
+	r.id = r.parent = root;
+	r.depth = 0;
+	r.size = edges.size() + 1;
+	unsorted.write(r);
+	stream_size_type depth = 0;
+	while (labelled.can_read()) {
+		const arc & a = labelled.read();
+		if (!a.down) {
+			--depth;
+			continue;
+		}
+		vertex_t v;
+		v.id = a.to;
+		v.parent = a.from;
+		v.depth = ++depth;
+		v.size = a.size;
+		unsorted.write(v);
+	}
+	list_ranking_bits::sort(unsorted, out, list_ranking_bits::id_less<vertex_t>());
+}
+
+} // namespace tpie
+
+#endif // __TPIE_EULER_TOUR_H__
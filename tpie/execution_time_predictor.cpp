@@ -28,6 +28,11 @@
 #include <tpie/tpie_log.h>
 #include <tpie/tempname.h>
 #include <tpie/util.h>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstring>
+#include <vector>
 #ifdef WIN32
 #include <windows.h>
 #undef NO_ERROR
@@ -85,14 +90,56 @@ struct entry {
 };
 
 
+///////////////////////////////////////////////////////////////////////////////
+/// A measurement as stored in the database file.
+///////////////////////////////////////////////////////////////////////////////
+struct record {
+	boost::uint64_t id;
+	boost::uint64_t n;
+	boost::uint64_t memory;
+	boost::uint64_t time;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// The key of the measurements of id with the given amount of memory.
+/// Memory is bucketed by powers of two; memory 0 means unknown and gives the
+/// key collecting all measurements of id.
+///////////////////////////////////////////////////////////////////////////////
+hash_type memory_key(hash_type id, stream_size_type memory) {
+	if (memory == 0) return id;
+	hash_type bucket = 1;
+	while (memory > 1) {
+		memory >>= 1;
+		++bucket;
+	}
+	return id * 1000003 + bucket;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// The database is an append-only file of records. Each process reads the
+/// file when TPIE is initialized and appends the records it measured when
+/// TPIE is finished. Appends and compactions of the file are serialized
+/// across processes by a lock on a separate lock file, so concurrent
+/// processes do not overwrite each other's measurements.
+///////////////////////////////////////////////////////////////////////////////
 class time_estimator_database {
 public:
 	typedef std::map<hash_type, entry> db_type;
 	db_type db;
 	std::string dir_name;
 	std::string file_name;
-	
-	time_estimator_database() {
+
+	/** Records measured by this process and not yet appended to the file. */
+	std::vector<record> pending;
+	/** Number of records in the file when it was loaded. */
+	size_t loaded;
+	boost::mutex mutex;
+
+	static const char * header() {
+		return "TPIE execution time log 1\n";
+	}
+
+	time_estimator_database() : loaded(0) {
 #ifdef WIN32
 		//dir_name 
 		TCHAR p[MAX_PATH];
@@ -107,69 +154,143 @@ public:
 		file_name = "/."; //make hidden, include path separator
 #endif	
 
-		file_name += "tpie_time_estimation_db";
+		file_name += "tpie_execution_time_log";
 #ifndef TPIE_NDEBUG
 		file_name += "_debug";
 #endif
 	}
-	
-	void load() {
+
+	std::string path() {
+		return dir_name+file_name;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Read all records of the database file. Returns false if the file
+	/// does not exist or is not a database file.
+	///////////////////////////////////////////////////////////////////////////
+	bool read_records(std::vector<record> & records) {
 		ifstream f;
-		std::string full_name = dir_name+file_name;
-		f.open(full_name.c_str(), ifstream::binary | ifstream::in);
-		if (f.is_open()) {
-			try {
-				tpie::unserializer u(f);
-				u << "TPIE time execution database";
-				size_t c;
-				u >> c;
-				for(size_t i=0; i < c; ++i) {
-					hash_type id;
-					size_t cnt;
-					u >> id >> cnt;
-					entry & e=db[id];
-					for (size_t j=0; j < cnt; ++j) {
-						stream_size_type n;
-						time_type time;
-						u >> n >> time;
-						e.add_point(p_t(n, time));
-					}
-				}
-			} catch(tpie::serialization_error &) {
-			}
-		}
+		f.open(path().c_str(), ifstream::binary | ifstream::in);
+		if (!f.is_open()) return false;
+		std::string h(strlen(header()), '\0');
+		f.read(&h[0], h.size());
+		if (!f || h != header()) return false;
+		record r;
+		while (f.read(reinterpret_cast<char *>(&r), sizeof(r))) records.push_back(r);
+		return true;
+	}
+
+	void fold(const record & r) {
+		db[r.id].add_point(p_t(r.n, r.time));
+		if (r.memory != 0) db[memory_key(r.id, r.memory)].add_point(p_t(r.n, r.time));
+	}
+
+	void load() {
+		std::vector<record> records;
+		if (!read_records(records)) return;
+		for (size_t i = 0; i < records.size(); ++i) fold(records[i]);
+		loaded = records.size();
+	}
+
+	void add(const record & r) {
+		boost::mutex::scoped_lock lock(mutex);
+		fold(r);
+		pending.push_back(r);
 	}
 
 	~time_estimator_database() {}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// Append the pending records to the database file, compacting the file
+	/// if it has grown much larger than the points it represents.
+	///////////////////////////////////////////////////////////////////////////
 	void save() {
-		std::string tmp=tpie::tempname::tpie_name("",dir_name);
+		if (pending.empty()) return;
+		try {
+			std::string lockName = path() + ".lock";
+			{
+				// file_lock requires the file to exist.
+				ofstream l(lockName.c_str(), ofstream::binary | ofstream::app);
+			}
+			boost::interprocess::file_lock fileLock(lockName.c_str());
+			boost::interprocess::scoped_lock<boost::interprocess::file_lock> lock(fileLock);
+
+			if (loaded + pending.size() > compact_threshold()) {
+				compact();
+			} else {
+				append();
+			}
+		} catch (boost::interprocess::interprocess_exception & e) {
+			log_error() << "Failed to store time estimation database: " << e.what() << std::endl;
+		}
+		pending.clear();
+	}
+
+private:
+	size_t compact_threshold() {
+		return std::max(static_cast<size_t>(4096), 4 * entry::max_points * db.size());
+	}
+
+	void append() {
+		bool exists = boost::filesystem::exists(path()) && boost::filesystem::file_size(path()) > 0;
+		if (exists) {
+			std::vector<record> records;
+			if (!read_records(records)) {
+				// Not a database file; replace it.
+				compact();
+				return;
+			}
+		}
 		ofstream f;
-		f.open(tmp.c_str(), ifstream::binary | ifstream::out);
+		f.open(path().c_str(), ofstream::binary | ofstream::out | ofstream::app);
 		if (!f.is_open()) {
-			log_error() << "Failed to store time estimation database: Could not create temporary file" << std::endl;
+			log_error() << "Failed to store time estimation database: Could not open " << path() << std::endl;
 			return;
 		}
-		
+		if (!exists) f.write(header(), strlen(header()));
+		f.write(reinterpret_cast<const char *>(&pending[0]), pending.size() * sizeof(record));
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Rewrite the file keeping the most recent records of each id and
+	/// memory bucket, including records appended by other processes since
+	/// the file was loaded.
+	///////////////////////////////////////////////////////////////////////////
+	void compact() {
+		std::vector<record> records;
+		read_records(records);
+		records.insert(records.end(), pending.begin(), pending.end());
+
+		std::map<hash_type, size_t> counts;
+		std::vector<record> keep;
+		for (size_t i = records.size(); i--;) {
+			size_t & c = counts[memory_key(records[i].id, records[i].memory)];
+			if (c++ < 2 * entry::max_points) keep.push_back(records[i]);
+		}
+		std::reverse(keep.begin(), keep.end());
+
+		std::string tmp=tpie::tempname::tpie_name("",dir_name);
 		{
-			tpie::serializer s(f);
-			s << "TPIE time execution database";
-			s << (size_t)db.size();
-			for(db_type::iterator i=db.begin(); i != db.end(); ++i) {
-				s << (hash_type)i->first << (size_t)i->second.count;
-				for (p_t * j=i->second.begin(); j != i->second.end(); ++j)
-					s << (stream_size_type)j->first << (time_type)j->second;
+			ofstream f;
+			f.open(tmp.c_str(), ofstream::binary | ofstream::out);
+			if (!f.is_open()) {
+				log_error() << "Failed to store time estimation database: Could not create temporary file" << std::endl;
+				return;
 			}
+			f.write(header(), strlen(header()));
+			if (!keep.empty())
+				f.write(reinterpret_cast<const char *>(&keep[0]), keep.size() * sizeof(record));
 		}
-		f.close();
 		try {
-			atomic_rename(tmp, dir_name+file_name);
+			atomic_rename(tmp, path());
 		} catch(std::runtime_error e) {
 			log_error() << "Failed to store time estimation database: " << e.what() << std::endl;
 		}
 	}
-	
+
+public:
 	time_type estimate(hash_type id, stream_size_type n, double & confidence) {
+		boost::mutex::scoped_lock lock(mutex);
 		db_type::iterator i=db.find(id);
 		if (i == db.end()) {
 			confidence=0.0;
@@ -226,7 +347,7 @@ void finish_execution_time_db() {
 
 execution_time_predictor::execution_time_predictor(const std::string & id): 
 	m_id(prime_hash(id)), m_start_time(boost::posix_time::not_a_date_time), 
-	m_estimate(-1), m_confidence(1), m_pause_time_at_start(0)
+	m_estimate(-1), m_confidence(1), m_n(0), m_memory(0), m_pause_time_at_start(0)
 #ifndef TPIE_NDEBUG
 	,m_name(id)
 #endif //TPIE_NDEBUG
@@ -236,31 +357,52 @@ execution_time_predictor::~execution_time_predictor() {
 }
 
 time_type execution_time_predictor::estimate_execution_time(stream_size_type n, double & confidence) {
-	if (m_id == prime_hash(std::string())) {
+	return estimate_execution_time(n, 0, confidence);
+}
+
+time_type execution_time_predictor::estimate_execution_time(stream_size_type n,
+															memory_size_type memory,
+															double & confidence) {
+	if (db == 0 || m_id == prime_hash(std::string())) {
 		confidence=0.0;
 		return -1;
 	}
-	time_type v=db->estimate(m_id, n, confidence);
+	time_type v = static_cast<time_type>(-1);
+	if (memory != 0) v=db->estimate(memory_key(m_id, memory), n, confidence);
+	if (v == static_cast<time_type>(-1)) {
+		v=db->estimate(m_id, n, confidence);
+		// Measured with a different amount of memory.
+		if (memory != 0) confidence /= 2;
+	}
 #ifndef TPIE_NDEBUG
-	if (v == static_cast<memory_size_type>(-1))
+	if (v == static_cast<time_type>(-1))
 		log_debug() << "No database entry for " << m_name << " (" << m_id << ")" << std::endl;
 #endif
 	return v;
 }
 
 void execution_time_predictor::start_execution(stream_size_type n) {
+	start_execution(n, 0);
+}
+
+void execution_time_predictor::start_execution(stream_size_type n, memory_size_type memory) {
     m_n = n;
-    m_estimate = estimate_execution_time(n, m_confidence);
+	m_memory = memory;
+    m_estimate = estimate_execution_time(n, memory, m_confidence);
     m_start_time = boost::posix_time::microsec_clock::local_time();
 	m_pause_time_at_start = s_pause_time;
 }
 
 time_type execution_time_predictor::end_execution() {
-	if (m_id == prime_hash(std::string()) || !s_store_times) return 0;
+	if (db == 0 || m_id == prime_hash(std::string()) || !s_store_times) return 0;
 	time_type t = (boost::posix_time::microsec_clock::local_time() - m_start_time).total_milliseconds();
 	t -= (s_pause_time - m_pause_time_at_start);
-	entry & e = db->db[m_id];
-	e.add_point( p_t(m_n, t) );
+	record r;
+	r.id = m_id;
+	r.n = m_n;
+	r.memory = m_memory;
+	r.time = t;
+	db->add(r);
 	m_start_time = boost::posix_time::not_a_date_time;
 	return t;
 }
@@ -73,7 +73,27 @@ public:
 	/// \param confidence (output) Confidence (between 0.0 and 1.0)
 	///////////////////////////////////////////////////////////////////////////
 	time_type estimate_execution_time(stream_size_type n, double & confidence);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Estimate execution time when the given amount of memory is used.
+	/// Measurements with a similar amount of memory are preferred; if there
+	/// are none, the estimate is based on all measurements with a lower
+	/// confidence.
+	/// \param n Input size
+	/// \param memory Memory in bytes, or 0 if unknown
+	/// \param confidence (output) Confidence (between 0.0 and 1.0)
+	///////////////////////////////////////////////////////////////////////////
+	time_type estimate_execution_time(stream_size_type n, memory_size_type memory,
+									  double & confidence);
+
 	void start_execution(stream_size_type n);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Start measuring an execution on input size n using the given amount
+	/// of memory. The measurement is stored in the database by
+	/// end_execution().
+	///////////////////////////////////////////////////////////////////////////
+	void start_execution(stream_size_type n, memory_size_type memory);
 	time_type end_execution();
 	std::string estimate_remaining_time(double progress);
 
@@ -93,6 +113,9 @@ private:
 	/** Input size */
 	stream_size_type m_n;
 
+	/** Memory used, or 0 if unknown */
+	memory_size_type m_memory;
+
 	time_type m_pause_time_at_start;
 
 #ifndef TPIE_NDEBUG
@@ -68,6 +68,11 @@ void file_base_crtp<child_t>::get_block_check(stream_size_type block) {
 	if (block * static_cast<stream_size_type>(m_blockItems) > self().size()) {
 		throw end_of_stream_exception();
 	}
+
+	// A block past the end of a temporary file grows the file when written.
+	if (m_tempFile != 0 && m_canWrite
+		&& block * static_cast<stream_size_type>(m_blockItems) == self().size())
+		check_temp_file_space(m_blockSize);
 }
 
 } // namespace tpie
@@ -26,6 +26,7 @@
 
 #include <tpie/file_base_crtp.h>
 #include <tpie/stream_crtp.h>
+#include <tpie/sortedness.h>
 
 namespace tpie {
 
@@ -77,6 +78,25 @@ public:
 		seek(std::min(o, size));
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Write the current block to the file if it has changed. This
+	/// also removes a sortedness mark (see tpie/sortedness.h).
+	///////////////////////////////////////////////////////////////////////////
+	inline void flush() {
+		flush_block();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Store a sortedness mark (see tpie/sortedness.h) in the user
+	/// data after writing the current block. The next block written to the
+	/// stream removes the mark.
+	///////////////////////////////////////////////////////////////////////////
+	inline void write_sortedness_mark(const sortedness_header & header) {
+		flush_block();
+		write_user_data(header);
+		m_sortednessMark = true;
+	}
+
 protected:
 	file_stream_base(memory_size_type itemSize,
 					 double blockFactor,
@@ -106,6 +126,7 @@ protected:
 		swap(m_block.data,      other.m_block.data);
 		swap(m_ownedTempFile,   other.m_ownedTempFile);
 		swap(m_tempFile,        other.m_tempFile);
+		swap(m_sortednessMark,  other.m_sortednessMark);
 	}
 
 	inline void open_inner(const std::string & path,
@@ -124,6 +145,8 @@ protected:
 		m_block.dirty = false;
 		m_block.data = tpie_new_array<char>(m_blockItems * m_itemSize);
 
+		m_sortednessMark = has_sortedness_mark();
+
 		initialize();
 		seek(0);
 	}
@@ -139,6 +162,12 @@ protected:
 	inline void flush_block() {
 		if (m_block.dirty) {
 			assert(m_canWrite);
+			if (m_sortednessMark) {
+				// Unless the application has replaced the mark meanwhile.
+				if (!m_canRead || has_sortedness_mark())
+					write_user_data(static_cast<const void *>(0), 0);
+				m_sortednessMark = false;
+			}
 			update_vars();
 			m_fileAccessor->write_block(m_block.data, m_block.number, m_block.size);
 		}
@@ -166,6 +195,8 @@ protected:
 
 
 	block_t m_block;
+	/** Whether the user data holds a sortedness mark to remove on write. */
+	bool m_sortednessMark;
 
 private:
 	friend class stream_crtp<file_stream_base>;
@@ -174,6 +205,13 @@ private:
 	block_t & __block() {return m_block;}
 	const block_t & __block() const {return m_block;}
 	void update_block_core();
+
+	inline bool has_sortedness_mark() {
+		if (user_data_size() != sizeof(sortedness_header)) return false;
+		sortedness_header header;
+		read_user_data(header);
+		return header.magic == sortedness_header::magicConst;
+	}
 };
 
 } // namespace tpie
@@ -0,0 +1,72 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __TPIE_GEOMETRY_H__
+#define __TPIE_GEOMETRY_H__
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file geometry.h
+/// \brief Points in the plane and the orientation test.
+///
+/// See pipelining/convex_hull.h for the convex hull.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <functional>
+
+namespace tpie {
+
+template <typename coord_t>
+struct point_2d {
+	coord_t x;
+	coord_t y;
+
+	bool operator==(const point_2d & other) const {
+		return x == other.x && y == other.y;
+	}
+
+	bool operator!=(const point_2d & other) const {
+		return !(*this == other);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Orders points by x and then by y.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+struct point_2d_less
+	: public std::binary_function<point_2d<coord_t>, point_2d<coord_t>, bool> {
+	bool operator()(const point_2d<coord_t> & a, const point_2d<coord_t> & b) const {
+		return a.x != b.x ? a.x < b.x : a.y < b.y;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Twice the signed area of the triangle pqr: positive if r is to the
+/// left of the line from p to q, negative if it is to the right, and zero
+/// if the points are collinear.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+inline coord_t orientation(const point_2d<coord_t> & p, const point_2d<coord_t> & q,
+						   const point_2d<coord_t> & r) {
+	return (q.x - p.x) * (r.y - p.y) - (q.y - p.y) * (r.x - p.x);
+}
+
+} // namespace tpie
+
+#endif // __TPIE_GEOMETRY_H__
@@ -112,6 +112,10 @@ memory_size_type default_worker_count() {
 	return workers;
 }
 
+bool job_manager_initialized() {
+	return the_job_manager != 0;
+}
+
 void init_job() {
 	the_job_manager = tpie_new<job_manager>();
 	memory_size_type workers = default_worker_count();
@@ -119,6 +119,16 @@ private:
 ///////////////////////////////////////////////////////////////////////////////
 memory_size_type default_worker_count();
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Return whether the job subsystem has been initialized, that is,
+/// whether jobs may be enqueued.
+///
+/// Structures that run I/O as background jobs should fall back to doing
+/// it synchronously when the job manager is not initialized, since
+/// tpie_init may be called without JOB_MANAGER.
+///////////////////////////////////////////////////////////////////////////////
+bool job_manager_initialized();
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \internal \brief Used by tpie_init to initialize the job subsystem.
 ///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,354 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file keyed_priority_queue.h
+/// \brief External memory priority queue with lazy decrease-key and erase.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TPIE_KEYED_PRIORITY_QUEUE_H__
+#define __TPIE_KEYED_PRIORITY_QUEUE_H__
+
+#include <tpie/priority_queue.h>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace tpie {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \class keyed_priority_queue
+/// \brief External memory priority queue of (key, priority) pairs supporting
+/// erase and decrease-key.
+///
+/// Erasing the pair (k, p) inserts a tombstone for (k, p) into the
+/// underlying tpie::priority_queue. Entries are ordered by priority, then
+/// key, with tombstones before the pairs they cancel, so a tombstone and
+/// its pair are adjacent in every sorted sequence that holds both. The
+/// underlying queue drops such adjacent entries when it writes its
+/// insertion buffer to disk and when it merges slots and group buffers; a
+/// tombstone whose pair is in another part of the queue cancels at the
+/// latest when both reach the top, without being reported.
+///
+/// Decrease-key is an insertion of the new pair followed by an erase of the
+/// old pair. The tombstone and the old pair are removed by the first merge
+/// that sees both, so the queue only holds them until then. Since the old
+/// priority must be given, this is suited for algorithms such as Dijkstra's
+/// that know the current tentative priority of each key.
+///
+/// size() counts the pairs that have been pushed and not erased or popped.
+///
+/// \tparam K  Key type; must be less-than comparable.
+/// \tparam P  Priority type.
+/// \tparam Comparator  Less-than comparator on priorities. The pair with the
+/// least priority is at the top.
+///////////////////////////////////////////////////////////////////////////////
+template <typename K, typename P, typename Comparator = std::less<P> >
+class keyed_priority_queue {
+public:
+	typedef K key_type;
+	typedef P priority_type;
+	typedef std::pair<K, P> value_type;
+
+private:
+	struct entry {
+		P priority;
+		K key;
+		bool tombstone;
+	};
+
+	class entry_comparator : public std::binary_function<entry, entry, bool> {
+	public:
+		entry_comparator(Comparator comp = Comparator()) : comp(comp) {}
+
+		bool operator()(const entry & a, const entry & b) const {
+			if (comp(a.priority, b.priority)) return true;
+			if (comp(b.priority, a.priority)) return false;
+			if (a.key < b.key) return true;
+			if (b.key < a.key) return false;
+			return a.tombstone && !b.tombstone;
+		}
+
+	private:
+		Comparator comp;
+	};
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief A tombstone cancels the pair that immediately follows it if
+	/// the pair has the same key and priority.
+	///////////////////////////////////////////////////////////////////////////
+	class entry_canceller {
+	public:
+		static const bool enabled = true;
+
+		entry_canceller(Comparator comp = Comparator()) : comp(comp) {}
+
+		bool operator()(const entry & a, const entry & b) const {
+			return a.tombstone && !b.tombstone
+				&& !comp(a.priority, b.priority) && !comp(b.priority, a.priority)
+				&& !(a.key < b.key) && !(b.key < a.key);
+		}
+
+	private:
+		Comparator comp;
+	};
+
+	typedef priority_queue<entry, entry_comparator,
+						   pq_overflow_heap<entry, entry_comparator>,
+						   entry_canceller> pq_type;
+
+public:
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Constructor.
+	///
+	/// \param f Factor of memory that the priority queue is allowed to use.
+	/// \param b Block factor
+	/// \param comp Comparator instance
+	///////////////////////////////////////////////////////////////////////////
+	keyed_priority_queue(double f=1.0, float b=0.0625, Comparator comp=Comparator())
+		: m_pq(f, b, entry_comparator(comp), entry_canceller(comp))
+		, m_comp(comp)
+		, m_size(0)
+		, m_pending(0)
+	{
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Constructor.
+	///
+	/// \param mm_avail Number of bytes the priority queue is allowed to use.
+	/// \param b Block factor
+	/// \param comp Comparator instance
+	///////////////////////////////////////////////////////////////////////////
+	keyed_priority_queue(memory_size_type mm_avail, float b=0.0625, Comparator comp=Comparator())
+		: m_pq(mm_avail, b, entry_comparator(comp), entry_canceller(comp))
+		, m_comp(comp)
+		, m_size(0)
+		, m_pending(0)
+	{
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Insert the pair (k, p).
+	///////////////////////////////////////////////////////////////////////////
+	void push(const K & k, const P & p) {
+		m_pq.push(make_entry(k, p, false));
+		++m_size;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Erase the pair (k, p), which must be in the queue.
+	///////////////////////////////////////////////////////////////////////////
+	void erase(const K & k, const P & p) {
+		tp_assert(m_size > 0, "erase() invoked on empty priority queue");
+		m_pq.push(make_entry(k, p, true));
+		--m_size;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Replace the pair (k, oldPriority), which must be in the queue,
+	/// by (k, newPriority).
+	///////////////////////////////////////////////////////////////////////////
+	void decrease_key(const K & k, const P & oldPriority, const P & newPriority) {
+		push(k, newPriority);
+		erase(k, oldPriority);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Key of the pair with the least priority.
+	///////////////////////////////////////////////////////////////////////////
+	const K & top_key() {
+		return top_entry().key;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Least priority in the queue.
+	///////////////////////////////////////////////////////////////////////////
+	const P & top_priority() {
+		return top_entry().priority;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief The pair with the least priority.
+	///////////////////////////////////////////////////////////////////////////
+	value_type top() {
+		const entry & e = top_entry();
+		return value_type(e.key, e.priority);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Remove the pair with the least priority.
+	///////////////////////////////////////////////////////////////////////////
+	void pop() {
+		top_entry();
+		m_pq.pop();
+		--m_size;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Number of pairs in the queue.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type size() const {
+		return m_size;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Number of entries in the underlying queue: the pairs, and the
+	/// tombstones and erased pairs that have not cancelled yet.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type entries() const {
+		return m_pq.size();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return true if the queue holds no pairs.
+	///////////////////////////////////////////////////////////////////////////
+	bool empty() const {
+		return m_size == 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Pop all pairs whose priority equals the least priority, and
+	/// process each by invoking f(key, priority).
+	///
+	/// \return The argument f
+	///////////////////////////////////////////////////////////////////////////
+	template <typename F>
+	F pop_all_equal(F f) {
+		if (empty()) return f;
+		P p = top_priority();
+		do {
+			const entry & e = top_entry();
+			f(e.key, e.priority);
+			m_pq.pop();
+			--m_size;
+		} while (!empty() && !m_comp(p, top_priority()));
+		return f;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Pop at most n pairs in order of priority and write them to the
+	/// output iterator as value_type.
+	///
+	/// The entries are taken from the underlying queue with pop_batch, at
+	/// most as many at a time as there are pairs left to pop or left in the
+	/// queue, and the tombstones among them are cancelled against their
+	/// pairs.
+	///
+	/// \return The number of pairs popped
+	///////////////////////////////////////////////////////////////////////////
+	template <typename OutputIterator>
+	stream_size_type pop_bulk(OutputIterator out, stream_size_type n) {
+		stream_size_type popped = 0;
+		while (popped < n && !empty()) {
+			memory_size_type batch = static_cast<memory_size_type>(
+				std::min(std::min(n - popped, m_size), static_cast<stream_size_type>(bulkBatchSize)));
+			m_batch.resize(batch);
+			memory_size_type got = static_cast<memory_size_type>(m_pq.pop_batch(m_batch.begin(), batch));
+			for (memory_size_type i = 0; i < got; ++i) {
+				const entry & e = m_batch[i];
+				if (!take(e)) continue;
+				*out = value_type(e.key, e.priority);
+				++out;
+				--m_size;
+				++popped;
+			}
+		}
+		return popped;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Enable or disable background merging in the underlying queue.
+	/// \sa priority_queue::set_background_merging
+	///////////////////////////////////////////////////////////////////////////
+	void set_background_merging(bool enabled) {
+		m_pq.set_background_merging(enabled);
+	}
+
+private:
+	static entry make_entry(const K & k, const P & p, bool tombstone) {
+		entry e;
+		e.priority = p;
+		e.key = k;
+		e.tombstone = tombstone;
+		return e;
+	}
+
+	bool same_pair(const entry & a, const entry & b) const {
+		return !m_comp(a.priority, b.priority) && !m_comp(b.priority, a.priority)
+			&& !(a.key < b.key) && !(b.key < a.key);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Account for an entry removed from the top of the underlying
+	/// queue, and return whether it is a live pair rather than a tombstone
+	/// or a cancelled pair.
+	///////////////////////////////////////////////////////////////////////////
+	bool take(const entry & e) {
+		if (e.tombstone) {
+			if (m_pending > 0 && same_pair(e, m_cancel)) {
+				++m_pending;
+			} else {
+				tp_assert(m_pending == 0, "Tombstone without matching pair");
+				m_cancel = e;
+				m_pending = 1;
+			}
+			return false;
+		}
+		if (m_pending > 0 && same_pair(e, m_cancel)) {
+			--m_pending;
+			return false;
+		}
+		tp_assert(m_pending == 0, "Tombstone without matching pair");
+		m_pending = 0;
+		return true;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Cancel tombstones against their pairs until a live pair is at
+	/// the top of the underlying queue, and return it.
+	///////////////////////////////////////////////////////////////////////////
+	const entry & top_entry() {
+		if (empty()) throw priority_queue_error("top() invoked on empty priority queue");
+		for (;;) {
+			const entry & e = m_pq.top();
+			if (take(e)) return e;
+			m_pq.pop();
+		}
+	}
+
+	/** Maximum number of entries taken from m_pq at a time by pop_bulk. */
+	static const memory_size_type bulkBatchSize = 1024;
+
+	pq_type m_pq;
+	Comparator m_comp;
+	/** Number of pairs pushed and neither erased nor popped. */
+	stream_size_type m_size;
+	/** The pair cancelled by the tombstones most recently popped. */
+	entry m_cancel;
+	/** Number of tombstones of m_cancel not yet matched by a pair. */
+	stream_size_type m_pending;
+	/** Entries taken from m_pq by pop_bulk. */
+	std::vector<entry> m_batch;
+};
+
+} // namespace tpie
+
+#endif // __TPIE_KEYED_PRIORITY_QUEUE_H__
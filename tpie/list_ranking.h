@@ -0,0 +1,439 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __TPIE_LIST_RANKING_H__
+#define __TPIE_LIST_RANKING_H__
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file list_ranking.h
+/// \brief External memory list ranking by independent set removal.
+///
+/// A list is given as a stream of nodes (id, next, weight) in any order,
+/// where next is the id of the successor, or list_ranking_end for the last
+/// node. The rank of a node is the sum of the weights of the nodes before
+/// it in its list. The stream may hold several disjoint lists.
+///
+/// Each round flips a coin for every node and removes the nodes that got
+/// heads while their predecessor got tails. These form an independent set
+/// holding a quarter of the nodes in expectation. The predecessor of a
+/// removed node is linked to its successor and absorbs its weight, the
+/// remaining list is ranked recursively, and the ranks of the removed nodes
+/// are computed from their predecessors. Each round is a constant number of
+/// sorts, so the total cost is O(sort(N)) I/Os.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <tpie/file_stream.h>
+#include <tpie/array.h>
+#include <tpie/exception.h>
+#include <tpie/memory.h>
+#include <tpie/pipelining.h>
+#include <algorithm>
+#include <limits>
+
+namespace tpie {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The next field of the last node of a list.
+///////////////////////////////////////////////////////////////////////////////
+const stream_size_type list_ranking_end = std::numeric_limits<stream_size_type>::max();
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A list node given to list_rank.
+///////////////////////////////////////////////////////////////////////////////
+template <typename W>
+struct list_ranking_node {
+	stream_size_type id;
+	stream_size_type next;
+	W weight;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The rank of a node computed by list_rank.
+///////////////////////////////////////////////////////////////////////////////
+template <typename W>
+struct list_ranking_rank {
+	stream_size_type id;
+	W rank;
+};
+
+namespace list_ranking_bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A node v removed in a round along with its predecessor u and the
+/// weight of u in that round, or a message from v to u.
+///////////////////////////////////////////////////////////////////////////////
+template <typename W>
+struct link {
+	stream_size_type to;
+	stream_size_type from;
+	W weight;
+};
+
+template <typename T>
+struct id_less {
+	bool operator()(const T & a, const T & b) const {
+		return a.id < b.id;
+	}
+};
+
+template <typename W>
+struct link_less {
+	bool operator()(const link<W> & a, const link<W> & b) const {
+		return a.to < b.to;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The coin flipped for a node in the given round.
+///////////////////////////////////////////////////////////////////////////////
+inline bool coin(stream_size_type id, stream_size_type round) {
+	uint64_t x = static_cast<uint64_t>(id) + 0x9e3779b97f4a7c15ull * (round + 1);
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return ((x ^ (x >> 31)) & 1) != 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Reads a stream with one item of lookahead.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class peeking_stream {
+public:
+	peeking_stream(file_stream<T> & fs) : m_fs(fs) {
+		advance();
+	}
+
+	bool can_read() const {
+		return m_hasItem;
+	}
+
+	const T & peek() const {
+		return m_item;
+	}
+
+	T read() {
+		T item = m_item;
+		advance();
+		return item;
+	}
+
+private:
+	void advance() {
+		m_hasItem = m_fs.can_read();
+		if (m_hasItem) m_item = m_fs.read();
+	}
+
+	file_stream<T> & m_fs;
+	T m_item;
+	bool m_hasItem;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sort the items of in into out, which must be empty.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename pred_t>
+void sort(file_stream<T> & in, file_stream<T> & out, const pred_t & pred) {
+	in.seek(0);
+	pipelining::pipeline p = pipelining::input(in) | pipelining::pipesort(pred) | pipelining::output(out);
+	p();
+	out.seek(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Memory used by rank_internal on n nodes: the nodes, the successor
+/// indices, the predecessor flags and the ranks.
+///////////////////////////////////////////////////////////////////////////////
+template <typename W>
+memory_size_type internal_memory_usage(stream_size_type n) {
+	return static_cast<memory_size_type>(n)
+		* (sizeof(list_ranking_node<W>) + sizeof(memory_size_type) + 1 + sizeof(W))
+		+ 4 * sizeof(array<W>);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Rank the lists in internal memory.
+///////////////////////////////////////////////////////////////////////////////
+template <typename W>
+void rank_internal(file_stream<list_ranking_node<W> > & in, file_stream<list_ranking_rank<W> > & out) {
+	typedef list_ranking_node<W> node_t;
+	memory_size_type n = static_cast<memory_size_type>(in.size());
+	array<node_t> nodes(n);
+	in.seek(0);
+	in.read(nodes.begin(), nodes.end());
+	std::sort(nodes.begin(), nodes.end(), id_less<node_t>());
+
+	// successor[i] is the index of the successor of nodes[i], or n.
+	array<memory_size_type> successor(n);
+	array<char> hasPredecessor(n, 0);
+	for (memory_size_type i = 0; i < n; ++i) {
+		successor[i] = n;
+		if (nodes[i].next == list_ranking_end) continue;
+		node_t key;
+		key.id = nodes[i].next;
+		typename array<node_t>::iterator s = std::lower_bound(nodes.begin(), nodes.end(), key, id_less<node_t>());
+		if (s == nodes.end() || s->id != nodes[i].next)
+			throw exception("list_rank: successor is not a node");
+		successor[i] = s - nodes.begin();
+		if (hasPredecessor[successor[i]])
+			throw exception("list_rank: node has two predecessors");
+		hasPredecessor[successor[i]] = 1;
+	}
+
+	array<W> ranks(n);
+	memory_size_type ranked = 0;
+	for (memory_size_type i = 0; i < n; ++i) {
+		if (hasPredecessor[i]) continue;
+		W sum = W();
+		for (memory_size_type j = i; j != n; j = successor[j]) {
+			ranks[j] = sum;
+			sum += nodes[j].weight;
+			++ranked;
+		}
+	}
+	if (ranked != n) throw exception("list_rank: the input contains a cycle");
+
+	for (memory_size_type i = 0; i < n; ++i) {
+		list_ranking_rank<W> r;
+		r.id = nodes[i].id;
+		r.rank = ranks[i];
+		out.write(r);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Copy the items of a stream to another.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+void copy(file_stream<T> & in, file_stream<T> & out) {
+	in.seek(0);
+	pipelining::pipeline p = pipelining::input(in) | pipelining::output(out);
+	p();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Rank the lists in the file in and write the ranks to the file out
+/// sorted by id.
+///
+/// Only the temporary files of a round are kept while the next round runs,
+/// so the memory used by open streams does not grow with the recursion.
+///////////////////////////////////////////////////////////////////////////////
+template <typename W>
+void rank(temp_file & inFile, temp_file & outFile, memory_size_type memory, stream_size_type round) {
+	typedef list_ranking_node<W> node_t;
+	typedef list_ranking_rank<W> rank_t;
+	typedef link<W> link_t;
+
+	// Find the predecessor of each node.
+	temp_file nodesFile;
+	temp_file predecessorsFile;
+	{
+		file_stream<node_t> in;
+		in.open(inFile, access_read);
+		if (internal_memory_usage<W>(in.size()) <= memory) {
+			file_stream<rank_t> out;
+			out.open(outFile);
+			rank_internal(in, out);
+			return;
+		}
+		file_stream<link_t> unsorted;
+		unsorted.open();
+		while (in.can_read()) {
+			const node_t & u = in.read();
+			if (u.next == list_ranking_end) continue;
+			link_t l;
+			l.to = u.next;
+			l.from = u.id;
+			l.weight = u.weight;
+			unsorted.write(l);
+		}
+		file_stream<link_t> predecessors;
+		predecessors.open(predecessorsFile);
+		sort(unsorted, predecessors, link_less<W>());
+		file_stream<node_t> nodes;
+		nodes.open(nodesFile);
+		sort(in, nodes, id_less<node_t>());
+	}
+
+	// Select the nodes to remove, and send the successor and weight of each
+	// removed node to its predecessor. Nodes without predecessor and
+	// successor have rank zero and take no part in the recursion.
+	temp_file keptFile;
+	temp_file removedFile;
+	temp_file bypassesFile;
+	temp_file ranksFile;
+	{
+		file_stream<node_t> nodes;
+		nodes.open(nodesFile, access_read);
+		file_stream<link_t> predecessors;
+		predecessors.open(predecessorsFile, access_read);
+		file_stream<node_t> kept;
+		kept.open(keptFile);
+		file_stream<link_t> removed;
+		removed.open(removedFile);
+		file_stream<rank_t> ranks;
+		ranks.open(ranksFile);
+		file_stream<link_t> unsortedBypasses;
+		unsortedBypasses.open();
+		peeking_stream<link_t> preds(predecessors);
+		stream_size_type heads = 0;
+		while (nodes.can_read()) {
+			const node_t & v = nodes.read();
+			bool hasPredecessor = preds.can_read() && preds.peek().to == v.id;
+			if (!hasPredecessor) {
+				++heads;
+				if (preds.can_read() && preds.peek().to < v.id)
+					throw exception("list_rank: successor is not a node");
+				if (v.next == list_ranking_end) {
+					rank_t r;
+					r.id = v.id;
+					r.rank = W();
+					ranks.write(r);
+				} else {
+					kept.write(v);
+				}
+				continue;
+			}
+			link_t p = preds.read();
+			if (preds.can_read() && preds.peek().to == v.id)
+				throw exception("list_rank: node has two predecessors");
+			if (coin(v.id, round) && !coin(p.from, round)) {
+				link_t r;
+				r.to = p.from;
+				r.from = v.id;
+				r.weight = p.weight;
+				removed.write(r);
+				link_t b;
+				b.to = p.from;
+				b.from = v.next;
+				b.weight = v.weight;
+				unsortedBypasses.write(b);
+			} else {
+				kept.write(v);
+			}
+		}
+		if (preds.can_read())
+			throw exception("list_rank: successor is not a node");
+		// Every list has a head, so only cycles are left.
+		if (heads == 0)
+			throw exception("list_rank: the input contains a cycle");
+		file_stream<link_t> bypasses;
+		bypasses.open(bypassesFile);
+		sort(unsortedBypasses, bypasses, link_less<W>());
+	}
+	nodesFile.free();
+	predecessorsFile.free();
+
+	// Link the predecessors of removed nodes past them. The kept nodes are
+	// sorted by id.
+	temp_file reducedFile;
+	{
+		file_stream<node_t> kept;
+		kept.open(keptFile, access_read);
+		file_stream<link_t> bypasses;
+		bypasses.open(bypassesFile, access_read);
+		file_stream<node_t> reduced;
+		reduced.open(reducedFile);
+		peeking_stream<link_t> bypass(bypasses);
+		while (kept.can_read()) {
+			node_t u = kept.read();
+			if (bypass.can_read() && bypass.peek().to == u.id) {
+				link_t b = bypass.read();
+				u.next = b.from;
+				u.weight += b.weight;
+			}
+			reduced.write(u);
+		}
+	}
+	keptFile.free();
+	bypassesFile.free();
+
+	temp_file reducedRanksFile;
+	rank<W>(reducedFile, reducedRanksFile, memory, round + 1);
+	reducedFile.free();
+
+	// The rank of a removed node is the rank of its predecessor plus the
+	// weight of the predecessor.
+	{
+		file_stream<rank_t> ranks;
+		ranks.open(ranksFile);
+		ranks.seek(0, file_stream<rank_t>::end);
+		{
+			file_stream<link_t> removed;
+			removed.open(removedFile, access_read);
+			file_stream<link_t> sortedRemoved;
+			sortedRemoved.open();
+			sort(removed, sortedRemoved, link_less<W>());
+			file_stream<rank_t> reducedRanks;
+			reducedRanks.open(reducedRanksFile, access_read);
+			peeking_stream<link_t> removedNodes(sortedRemoved);
+			while (reducedRanks.can_read()) {
+				const rank_t & u = reducedRanks.read();
+				ranks.write(u);
+				while (removedNodes.can_read() && removedNodes.peek().to == u.id) {
+					link_t l = removedNodes.read();
+					rank_t r;
+					r.id = l.from;
+					r.rank = u.rank + l.weight;
+					ranks.write(r);
+				}
+			}
+		}
+		removedFile.free();
+		reducedRanksFile.free();
+		file_stream<rank_t> out;
+		out.open(outFile);
+		sort(ranks, out, id_less<rank_t>());
+	}
+}
+
+} // namespace list_ranking_bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Compute the rank of every node of one or more lists.
+///
+/// \param in  The list nodes in any order. Ids must be distinct.
+/// \param out  Receives the rank of each node, sorted by id.
+/// \param memory  Number of bytes to use for ranking a list in internal
+/// memory. If zero, the memory available in the memory manager is used.
+///////////////////////////////////////////////////////////////////////////////
+template <typename W>
+void list_rank(file_stream<list_ranking_node<W> > & in, file_stream<list_ranking_rank<W> > & out,
+			   memory_size_type memory = 0) {
+	if (memory == 0) memory = get_memory_manager().available() / 2;
+	if (list_ranking_bits::internal_memory_usage<W>(in.size()) <= memory) {
+		list_ranking_bits::rank_internal(in, out);
+	} else {
+		temp_file inFile;
+		temp_file outFile;
+		{
+			file_stream<list_ranking_node<W> > copy;
+			copy.open(inFile);
+			list_ranking_bits::copy(in, copy);
+		}
+		list_ranking_bits::rank<W>(inFile, outFile, memory, 0);
+		file_stream<list_ranking_rank<W> > ranks;
+		ranks.open(outFile, access_read);
+		list_ranking_bits::copy(ranks, out);
+	}
+	out.seek(0);
+}
+
+} // namespace tpie
+
+#endif // __TPIE_LIST_RANKING_H__
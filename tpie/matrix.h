@@ -0,0 +1,457 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __TPIE_MATRIX_H__
+#define __TPIE_MATRIX_H__
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file matrix.h
+/// \brief External memory dense matrices stored in square tiles.
+///
+/// A matrix is stored in a file as a grid of square tiles in row major
+/// order, each tile holding its elements in row major order and padded with
+/// zeros at the right and bottom border of the matrix. By default a tile
+/// fills one block of the file.
+///
+/// matrix_multiply works on square blocks of whole tiles, as large as the
+/// given memory allows for a block of each operand, and splits the product
+/// of two blocks among the worker threads. matrix_transpose moves each tile
+/// to its mirrored position, transposing it in memory.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <tpie/file_stream.h>
+#include <tpie/array.h>
+#include <tpie/job.h>
+#include <tpie/memory.h>
+#include <tpie/exception.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+namespace tpie {
+
+namespace matrix_bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The contents of the user data of a matrix file.
+///////////////////////////////////////////////////////////////////////////////
+struct header {
+	stream_size_type rows;
+	stream_size_type cols;
+	stream_size_type tileSide;
+};
+
+} // namespace matrix_bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Dense matrix of elements of type T stored in a file.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class matrix {
+public:
+	typedef T item_type;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief The side of the largest square tile fitting in a block.
+	///////////////////////////////////////////////////////////////////////////
+	static memory_size_type default_tile_side() {
+		memory_size_type items = file_stream<T>::block_size(1.0) / sizeof(T);
+		memory_size_type side = static_cast<memory_size_type>(std::sqrt(static_cast<double>(items)));
+		while (side * side > items) --side;
+		while ((side + 1) * (side + 1) <= items) ++side;
+		return std::max(side, static_cast<memory_size_type>(1));
+	}
+
+	static memory_size_type memory_usage(memory_size_type tileSide = 0) {
+		if (tileSide == 0) tileSide = default_tile_side();
+		return sizeof(matrix) + file_stream<T>::memory_usage(block_factor(tileSide))
+			+ array<T>::memory_usage(tileSide * tileSide);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \param tileSide  The side of the tiles, or zero for the default. A
+	/// file must be opened with the tile side it was created with.
+	///////////////////////////////////////////////////////////////////////////
+	matrix(memory_size_type tileSide = 0)
+		: m_tileSide(tileSide == 0 ? default_tile_side() : tileSide)
+		, m_file(block_factor(m_tileSide))
+	{
+		m_header.rows = m_header.cols = 0;
+		m_header.tileSide = m_tileSide;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Open an existing matrix file.
+	///////////////////////////////////////////////////////////////////////////
+	void open(const std::string & path) {
+		m_file.open(path, access_read_write, sizeof(matrix_bits::header), access_random);
+		if (m_file.user_data_size() != sizeof(matrix_bits::header))
+			throw exception("matrix: the file is not a matrix");
+		m_file.read_user_data(m_header);
+		if (m_header.tileSide != m_tileSide)
+			throw exception("matrix: the file has a different tile side");
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Create a matrix file of the given dimensions filled with zeros,
+	/// replacing the contents of the file.
+	///////////////////////////////////////////////////////////////////////////
+	void open(const std::string & path, stream_size_type rows, stream_size_type cols) {
+		m_file.open(path, access_read_write, sizeof(matrix_bits::header), access_random);
+		create(rows, cols);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Create a temporary matrix of the given dimensions filled with
+	/// zeros.
+	///////////////////////////////////////////////////////////////////////////
+	void open(stream_size_type rows, stream_size_type cols) {
+		m_file.open(sizeof(matrix_bits::header), access_random);
+		create(rows, cols);
+	}
+
+	void close() {
+		m_file.close();
+		m_header.rows = m_header.cols = 0;
+	}
+
+	stream_size_type rows() const {
+		return m_header.rows;
+	}
+
+	stream_size_type cols() const {
+		return m_header.cols;
+	}
+
+	memory_size_type tile_side() const {
+		return m_tileSide;
+	}
+
+	stream_size_type tile_rows() const {
+		return (m_header.rows + m_tileSide - 1) / m_tileSide;
+	}
+
+	stream_size_type tile_cols() const {
+		return (m_header.cols + m_tileSide - 1) / m_tileSide;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Read the nr by nc submatrix with upper left element (r, c) into
+	/// the row major buffer out.
+	///
+	/// Each tile overlapping the submatrix is read whole, in the order the
+	/// tiles are stored, and its part of the submatrix is copied to out.
+	///////////////////////////////////////////////////////////////////////////
+	void read_block(stream_size_type r, stream_size_type c,
+					memory_size_type nr, memory_size_type nc, T * out) {
+		check_block(r, c, nr, nc);
+		if (nr == 0 || nc == 0) return;
+		m_tile.resize(m_tileSide * m_tileSide);
+		for (stream_size_type tr = r / m_tileSide; tr * m_tileSide < r + nr; ++tr) {
+			for (stream_size_type tc = c / m_tileSide; tc * m_tileSide < c + nc; ++tc) {
+				read_tile(tr, tc, m_tile.get());
+				tile_part p(*this, tr, tc, r, c, nr, nc);
+				for (stream_size_type i = p.rowBegin; i < p.rowEnd; ++i) {
+					const T * src = m_tile.get() + p.tile_index(i, p.colBegin);
+					std::copy(src, src + p.width(), out + p.block_index(i, p.colBegin));
+				}
+			}
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Overwrite the nr by nc submatrix with upper left element (r, c)
+	/// by the row major buffer in.
+	///
+	/// Each tile overlapping the submatrix is written whole. A tile that is
+	/// only partly overwritten is read first.
+	///////////////////////////////////////////////////////////////////////////
+	void write_block(stream_size_type r, stream_size_type c,
+					 memory_size_type nr, memory_size_type nc, const T * in) {
+		check_block(r, c, nr, nc);
+		if (nr == 0 || nc == 0) return;
+		m_tile.resize(m_tileSide * m_tileSide);
+		for (stream_size_type tr = r / m_tileSide; tr * m_tileSide < r + nr; ++tr) {
+			for (stream_size_type tc = c / m_tileSide; tc * m_tileSide < c + nc; ++tc) {
+				tile_part p(*this, tr, tc, r, c, nr, nc);
+				if (p.covers_tile(*this))
+					std::fill(m_tile.begin(), m_tile.end(), T());
+				else
+					read_tile(tr, tc, m_tile.get());
+				for (stream_size_type i = p.rowBegin; i < p.rowEnd; ++i) {
+					const T * src = in + p.block_index(i, p.colBegin);
+					std::copy(src, src + p.width(), m_tile.get() + p.tile_index(i, p.colBegin));
+				}
+				write_tile(tr, tc, m_tile.get());
+			}
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Read the tile_side() squared elements of a tile including its
+	/// padding.
+	///////////////////////////////////////////////////////////////////////////
+	void read_tile(stream_size_type tileRow, stream_size_type tileCol, T * out) {
+		m_file.seek(tile_offset(tileRow, tileCol));
+		m_file.read(out, out + m_tileSide * m_tileSide);
+	}
+
+	void write_tile(stream_size_type tileRow, stream_size_type tileCol, const T * in) {
+		m_file.seek(tile_offset(tileRow, tileCol));
+		m_file.write(in, in + m_tileSide * m_tileSide);
+	}
+
+private:
+	static double block_factor(memory_size_type tileSide) {
+		return file_stream<T>::calculate_block_factor(tileSide * tileSide * sizeof(T));
+	}
+
+	void create(stream_size_type rows, stream_size_type cols) {
+		m_header.rows = rows;
+		m_header.cols = cols;
+		m_file.truncate(0);
+		m_file.write_user_data(m_header);
+		stream_size_type items = tile_rows() * tile_cols() * m_tileSide * m_tileSide;
+		T zero = T();
+		for (stream_size_type i = 0; i < items; ++i) m_file.write(zero);
+	}
+
+	stream_size_type tile_offset(stream_size_type tileRow, stream_size_type tileCol) const {
+		return (tileRow * tile_cols() + tileCol) * m_tileSide * m_tileSide;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief The elements a tile shares with a submatrix, given by the
+	/// rows [rowBegin, rowEnd) and columns [colBegin, colEnd) of the matrix.
+	///////////////////////////////////////////////////////////////////////////
+	struct tile_part {
+		tile_part(const matrix & m, stream_size_type tileRow, stream_size_type tileCol,
+				  stream_size_type r, stream_size_type c,
+				  memory_size_type nr, memory_size_type nc)
+			: side(m.tile_side())
+			, tileTop(tileRow * side)
+			, tileLeft(tileCol * side)
+			, blockTop(r)
+			, blockLeft(c)
+			, blockCols(nc)
+			, rowBegin(std::max(r, tileTop))
+			, rowEnd(std::min(r + nr, tileTop + side))
+			, colBegin(std::max(c, tileLeft))
+			, colEnd(std::min(c + nc, tileLeft + side))
+		{
+		}
+
+		memory_size_type width() const {
+			return static_cast<memory_size_type>(colEnd - colBegin);
+		}
+
+		memory_size_type tile_index(stream_size_type i, stream_size_type j) const {
+			return static_cast<memory_size_type>((i - tileTop) * side + (j - tileLeft));
+		}
+
+		memory_size_type block_index(stream_size_type i, stream_size_type j) const {
+			return static_cast<memory_size_type>((i - blockTop) * blockCols + (j - blockLeft));
+		}
+
+		/** Whether the part holds every element of the tile inside m. */
+		bool covers_tile(const matrix & m) const {
+			return rowBegin == tileTop && colBegin == tileLeft
+				&& rowEnd == std::min(tileTop + side, m.rows())
+				&& colEnd == std::min(tileLeft + side, m.cols());
+		}
+
+		memory_size_type side;
+		stream_size_type tileTop;
+		stream_size_type tileLeft;
+		stream_size_type blockTop;
+		stream_size_type blockLeft;
+		memory_size_type blockCols;
+		stream_size_type rowBegin;
+		stream_size_type rowEnd;
+		stream_size_type colBegin;
+		stream_size_type colEnd;
+	};
+
+	void check_block(stream_size_type r, stream_size_type c,
+					 memory_size_type nr, memory_size_type nc) const {
+		if (r + nr > m_header.rows || c + nc > m_header.cols)
+			throw exception("matrix: block outside the matrix");
+	}
+
+	memory_size_type m_tileSide;
+	file_stream<T> m_file;
+	matrix_bits::header m_header;
+	/** Buffer of the tile being read or written by read_block and write_block. */
+	array<T> m_tile;
+};
+
+namespace matrix_bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief c += a b for rows [rowBegin, rowEnd) of the row major blocks a
+/// (rows by inner), b (inner by cols) and c (rows by cols).
+///
+/// The inner and column ranges are cut into pieces so that the rows of b
+/// used by a piece stay in cache, and the innermost loop runs over
+/// contiguous rows of b and c to let the compiler vectorize it.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+void multiply_add(const T * a, const T * b, T * c,
+				  memory_size_type inner, memory_size_type cols,
+				  memory_size_type rowBegin, memory_size_type rowEnd) {
+	const memory_size_type innerPiece = 128;
+	const memory_size_type colPiece = 256;
+	for (memory_size_type k0 = 0; k0 < inner; k0 += innerPiece) {
+		memory_size_type k1 = std::min(inner, k0 + innerPiece);
+		for (memory_size_type j0 = 0; j0 < cols; j0 += colPiece) {
+			memory_size_type j1 = std::min(cols, j0 + colPiece);
+			for (memory_size_type i = rowBegin; i < rowEnd; ++i) {
+				T * ci = c + i * cols;
+				const T * ai = a + i * inner;
+				for (memory_size_type k = k0; k < k1; ++k) {
+					const T aik = ai[k];
+					const T * bk = b + k * cols;
+					for (memory_size_type j = j0; j < j1; ++j) ci[j] += aik * bk[j];
+				}
+			}
+		}
+	}
+}
+
+template <typename T>
+class multiply_job : public job {
+public:
+	multiply_job(const T * a, const T * b, T * c, memory_size_type inner, memory_size_type cols,
+				 memory_size_type rowBegin, memory_size_type rowEnd)
+		: a(a), b(b), c(c), inner(inner), cols(cols), rowBegin(rowBegin), rowEnd(rowEnd) {}
+
+	virtual void operator()() {
+		multiply_add(a, b, c, inner, cols, rowBegin, rowEnd);
+	}
+
+private:
+	const T * a;
+	const T * b;
+	T * c;
+	memory_size_type inner;
+	memory_size_type cols;
+	memory_size_type rowBegin;
+	memory_size_type rowEnd;
+};
+
+} // namespace matrix_bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Compute c = a b.
+///
+/// \param c  A matrix with the rows of a and the columns of b.
+/// \param memory  Memory for the blocks of the operands, or zero to use the
+/// memory available to the memory manager besides the tile buffers and
+/// streams of the matrices.
+/// \param threads  Number of threads multiplying blocks, or zero for the
+/// default number of workers. Without a job manager, the blocks are
+/// multiplied in the calling thread.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+void matrix_multiply(matrix<T> & a, matrix<T> & b, matrix<T> & c,
+					 memory_size_type memory = 0, memory_size_type threads = 0) {
+	if (a.cols() != b.rows() || c.rows() != a.rows() || c.cols() != b.cols())
+		throw exception("matrix_multiply: dimensions do not match");
+	if (memory == 0) {
+		// The tile buffers and streams of the matrices are allocated on
+		// first use.
+		memory_size_type reserved = matrix<T>::memory_usage(a.tile_side())
+			+ matrix<T>::memory_usage(b.tile_side())
+			+ matrix<T>::memory_usage(c.tile_side());
+		memory_size_type available = get_memory_manager().available();
+		memory = available > reserved ? available - reserved : 0;
+	}
+	if (threads == 0) threads = default_worker_count();
+
+	// Three square blocks of a whole number of tiles of c, and no larger
+	// than the matrices.
+	memory_size_type t = c.tile_side();
+	memory_size_type side = static_cast<memory_size_type>(
+		std::sqrt(static_cast<double>(memory / (3 * sizeof(T)))));
+	if (side >= t) side -= side % t;
+	side = std::max(side, static_cast<memory_size_type>(1));
+	stream_size_type largest = std::max(a.rows(), std::max(a.cols(), b.cols()));
+	if (side > largest) side = static_cast<memory_size_type>(largest);
+	if (side == 0) return;
+
+	array<T> blockA(side * side);
+	array<T> blockB(side * side);
+	array<T> blockC(side * side);
+	array<auto_ptr<matrix_bits::multiply_job<T> > > jobs(threads);
+	for (stream_size_type r = 0; r < c.rows(); r += side) {
+		memory_size_type nr = static_cast<memory_size_type>(std::min<stream_size_type>(side, c.rows() - r));
+		for (stream_size_type col = 0; col < c.cols(); col += side) {
+			memory_size_type nc = static_cast<memory_size_type>(std::min<stream_size_type>(side, c.cols() - col));
+			std::fill(blockC.get(), blockC.get() + nr * nc, T());
+			for (stream_size_type k = 0; k < a.cols(); k += side) {
+				memory_size_type nk = static_cast<memory_size_type>(std::min<stream_size_type>(side, a.cols() - k));
+				a.read_block(r, k, nr, nk, blockA.get());
+				b.read_block(k, col, nk, nc, blockB.get());
+				memory_size_type jobCount = std::min(threads, nr);
+				if (jobCount <= 1 || !job_manager_initialized()) {
+					matrix_bits::multiply_add(blockA.get(), blockB.get(), blockC.get(), nk, nc, 0, nr);
+					continue;
+				}
+				for (memory_size_type i = 0; i < jobCount; ++i) {
+					jobs[i].reset(tpie_new<matrix_bits::multiply_job<T> >(
+						blockA.get(), blockB.get(), blockC.get(), nk, nc,
+						nr * i / jobCount, nr * (i + 1) / jobCount));
+					jobs[i]->enqueue();
+				}
+				for (memory_size_type i = 0; i < jobCount; ++i) jobs[i]->join();
+			}
+			c.write_block(r, col, nr, nc, blockC.get());
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Store the transpose of a in out, which must have the columns of a
+/// as rows, the rows of a as columns and the tile side of a.
+///
+/// The tiles of a are read in the order they are stored.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+void matrix_transpose(matrix<T> & a, matrix<T> & out) {
+	if (out.rows() != a.cols() || out.cols() != a.rows())
+		throw exception("matrix_transpose: dimensions do not match");
+	if (out.tile_side() != a.tile_side())
+		throw exception("matrix_transpose: tile sides differ");
+	memory_size_type t = a.tile_side();
+	array<T> tile(t * t);
+	array<T> transposed(t * t);
+	for (stream_size_type i = 0; i < a.tile_rows(); ++i) {
+		for (stream_size_type j = 0; j < a.tile_cols(); ++j) {
+			a.read_tile(i, j, tile.get());
+			for (memory_size_type r = 0; r < t; ++r)
+				for (memory_size_type c = 0; c < t; ++c)
+					transposed[c * t + r] = tile[r * t + c];
+			out.write_tile(j, i, transposed.get());
+		}
+	}
+}
+
+} // namespace tpie
+
+#endif // __TPIE_MATRIX_H__
@@ -34,10 +34,13 @@
 #include <tpie/pipelining/pair_factory.h>
 #include <tpie/pipelining/pipe_base.h>
 #include <tpie/pipelining/factory_helpers.h>
+#include <tpie/pipelining/push_batch.h>
 #include <tpie/pipelining/virtual.h>
 
 // Library
 #include <tpie/pipelining/buffer.h>
+#include <tpie/pipelining/connected_components.h>
+#include <tpie/pipelining/convex_hull.h>
 #include <tpie/pipelining/file_stream.h>
 #include <tpie/pipelining/helpers.h>
 #include <tpie/pipelining/join.h>
@@ -45,9 +48,12 @@
 #include <tpie/pipelining/node_map_dump.h>
 #include <tpie/pipelining/numeric.h>
 #include <tpie/pipelining/reverse.h>
+#include <tpie/pipelining/rtree.h>
 #include <tpie/pipelining/serialization.h>
 #include <tpie/pipelining/sort.h>
+#include <tpie/pipelining/time_forward.h>
 #include <tpie/pipelining/serialization_sort.h>
+#include <tpie/pipelining/spatial_join.h>
 #include <tpie/pipelining/std_glue.h>
 #include <tpie/pipelining/stdio.h>
 #include <tpie/pipelining/uniq.h>
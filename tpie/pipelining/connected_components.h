@@ -0,0 +1,165 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file pipelining/connected_components.h
+/// \brief Pipelining node computing the connected components of the graph
+/// given by the edges pushed to it. See tpie/connected_components.h.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TPIE_PIPELINING_CONNECTED_COMPONENTS_H__
+#define __TPIE_PIPELINING_CONNECTED_COMPONENTS_H__
+
+#include <tpie/pipelining/node.h>
+#include <tpie/pipelining/factory_helpers.h>
+#include <tpie/connected_components.h>
+
+namespace tpie {
+
+namespace pipelining {
+
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Stores the edges pushed to it in a stream.
+///////////////////////////////////////////////////////////////////////////////
+class connected_components_input_t : public node {
+public:
+	typedef connected_components_edge item_type;
+
+	connected_components_input_t(const node_token & token)
+		: node(token)
+	{
+		set_name("Storing edges", PRIORITY_INSIGNIFICANT);
+		set_minimum_memory(file_stream<item_type>::memory_usage());
+	}
+
+	virtual void propagate() override {
+		m_edges = tpie_new<file_stream<item_type> >();
+		m_edges->open();
+		forward("edges", m_edges);
+	}
+
+	void push(const item_type & e) {
+		m_edges->write(e);
+	}
+
+private:
+	file_stream<item_type> * m_edges;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Labels the stored edges in its own phase and pushes the labels.
+///////////////////////////////////////////////////////////////////////////////
+template <typename dest_t>
+class connected_components_output_t : public node {
+public:
+	typedef connected_component item_type;
+
+	connected_components_output_t(const dest_t & dest, const node_token & input_token)
+		: dest(dest)
+	{
+		add_dependency(input_token);
+		add_push_destination(dest);
+		set_name("Connected components", PRIORITY_SIGNIFICANT);
+		// Room for the streams and merge_sorter of a contraction round.
+		set_minimum_memory(8 * file_stream<connected_components_edge>::memory_usage());
+		set_memory_fraction(1.0);
+	}
+
+	virtual void propagate() override {
+		m_edges = fetch<file_stream<connected_components_edge> *>("edges");
+		set_steps(m_edges->size());
+	}
+
+	virtual void go() override {
+		file_stream<item_type> labels;
+		labels.open();
+		::tpie::connected_components(*m_edges, labels, get_available_memory());
+		tpie_delete(m_edges);
+		m_edges = 0;
+		while (labels.can_read()) dest.push(labels.read());
+		step(get_steps());
+	}
+
+	virtual void end() override {
+		tpie_delete(m_edges);
+		m_edges = 0;
+	}
+
+private:
+	dest_t dest;
+	file_stream<connected_components_edge> * m_edges;
+};
+
+template <typename dest_t>
+class connected_components_t : public node {
+public:
+	typedef connected_components_edge item_type;
+	typedef connected_components_input_t input_t;
+	typedef connected_components_output_t<dest_t> output_t;
+
+	connected_components_t(const dest_t & dest)
+		: input_token()
+		, input(input_token)
+		, output(dest, input_token)
+	{
+		add_push_destination(input);
+		set_name("Connected components", PRIORITY_INSIGNIFICANT);
+	}
+
+	connected_components_t(const connected_components_t & o)
+		: node(o)
+		, input_token(o.input_token)
+		, input(o.input)
+		, output(o.output)
+	{
+	}
+
+	void push(const item_type & e) {
+		input.push(e);
+	}
+
+	node_token input_token;
+
+	input_t input;
+	output_t output;
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node that takes the edges of an undirected graph and
+/// pushes every vertex with the least vertex of its component, sorted by
+/// vertex.
+///
+/// The edges are labelled in a phase of their own once they have all been
+/// pushed, using disjoint_sets when the vertices fit in the memory of the
+/// phase and graph contraction otherwise. An isolated vertex v is given by
+/// the edge (v, v).
+///////////////////////////////////////////////////////////////////////////////
+inline pipe_middle<factory_0<bits::connected_components_t> > connected_components() {
+	return factory_0<bits::connected_components_t>();
+}
+
+} // namespace pipelining
+
+} // namespace tpie
+
+#endif // __TPIE_PIPELINING_CONNECTED_COMPONENTS_H__
@@ -0,0 +1,337 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file pipelining/convex_hull.h
+/// \brief Pipelining nodes computing the convex hull of a set of points.
+///
+/// \code
+/// pipeline p = input(points) | convex_hull<double>() | output(hull);
+/// \endcode
+///
+/// The points are sorted by x and y, and the sorted points are cut into
+/// batches whose own hulls are computed in parallel, dropping the points
+/// inside them, since such points are inside the hull of all the points as
+/// well. The hulls of the batches are then merged into the upper and lower
+/// hull in a single pass with an external stack for each.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TPIE_PIPELINING_CONVEX_HULL_H__
+#define __TPIE_PIPELINING_CONVEX_HULL_H__
+
+#include <tpie/pipelining/node.h>
+#include <tpie/pipelining/pipe_base.h>
+#include <tpie/pipelining/factory_helpers.h>
+#include <tpie/pipelining/parallel.h>
+#include <tpie/pipelining/sort.h>
+#include <tpie/geometry.h>
+#include <tpie/stack.h>
+#include <tpie/tempname.h>
+#include <tpie/array_view.h>
+#include <vector>
+
+namespace tpie {
+
+namespace pipelining {
+
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Whether the middle of three points sorted by x and y is kept on
+/// the upper hull (a right turn) or the lower hull (a left turn).
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+inline bool hull_turn(const point_2d<coord_t> & a, const point_2d<coord_t> & b,
+					  const point_2d<coord_t> & c, bool upper) {
+	coord_t o = orientation(a, b, c);
+	return upper ? o < 0 : o > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pushes the points of each batch of sorted points that are on the
+/// upper or lower hull of the batch, in order.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+class hull_filter_t {
+public:
+	template <typename dest_t>
+	class type : public node {
+	public:
+		typedef point_2d<coord_t> item_type;
+
+		type(const dest_t & dest)
+			: dest(dest)
+		{
+			add_push_destination(dest);
+			set_name("Hull of batch", PRIORITY_INSIGNIFICANT);
+		}
+
+		void push(const item_type & p) {
+			dest.push(p);
+		}
+
+		void push_batch(array_view<const item_type> points) {
+			memory_size_type n = points.size();
+			keep.assign(n, false);
+			chain(points, true);
+			chain(points, false);
+			for (memory_size_type i = 0; i < n; ++i)
+				if (keep[i]) dest.push(points[i]);
+		}
+
+	private:
+		void chain(array_view<const item_type> points, bool upper) {
+			hull.clear();
+			for (memory_size_type i = 0; i < points.size(); ++i) {
+				if (!hull.empty() && points[hull.back()] == points[i]) continue;
+				while (hull.size() >= 2
+					   && !hull_turn(points[hull[hull.size() - 2]], points[hull.back()], points[i], upper))
+					hull.pop_back();
+				hull.push_back(i);
+			}
+			for (memory_size_type i = 0; i < hull.size(); ++i) keep[hull[i]] = true;
+		}
+
+		dest_t dest;
+		std::vector<bool> keep;
+		std::vector<memory_size_type> hull;
+	};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Builds the upper and lower hull of the sorted points pushed to it
+/// on external stacks.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+class hull_input_t : public node {
+public:
+	typedef point_2d<coord_t> item_type;
+
+	hull_input_t(const node_token & token)
+		: node(token)
+		, m_upperFile(0)
+		, m_upper(0)
+		, m_lower(0)
+	{
+		set_name("Merge hulls", PRIORITY_INSIGNIFICANT);
+		set_minimum_memory(2 * stack<item_type>::memory_usage());
+	}
+
+	virtual void propagate() override {
+		m_upperFile = tpie_new<temp_file>();
+		m_lower = tpie_new<stack<item_type> >();
+		forward("upper", m_upperFile);
+		forward("lower", m_lower);
+	}
+
+	virtual void begin() override {
+		node::begin();
+		m_upper = tpie_new<stack<item_type> >(*m_upperFile);
+	}
+
+	void push(const item_type & p) {
+		add(m_upper, p, true);
+		add(m_lower, p, false);
+	}
+
+	virtual void end() override {
+		// Write the upper hull to its file for the output node to read.
+		tpie_delete(m_upper);
+		m_upper = 0;
+		node::end();
+	}
+
+private:
+	static void add(stack<item_type> * s, const item_type & p, bool upper) {
+		if (s->empty()) {
+			s->push(p);
+			return;
+		}
+		item_type b = s->pop();
+		if (b == p) {
+			s->push(b);
+			return;
+		}
+		while (!s->empty()) {
+			item_type a = s->top();
+			if (hull_turn(a, b, p, upper)) break;
+			b = s->pop();
+		}
+		s->push(b);
+		s->push(p);
+	}
+
+	temp_file * m_upperFile;
+	stack<item_type> * m_upper;
+	stack<item_type> * m_lower;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pushes the vertices of the hull in clockwise order from the
+/// leftmost point.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+class hull_output_t {
+public:
+	template <typename dest_t>
+	class type : public node {
+	public:
+		typedef point_2d<coord_t> item_type;
+
+		type(const dest_t & dest, const node_token & input_token)
+			: dest(dest)
+			, m_upperFile(0)
+			, m_lower(0)
+		{
+			add_dependency(input_token);
+			add_push_destination(dest);
+			set_name("Convex hull", PRIORITY_INSIGNIFICANT);
+			set_minimum_memory(file_stream<item_type>::memory_usage());
+		}
+
+		virtual void propagate() override {
+			m_upperFile = fetch<temp_file *>("upper");
+			m_lower = fetch<stack<item_type> *>("lower");
+		}
+
+		virtual void go() override {
+			// The upper hull from left to right, and then the lower hull
+			// from right to left without the endpoints it shares with the
+			// upper hull.
+			{
+				file_stream<item_type> upper;
+				upper.open(*m_upperFile, access_read);
+				while (upper.can_read()) dest.push(upper.read());
+			}
+			stream_size_type n = m_lower->size();
+			for (stream_size_type i = 0; i < n; ++i) {
+				item_type p = m_lower->pop();
+				if (i != 0 && i + 1 != n) dest.push(p);
+			}
+		}
+
+		virtual void end() override {
+			tpie_delete(m_lower);
+			tpie_delete(m_upperFile);
+			m_lower = 0;
+			m_upperFile = 0;
+		}
+
+	private:
+		dest_t dest;
+		temp_file * m_upperFile;
+		stack<item_type> * m_lower;
+	};
+};
+
+template <typename coord_t>
+class hull_scan_t {
+public:
+	template <typename dest_t>
+	class type : public node {
+	public:
+		typedef point_2d<coord_t> item_type;
+		typedef hull_input_t<coord_t> input_t;
+		typedef typename hull_output_t<coord_t>::template type<dest_t> output_t;
+
+		type(const dest_t & dest)
+			: input_token()
+			, input(input_token)
+			, output(dest, input_token)
+		{
+			add_push_destination(input);
+			set_name("Convex hull", PRIORITY_INSIGNIFICANT);
+		}
+
+		type(const type & o)
+			: node(o)
+			, input_token(o.input_token)
+			, input(o.input)
+			, output(o.output)
+		{
+		}
+
+		void push(const item_type & p) {
+			input.push(p);
+		}
+
+		node_token input_token;
+
+		input_t input;
+		output_t output;
+	};
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node that takes points sorted by x and y in batches and
+/// pushes those on the hull of their batch. Use it inside parallel() with
+/// maintain_order.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+inline pipe_middle<factory_0<bits::hull_filter_t<coord_t>::template type> >
+hull_filter() {
+	return factory_0<bits::hull_filter_t<coord_t>::template type>();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node that takes points sorted by x and y and pushes the
+/// vertices of their convex hull in clockwise order, starting from the
+/// least point, in a phase of its own.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+inline pipe_middle<factory_0<bits::hull_scan_t<coord_t>::template type> >
+hull_scan() {
+	return factory_0<bits::hull_scan_t<coord_t>::template type>();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The pipe type returned by convex_hull.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+struct convex_hull_pipe {
+	typedef factory_0<bits::hull_filter_t<coord_t>::template type> filter_t;
+	typedef bits::pair_factory<bits::sort_factory<point_2d_less<coord_t> >, parallel_bits::factory<filter_t> > filtered_t;
+	typedef factory_0<bits::hull_scan_t<coord_t>::template type> scan_t;
+	typedef pipe_middle<bits::pair_factory<filtered_t, scan_t> > type;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node that takes a set of points and pushes the
+/// vertices of their convex hull in clockwise order, starting from the
+/// point with the least x and then the least y. Points on an edge of the
+/// hull are not vertices.
+///
+/// \param threads  Number of threads computing the hulls of batches, or
+/// zero for the default number of workers.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+inline typename convex_hull_pipe<coord_t>::type convex_hull(size_t threads = 0) {
+	if (threads == 0) threads = default_worker_count();
+	return pipesort(point_2d_less<coord_t>())
+		| parallel(hull_filter<coord_t>(), maintain_order, threads)
+		| hull_scan<coord_t>();
+}
+
+} // namespace pipelining
+
+} // namespace tpie
+
+#endif // __TPIE_PIPELINING_CONVEX_HULL_H__
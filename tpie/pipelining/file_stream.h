@@ -24,6 +24,8 @@
 
 #include <tpie/pipelining/node.h>
 #include <tpie/pipelining/factory_helpers.h>
+#include <tpie/pipelining/sortedness.h>
+#include <tpie/pipelining/push_batch.h>
 
 namespace tpie {
 
@@ -34,7 +36,8 @@ namespace bits {
 ///////////////////////////////////////////////////////////////////////////////
 /// \class input_t
 ///
-/// file_stream input generator.
+/// file_stream input generator. If the destination implements push_batch,
+/// the items are read and pushed in batches.
 ///////////////////////////////////////////////////////////////////////////////
 template <typename dest_t>
 class input_t : public node {
@@ -44,12 +47,18 @@ public:
 	inline input_t(const dest_t & dest, file_stream<item_type> & fs) : dest(dest), fs(fs) {
 		add_push_destination(dest);
 		set_name("Read", PRIORITY_INSIGNIFICANT);
-		set_minimum_memory(fs.memory_usage());
+		memory_size_type batchMemory = 0;
+		if (has_push_batch<dest_t, item_type>::value)
+			batchMemory = array<item_type>::memory_usage(push_batch_items<item_type>());
+		set_minimum_memory(fs.memory_usage() + batchMemory);
 	}
 
 	virtual void propagate() override {
 		if (fs.is_open()) {
 			forward("items", fs.size());
+			uint64_t predicate;
+			if (read_sortedness(fs, predicate))
+				forward("sortedness", sortedness(predicate));
 		} else {
 			forward("items", 0);
 		}
@@ -57,7 +66,17 @@ public:
 	}
 
 	virtual void go() override {
-		if (fs.is_open()) {
+		if (!fs.is_open()) return;
+		if (has_push_batch<dest_t, item_type>::value) {
+			array<item_type> buffer(push_batch_items<item_type>());
+			while (fs.can_read()) {
+				memory_size_type n = static_cast<memory_size_type>(
+					std::min(static_cast<stream_size_type>(buffer.size()), fs.size() - fs.offset()));
+				fs.read(buffer.begin(), buffer.find(n));
+				push_batch_to(dest, array_view<const item_type>(buffer.get(), n));
+				step(n);
+			}
+		} else {
 			while (fs.can_read()) {
 				dest.push(fs.read());
 				step();
@@ -87,6 +106,9 @@ public:
 
 	virtual void propagate() override {
 		forward("items", fs.size());
+		uint64_t predicate;
+		if (read_sortedness(fs, predicate))
+			forward("sortedness", sortedness(predicate));
 		set_steps(fs.size());
 	}
 
@@ -105,23 +127,46 @@ public:
 ///////////////////////////////////////////////////////////////////////////////
 /// \class output_t
 ///
-/// file_stream output terminator.
+/// file_stream output terminator. If the items are known to be sorted and the
+/// stream is empty when the phase begins, the stream is marked as sorted
+/// (see tpie/sortedness.h) when the phase ends.
 ///////////////////////////////////////////////////////////////////////////////
 template <typename T>
 class output_t : public node {
 public:
 	typedef T item_type;
 
-	inline output_t(file_stream<T> & fs) : fs(fs) {
+	inline output_t(file_stream<T> & fs) : fs(fs), m_sorted(false) {
 		set_name("Write", PRIORITY_INSIGNIFICANT);
 		set_minimum_memory(fs.memory_usage());
 	}
 
+	virtual void propagate() override {
+		if (!is_forwarded_explicitly("sortedness")) return;
+		sortedness s = fetch<sortedness>("sortedness");
+		m_sorted = s.exact;
+		m_predicate = s.predicate;
+	}
+
+	virtual void begin() override {
+		if (m_sorted && fs.size() != 0) m_sorted = false;
+	}
+
 	inline void push(const T & item) {
 		fs.write(item);
 	}
+
+	void push_batch(array_view<const T> items) {
+		fs.write(items.begin(), items.end());
+	}
+
+	virtual void end() override {
+		if (m_sorted) write_sortedness(fs, m_predicate);
+	}
 private:
 	file_stream<T> & fs;
+	bool m_sorted;
+	uint64_t m_predicate;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
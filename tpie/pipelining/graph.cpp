@@ -20,6 +20,7 @@
 #include <tpie/pipelining/graph.h>
 #include <tpie/pipelining/tokens.h>
 #include <tpie/pipelining/node.h>
+#include <tpie/execution_time_predictor.h>
 
 namespace {
 
@@ -375,7 +376,7 @@ memory_size_type graph_traits::memory_usage(size_t phases) {
 	return phases * (sizeof(auto_ptr<Progress::sub>) + sizeof(Progress::sub));
 }
 
-void graph_traits::go_all(stream_size_type n, Progress::base & pi) {
+void graph_traits::go_all(stream_size_type n, Progress::base & pi, memory_size_type memory) {
 	map.assert_authoritative();
 	Progress::fp fp(&pi);
 	array<auto_ptr<Progress::sub> > subindicators(m_phases.size());
@@ -387,12 +388,29 @@ void graph_traits::go_all(stream_size_type n, Progress::base & pi) {
 		subindicators[i].reset(tpie_new<Progress::sub>(fp, uid.c_str(), TPIE_FSI, n, name.c_str()));
 	}
 
-	fp.init();
-	for (size_t i = 0; i < m_phases.size(); ++i) {
-		if (m_evacuatePrevious[i]) m_phases[i-1].evacuate_all();
-		m_phases[i].go(*subindicators[i]);
+	// Feed the estimated remaining time of the progress indicator with
+	// measurements of previous executions of the same phases.
+	std::string uid;
+	for (size_t i = 0; i < m_phases.size(); ++i) uid += m_phases[i].get_unique_id() + ';';
+	execution_time_predictor predictor("pipeline;" + uid);
+	execution_time_predictor * oldPredictor = pi.get_time_predictor();
+	if (oldPredictor == 0) pi.set_time_predictor(&predictor);
+	predictor.start_execution(n, memory);
+
+	try {
+		fp.init();
+		for (size_t i = 0; i < m_phases.size(); ++i) {
+			if (m_evacuatePrevious[i]) m_phases[i-1].evacuate_all();
+			m_phases[i].go(*subindicators[i]);
+		}
+		fp.done();
+	} catch (...) {
+		pi.set_time_predictor(oldPredictor);
+		throw;
 	}
-	fp.done();
+
+	predictor.end_execution();
+	pi.set_time_predictor(oldPredictor);
 }
 
 void graph_traits::calc_phases() {
@@ -520,6 +538,11 @@ void phase::go(progress_indicator_base & pi) {
 		totalSteps += propagateOrder[i]->get_steps();
 		propagateOrder[i]->set_state(node::STATE_AFTER_PROPAGATE);
 	}
+	memory_size_type memory = 0;
+	for (size_t i = 0; i < m_nodes.size(); ++i) memory += m_nodes[i]->get_available_memory();
+	execution_time_predictor predictor("pipelining phase;" + get_unique_id());
+	predictor.start_execution(totalSteps, memory);
+
 	pi.init(totalSteps);
 	for (size_t i = 0; i < beginOrder.size(); ++i) {
 		if (beginOrder[i]->get_state() != node::STATE_AFTER_PROPAGATE) {
@@ -548,6 +571,7 @@ void phase::go(progress_indicator_base & pi) {
 		endOrder[i]->set_state(node::STATE_AFTER_END);
 	}
 	pi.done();
+	predictor.end_execution();
 
 	if (initiators == 0)
 		throw no_initiator_node();
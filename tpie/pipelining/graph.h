@@ -132,7 +132,14 @@ public:
 		return m_itemSinks;
 	}
 
-	void go_all(stream_size_type n, Progress::base & pi);
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Run all phases. The execution time of each phase and of the
+	/// whole pipeline is stored in the execution time database, keyed by the
+	/// unique ids of the phases.
+	/// \param n  Input size passed to the progress indicators.
+	/// \param memory  Memory assigned to each phase.
+	///////////////////////////////////////////////////////////////////////////
+	void go_all(stream_size_type n, Progress::base & pi, memory_size_type memory);
 
 private:
 	const node_map & map;
@@ -25,6 +25,10 @@
 #include <tpie/pipelining/exception.h>
 #include <tpie/dummy_progress.h>
 #include <tpie/array_view.h>
+#include <tpie/job.h>
+#include <tpie/stats.h>
+#include <tpie/internal_priority_queue.h>
+#include <sstream>
 
 namespace tpie {
 
@@ -39,6 +43,26 @@ namespace tpie {
 /// of a single run, we are in "report internal" mode, meaning we do not write
 /// anything to disk. This causes phase 2 to be a no-op and phase 3 to be a
 /// simple array traversal.
+///
+/// By default, every run in phase 1 has exactly runLength items. With
+/// replacement selection enabled, runs are formed using a heap of runLength
+/// items, giving runs of about twice that length on random input and a
+/// single run on input that is sorted except for local disorder.
+///
+/// If only the first k items of the sorted output are needed, set_limit(k)
+/// bounds the work: when k items fit in the run buffer, phase 1 keeps the k
+/// smallest items in a bounded internal_priority_queue of k items instead of
+/// allocating the run buffer, and nothing is written to disk.
+/// Otherwise each run and each merge is truncated after k items.
+///
+/// The merges of an intermediate merge level are independent, and
+/// set_parallel_merges() lets several of them run concurrently as jobs.
+///
+/// The run files of a merge level are deleted as soon as the next level is
+/// complete, so at most two levels use temporary space at a time; see
+/// predicted_peak_temp_usage(). If the temporary file limit (see
+/// set_temp_file_limit) cannot accommodate the merges, this is reported
+/// before merging starts rather than when the space runs out.
 ///////////////////////////////////////////////////////////////////////////////
 template <typename T, bool UseProgress, typename pred_t = std::less<T> >
 class merge_sorter {
@@ -56,7 +80,12 @@ public:
 		, pred(pred)
 		, m_evacuated(false)
 		, m_finalMergeInitialized(false)
+		, m_presorted(false)
+		, m_replacementSelection(false)
+		, m_limit(std::numeric_limits<stream_size_type>::max())
+		, m_topItems(0, heap_pred(pred))
 	{
+		p.parallelMerges = 1;
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -103,6 +132,74 @@ private:
 	}
 
 public:
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Declare that items will be pushed in sorted order.
+	///
+	/// Must be called before begin(). The sorter then skips sorting and
+	/// merging: items are written to a single run in the order they are
+	/// pushed, and the final merge reads that run back sequentially.
+	///////////////////////////////////////////////////////////////////////////
+	inline void set_presorted() {
+		tp_assert(m_state == stParameters, "Merge sorting already begun");
+		m_presorted = true;
+		log_debug() << "Merge sorter input is presorted" << std::endl;
+	}
+
+	inline bool is_presorted() const {
+		return m_presorted;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Enable or disable run formation by replacement selection.
+	///
+	/// Must be called before begin(). Runs formed by replacement selection
+	/// have varying lengths, which are kept in memory using two
+	/// stream_size_types per run.
+	///////////////////////////////////////////////////////////////////////////
+	inline void set_replacement_selection(bool enabled) {
+		tp_assert(m_state == stParameters, "Merge sorting already begun");
+		m_replacementSelection = enabled;
+	}
+
+	inline bool uses_replacement_selection() const {
+		return m_replacementSelection;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Only report the first k items of the sorted output.
+	///
+	/// Must be called before begin().
+	///////////////////////////////////////////////////////////////////////////
+	inline void set_limit(stream_size_type k) {
+		tp_assert(m_state == stParameters, "Merge sorting already begun");
+		m_limit = k;
+		log_debug() << "Merge sorter reports at most " << k << " items" << std::endl;
+	}
+
+	inline stream_size_type get_limit() const {
+		return m_limit;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Set the number of intermediate merges to run concurrently.
+	///
+	/// The phase 2 memory is split evenly among the concurrent merges, so
+	/// the fanout decreases and more merge levels may be needed. This pays
+	/// off when the temporary directory is on a device that serves several
+	/// streams at once well, such as an SSD; on a single spinning disk, the
+	/// default of one merge at a time is usually best.
+	/// Must be called before begin().
+	///////////////////////////////////////////////////////////////////////////
+	inline void set_parallel_merges(memory_size_type merges) {
+		tp_assert(m_state == stParameters, "Merge sorting already begun");
+		p.parallelMerges = std::max(merges, static_cast<memory_size_type>(1));
+		maybe_calculate_parameters();
+	}
+
+	inline memory_size_type get_parallel_merges() const {
+		return p.parallelMerges;
+	}
+
 	inline void set_phase_1_memory(memory_size_type m1) {
 		p.memoryPhase1 = m1;
 		maybe_calculate_parameters();
@@ -125,12 +222,28 @@ public:
 		tp_assert(m_state == stParameters, "Merge sorting already begun");
 		if (!m_parametersSet) throw merge_sort_not_ready();
 		log_debug() << "Start forming input runs" << std::endl;
-		m_currentRunItems.resize((size_t)p.runLength);
+		m_boundedHeap = !m_presorted && m_limit <= p.runLength;
+		if (m_boundedHeap) {
+			m_topItems.resize(static_cast<size_t>(m_limit));
+			log_debug() << "Keeping the " << m_limit << " smallest items in a bounded heap" << std::endl;
+		} else {
+			m_currentRunItems.resize((size_t)p.runLength);
+		}
 		m_runFiles.resize(p.fanout*2);
 		m_currentRunItemCount = 0;
 		m_finishedRuns = 0;
 		m_state = stRunFormation;
 		m_itemCount = 0;
+		m_heapSize = 0;
+		m_presortedItems = 0;
+		if (m_presorted && m_replacementSelection) {
+			log_debug() << "Input is presorted; not using replacement selection" << std::endl;
+			m_replacementSelection = false;
+		}
+		if (m_boundedHeap && m_replacementSelection) {
+			log_debug() << "Output fits in a bounded heap; not using replacement selection" << std::endl;
+			m_replacementSelection = false;
+		}
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -138,23 +251,112 @@ public:
 	///////////////////////////////////////////////////////////////////////////
 	inline void push(const T & item) {
 		tp_assert(m_state == stRunFormation, "Wrong phase");
+		if (m_presorted && m_itemCount >= m_limit) {
+			// Later items cannot be among the first m_limit.
+			++m_itemCount;
+			return;
+		}
+		if (m_boundedHeap) {
+			push_bounded(item);
+			++m_itemCount;
+			return;
+		}
 		if (m_currentRunItemCount >= p.runLength) {
-			sort_current_run();
-			empty_current_run();
+			if (m_replacementSelection) {
+				replace_smallest(item);
+				++m_itemCount;
+				return;
+			}
+			if (m_presorted) {
+				append_presorted_run();
+			} else {
+				sort_current_run();
+				empty_current_run();
+			}
 		}
+		tp_assert(!m_presorted || m_itemCount == 0
+				  || !pred(item, m_currentRunItemCount > 0
+						   ? m_currentRunItems[m_currentRunItemCount-1]
+						   : m_lastPresortedItem),
+				  "Presorted input is out of order");
 		m_currentRunItems[m_currentRunItemCount] = item;
 		++m_currentRunItemCount;
 		++m_itemCount;
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Push a batch of items to merge sorter during phase 1.
+	///
+	/// In the default mode the items are copied to the run buffer in blocks.
+	///////////////////////////////////////////////////////////////////////////
+	inline void push_batch(array_view<const T> items) {
+		if (m_presorted || m_replacementSelection
+			|| m_limit != std::numeric_limits<stream_size_type>::max()) {
+			for (size_t i = 0; i < items.size(); ++i) push(items[i]);
+			return;
+		}
+		tp_assert(m_state == stRunFormation, "Wrong phase");
+		size_t i = 0;
+		while (i < items.size()) {
+			if (m_currentRunItemCount >= p.runLength) {
+				sort_current_run();
+				empty_current_run();
+			}
+			memory_size_type n = std::min(static_cast<memory_size_type>(items.size() - i),
+										  p.runLength - m_currentRunItemCount);
+			std::copy(items.find(i), items.find(i+n),
+					  m_currentRunItems.find(m_currentRunItemCount));
+			m_currentRunItemCount += n;
+			m_itemCount += n;
+			i += n;
+		}
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief End phase 1.
 	///////////////////////////////////////////////////////////////////////////
 	inline void end() {
 		tp_assert(m_state == stRunFormation, "Wrong phase");
-		sort_current_run();
 
-		if (m_itemCount == 0) {
+		if (m_replacementSelection && (m_finishedRuns > 0 || m_runWriter.is_open())) {
+			// Finish the current replacement selection run, and write the
+			// items set aside for the next run as a final run.
+			memory_size_type nextRunBegin = m_heapSize;
+			while (m_heapSize > 0) {
+				std::pop_heap(m_currentRunItems.begin(), m_currentRunItems.begin()+m_heapSize, heap_pred(pred));
+				--m_heapSize;
+				write_to_current_run(m_currentRunItems[m_heapSize]);
+			}
+			if (m_runWriter.is_open()) end_replacement_run();
+			std::copy(m_currentRunItems.begin()+nextRunBegin,
+					  m_currentRunItems.begin()+m_currentRunItemCount,
+					  m_currentRunItems.begin());
+			m_currentRunItemCount -= nextRunBegin;
+		}
+		if (m_boundedHeap) {
+			// The heap array is a std heap ordered by pred, largest item first.
+			m_currentRunItemCount = m_topItems.size();
+			m_currentRunItems.swap(m_topItems.get_array());
+			m_topItems.resize(0);
+			std::sort_heap(m_currentRunItems.begin(), m_currentRunItems.begin()+m_currentRunItemCount, pred);
+			log_debug() << "Kept " << m_currentRunItemCount << " of " << m_itemCount << " items in a bounded heap" << std::endl;
+		} else {
+			sort_current_run();
+		}
+
+		if (m_replacementSelection && m_finishedRuns > 0) {
+			m_reportInternal = false;
+			if (m_currentRunItemCount > 0) empty_current_run();
+			m_currentRunItems.resize(0);
+			log_debug() << "Got " << m_finishedRuns << " runs by replacement selection. External reporting mode." << std::endl;
+		} else if (m_presorted && m_finishedRuns > 0) {
+			// All items form a single run.
+			append_presorted_run();
+			record_run(0, 0, 0, m_presortedItems);
+			m_reportInternal = false;
+			m_currentRunItems.resize(0);
+			log_debug() << "Got " << m_itemCount << " presorted items. External reporting mode." << std::endl;
+		} else if (m_itemCount == 0) {
 			tp_assert(m_currentRunItemCount == 0, "m_itemCount == 0, but m_currentRunItemCount != 0");
 			m_reportInternal = true;
 			m_itemsPulled = 0;
@@ -238,9 +440,29 @@ private:
 	///////////////////////////////////////////////////////////////////////////
 
 	inline void sort_current_run() {
+		if (m_presorted) return;
 		parallel_sort(m_currentRunItems.begin(), m_currentRunItems.begin()+m_currentRunItemCount, pred);
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// In presorted mode, append the current run buffer to the single run
+	/// in run file 0.
+	/// postcondition: m_currentRunItemCount = 0
+	///////////////////////////////////////////////////////////////////////////
+	inline void append_presorted_run() {
+		file_stream<T> fs;
+		fs.open(m_runFiles[run_file_index(0, 0)], access_read_write);
+		fs.seek(0, file_stream<T>::end);
+		for (memory_size_type i = 0; i < m_currentRunItemCount; ++i) {
+			fs.write(m_currentRunItems[i]);
+		}
+		if (m_currentRunItemCount > 0)
+			m_lastPresortedItem = m_currentRunItems[m_currentRunItemCount-1];
+		m_presortedItems += m_currentRunItemCount;
+		m_currentRunItemCount = 0;
+		m_finishedRuns = 1;
+	}
+
 	// postcondition: m_currentRunItemCount = 0
 	inline void empty_current_run() {
 		if (m_finishedRuns < 10)
@@ -249,18 +471,114 @@ private:
 			log_debug() << "..." << std::endl;
 		file_stream<T> fs;
 		open_run_file_write(fs, 0, m_finishedRuns);
-		for (memory_size_type i = 0; i < m_currentRunItemCount; ++i) {
+		memory_size_type n = m_currentRunItemCount;
+		if (n > m_limit) n = static_cast<memory_size_type>(m_limit);
+		if (variable_runs())
+			record_run(0, m_finishedRuns, fs.offset(), n);
+		for (memory_size_type i = 0; i < n; ++i) {
 			fs.write(m_currentRunItems[i]);
 		}
 		m_currentRunItemCount = 0;
 		++m_finishedRuns;
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// Replacement selection: The first m_heapSize items of m_currentRunItems
+	/// form a heap of items that may still go into the current run. The
+	/// remaining items are smaller than the last item written and are set
+	/// aside for the next run.
+	///////////////////////////////////////////////////////////////////////////
+	class heap_pred : public std::binary_function<T, T, bool> {
+	public:
+		heap_pred(pred_t pred) : pred(pred) {}
+
+		inline bool operator()(const T & lhs, const T & rhs) {
+			return pred(rhs, lhs);
+		}
+
+	private:
+		pred_t pred;
+	};
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Replacement selection: Write the smallest item of the heap to the
+	/// current run and replace it by the given item.
+	/// Precondition: m_currentRunItemCount == p.runLength
+	///////////////////////////////////////////////////////////////////////////
+	inline void replace_smallest(const T & item) {
+		if (m_heapSize == 0) start_replacement_run();
+		typename array<T>::iterator heapBegin = m_currentRunItems.begin();
+		write_to_current_run(*heapBegin);
+		bool sameRun = !pred(item, *heapBegin);
+		std::pop_heap(heapBegin, heapBegin+m_heapSize, heap_pred(pred));
+		if (sameRun) {
+			*(heapBegin+(m_heapSize-1)) = item;
+			std::push_heap(heapBegin, heapBegin+m_heapSize, heap_pred(pred));
+		} else {
+			--m_heapSize;
+			*(heapBegin+m_heapSize) = item;
+			if (m_heapSize == 0) end_replacement_run();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Replacement selection: Write an item to the current run unless the run
+	/// already has m_limit items.
+	///////////////////////////////////////////////////////////////////////////
+	inline void write_to_current_run(const T & item) {
+		if (m_runWriter.offset() - m_runWriterOffset < m_limit)
+			m_runWriter.write(item);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Bounded heap: m_topItems holds the m_limit smallest items seen so far
+	/// with the largest item on top. Replace the largest item by the given
+	/// item if it is smaller.
+	///////////////////////////////////////////////////////////////////////////
+	inline void push_bounded(const T & item) {
+		if (m_topItems.size() < m_limit) {
+			m_topItems.push(item);
+		} else if (m_limit > 0 && pred(item, m_topItems.top())) {
+			m_topItems.pop_and_push(item);
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Replacement selection: Turn all buffered items into a heap and open
+	/// a new run.
+	///////////////////////////////////////////////////////////////////////////
+	inline void start_replacement_run() {
+		m_heapSize = m_currentRunItemCount;
+		std::make_heap(m_currentRunItems.begin(), m_currentRunItems.begin()+m_heapSize, heap_pred(pred));
+		open_run_file_write(m_runWriter, 0, m_finishedRuns);
+		m_runWriterOffset = m_runWriter.offset();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Replacement selection: Close the current run.
+	///////////////////////////////////////////////////////////////////////////
+	inline void end_replacement_run() {
+		stream_size_type length = m_runWriter.offset() - m_runWriterOffset;
+		if (m_finishedRuns < 10)
+			log_debug() << "Wrote " << length << " items to run file " << m_finishedRuns << " by replacement selection" << std::endl;
+		record_run(0, m_finishedRuns, m_runWriterOffset, length);
+		m_runWriter.close();
+		++m_finishedRuns;
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	/// Prepare m_merger for merging the runNumber'th to the
 	/// (runNumber+runCount)'th run in mergeLevel.
 	///////////////////////////////////////////////////////////////////////////
 	inline void initialize_merger(memory_size_type mergeLevel, memory_size_type runNumber, memory_size_type runCount) {
+		initialize_merger(m_merger, mergeLevel, runNumber, runCount);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Prepare the given merger for merging the runNumber'th to the
+	/// (runNumber+runCount)'th run in mergeLevel.
+	///////////////////////////////////////////////////////////////////////////
+	inline void initialize_merger(merger<T, pred_t> & m, memory_size_type mergeLevel, memory_size_type runNumber, memory_size_type runCount) {
 		// runCount is a memory_size_type since we must be able to have that
 		// many file_streams open at the same time.
 
@@ -269,9 +587,16 @@ private:
 		for (memory_size_type i = 0; i < runCount; ++i) {
 			open_run_file_read(in[i], mergeLevel, runNumber+i);
 		}
-		stream_size_type runLength = calculate_run_length(p.runLength, p.fanout, mergeLevel);
 		// Pass file streams with correct stream offsets to the merger
-		m_merger.reset(in, runLength);
+		if (variable_runs()) {
+			array<stream_size_type> runLengths(runCount);
+			for (memory_size_type i = 0; i < runCount; ++i) {
+				runLengths[i] = run_length(mergeLevel, runNumber+i);
+			}
+			m.reset(in, runLengths);
+		} else {
+			m.reset(in, run_length(mergeLevel, 0));
+		}
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -292,6 +617,7 @@ private:
 			memory_size_type i = p.finalFanout-1;
 			memory_size_type n = runCount-i;
 			log_debug() << "Merge " << n << " runs starting from #" << i << std::endl;
+			free_run_files(finalMergeLevel+1);
 			dummy_progress_indicator pi;
 			m_finalMergeSpecialRunNumber = merge_runs(finalMergeLevel, i, n, pi);
 		} else {
@@ -312,9 +638,15 @@ public:
 			}
 			open_run_file_read(in[p.finalFanout-1], m_finalMergeLevel+1, m_finalMergeSpecialRunNumber);
 			log_debug() << "Special large run is at offset " << in[p.finalFanout-1].offset() << " and has size " << in[p.finalFanout-1].size() << std::endl;
-			stream_size_type runLength = calculate_run_length(p.runLength, p.fanout, m_finalMergeLevel+1);
-			log_debug() << "Run length " << runLength << std::endl;
-			m_merger.reset(in, runLength);
+			// The final level may hold more runs than the fanout, in which
+			// case a run file holds several runs, so the ordinary runs must
+			// not be read with the length of the special run.
+			array<stream_size_type> runLengths(p.finalFanout);
+			for (memory_size_type i = 0; i < p.finalFanout-1; ++i) {
+				runLengths[i] = run_length(m_finalMergeLevel, i);
+			}
+			runLengths[p.finalFanout-1] = run_length(m_finalMergeLevel+1, m_finalMergeSpecialRunNumber);
+			m_merger.reset(in, runLengths);
 		} else {
 			initialize_merger(m_finalMergeLevel, 0, m_finalRunCount);
 		}
@@ -333,6 +665,56 @@ private:
 		return runLength;
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Get the number of items in the given run.
+	///
+	/// Without replacement selection, this is an upper bound, as the last run
+	/// in each merge level may be shorter.
+	///////////////////////////////////////////////////////////////////////////
+	inline stream_size_type run_length(memory_size_type mergeLevel, memory_size_type runNumber) {
+		if (variable_runs()) return m_runLengths[mergeLevel % 2][runNumber];
+		return calculate_run_length(p.runLength, p.fanout, mergeLevel);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Get the stream offset of the given run in its run file.
+	///////////////////////////////////////////////////////////////////////////
+	inline stream_size_type run_offset(memory_size_type mergeLevel, memory_size_type runNumber) {
+		if (variable_runs()) return m_runOffsets[mergeLevel % 2][runNumber];
+		return calculate_run_length(p.runLength, p.fanout, mergeLevel) * (runNumber / p.fanout);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Whether runs may have different lengths, in which case their
+	/// offsets and lengths are recorded in m_runOffsets and m_runLengths.
+	///////////////////////////////////////////////////////////////////////////
+	inline bool variable_runs() const {
+		return m_replacementSelection || m_presorted
+			|| m_limit != std::numeric_limits<stream_size_type>::max();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Record the offset and length of a run of variable length.
+	///////////////////////////////////////////////////////////////////////////
+	inline void record_run(memory_size_type mergeLevel, memory_size_type runNumber,
+						   stream_size_type offset, stream_size_type length) {
+		array<stream_size_type> & offsets = m_runOffsets[mergeLevel % 2];
+		array<stream_size_type> & lengths = m_runLengths[mergeLevel % 2];
+		if (runNumber >= offsets.size()) {
+			memory_size_type n = std::max(runNumber+1, 2*offsets.size());
+			grow_run_table(offsets, n);
+			grow_run_table(lengths, n);
+		}
+		offsets[runNumber] = offset;
+		lengths[runNumber] = length;
+	}
+
+	static inline void grow_run_table(array<stream_size_type> & table, memory_size_type n) {
+		array<stream_size_type> grown(n);
+		std::copy(table.begin(), table.end(), grown.begin());
+		table.swap(grown);
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	/// Merge the runNumber'th to the (runNumber+runCount)'th in mergeLevel
 	/// into mergeLevel+1.
@@ -344,13 +726,166 @@ private:
 		file_stream<T> out;
 		memory_size_type nextRunNumber = runNumber/p.fanout;
 		open_run_file_write(out, mergeLevel+1, nextRunNumber);
-		while (m_merger.can_pull()) {
+		stream_size_type offset = out.offset();
+		stream_size_type written = 0;
+		while (m_merger.can_pull() && written < m_limit) {
 			pi.step();
 			out.write(m_merger.pull());
+			++written;
 		}
+		if (m_merger.can_pull()) m_merger.reset();
+		if (variable_runs())
+			record_run(mergeLevel+1, nextRunNumber, offset, written);
 		return nextRunNumber;
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Delete the run files that mergeLevel shares with mergeLevel-2,
+	/// whose runs have all been merged.
+	///////////////////////////////////////////////////////////////////////////
+	inline void free_run_files(memory_size_type mergeLevel) {
+		for (memory_size_type i = 0; i < p.fanout; ++i)
+			m_runFiles[run_file_index(mergeLevel, i)].free();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Bound on the space a run file uses beyond its items: its
+	/// header and the padding of its last block.
+	///////////////////////////////////////////////////////////////////////////
+	static inline stream_size_type run_file_overhead() {
+		return 2 * static_cast<stream_size_type>(file_stream<T>::block_size(1.0));
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Temporary file space needed, beyond the runs themselves, to
+	/// merge runCount runs of at most runSize bytes holding dataSize bytes.
+	///////////////////////////////////////////////////////////////////////////
+	inline stream_size_type merge_temp_usage(stream_size_type runCount,
+											 stream_size_type runSize,
+											 stream_size_type dataSize) const {
+		if (runCount <= p.finalFanout) return 0;
+		if (runCount <= p.fanout + p.finalFanout - 1)
+			return std::min(dataSize, (runCount - p.finalFanout + 1) * runSize)
+				+ run_file_overhead();
+		return dataSize + p.fanout * run_file_overhead();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Check that the merges fit in the temporary file space left.
+	///
+	/// With TEMP_FILE_ENFORCE_THROW, an out_of_space_exception is thrown
+	/// before any merging is done; otherwise a warning is logged.
+	///////////////////////////////////////////////////////////////////////////
+	inline void check_merge_temp_usage() {
+		stream_size_type available = get_temp_file_available();
+		if (available == std::numeric_limits<stream_size_type>::max()) return;
+		stream_size_type dataItems = m_itemCount;
+		if (m_finishedRuns > 0 && m_limit < m_itemCount / m_finishedRuns)
+			dataItems = m_finishedRuns * m_limit;
+		stream_size_type dataSize = dataItems * sizeof(T);
+		stream_size_type runSize = variable_runs()
+			? dataSize
+			: std::min(p.runLength, m_limit) * sizeof(T);
+		stream_size_type needed = merge_temp_usage(m_finishedRuns, runSize, dataSize);
+		log_debug() << "Merging " << m_finishedRuns << " runs needs " << needed
+			<< " b of temporary space; " << available << " b available" << std::endl;
+		if (needed <= available) return;
+		std::stringstream ss;
+		ss << "Not enough temporary file space to merge " << m_finishedRuns
+		   << " runs: " << needed << " bytes needed, but only "
+		   << available << " bytes available.";
+		if (get_temp_file_enforcement() == TEMP_FILE_ENFORCE_THROW)
+			throw out_of_space_exception(ss.str());
+		if (get_temp_file_enforcement() == TEMP_FILE_ENFORCE_WARN)
+			log_warning() << ss.str() << std::endl;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Job running a single intermediate merge. The merger and the
+	/// output stream are set up by merge_level_in_parallel.
+	///////////////////////////////////////////////////////////////////////////
+	class merge_job : public job {
+	public:
+		merge_job(const pred_t & pred)
+			: m_merger(pred)
+			, failed(false)
+		{
+		}
+
+		virtual void operator()() {
+			try {
+				written = 0;
+				while (m_merger.can_pull() && written < limit) {
+					out.write(m_merger.pull());
+					++written;
+				}
+				if (m_merger.can_pull()) m_merger.reset();
+			} catch (const std::exception & e) {
+				error = e.what();
+				failed = true;
+			}
+		}
+
+		merger<T, pred_t> m_merger;
+		file_stream<T> out;
+		memory_size_type runNumber;
+		stream_size_type offset;
+		stream_size_type written;
+		stream_size_type limit;
+		bool failed;
+		std::string error;
+	};
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Merge all runs in mergeLevel into mergeLevel+1 using the jobs in
+	/// m_mergeJobs. Merges are started in batches of consecutive output runs,
+	/// which go to distinct run files since there are at most fanout jobs.
+	/// Without a job manager, the jobs are run one after another in the
+	/// calling thread.
+	/// \returns The number of runs in mergeLevel+1.
+	///////////////////////////////////////////////////////////////////////////
+	inline memory_size_type merge_level_in_parallel(memory_size_type mergeLevel, memory_size_type runCount, typename Progress::base & pi) {
+		const bool background = job_manager_initialized();
+		memory_size_type newRunCount = (runCount + p.fanout - 1) / p.fanout;
+		for (memory_size_type first = 0; first < newRunCount; first += m_mergeJobs.size()) {
+			memory_size_type jobs = std::min(m_mergeJobs.size(), newRunCount - first);
+			memory_size_type started = 0;
+			try {
+				for (; started < jobs; ++started) {
+					merge_job & j = *m_mergeJobs[started];
+					j.runNumber = first + started;
+					memory_size_type i = j.runNumber * p.fanout;
+					initialize_merger(j.m_merger, mergeLevel, i, std::min(runCount-i, p.fanout));
+					open_run_file_write(j.out, mergeLevel+1, j.runNumber);
+					j.offset = j.out.offset();
+					j.limit = m_limit;
+					if (background) j.enqueue();
+					else j();
+				}
+			} catch (...) {
+				if (background)
+					for (memory_size_type k = 0; k < started; ++k) m_mergeJobs[k]->join();
+				throw;
+			}
+			std::string error;
+			for (memory_size_type k = 0; k < jobs; ++k) {
+				merge_job & j = *m_mergeJobs[k];
+				if (background) j.join();
+				j.out.close();
+				if (j.failed) {
+					error = j.error;
+					j.failed = false;
+					continue;
+				}
+				pi.step(j.written);
+				if (variable_runs())
+					record_run(mergeLevel+1, j.runNumber, j.offset, j.written);
+			}
+			if (!error.empty()) throw exception(error);
+		}
+		return newRunCount;
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	/// Phase 2: Merge all runs and initialize merger for public pulling.
 	///////////////////////////////////////////////////////////////////////////
@@ -362,8 +897,27 @@ private:
 
 		memory_size_type mergeLevel = 0;
 		memory_size_type runCount = m_finishedRuns;
-		while (runCount > p.fanout) {
+		check_merge_temp_usage();
+
+		// As long as the runs in excess of the final fanout can be merged in
+		// a single merge (see initialize_final_merger), the final merge
+		// level is reached without merging every run.
+		const memory_size_type maxFinalRunCount = p.fanout + p.finalFanout - 1;
+		memory_size_type parallelMerges = std::min(p.parallelMerges, p.fanout);
+		if (runCount > maxFinalRunCount && parallelMerges > 1) {
+			log_debug() << "Running " << parallelMerges << " merges in parallel" << std::endl;
+			m_mergeJobs.resize(parallelMerges);
+			for (memory_size_type i = 0; i < parallelMerges; ++i)
+				m_mergeJobs[i].reset(tpie_new<merge_job>(pred));
+		}
+		while (runCount > maxFinalRunCount) {
 			log_debug() << "Merge " << runCount << " runs in merge level " << mergeLevel << '\n';
+			free_run_files(mergeLevel+1);
+			if (parallelMerges > 1) {
+				runCount = merge_level_in_parallel(mergeLevel, runCount, pi);
+				++mergeLevel;
+				continue;
+			}
 			memory_size_type newRunCount = 0;
 			for (memory_size_type i = 0; i < runCount; i += p.fanout) {
 				memory_size_type n = std::min(runCount-i, p.fanout);
@@ -379,8 +933,10 @@ private:
 			++mergeLevel;
 			runCount = newRunCount;
 		}
+		m_mergeJobs.resize(0);
 		log_debug() << "Final merge level " << mergeLevel << " has " << runCount << " runs" << std::endl;
 		initialize_final_merger(mergeLevel, runCount);
+		m_itemsPulled = 0;
 
 		m_state = stReport;
 		pi.done();
@@ -395,6 +951,7 @@ public:
 		tp_assert(m_state == stReport, "Wrong phase");
 		if (m_reportInternal) return m_itemsPulled < m_currentRunItemCount;
 		else {
+			if (m_itemsPulled >= m_limit) return false;
 			if (m_evacuated) reinitialize_final_merger();
 			return m_merger.can_pull();
 		}
@@ -411,12 +968,39 @@ public:
 			return el;
 		} else {
 			if (m_evacuated) reinitialize_final_merger();
-			return m_merger.pull();
+			++m_itemsPulled;
+			T el = m_merger.pull();
+			if (m_itemsPulled == m_limit && m_merger.can_pull()) m_merger.reset();
+			return el;
 		}
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Get the number of items that will be reported, that is, the
+	/// number of items pushed, but at most the limit.
+	///////////////////////////////////////////////////////////////////////////
 	inline stream_size_type item_count() {
-		return m_itemCount;
+		return std::min(m_itemCount, m_limit);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Predict the largest amount of temporary file space used while
+	/// sorting the given number of items with the current parameters.
+	///
+	/// This is an upper bound: runs are assumed to be as long as without
+	/// replacement selection, and every run file is assumed to end with an
+	/// almost empty block.
+	///////////////////////////////////////////////////////////////////////////
+	inline stream_size_type predicted_peak_temp_usage(stream_size_type items) const {
+		if (!m_parametersSet) throw merge_sort_not_ready();
+		if (items <= p.internalReportThreshold) return 0;
+		if (m_presorted) return items * sizeof(T);
+		stream_size_type runs = (items + p.runLength - 1) / p.runLength;
+		stream_size_type runItems = std::min(p.runLength, m_limit);
+		stream_size_type dataSize = std::min(items, runs * runItems) * sizeof(T);
+		stream_size_type runFiles = std::min(runs, static_cast<stream_size_type>(p.fanout));
+		return dataSize + runFiles * run_file_overhead()
+			+ merge_temp_usage(runs, runItems * sizeof(T), dataSize);
 	}
 
 	static memory_size_type memory_usage_phase_1(const sort_parameters & params) {
@@ -440,7 +1024,7 @@ public:
 	}
 
 	static memory_size_type memory_usage_phase_2(const sort_parameters & params) {
-		return fanout_memory_usage(params.fanout);
+		return params.parallelMerges * fanout_memory_usage(params.fanout);
 	}
 
 	static memory_size_type minimum_memory_phase_2() {
@@ -460,7 +1044,12 @@ public:
 	}
 
 	inline memory_size_type evacuated_memory_usage() const {
-		return 2*p.fanout*sizeof(temp_file);
+		memory_size_type runTables = 0;
+		for (size_t i = 0; i < 2; ++i) {
+			runTables += static_cast<memory_size_type>(array<stream_size_type>::memory_usage(m_runOffsets[i].size()))
+				+ static_cast<memory_size_type>(array<stream_size_type>::memory_usage(m_runLengths[i].size()));
+		}
+		return 2*p.fanout*sizeof(temp_file) + runTables;
 	}
 
 private:
@@ -483,11 +1072,13 @@ private:
 		// Phase 2 (merge):
 		// Run length: unbounded
 		// Fanout: determined by the size of our merge heap and the stream memory usage.
+		// With parallel merges, each merge gets an equal share of the memory.
 		log_debug() << "Phase 2: " << p.memoryPhase2 << " b available memory\n";
-		p.fanout = calculate_fanout(p.memoryPhase2);
-		if (fanout_memory_usage(p.fanout) > p.memoryPhase2) {
-			log_debug() << "Not enough memory for fanout " << p.fanout << "! (" << p.memoryPhase2 << " < " << fanout_memory_usage(p.fanout) << ")\n";
-			p.memoryPhase2 = fanout_memory_usage(p.fanout);
+		p.fanout = calculate_fanout(p.memoryPhase2 / p.parallelMerges);
+		if (memory_usage_phase_2(p) > p.memoryPhase2) {
+			log_debug() << "Not enough memory for " << p.parallelMerges << " merges of fanout " << p.fanout << "! (" << p.memoryPhase2 << " < " << memory_usage_phase_2(p) << ")\n";
+			p.parallelMerges = std::max(p.memoryPhase2 / fanout_memory_usage(p.fanout), static_cast<memory_size_type>(1));
+			p.memoryPhase2 = std::max(p.memoryPhase2, memory_usage_phase_2(p));
 		}
 
 		// Phase 3 (final merge & report):
@@ -608,6 +1199,13 @@ public:
 			p.dump(log_debug());
 			log_debug() << std::endl;
 		}
+
+		stream_size_type peak = predicted_peak_temp_usage(n);
+		if (peak > get_temp_file_available()) {
+			log_warning() << "Sorting up to " << n << " items may use " << peak
+				<< " bytes of temporary space, but only " << get_temp_file_available()
+				<< " bytes are available." << std::endl;
+		}
 	}
 
 private:
@@ -643,7 +1241,7 @@ private:
 
 		memory_size_type idx = run_file_index(mergeLevel, runNumber);
 		fs.open(m_runFiles[idx], access_read);
-		fs.seek(calculate_run_length(p.runLength, p.fanout, mergeLevel) * (runNumber / p.fanout), file_stream<T>::beginning);
+		fs.seek(run_offset(mergeLevel, runNumber), file_stream<T>::beginning);
 	}
 
 	enum state_type {
@@ -660,6 +1258,9 @@ private:
 
 	merger<T, pred_t> m_merger;
 
+	// Jobs for merging runs concurrently in phase 2.
+	array<tpie::auto_ptr<merge_job> > m_mergeJobs;
+
 	array<temp_file> m_runFiles;
 
 	// number of runs already written to disk.
@@ -687,6 +1288,31 @@ private:
 	memory_size_type m_finalMergeLevel;
 	memory_size_type m_finalRunCount;
 	memory_size_type m_finalMergeSpecialRunNumber;
+
+	// Whether the input is known to arrive in sorted order.
+	bool m_presorted;
+	// In presorted mode, the last item written to the single run.
+	T m_lastPresortedItem;
+	// In presorted mode, the number of items written to the single run.
+	stream_size_type m_presortedItems;
+
+	bool m_replacementSelection;
+	// Replacement selection: number of items in the heap in m_currentRunItems.
+	memory_size_type m_heapSize;
+	// Replacement selection: the run currently being written.
+	file_stream<T> m_runWriter;
+	stream_size_type m_runWriterOffset;
+	// Replacement selection: offsets and lengths of runs, indexed like
+	// m_runFiles by merge level modulo 2.
+	array<stream_size_type> m_runOffsets[2];
+	array<stream_size_type> m_runLengths[2];
+
+	// Maximum number of items to report.
+	stream_size_type m_limit;
+	// Whether the m_limit smallest items are kept in m_topItems.
+	bool m_boundedHeap;
+	// Bounded heap of at most m_limit items, largest item on top.
+	internal_priority_queue<T, heap_pred> m_topItems;
 };
 
 } // namespace tpie
@@ -42,9 +42,9 @@ public:
 		tp_assert(can_pull(), "pull() while !can_pull()");
 		T el = pq.top().first;
 		size_t i = pq.top().second;
-		if (in[i].can_read() && itemsRead[i] < runLength) {
+		if (in[i].can_read() && itemsLeft[i] > 0) {
 			pq.pop_and_push(std::make_pair(in[i].read(), i));
-			++itemsRead[i];
+			--itemsLeft[i];
 		} else {
 			pq.pop();
 		}
@@ -57,7 +57,7 @@ public:
 	inline void reset() {
 		in.resize(0);
 		pq.resize(0);
-		itemsRead.resize(0);
+		itemsLeft.resize(0);
 	}
 
 	// Initialize merger with given sorted input runs. Each file stream is
@@ -65,17 +65,22 @@ public:
 	// and runLength items are read from each stream (unless end of stream
 	// occurs earlier).
 	// Precondition: !can_pull()
-	inline void reset(array<file_stream<T> > & inputs, size_t runLength) {
-		this->runLength = runLength;
+	inline void reset(array<file_stream<T> > & inputs, stream_size_type runLength) {
 		tp_assert(pq.empty(), "Reset before we are done");
-		n = inputs.size();
-		in.swap(inputs);
-		pq.resize(n);
-		for (size_t i = 0; i < n; ++i) {
-			pq.unsafe_push(std::make_pair(in[i].read(), i));
-		}
-		pq.make_safe();
-		itemsRead.resize(n, 1);
+		itemsLeft.resize(inputs.size(), runLength);
+		start(inputs);
+	}
+
+	// Initialize merger with given sorted input runs of varying length.
+	// runLengths[i] items are read from inputs[i] (unless end of stream
+	// occurs earlier).
+	// Precondition: !can_pull()
+	inline void reset(array<file_stream<T> > & inputs, const array<stream_size_type> & runLengths) {
+		tp_assert(pq.empty(), "Reset before we are done");
+		tp_assert(inputs.size() == runLengths.size(), "Wrong number of run lengths");
+		itemsLeft.resize(inputs.size());
+		std::copy(runLengths.begin(), runLengths.end(), itemsLeft.begin());
+		start(inputs);
 	}
 
 	inline static memory_size_type memory_usage(memory_size_type fanout) {
@@ -86,8 +91,8 @@ public:
 			+ static_cast<memory_size_type>(array<file_stream<T> >::memory_usage(fanout)) // in
 			- fanout*sizeof(file_stream<T>) // in file_streams
 			+ fanout*file_stream<T>::memory_usage() // in file_streams
-			- sizeof(array<size_t>) // itemsRead
-			+ static_cast<memory_size_type>(array<size_t>::memory_usage(fanout)) // itemsRead
+			- sizeof(array<stream_size_type>) // itemsLeft
+			+ static_cast<memory_size_type>(array<stream_size_type>::memory_usage(fanout)) // itemsLeft
 			;
 	}
 
@@ -112,10 +117,22 @@ public:
 	};
 
 private:
+	// reset helper. Precondition: itemsLeft holds the run lengths.
+	inline void start(array<file_stream<T> > & inputs) {
+		n = inputs.size();
+		in.swap(inputs);
+		pq.resize(n);
+		for (size_t i = 0; i < n; ++i) {
+			if (itemsLeft[i] == 0 || !in[i].can_read()) continue;
+			pq.unsafe_push(std::make_pair(in[i].read(), i));
+			--itemsLeft[i];
+		}
+		pq.make_safe();
+	}
+
 	internal_priority_queue<std::pair<T, size_t>, predwrap> pq;
 	array<file_stream<T> > in;
-	array<size_t> itemsRead;
-	size_t runLength;
+	array<stream_size_type> itemsLeft;
 	size_t n;
 };
 
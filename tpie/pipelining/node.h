@@ -514,6 +514,16 @@ public:
 		return m_values.count(key) != 0;
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Find out if a piece of auxiliary data was forwarded to this
+	/// node by an immediate predecessor, as opposed to being relayed
+	/// implicitly through intermediate nodes.
+	///////////////////////////////////////////////////////////////////////////
+	inline bool is_forwarded_explicitly(std::string key) {
+		valuemap::iterator i = m_values.find(key);
+		return i != m_values.end() && i->second.second;
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief Fetch piece of auxiliary data as boost::any (the internal
 	/// representation).
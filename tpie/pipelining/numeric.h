@@ -24,6 +24,7 @@
 #include <tpie/pipelining/node.h>
 #include <tpie/pipelining/pipe_base.h>
 #include <tpie/pipelining/factory_helpers.h>
+#include <tpie/pipelining/push_batch.h>
 
 namespace tpie {
 
@@ -39,14 +40,46 @@ public:
 	inline linear_t(const dest_t & dest, item_type factor, item_type term) : dest(dest), factor(factor), term(term) {
 		add_push_destination(dest);
 		set_name("Linear transform", PRIORITY_INSIGNIFICANT);
+		if (has_push_batch<dest_t, item_type>::value)
+			set_minimum_memory(array<item_type>::memory_usage(push_batch_items<item_type>()));
 	}
+
+	virtual void begin() override {
+		node::begin();
+		if (has_push_batch<dest_t, item_type>::value)
+			buffer.resize(push_batch_items<item_type>());
+	}
+
 	inline void push(const item_type & item) {
 		dest.push(item*factor+term);
 	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Transform the items into a buffer of push_batch_items() items
+	/// and push them on in batches of at most that size.
+	///////////////////////////////////////////////////////////////////////////
+	void push_batch(array_view<const item_type> items) {
+		if (!has_push_batch<dest_t, item_type>::value) {
+			for (size_t i = 0; i < items.size(); ++i) push(items[i]);
+			return;
+		}
+		size_t i = 0;
+		while (i < items.size()) {
+			size_t n = std::min(items.size() - i, buffer.size());
+			for (size_t j = 0; j < n; ++j) buffer[j] = items[i+j]*factor+term;
+			push_batch_to(dest, array_view<const item_type>(buffer.get(), n));
+			i += n;
+		}
+	}
+
+	virtual void end() override {
+		buffer.resize(0);
+	}
 private:
 	dest_t dest;
 	item_type factor;
 	item_type term;
+	array<item_type> buffer;
 };
 
 } // namespace bits
@@ -22,7 +22,9 @@
 
 #include <tpie/pipelining/node.h>
 #include <tpie/pipelining/factory_base.h>
+#include <tpie/pipelining/push_batch.h>
 #include <tpie/array_view.h>
+#include <tpie/internal_queue.h>
 #include <boost/shared_ptr.hpp>
 #include <tpie/pipelining/maintain_order_type.h>
 #include <tpie/pipelining/parallel/options.h>
@@ -43,6 +45,44 @@ class after;
 template <typename T1, typename T2>
 class state;
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Progress indicator of a parallel worker.
+///
+/// Steps are counted in the worker thread without synchronization. When the
+/// indicator refreshes, which happens at the refresh frequency of
+/// progress_indicator_base, the count is published to the main thread.
+///////////////////////////////////////////////////////////////////////////////
+class worker_progress_indicator : public progress_indicator_base {
+public:
+	worker_progress_indicator()
+		: progress_indicator_base(0)
+		, m_published(0)
+	{
+	}
+
+	virtual void init(stream_size_type range) override { unused(range); }
+	virtual void done() override {}
+	virtual void set_range(stream_size_type range) override { unused(range); }
+
+	virtual void refresh() override {
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_published = m_current;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Number of steps as of the latest refresh. May be called from
+	/// any thread.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type get_published() {
+		boost::mutex::scoped_lock lock(m_mutex);
+		return m_published;
+	}
+
+private:
+	boost::mutex m_mutex;
+	stream_size_type m_published;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief Class containing an array of node instances. We cannot use
 /// tpie::array or similar, since we need to construct the elements in a
@@ -59,7 +99,7 @@ protected:
 	static const size_t alignment = 64;
 
 	/** Progress indicator type */
-	typedef progress_indicator_null pi_t;
+	typedef worker_progress_indicator pi_t;
 	aligned_array<pi_t, alignment> m_progressIndicators;
 
 	///////////////////////////////////////////////////////////////////////////
@@ -92,10 +132,16 @@ public:
 		return *m_dests[idx];
 	}
 
-	stream_size_type sum_steps() {
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Total number of steps taken by the workers. Unless exact is
+	/// true, the counts published at the latest refresh of each worker are
+	/// used; exact counts may only be read when the workers have terminated.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type sum_steps(bool exact = false) {
 		stream_size_type res = 0;
 		for (size_t i = 0; i < m_progressIndicators.size(); ++i) {
-			res += m_progressIndicators.get(i)->get_current();
+			pi_t * pi = m_progressIndicators.get(i);
+			res += exact ? pi->get_current() : pi->get_published();
 		}
 		return res;
 	}
@@ -463,6 +509,23 @@ public:
 		m_buffer->m_outputBuffer[m_buffer->m_outputSize++] = item;
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Copy a batch to thread-local buffer, flushing it when full.
+	///////////////////////////////////////////////////////////////////////////
+	void push_batch(array_view<const T> items) {
+		size_t i = 0;
+		while (i < items.size()) {
+			if (m_buffer->m_outputSize >= m_buffer->m_outputBuffer.size())
+				flush_buffer_impl(false);
+			size_t n = std::min(items.size() - i,
+								static_cast<size_t>(m_buffer->m_outputBuffer.size() - m_buffer->m_outputSize));
+			std::copy(items.find(i), items.find(i+n),
+					  m_buffer->m_outputBuffer.find(m_buffer->m_outputSize));
+			m_buffer->m_outputSize += n;
+			i += n;
+		}
+	}
+
 	virtual void end() override {
 		flush_buffer_impl(true);
 	}
@@ -697,9 +760,7 @@ public:
 	/// input, then the flush at the end is not needed.
 	///////////////////////////////////////////////////////////////////////////
 	virtual void push_all(array_view<item_type> items) {
-		for (size_t i = 0; i < items.size(); ++i) {
-			dest.push(items[i]);
-		}
+		push_batch_to(dest, array_view<const item_type>(items));
 
 		// virtual invocation
 		this->st.output(this->parId).flush_buffer();
@@ -733,9 +794,7 @@ public:
 	/// \brief Push all items from output buffer to the rest of the pipeline.
 	///////////////////////////////////////////////////////////////////////////
 	virtual void consume(array_view<item_type> a) override {
-		for (size_t i = 0; i < a.size(); ++i) {
-			dest.push(a[i]);
-		}
+		push_batch_to(dest, array_view<const item_type>(a));
 	}
 };
 
@@ -851,7 +910,7 @@ private:
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief  Propagate progress information.
 	///////////////////////////////////////////////////////////////////////////
-	void flush_steps() {
+	void flush_steps(bool exact = false) {
 		// The number of items has been forwarded along unchanged to all
 		// the workers (it is still a valid upper bound).
 		//
@@ -863,7 +922,7 @@ private:
 		// In effect, every time step() is called once in a single worker,
 		// we process this as if all workers called step().
 
-		stream_size_type steps = st->pipes->sum_steps();
+		stream_size_type steps = st->pipes->sum_steps(exact);
 		if (steps != m_steps) {
 			this->get_progress_indicator()->step(st->opts.numJobs*(steps - m_steps));
 			m_steps = steps;
@@ -925,6 +984,24 @@ public:
 		empty_input_buffer(lock);
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Copy a batch to the input buffer, sending it off to workers
+	/// whenever it fills up.
+	///////////////////////////////////////////////////////////////////////////
+	void push_batch(array_view<const item_type> items) {
+		size_t i = 0;
+		while (i < items.size()) {
+			size_t n = std::min(items.size() - i, st->opts.bufSize - written);
+			std::copy(items.find(i), items.find(i+n), inputBuffer.find(written));
+			written += n;
+			i += n;
+			if (written < st->opts.bufSize) break;
+			state_base::lock_t lock(st->mutex);
+			flush_steps();
+			empty_input_buffer(lock);
+		}
+	}
+
 private:
 	void empty_input_buffer(state_base::lock_t & lock) {
 		while (written > 0) {
@@ -1029,7 +1106,7 @@ public:
 		}
 		// All workers terminated
 
-		flush_steps();
+		flush_steps(true);
 	}
 };
 
@@ -99,7 +99,7 @@ void pipeline_base::operator()(stream_size_type items, progress_indicator_base &
 		i->print_memory(log_debug());
 #endif // TPIE_NDEBUG
 	}
-	g.go_all(items, pi);
+	g.go_all(items, pi, mem);
 }
 
 void pipeline_base::forward_any(std::string key, const boost::any & value) {
@@ -0,0 +1,108 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file push_batch.h  Batched push protocol.
+///
+/// Besides push(const item_type &), a node may implement
+///
+///     void push_batch(array_view<const item_type> items);
+///
+/// to receive a whole block of items in one call. Nodes that produce items
+/// in blocks call push_batch_to(dest, items), which invokes dest.push_batch
+/// if the destination implements it, and otherwise pushes the items one at
+/// a time. push_batch must be a non-template member of the destination type
+/// itself with exactly the signature above to be detected.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TPIE_PIPELINING_PUSH_BATCH_H__
+#define __TPIE_PIPELINING_PUSH_BATCH_H__
+
+#include <tpie/array_view.h>
+#include <algorithm>
+
+namespace tpie {
+
+namespace pipelining {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Number of items in the batches pushed by nodes that read or buffer
+/// items of type T themselves.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+inline memory_size_type push_batch_items() {
+	return std::max(static_cast<memory_size_type>(1),
+					static_cast<memory_size_type>(32*1024 / sizeof(T)));
+}
+
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief has_push_batch<dest_t, T>::value is true if dest_t has a member
+/// void push_batch(array_view<const T>).
+///////////////////////////////////////////////////////////////////////////////
+template <typename dest_t, typename T>
+class has_push_batch {
+	typedef char yes;
+	typedef char (&no)[2];
+
+	template <typename U, void (U::*)(array_view<const T>)>
+	struct check;
+
+	template <typename U>
+	static yes test(check<U, &U::push_batch> *);
+
+	template <typename U>
+	static no test(...);
+
+public:
+	static const bool value = sizeof(test<dest_t>(0)) == sizeof(yes);
+};
+
+template <bool batched>
+struct push_batch_impl {
+	template <typename dest_t, typename T>
+	static void go(dest_t & dest, array_view<const T> items) {
+		for (size_t i = 0; i < items.size(); ++i) dest.push(items[i]);
+	}
+};
+
+template <>
+struct push_batch_impl<true> {
+	template <typename dest_t, typename T>
+	static void go(dest_t & dest, array_view<const T> items) {
+		dest.push_batch(items);
+	}
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Push a batch of items to dest, using dest.push_batch if available.
+///////////////////////////////////////////////////////////////////////////////
+template <typename dest_t, typename T>
+inline void push_batch_to(dest_t & dest, array_view<const T> items) {
+	bits::push_batch_impl<bits::has_push_batch<dest_t, T>::value>::go(dest, items);
+}
+
+} // namespace pipelining
+
+} // namespace tpie
+
+#endif // __TPIE_PIPELINING_PUSH_BATCH_H__
@@ -0,0 +1,210 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file pipelining/rtree.h
+/// \brief Pipelining nodes bulk loading an R-tree in Hilbert order.
+///
+/// \code
+/// rtree<double> tree;
+/// tree.open("index.tpie");
+/// pipeline p = input(rectangles) | rtree_bulk_load(tree, bounds);
+/// p();
+/// \endcode
+///
+/// The Hilbert values of the rectangles are computed in parallel and the
+/// rectangles are sorted by them with pipesort before being packed into
+/// the tree.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TPIE_PIPELINING_RTREE_H__
+#define __TPIE_PIPELINING_RTREE_H__
+
+#include <tpie/pipelining/node.h>
+#include <tpie/pipelining/pipe_base.h>
+#include <tpie/pipelining/factory_helpers.h>
+#include <tpie/pipelining/parallel.h>
+#include <tpie/pipelining/sort.h>
+#include <tpie/rtree.h>
+#include <functional>
+
+namespace tpie {
+
+namespace pipelining {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief An entry along with the Hilbert value of its center.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+struct hilbert_keyed_entry {
+	stream_size_type key;
+	rtree_entry<coord_t> entry;
+};
+
+template <typename coord_t>
+struct hilbert_key_less
+	: public std::binary_function<hilbert_keyed_entry<coord_t>, hilbert_keyed_entry<coord_t>, bool> {
+	bool operator()(const hilbert_keyed_entry<coord_t> & a, const hilbert_keyed_entry<coord_t> & b) const {
+		return a.key < b.key;
+	}
+};
+
+namespace bits {
+
+template <typename coord_t>
+class hilbert_key_t {
+public:
+	/** Side of the grid the centers are mapped to. */
+	static const stream_size_type side = static_cast<stream_size_type>(1) << 32;
+
+	template <typename dest_t>
+	class type : public node {
+	public:
+		typedef rtree_entry<coord_t> item_type;
+
+		type(const dest_t & dest, const rtree_rectangle<coord_t> & bounds)
+			: dest(dest)
+			, bounds(bounds)
+		{
+			add_push_destination(dest);
+			set_name("Hilbert values", PRIORITY_INSIGNIFICANT);
+		}
+
+		void push(const item_type & e) {
+			hilbert_keyed_entry<coord_t> k;
+			k.key = hilbert_value(grid(e.mbr.xlo, e.mbr.xhi, bounds.xlo, bounds.xhi),
+								  grid(e.mbr.ylo, e.mbr.yhi, bounds.ylo, bounds.yhi),
+								  side);
+			k.entry = e;
+			dest.push(k);
+		}
+
+	private:
+		///////////////////////////////////////////////////////////////////////
+		/// \brief The grid coordinate of the center of [lo, hi] within the
+		/// bounds [min, max].
+		///////////////////////////////////////////////////////////////////////
+		static stream_size_type grid(coord_t lo, coord_t hi, coord_t min, coord_t max) {
+			double extent = static_cast<double>(max) - static_cast<double>(min);
+			if (!(extent > 0)) return 0;
+			double f = ((static_cast<double>(lo) + static_cast<double>(hi)) / 2 - static_cast<double>(min)) / extent;
+			if (!(f > 0)) return 0;
+			if (f >= 1) return side - 1;
+			return static_cast<stream_size_type>(f * static_cast<double>(side - 1));
+		}
+
+		dest_t dest;
+		rtree_rectangle<coord_t> bounds;
+	};
+};
+
+template <typename coord_t, memory_size_type fanout>
+class rtree_builder_t : public node {
+public:
+	typedef hilbert_keyed_entry<coord_t> item_type;
+	typedef rtree<coord_t, fanout> tree_type;
+
+	rtree_builder_t(tree_type & tree)
+		: tree(tree)
+		, builder(0)
+	{
+		set_name("Build R-tree", PRIORITY_SIGNIFICANT);
+		set_minimum_memory(tree_type::builder::memory_usage());
+	}
+
+	virtual void begin() override {
+		node::begin();
+		builder = tpie_new<typename tree_type::builder>(tree);
+		builder->begin();
+	}
+
+	void push(const item_type & k) {
+		builder->push(k.entry);
+	}
+
+	virtual void end() override {
+		builder->end();
+		tpie_delete(builder);
+		builder = 0;
+		node::end();
+	}
+
+private:
+	tree_type & tree;
+	typename tree_type::builder * builder;
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node computing the Hilbert value of the center of each
+/// entry on a grid covering the given bounds.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+inline pipe_middle<factory_1<bits::hilbert_key_t<coord_t>::template type, rtree_rectangle<coord_t> > >
+hilbert_keys(const rtree_rectangle<coord_t> & bounds) {
+	return factory_1<bits::hilbert_key_t<coord_t>::template type, rtree_rectangle<coord_t> >(bounds);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node replacing the contents of the tree by the entries
+/// pushed to it, which must be sorted by Hilbert value.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t, memory_size_type fanout>
+inline pipe_end<termfactory_1<bits::rtree_builder_t<coord_t, fanout>, rtree<coord_t, fanout> &> >
+rtree_builder(rtree<coord_t, fanout> & tree) {
+	return termfactory_1<bits::rtree_builder_t<coord_t, fanout>, rtree<coord_t, fanout> &>(tree);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The pipe type returned by rtree_bulk_load.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t, memory_size_type fanout>
+struct rtree_bulk_load_pipe {
+	typedef factory_1<bits::hilbert_key_t<coord_t>::template type, rtree_rectangle<coord_t> > keys_t;
+	typedef bits::pair_factory<parallel_bits::factory<keys_t>, bits::sort_factory<hilbert_key_less<coord_t> > > sorted_t;
+	typedef termfactory_1<bits::rtree_builder_t<coord_t, fanout>, rtree<coord_t, fanout> &> builder_t;
+	typedef pipe_end<bits::termpair_factory<sorted_t, builder_t> > type;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node bulk loading the tree with the entries pushed to
+/// it.
+///
+/// \param tree  The tree to replace the contents of.
+/// \param bounds  A rectangle containing the centers of the entries, which
+/// is mapped to the Hilbert curve grid.
+/// \param threads  Number of threads computing Hilbert values, or zero for
+/// the default number of workers.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t, memory_size_type fanout>
+inline typename rtree_bulk_load_pipe<coord_t, fanout>::type
+rtree_bulk_load(rtree<coord_t, fanout> & tree, const rtree_rectangle<coord_t> & bounds,
+				size_t threads = 0) {
+	if (threads == 0) threads = default_worker_count();
+	return parallel(hilbert_keys(bounds), arbitrary_order, threads)
+		| pipesort(hilbert_key_less<coord_t>())
+		| rtree_builder(tree);
+}
+
+} // namespace pipelining
+
+} // namespace tpie
+
+#endif // __TPIE_PIPELINING_RTREE_H__
@@ -24,6 +24,8 @@
 #include <tpie/pipelining/pipe_base.h>
 #include <tpie/pipelining/factory_base.h>
 #include <tpie/pipelining/merge_sorter.h>
+#include <tpie/pipelining/sortedness.h>
+#include <tpie/pipelining/push_batch.h>
 #include <tpie/parallel_sort.h>
 #include <tpie/file_stream.h>
 #include <tpie/tempname.h>
@@ -98,6 +100,8 @@ public:
 	virtual void propagate() override {
 		this->set_steps(this->m_sorter->item_count());
 		this->forward("items", static_cast<stream_size_type>(this->m_sorter->item_count()));
+		if (has_predicate_identity<pred_t>())
+			this->forward("sortedness", sortedness(predicate_identity<pred_t>()));
 	}
 
 	inline bool can_pull() const {
@@ -158,6 +162,8 @@ public:
 	virtual void propagate() override {
 		this->set_steps(this->m_sorter->item_count());
 		this->forward("items", static_cast<stream_size_type>(this->m_sorter->item_count()));
+		if (has_predicate_identity<pred_t>())
+			this->forward("sortedness", sortedness(predicate_identity<pred_t>()));
 	}
 
 	virtual void go() override {
@@ -286,6 +292,15 @@ public:
 	virtual void propagate() override {
 		if (this->can_fetch("items"))
 			m_sorter->set_items(this->fetch<stream_size_type>("items"));
+		if (has_predicate_identity<pred_t>() && this->is_forwarded_explicitly("sortedness")) {
+			sortedness s = this->template fetch<sortedness>("sortedness");
+			if (s.predicate == predicate_identity<pred_t>()) {
+				if (s.exact)
+					m_sorter->set_presorted();
+				else
+					m_sorter->set_replacement_selection(true);
+			}
+		}
 		m_sorter->begin();
 	}
 
@@ -293,6 +308,10 @@ public:
 		m_sorter->push(item);
 	}
 
+	void push_batch(array_view<const item_type> items) {
+		m_sorter->push_batch(items);
+	}
+
 	virtual void end() override {
 		node::end();
 		m_sorter->end();
@@ -321,6 +340,27 @@ template <typename child_t>
 class sort_factory_base : public factory_base {
 	const child_t & self() const { return *static_cast<const child_t *>(this); }
 public:
+	sort_factory_base()
+		: m_limit(std::numeric_limits<stream_size_type>::max())
+		, m_parallelMerges(1)
+	{
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Only output the first k items in sorted order.
+	///////////////////////////////////////////////////////////////////////////
+	void set_limit(stream_size_type k) {
+		m_limit = k;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Run up to the given number of intermediate merges concurrently.
+	/// See merge_sorter::set_parallel_merges.
+	///////////////////////////////////////////////////////////////////////////
+	void set_parallel_merges(memory_size_type merges) {
+		m_parallelMerges = merges;
+	}
+
 	template <typename dest_t>
 	struct constructed {
 	private:
@@ -337,6 +377,8 @@ public:
 		typedef typename constructed<dest_t>::pred_type pred_type;
 
 		sort_output_t<pred_type, dest_t> output(dest, self().template get_pred<item_type>());
+		output.get_sorter()->set_limit(m_limit);
+		output.get_sorter()->set_parallel_merges(m_parallelMerges);
 		this->init_sub_node(output);
 		sort_calc_t<item_type, pred_type> calc(output);
 		this->init_sub_node(calc);
@@ -345,6 +387,10 @@ public:
 
 		return input;
 	}
+
+private:
+	stream_size_type m_limit;
+	memory_size_type m_parallelMerges;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -411,6 +457,35 @@ pipesort(const pred_t & p) {
 	return pipe_middle<fact>(fact(p)).name("Sort");
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node that outputs the k smallest items in sorted order
+/// using std::less.
+///
+/// If k items fit in memory, the k smallest items are kept in a bounded heap
+/// and no temporary files are used. Otherwise, the items are merge sorted
+/// with every run and merge truncated after k items.
+///////////////////////////////////////////////////////////////////////////////
+inline pipe_middle<bits::default_pred_sort_factory>
+top_k(stream_size_type k) {
+	typedef bits::default_pred_sort_factory fact;
+	fact f;
+	f.set_limit(k);
+	return pipe_middle<fact>(f).name("Top-k");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node that outputs the k smallest items in sorted order
+/// using the given predicate.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t>
+inline pipe_middle<bits::sort_factory<pred_t> >
+top_k(stream_size_type k, const pred_t & p) {
+	typedef bits::sort_factory<pred_t> fact;
+	fact f(p);
+	f.set_limit(k);
+	return pipe_middle<fact>(f).name("Top-k");
+}
+
 template <typename T, typename pred_t=std::less<T> >
 class passive_sorter;
 
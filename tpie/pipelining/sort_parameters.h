@@ -42,6 +42,9 @@ struct sort_parameters {
 	memory_size_type fanout;
 	/** Fanout of merge tree during phase 4. Less or equal to fanout. */
 	memory_size_type finalFanout;
+	/** Number of intermediate merges run concurrently, each using an equal
+	 * share of the memory available while merging runs. */
+	memory_size_type parallelMerges;
 
 	void dump(std::ostream & out) const {
 		out << "Merge sort parameters\n"
@@ -49,6 +52,7 @@ struct sort_parameters {
 			<< "Run length:                  " << runLength << '\n'
 			<< "Phase 2 memory:              " << memoryPhase2 << '\n'
 			<< "Fanout:                      " << fanout << '\n'
+			<< "Parallel merges:             " << parallelMerges << '\n'
 			<< "Phase 3 memory:              " << memoryPhase3 << '\n'
 			<< "Final merge level fanout:    " << finalFanout << '\n'
 			<< "Internal report threshold:   " << internalReportThreshold << '\n';
@@ -0,0 +1,77 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __TPIE_PIPELINING_SORTEDNESS_H__
+#define __TPIE_PIPELINING_SORTEDNESS_H__
+
+#include <tpie/sortedness.h>
+
+namespace tpie {
+
+namespace pipelining {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sortedness metadata forwarded between nodes with the key
+/// "sortedness".
+///
+/// A node forwards a sortedness object to declare that the items it pushes
+/// are ordered by the predicate with the given identity, or, if exact is
+/// false, that they are almost ordered, meaning that each item is close to
+/// its position in sorted order. Since forwarded data is relayed implicitly
+/// through all successors, including nodes that reorder or transform items,
+/// consumers should only trust sortedness that was forwarded explicitly by an
+/// immediate predecessor; see node::is_forwarded_explicitly. Only forward it
+/// for predicates with an identity, see tpie::has_predicate_identity().
+///////////////////////////////////////////////////////////////////////////////
+struct sortedness {
+	sortedness(uint64_t predicate, bool exact = true)
+		: predicate(predicate)
+		, exact(exact)
+	{
+	}
+
+	/** Identity of the predicate, see tpie::predicate_identity(). */
+	uint64_t predicate;
+	/** False if the items are only almost sorted. */
+	bool exact;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Construct the sortedness metadata of items ordered by the given
+/// predicate.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t>
+inline sortedness sorted_by(const pred_t & pred) {
+	return sortedness(predicate_identity(pred));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Construct the sortedness metadata of items almost ordered by the
+/// given predicate.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t>
+inline sortedness almost_sorted_by(const pred_t & pred) {
+	return sortedness(predicate_identity(pred), false);
+}
+
+} // namespace pipelining
+
+} // namespace tpie
+
+#endif // __TPIE_PIPELINING_SORTEDNESS_H__
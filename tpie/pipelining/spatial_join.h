@@ -0,0 +1,465 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file pipelining/spatial_join.h
+/// \brief Partition based spatial merge join of two sets of rectangles.
+///
+/// \code
+/// spatial_join<double> j(bounds);
+/// pipeline p1 = input(buildings) | j.left();
+/// pipeline p2 = input(parcels) | j.right();
+/// pipeline p3 = j.output() | output(pairs);
+/// p3();
+/// \endcode
+///
+/// The bounds are covered by a grid of tiles, and the tiles are assigned
+/// round robin to a number of partitions. Each input rectangle is written to
+/// the partitions of the tiles it overlaps. Once both inputs are
+/// partitioned, the partitions are loaded into memory and plane swept in
+/// parallel on the job pool. A pair found in several partitions is reported
+/// only by the partition of the tile containing the lower left corner of the
+/// intersection of the two rectangles.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TPIE_PIPELINING_SPATIAL_JOIN_H__
+#define __TPIE_PIPELINING_SPATIAL_JOIN_H__
+
+#include <tpie/pipelining/node.h>
+#include <tpie/pipelining/pipe_base.h>
+#include <tpie/pipelining/factory_helpers.h>
+#include <tpie/pipelining/push_batch.h>
+#include <tpie/rtree.h>
+#include <tpie/file_stream.h>
+#include <tpie/tempname.h>
+#include <tpie/array.h>
+#include <tpie/job.h>
+#include <algorithm>
+#include <string>
+
+namespace tpie {
+
+namespace pipelining {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The ids of a left and a right rectangle that intersect.
+///////////////////////////////////////////////////////////////////////////////
+struct spatial_join_result {
+	stream_size_type left;
+	stream_size_type right;
+};
+
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The grid and the partition files shared by the nodes of a join.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+class spatial_join_state {
+public:
+	typedef rtree_entry<coord_t> entry_type;
+	typedef rtree_rectangle<coord_t> rectangle_type;
+
+	/** Block factor of the partition streams, which are all open at once. */
+	static double block_factor() {
+		return 1.0 / 32;
+	}
+
+	spatial_join_state(const rectangle_type & bounds, memory_size_type partitions,
+					   memory_size_type tiles, memory_size_type threads)
+		: bounds(bounds)
+		, partitions(partitions)
+		, tiles(tiles)
+		, threads(threads)
+	{
+		files[0].resize(partitions);
+		files[1].resize(partitions);
+		for (memory_size_type i = 0; i < partitions; ++i) {
+			files[0][i].reset(tpie_new<temp_file>());
+			files[1][i].reset(tpie_new<temp_file>());
+		}
+	}
+
+	memory_size_type tile_x(coord_t x) const {
+		return tile(x, bounds.xlo, bounds.xhi);
+	}
+
+	memory_size_type tile_y(coord_t y) const {
+		return tile(y, bounds.ylo, bounds.yhi);
+	}
+
+	memory_size_type partition(memory_size_type tx, memory_size_type ty) const {
+		return static_cast<memory_size_type>((static_cast<stream_size_type>(ty) * tiles + tx) % partitions);
+	}
+
+	rectangle_type bounds;
+	memory_size_type partitions;
+	memory_size_type tiles;
+	memory_size_type threads;
+
+	/** Partition files of the left and right input. */
+	array<auto_ptr<temp_file> > files[2];
+
+	/** Partition streams of each input while it is being partitioned. */
+	array<auto_ptr<file_stream<entry_type> > > writers[2];
+
+private:
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief The tile of the coordinate along an axis spanning [min, max].
+	/// Coordinates outside the bounds belong to the tiles at the border.
+	///////////////////////////////////////////////////////////////////////////
+	memory_size_type tile(coord_t v, coord_t min, coord_t max) const {
+		double extent = static_cast<double>(max) - static_cast<double>(min);
+		if (!(extent > 0)) return 0;
+		double f = (static_cast<double>(v) - static_cast<double>(min)) / extent;
+		if (!(f > 0)) return 0;
+		if (f >= 1) return tiles - 1;
+		return std::min(tiles - 1, static_cast<memory_size_type>(f * tiles));
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Writes each rectangle to the partitions of the tiles it overlaps.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+class spatial_join_partition_t : public node {
+public:
+	typedef rtree_entry<coord_t> item_type;
+	typedef spatial_join_state<coord_t> state_type;
+
+	spatial_join_partition_t(const node_token & token, state_type & state, memory_size_type side)
+		: node(token)
+		, state(state)
+		, side(side)
+	{
+		set_name(side == 0 ? "Partition left input" : "Partition right input", PRIORITY_INSIGNIFICANT);
+		set_minimum_memory(state.partitions
+						   * (file_stream<item_type>::memory_usage(state_type::block_factor())
+							  + sizeof(stream_size_type)));
+	}
+
+	virtual void begin() override {
+		node::begin();
+		array<auto_ptr<file_stream<item_type> > > & streams = state.writers[side];
+		streams.resize(state.partitions);
+		for (memory_size_type i = 0; i < state.partitions; ++i) {
+			streams[i].reset(tpie_new<file_stream<item_type> >(state_type::block_factor()));
+			streams[i]->open(*state.files[side][i], access_write);
+		}
+		lastWritten.resize(state.partitions, 0);
+		items = 0;
+	}
+
+	void push(const item_type & e) {
+		// A rectangle overlapping several tiles of the same partition is
+		// written to it once; lastWritten holds the number of the item
+		// last written to each partition.
+		++items;
+		memory_size_type x1 = state.tile_x(e.mbr.xlo);
+		memory_size_type x2 = state.tile_x(e.mbr.xhi);
+		memory_size_type y1 = state.tile_y(e.mbr.ylo);
+		memory_size_type y2 = state.tile_y(e.mbr.yhi);
+		for (memory_size_type ty = y1; ty <= y2; ++ty) {
+			for (memory_size_type tx = x1; tx <= x2; ++tx) {
+				memory_size_type p = state.partition(tx, ty);
+				if (lastWritten[p] == items) continue;
+				lastWritten[p] = items;
+				state.writers[side][p]->write(e);
+			}
+		}
+	}
+
+	virtual void end() override {
+		state.writers[side].resize(0);
+		lastWritten.resize(0);
+		node::end();
+	}
+
+private:
+	state_type & state;
+	memory_size_type side;
+	array<stream_size_type> lastWritten;
+	stream_size_type items;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Joins the partitions in parallel and pushes the pairs found.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+class spatial_join_output_t {
+public:
+	typedef rtree_entry<coord_t> entry_type;
+	typedef spatial_join_state<coord_t> state_type;
+
+	template <typename dest_t>
+	class type : public node {
+	public:
+		typedef spatial_join_result item_type;
+
+		type(const dest_t & dest, state_type & state,
+			 const node_token & leftToken, const node_token & rightToken)
+			: dest(dest)
+			, state(state)
+		{
+			add_dependency(leftToken);
+			add_dependency(rightToken);
+			add_push_destination(dest);
+			set_name("Spatial join", PRIORITY_SIGNIFICANT);
+			set_minimum_memory(worker_count() * sweep_job::memory_usage());
+		}
+
+		virtual void propagate() override {
+			set_steps(state.partitions);
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Keeps a window of partitions being joined on the job pool,
+		/// and pushes the pairs of each in partition order.
+		///
+		/// Without a job manager, the partitions are joined one at a time in
+		/// the calling thread.
+		///////////////////////////////////////////////////////////////////////
+		virtual void go() override {
+			bool background = job_manager_initialized();
+			memory_size_type window = std::min(background ? worker_count() : 1, state.partitions);
+			array<auto_ptr<sweep_job> > jobs(window);
+			try {
+				for (memory_size_type p = 0; p < window; ++p) {
+					jobs[p].reset(tpie_new<sweep_job>(state, p));
+					start(*jobs[p], background);
+				}
+				for (memory_size_type p = 0; p < state.partitions; ++p) {
+					auto_ptr<sweep_job> & j = jobs[p % window];
+					if (background) j->join();
+					if (j->failed) throw exception(j->error);
+					j->push_results(dest);
+					j.reset();
+					if (p + window < state.partitions) {
+						j.reset(tpie_new<sweep_job>(state, p + window));
+						start(*j, background);
+					}
+					step();
+				}
+			} catch (...) {
+				// The jobs refer to the state and must finish before they
+				// are destroyed.
+				if (background)
+					for (memory_size_type i = 0; i < window; ++i)
+						if (jobs[i].get() != 0) jobs[i]->join();
+				throw;
+			}
+		}
+
+	private:
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Loads both sides of a partition and plane sweeps them.
+		///
+		/// The pairs found are collected in a buffer of push_batch_items()
+		/// pairs, and written to a temporary stream each time it is full, so
+		/// the memory used for the results of a partition is bounded. The
+		/// rectangles of the partition are held in tpie::arrays, which the
+		/// memory manager accounts for.
+		///////////////////////////////////////////////////////////////////////
+		class sweep_job : public job {
+		public:
+			sweep_job(state_type & state, memory_size_type partition)
+				: state(state)
+				, partition(partition)
+				, failed(false)
+				, results(push_batch_items<spatial_join_result>())
+				, buffered(0)
+				, spill(state_type::block_factor())
+			{
+			}
+
+			///////////////////////////////////////////////////////////////////
+			/// \brief Memory used by a job besides the rectangles of its
+			/// partition.
+			///////////////////////////////////////////////////////////////////
+			static memory_size_type memory_usage() {
+				return sizeof(sweep_job)
+					+ file_stream<entry_type>::memory_usage(state_type::block_factor())
+					+ file_stream<spatial_join_result>::memory_usage(state_type::block_factor())
+					+ array<spatial_join_result>::memory_usage(push_batch_items<spatial_join_result>());
+			}
+
+			virtual void operator()() {
+				try {
+					array<entry_type> left;
+					array<entry_type> right;
+					load(0, left);
+					load(1, right);
+					sweep(left, right);
+				} catch (const std::exception & e) {
+					error = e.what();
+					failed = true;
+				}
+			}
+
+			///////////////////////////////////////////////////////////////////
+			/// \brief Push the pairs found, in the order they were found.
+			///////////////////////////////////////////////////////////////////
+			template <typename D>
+			void push_results(D & dest) {
+				if (spill.is_open()) {
+					spill.seek(0);
+					while (spill.can_read()) dest.push(spill.read());
+					spill.close();
+				}
+				for (memory_size_type i = 0; i < buffered; ++i) dest.push(results[i]);
+				buffered = 0;
+			}
+
+			state_type & state;
+			memory_size_type partition;
+			bool failed;
+			std::string error;
+
+		private:
+			void load(memory_size_type side, array<entry_type> & entries) {
+				file_stream<entry_type> in(state_type::block_factor());
+				in.open(*state.files[side][partition], access_read);
+				entries.resize(static_cast<size_t>(in.size()));
+				in.read(entries.begin(), entries.end());
+			}
+
+			static bool xlo_less(const entry_type & a, const entry_type & b) {
+				return a.mbr.xlo < b.mbr.xlo;
+			}
+
+			///////////////////////////////////////////////////////////////////
+			/// \brief Sweep a vertical line over both sides by left edge. The
+			/// rectangle with the least left edge is tested against those on
+			/// the other side that start before its right edge.
+			///////////////////////////////////////////////////////////////////
+			void sweep(array<entry_type> & left, array<entry_type> & right) {
+				std::sort(left.begin(), left.end(), xlo_less);
+				std::sort(right.begin(), right.end(), xlo_less);
+				size_t i = 0;
+				size_t j = 0;
+				while (i < left.size() && j < right.size()) {
+					if (left[i].mbr.xlo <= right[j].mbr.xlo) {
+						const entry_type & a = left[i++];
+						for (size_t k = j; k < right.size() && right[k].mbr.xlo <= a.mbr.xhi; ++k)
+							report(a, right[k]);
+					} else {
+						const entry_type & b = right[j++];
+						for (size_t k = i; k < left.size() && left[k].mbr.xlo <= b.mbr.xhi; ++k)
+							report(left[k], b);
+					}
+				}
+			}
+
+			void report(const entry_type & a, const entry_type & b) {
+				if (a.mbr.ylo > b.mbr.yhi || b.mbr.ylo > a.mbr.yhi) return;
+				// Reference point: the lower left corner of the intersection.
+				coord_t x = std::max(a.mbr.xlo, b.mbr.xlo);
+				coord_t y = std::max(a.mbr.ylo, b.mbr.ylo);
+				if (state.partition(state.tile_x(x), state.tile_y(y)) != partition) return;
+				if (buffered == results.size()) {
+					if (!spill.is_open()) spill.open();
+					spill.write(results.begin(), results.end());
+					buffered = 0;
+				}
+				results[buffered].left = a.id;
+				results[buffered].right = b.id;
+				++buffered;
+			}
+
+			array<spatial_join_result> results;
+			memory_size_type buffered;
+			file_stream<spatial_join_result> spill;
+		};
+
+		memory_size_type worker_count() const {
+			return state.threads == 0 ? default_worker_count() : state.threads;
+		}
+
+		static void start(sweep_job & j, bool background) {
+			if (background) j.enqueue();
+			else j();
+		}
+
+		dest_t dest;
+		state_type & state;
+	};
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Partition based spatial merge join of the rectangles pushed to
+/// left() with those pushed to right(). The ids of the intersecting pairs
+/// are pushed by output() in a phase of its own.
+///
+/// Both sides of a partition must fit in memory together. Partitions are
+/// joined while the following ones are loaded, one per worker thread. The
+/// pairs found in a partition are written to a temporary stream while it
+/// waits for the preceding partitions to be pushed.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+class spatial_join {
+public:
+	typedef rtree_entry<coord_t> item_type;
+	typedef rtree_rectangle<coord_t> rectangle_type;
+	typedef bits::spatial_join_state<coord_t> state_type;
+	typedef bits::spatial_join_partition_t<coord_t> partition_t;
+	typedef termfactory_3<partition_t, node_token, state_type &, memory_size_type> partition_factory;
+	typedef factory_3<bits::spatial_join_output_t<coord_t>::template type,
+					  state_type &, node_token, node_token> output_factory;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \param bounds  The rectangle covered by the grid. Rectangles outside
+	/// it are joined in the tiles at its border.
+	/// \param partitions  Number of partitions.
+	/// \param tiles  Number of tiles along each side of the grid; more tiles
+	/// than partitions spread clustered data over the partitions.
+	/// \param threads  Number of partitions joined at once, or zero for the
+	/// default number of workers.
+	///////////////////////////////////////////////////////////////////////////
+	spatial_join(const rectangle_type & bounds, memory_size_type partitions = 64,
+				 memory_size_type tiles = 32, memory_size_type threads = 0)
+		: state(bounds, std::max(partitions, static_cast<memory_size_type>(1)),
+				std::max(tiles, static_cast<memory_size_type>(1)), threads)
+	{
+	}
+
+	pipe_end<partition_factory> left() {
+		return partition_factory(leftToken, state, 0);
+	}
+
+	pipe_end<partition_factory> right() {
+		return partition_factory(rightToken, state, 1);
+	}
+
+	pipe_begin<output_factory> output() {
+		return output_factory(state, leftToken, rightToken);
+	}
+
+private:
+	state_type state;
+	node_token leftToken;
+	node_token rightToken;
+};
+
+} // namespace pipelining
+
+} // namespace tpie
+
+#endif // __TPIE_PIPELINING_SPATIAL_JOIN_H__
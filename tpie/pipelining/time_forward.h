@@ -0,0 +1,379 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file time_forward.h
+/// \brief Time-forward processing of directed acyclic graphs.
+///
+/// The vertices of the graph are pushed in topological order, and the i'th
+/// vertex pushed is identified by its rank i. The edges are pulled from a
+/// pull pipe as time_forward_edge pairs (from, to) of ranks with from < to,
+/// sorted by from.
+///
+/// For each vertex v, the node invokes the user's functor on v and the
+/// values of the in-neighbours of v, and pushes the returned value. The value
+/// is sent along each out-edge of v through an external priority queue keyed
+/// on the rank of the receiver, so the messages for a vertex are popped in
+/// one go when it is reached. This takes O(sort(E)) I/Os.
+///
+/// The functor must define the typedefs vertex_type and message_type and
+/// have a call operator
+/// \code
+/// message_type operator()(const vertex_type & v,
+///                         const message_type * begin,
+///                         const message_type * end) const;
+/// \endcode
+/// where [begin, end) are the values of the in-neighbours of v in no
+/// particular order. The messages of a batch of vertices are gathered in a
+/// buffer of messageBufferItems per thread; a vertex with more in-neighbours
+/// than that grows the buffer, so its messages must fit in memory.
+///
+/// When more than one thread is requested, consecutive vertices with no
+/// edges between them are evaluated concurrently, and the call operator
+/// must then be safe to invoke from several threads at once.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TPIE_PIPELINING_TIME_FORWARD_H__
+#define __TPIE_PIPELINING_TIME_FORWARD_H__
+
+#include <tpie/pipelining/node.h>
+#include <tpie/pipelining/pipe_base.h>
+#include <tpie/pipelining/factory_helpers.h>
+#include <tpie/priority_queue.h>
+#include <tpie/array.h>
+#include <tpie/job.h>
+#include <tpie/exception.h>
+#include <vector>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <utility>
+
+namespace tpie {
+
+namespace pipelining {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief An edge (from, to) between the vertices of the given ranks.
+///////////////////////////////////////////////////////////////////////////////
+typedef std::pair<stream_size_type, stream_size_type> time_forward_edge;
+
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A value sent to the vertex of the given rank.
+///////////////////////////////////////////////////////////////////////////////
+template <typename M>
+struct time_forward_message {
+	stream_size_type to;
+	M value;
+};
+
+template <typename M>
+struct time_forward_message_less
+	: public std::binary_function<time_forward_message<M>, time_forward_message<M>, bool> {
+	bool operator()(const time_forward_message<M> & a, const time_forward_message<M> & b) const {
+		return a.to < b.to;
+	}
+};
+
+template <typename fact_t, typename F>
+class time_forward_t {
+public:
+	typedef typename fact_t::constructed_type edges_t;
+	typedef typename F::vertex_type vertex_type;
+	typedef typename F::message_type message_type;
+	typedef time_forward_message<message_type> message_t;
+	typedef priority_queue<message_t, time_forward_message_less<message_type> > pq_t;
+
+	/** Number of vertices per thread in a batch evaluated concurrently. */
+	static const memory_size_type batchSizePerThread = 1024;
+	/** Number of received messages buffered per thread. */
+	static const memory_size_type messageBufferItems = 4096;
+
+	template <typename dest_t>
+	class type : public node {
+	public:
+		typedef vertex_type item_type;
+
+		type(const dest_t & dest, const fact_t & fact, const F & f, memory_size_type threads)
+			: dest(dest)
+			, edges(fact.construct())
+			, f(f)
+			, threads(std::max(threads, static_cast<memory_size_type>(1)))
+			, pq(0)
+		{
+			add_push_destination(dest);
+			add_pull_source(edges);
+			set_name("Time-forward processing", PRIORITY_SIGNIFICANT);
+			// The priority queue needs room for a fanout of a few streams.
+			set_minimum_memory(16*file_stream<message_t>::memory_usage(0.0625) + batch_memory());
+			set_memory_fraction(1.0);
+		}
+
+		virtual void begin() override {
+			node::begin();
+			memory_size_type pqMemory = get_available_memory() - batch_memory();
+			pq = tpie_new<pq_t>(pqMemory);
+			memory_size_type capacity = batch_capacity();
+			vertices.resize(capacity);
+			values.resize(capacity);
+			offsets.resize(capacity + 1);
+			messages.resize(threads * messageBufferItems);
+			batchSize = 0;
+			batchBegin = rank = 0;
+			minTarget = std::numeric_limits<stream_size_type>::max();
+			primed = false;
+		}
+
+		void push(const vertex_type & v) {
+			if (!primed) next_edge();
+			vertices[batchSize++] = v;
+			while (hasEdge && nextEdge.first == rank) {
+				if (nextEdge.second <= rank)
+					throw exception("time_forward: edge does not point forward in the topological order");
+				batchEdges.push_back(nextEdge);
+				minTarget = std::min(minTarget, nextEdge.second);
+				next_edge();
+			}
+			if (hasEdge && nextEdge.first < rank)
+				throw exception("time_forward: edges are not sorted by source");
+			++rank;
+			// The next vertex may only join the batch if no vertex of the
+			// batch sends it a message.
+			if (minTarget <= rank || batchSize == vertices.size()) flush();
+		}
+
+		virtual void end() override {
+			flush();
+			if (!primed) next_edge();
+			bool danglingEdges = hasEdge || !pq->empty();
+			tpie_delete(pq);
+			pq = 0;
+			vertices.resize(0);
+			values.resize(0);
+			offsets.resize(0);
+			messages.resize(0);
+			std::vector<time_forward_edge>().swap(batchEdges);
+			if (danglingEdges)
+				throw exception("time_forward: edge to a vertex beyond the last vertex");
+			node::end();
+		}
+
+	private:
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Evaluates the functor on a range of the current batch.
+		///////////////////////////////////////////////////////////////////////
+		class evaluate_job : public job {
+		public:
+			evaluate_job(type & t, memory_size_type begin, memory_size_type end)
+				: t(t), begin(begin), end(end), failed(false) {}
+
+			virtual void operator()() {
+				try {
+					t.evaluate(begin, end);
+				} catch (const std::exception & e) {
+					error = e.what();
+					failed = true;
+				}
+			}
+
+			type & t;
+			memory_size_type begin;
+			memory_size_type end;
+			bool failed;
+			std::string error;
+		};
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Output iterator storing the values of popped messages.
+		///////////////////////////////////////////////////////////////////////
+		class value_writer : public std::iterator<std::output_iterator_tag, void, void, void, void> {
+		public:
+			value_writer(message_type * p) : p(p) {}
+			value_writer & operator*() { return *this; }
+			value_writer & operator=(const message_t & m) { *p = m.value; return *this; }
+			value_writer & operator++() { ++p; return *this; }
+			value_writer operator++(int) { value_writer r(*this); ++p; return r; }
+		private:
+			message_type * p;
+		};
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Iterator over the messages sent along batchEdges.
+		///////////////////////////////////////////////////////////////////////
+		class message_iterator {
+		public:
+			message_iterator(const type & t, const time_forward_edge * e) : t(&t), e(e) {}
+			message_t operator*() const {
+				message_t m;
+				m.to = e->second;
+				m.value = t->values[e->first - t->batchBegin];
+				return m;
+			}
+			message_iterator & operator++() { ++e; return *this; }
+			bool operator!=(const message_iterator & other) const { return e != other.e; }
+		private:
+			const type * t;
+			const time_forward_edge * e;
+		};
+
+		void next_edge() {
+			hasEdge = edges.can_pull();
+			if (hasEdge) nextEdge = edges.pull();
+			primed = true;
+		}
+
+		memory_size_type batch_capacity() const {
+			return threads == 1 ? 1 : threads * batchSizePerThread;
+		}
+
+		memory_size_type batch_memory() const {
+			return batch_capacity() * (sizeof(vertex_type) + sizeof(message_type) + sizeof(memory_size_type))
+				+ threads * messageBufferItems * sizeof(message_type);
+		}
+
+		void evaluate(memory_size_type begin, memory_size_type end) {
+			const message_type * m = messages.get();
+			for (memory_size_type i = begin; i < end; ++i)
+				values[i] = f(vertices[i], m + offsets[i], m + offsets[i+1]);
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Evaluate the vertices [begin, end) of the batch, whose
+		/// messages are in the message buffer.
+		///////////////////////////////////////////////////////////////////////
+		void evaluate_range(memory_size_type begin, memory_size_type end) {
+			if (threads == 1 || end - begin < 2 * batchSizePerThread || !job_manager_initialized()) {
+				evaluate(begin, end);
+				return;
+			}
+			memory_size_type jobCount = (end - begin + batchSizePerThread - 1) / batchSizePerThread;
+			array<auto_ptr<evaluate_job> > jobs(jobCount);
+			for (memory_size_type i = 0; i < jobCount; ++i) {
+				memory_size_type jobBegin = begin + i * batchSizePerThread;
+				memory_size_type jobEnd = std::min(end, jobBegin + batchSizePerThread);
+				jobs[i].reset(tpie_new<evaluate_job>(*this, jobBegin, jobEnd));
+				jobs[i]->enqueue();
+			}
+			for (memory_size_type i = 0; i < jobCount; ++i) jobs[i]->join();
+			for (memory_size_type i = 0; i < jobCount; ++i)
+				if (jobs[i]->failed) throw exception(jobs[i]->error);
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Evaluate the vertices of the batch, send their values along
+		/// their out-edges and push them.
+		///
+		/// The messages of each vertex are popped in one pop_batch call. When
+		/// the message buffer fills up, the vertices whose messages are
+		/// complete are evaluated and the rest are moved to the front.
+		///////////////////////////////////////////////////////////////////////
+		void flush() {
+			if (batchSize == 0) return;
+			memory_size_type first = 0;
+			memory_size_type used = 0;
+			offsets[0] = 0;
+			for (memory_size_type i = 0; i < batchSize; ) {
+				message_t bound;
+				bound.to = batchBegin + i + 1;
+				used += static_cast<memory_size_type>(
+					pq->pop_batch(value_writer(messages.get() + used), messages.size() - used, bound));
+				if (used < messages.size() || pq->empty() || pq->top().to > batchBegin + i) {
+					offsets[++i] = used;
+				} else if (offsets[i] == 0) {
+					// The messages of vertex i alone fill the buffer.
+					array<message_type> grown(2 * messages.size());
+					std::copy(messages.begin(), messages.end(), grown.begin());
+					messages.swap(grown);
+				} else {
+					evaluate_range(first, i);
+					std::copy(messages.begin() + offsets[i], messages.begin() + used, messages.begin());
+					used -= offsets[i];
+					offsets[i] = 0;
+					first = i;
+				}
+			}
+			evaluate_range(first, batchSize);
+
+			if (!batchEdges.empty())
+				pq->push_batch(message_iterator(*this, &batchEdges[0]),
+							   message_iterator(*this, &batchEdges[0] + batchEdges.size()));
+			for (memory_size_type i = 0; i < batchSize; ++i) dest.push(values[i]);
+
+			batchEdges.clear();
+			batchBegin += batchSize;
+			batchSize = 0;
+			minTarget = std::numeric_limits<stream_size_type>::max();
+		}
+
+		dest_t dest;
+		edges_t edges;
+		F f;
+		memory_size_type threads;
+		pq_t * pq;
+
+		/** Vertices of the current batch. */
+		array<vertex_type> vertices;
+		/** Values computed for the vertices of the current batch. */
+		array<message_type> values;
+		/** Messages of the i'th vertex of the batch are at offsets [i, i+1). */
+		array<memory_size_type> offsets;
+		/** Messages received by the vertices of the batch. */
+		array<message_type> messages;
+		/** Out-edges of the vertices of the current batch. */
+		std::vector<time_forward_edge> batchEdges;
+		memory_size_type batchSize;
+		/** Rank of the first vertex of the batch. */
+		stream_size_type batchBegin;
+		/** Rank of the next vertex pushed. */
+		stream_size_type rank;
+		/** Least target of an edge in batchEdges. */
+		stream_size_type minTarget;
+		/** Next edge not yet in batchEdges, if hasEdge. */
+		time_forward_edge nextEdge;
+		bool hasEdge;
+		/** Whether the first edge has been pulled. */
+		bool primed;
+	};
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node that evaluates a DAG by time-forward processing.
+///
+/// Vertices are pushed in topological order and the value computed for each
+/// vertex is pushed in the same order. See time_forward.h.
+///
+/// \param edges  Pull pipe of time_forward_edge sorted by source rank.
+/// \param f  Functor computing the value of a vertex.
+/// \param threads  Number of threads evaluating the functor.
+///////////////////////////////////////////////////////////////////////////////
+template <typename fact_t, typename F>
+inline pipe_middle<factory_3<bits::time_forward_t<fact_t, F>::template type, fact_t, F, memory_size_type> >
+time_forward(const pullpipe_begin<fact_t> & edges, const F & f, memory_size_type threads = 1) {
+	return factory_3<bits::time_forward_t<fact_t, F>::template type, fact_t, F, memory_size_type>(edges.factory, f, threads);
+}
+
+} // namespace pipelining
+
+} // namespace tpie
+
+#endif // __TPIE_PIPELINING_TIME_FORWARD_H__
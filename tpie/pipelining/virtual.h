@@ -24,6 +24,14 @@
 #ifndef __TPIE_PIPELINING_VIRTUAL_H__
 #define __TPIE_PIPELINING_VIRTUAL_H__
 
+#include <tpie/array.h>
+#include <tpie/pipelining/push_batch.h>
+#include <boost/type_traits/remove_const.hpp>
+#include <boost/type_traits/remove_reference.hpp>
+#include <boost/type_traits/is_reference.hpp>
+#include <boost/type_traits/is_pod.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+
 namespace tpie {
 
 namespace pipelining {
@@ -69,18 +77,32 @@ struct maybe_add_const_ref<T *> {
 	typedef T * type;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The item type without const and reference qualifiers, used for
+/// batches of items.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+struct batch_value {
+	typedef typename boost::remove_const<typename boost::remove_reference<T>::type>::type type;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief Virtual base node that is injected into the beginning of a
 /// virtual chunk. For efficiency, the push method accepts a const reference
 /// type unless the item type is already const/ref/pointer.
+///
+/// push_batch crosses the virtual chunk boundary with a single virtual call
+/// per batch; see push_batch.h.
 ///////////////////////////////////////////////////////////////////////////////
 template <typename Input>
 class virtsrc : public node {
 	typedef typename maybe_add_const_ref<Input>::type input_type;
+	typedef typename batch_value<Input>::type value_type;
 
 public:
 	virtual const node_token & get_token() = 0;
 	virtual void push(input_type v) = 0;
+	virtual void push_batch(array_view<const value_type> items) = 0;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -93,6 +115,7 @@ public:
 
 private:
 	typedef typename maybe_add_const_ref<item_type>::type input_type;
+	typedef typename batch_value<item_type>::type value_type;
 	dest_t dest;
 
 public:
@@ -110,17 +133,34 @@ public:
 	void push(input_type v) {
 		dest.push(v);
 	}
+
+	void push_batch(array_view<const value_type> items) {
+		push_batch_to(dest, items);
+	}
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief Virtual node that is injected into the end of a virtual
 /// chunk. May be dynamically connected to a virtsrc using the set_destination
 /// method.
+///
+/// When Output is a POD value type, items pushed to the virtrecv are
+/// collected in a buffer that is passed on with a single virtual
+/// push_batch call when it is full and in end(), so the joint between two
+/// virtual chunks costs one virtual call per batch rather than per item.
+/// Other item types (references, or types whose copy assignment may not be
+/// bitwise, such as tpie::array) are forwarded one virtual push at a time.
 ///////////////////////////////////////////////////////////////////////////////
 template <typename Output>
 class virtrecv : public node {
+	typedef typename batch_value<Output>::type value_type;
+	static const bool buffered = !boost::is_reference<Output>::value
+		&& boost::is_pod<value_type>::value;
+
 	virtrecv *& m_self;
 	virtsrc<Output> * m_virtdest;
+	array<value_type> m_buffer;
+	memory_size_type m_buffered;
 
 public:
 	typedef Output item_type;
@@ -128,28 +168,46 @@ public:
 	virtrecv(virtrecv *& self)
 		: m_self(self)
 		, m_virtdest(0)
+		, m_buffered(0)
 	{
 		m_self = this;
 		set_name("Virtual destination", PRIORITY_INSIGNIFICANT);
+		if (buffered)
+			set_minimum_memory(static_cast<memory_size_type>(
+				array<value_type>::memory_usage(push_batch_items<value_type>())));
 	}
 
 	virtrecv(const virtrecv & other)
 		: node(other)
 		, m_self(other.m_self)
 		, m_virtdest(other.m_virtdest)
+		, m_buffered(0)
 	{
 		m_self = this;
 	}
 
-	void begin() {
+	virtual void begin() override {
 		node::begin();
 		if (m_virtdest == 0) {
 			throw tpie::exception("No virtual destination");
 		}
+		allocate_buffer(boost::integral_constant<bool, buffered>());
+		m_buffered = 0;
 	}
 
 	void push(typename maybe_add_const_ref<Output>::type v) {
-		m_virtdest->push(v);
+		push(v, boost::integral_constant<bool, buffered>());
+	}
+
+	void push_batch(array_view<const value_type> items) {
+		flush();
+		m_virtdest->push_batch(items);
+	}
+
+	virtual void end() override {
+		flush();
+		m_buffer.resize(0);
+		node::end();
 	}
 
 	void set_destination(virtsrc<Output> * dest) {
@@ -160,6 +218,29 @@ public:
 		m_virtdest = dest;
 		add_push_destination(dest->get_token());
 	}
+
+private:
+	void allocate_buffer(boost::true_type) {
+		m_buffer.resize(push_batch_items<value_type>());
+	}
+
+	void allocate_buffer(boost::false_type) {
+	}
+
+	void push(typename maybe_add_const_ref<Output>::type v, boost::true_type) {
+		m_buffer[m_buffered++] = v;
+		if (m_buffered == m_buffer.size()) flush();
+	}
+
+	void push(typename maybe_add_const_ref<Output>::type v, boost::false_type) {
+		m_virtdest->push(v);
+	}
+
+	void flush() {
+		if (m_buffered == 0) return;
+		m_virtdest->push_batch(array_view<const value_type>(m_buffer.get(), m_buffered));
+		m_buffered = 0;
+	}
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -46,8 +46,9 @@ class pq_merge_heap {
 		/// \brief Constructor.
 		///
 		/// \param elements Maximum allowed size of the heap.
+		/// \param comp Comparator instance
 		///////////////////////////////////////////////////////////////////////
-		pq_merge_heap(memory_size_type elements);
+		pq_merge_heap(memory_size_type elements, Comparator comp = Comparator());
 
 		///////////////////////////////////////////////////////////////////////
 		/// \brief Destructor.
@@ -19,7 +19,8 @@
 
 
 template <typename T, typename Comparator>
-pq_merge_heap<T, Comparator>::pq_merge_heap(memory_size_type elements) {
+pq_merge_heap<T, Comparator>::pq_merge_heap(memory_size_type elements, Comparator comp)
+	: comp_(comp) {
 	maxsize = elements;
 	heap = tpie_new_array<T>(elements);
 	runs = tpie_new_array<run_type>(elements);
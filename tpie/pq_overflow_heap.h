@@ -52,6 +52,17 @@ public:
     ///////////////////////////////////////////////////////////////////////////
     void push(const T& x);
 
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Insert items from [first, last) until the queue is full.
+    ///
+    /// The heap order is rebuilt once when the items outnumber those
+    /// already in the queue, and restored item by item otherwise.
+    ///
+    /// \return Iterator to the first item that was not inserted.
+    ///////////////////////////////////////////////////////////////////////////
+    template <typename IT>
+    IT push_batch(IT first, IT last);
+
     ///////////////////////////////////////////////////////////////////////////
     /// \brief Remove the top element from the priority queue.
     ///////////////////////////////////////////////////////////////////////////
@@ -33,6 +33,25 @@ inline void pq_overflow_heap<T, Comparator>::push(const T& x) {
 	h.push(x);
 }
 
+template<typename T, typename Comparator>
+template<typename IT>
+inline IT pq_overflow_heap<T, Comparator>::push_batch(IT first, IT last) {
+	memory_size_type old = h.size();
+	bool rebuild = false;
+	for(; first != last && h.size() < maxsize; ++first) {
+		// Sift items up until they outnumber the items already in the
+		// heap; then append the rest and rebuild the heap once.
+		if(h.size() < 2*old) {
+			h.push(*first);
+		} else {
+			h.unsafe_push(*first);
+			rebuild = true;
+		}
+	}
+	if(rebuild) h.make_safe();
+	return first;
+}
+
 template<typename T, typename Comparator>
 inline void pq_overflow_heap<T, Comparator>::pop() {
 	assert(!empty());
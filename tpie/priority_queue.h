@@ -41,6 +41,7 @@
 #include <tpie/err.h>
 #include <tpie/stream.h>
 #include <tpie/array.h>
+#include <tpie/job.h>
 #include <boost/filesystem.hpp>
 
 namespace tpie {
@@ -50,6 +51,24 @@ namespace tpie {
 		{ }
 	};
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Default Canceller of priority_queue: no elements cancel.
+///
+/// A Canceller has a call operator taking two elements a and b, where a
+/// immediately precedes b in the order of the queue, that returns true if
+/// a and b cancel each other, in which case both are dropped from the
+/// queue. The static member enabled tells whether cancellation is checked
+/// at all.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+struct pq_no_cancel {
+	static const bool enabled = false;
+
+	bool operator()(const T &, const T &) const {
+		return false;
+	}
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \class priority_queue
 /// \brief External memory priority queue implementation.
@@ -71,9 +90,24 @@ namespace tpie {
 /// However, even with as little as 8 MB of memory, this maximum capacity in
 /// practice exceeds 2**48, corresponding to a petabyte-sized dataset of 32-bit
 /// integers.
+///
+/// By default, slot writes and group buffer refills run as jobs in the TPIE
+/// job manager. After the deletion buffer has been refilled, group buffers
+/// that have run low are refilled in the background while the deletion
+/// buffer is consumed, and a full insertion buffer is written to its slot
+/// while subsequent items are pushed. Operations that need the group and
+/// slot structure wait for these jobs to finish. See set_background_merging.
+/// If the job manager is not initialized, all merging is done synchronously.
+///
+/// With a Canceller other than pq_no_cancel, adjacent elements that cancel
+/// each other (see pq_no_cancel) are dropped when the insertion buffer is
+/// written to a slot and whenever slots and group buffers are merged, so
+/// they do not occupy the queue until they reach the top. size() counts
+/// the elements not yet cancelled.
 ///////////////////////////////////////////////////////////////////////////////
 
-template<typename T, typename Comparator = std::less<T>, typename OPQType = pq_overflow_heap<T, Comparator> >
+template<typename T, typename Comparator = std::less<T>, typename OPQType = pq_overflow_heap<T, Comparator>,
+		 typename Canceller = pq_no_cancel<T> >
 class priority_queue {
 	typedef memory_size_type group_type;
 	typedef memory_size_type slot_type;
@@ -83,13 +117,19 @@ public:
 	///
 	/// \param f Factor of memory that the priority queue is allowed to use.
 	/// \param b Block factor
+	/// \param comp Comparator instance
+	/// \param cancel Canceller instance
 	///////////////////////////////////////////////////////////////////////////
-	priority_queue(double f=1.0, float b=0.0625);
+	priority_queue(double f=1.0, float b=0.0625, Comparator comp=Comparator(),
+				   Canceller cancel=Canceller());
 
 #ifndef DOXYGEN
 	// \param mmavail Number of bytes the priority queue is allowed to use.
 	// \param b Block factor
-	priority_queue(memory_size_type mm_avail, float b=0.0625);
+	// \param comp Comparator instance
+	// \param cancel Canceller instance
+	priority_queue(memory_size_type mm_avail, float b=0.0625, Comparator comp=Comparator(),
+				   Canceller cancel=Canceller());
 #endif
 
 
@@ -156,8 +196,56 @@ public:
     /////////////////////////////////////////////////////////
     template <typename F> F pop_equals(F f);
 
+    /////////////////////////////////////////////////////////
+    ///
+    /// Insert the items in the range [first, last) into the
+    /// priority queue.
+    ///
+    /// Items are copied into the insertion buffer in chunks
+    /// that fill it, and the heap order is restored once per
+    /// chunk rather than once per item.
+    ///
+    /////////////////////////////////////////////////////////
+    template <typename IT> void push_batch(IT first, IT last);
+
+    /////////////////////////////////////////////////////////
+    ///
+    /// Remove at most n elements from the top of the priority
+    /// queue and write them in order to the output iterator.
+    ///
+    /// Runs of elements in the deletion buffer that precede
+    /// the top of the insertion buffer are copied in one go.
+    ///
+    /// \return The number of elements removed
+    ///
+    /////////////////////////////////////////////////////////
+    template <typename OutputIterator>
+    stream_size_type pop_batch(OutputIterator out, stream_size_type n);
+
+    /////////////////////////////////////////////////////////
+    ///
+    /// Remove at most n elements that compare less than
+    /// bound from the top of the priority queue and write
+    /// them in order to the output iterator.
+    ///
+    /// \return The number of elements removed
+    ///
+    /////////////////////////////////////////////////////////
+    template <typename OutputIterator>
+    stream_size_type pop_batch(OutputIterator out, stream_size_type n, const T & bound);
+
+    /////////////////////////////////////////////////////////
+    ///
+    /// Enable or disable background slot writes and group
+    /// buffer refills. Background jobs require the job
+    /// manager; without it, merging is always synchronous.
+    ///
+    /////////////////////////////////////////////////////////
+    void set_background_merging(bool enabled);
+
 private:
     Comparator comp_;
+    Canceller cancel_;
     T dummy;
 
     T min;
@@ -223,14 +311,37 @@ private:
     temp_file & group_data(group_type groupid);
     memory_size_type slot_max_size(slot_type slotid);
     void write_slot(slot_type slotid, T* arr, memory_size_type len);
+    void slot_written(slot_type slotid, memory_size_type len);
     slot_type free_slot(group_type group);
+    void flush_insertion_buffer();
     void empty_group(group_type group);
     void fill_buffer();
-    void fill_group_buffer(group_type group);
+    template <typename OutputIterator>
+    stream_size_type pop_batch_below(OutputIterator out, stream_size_type n, const T * bound);
+    stream_size_type fill_group_buffer(group_type group);
+    memory_size_type cancel_sorted(T * arr, memory_size_type len);
     void compact(slot_type slot);
     void validate();
     void remove_group_buffer(group_type group);
     void dump();
+
+	class fill_group_job;
+	class write_slot_job;
+	class cancel_window;
+
+	/** Whether slot writes and group buffer refills run as jobs. */
+	bool m_background;
+	/** Number of group buffers refilled concurrently in the background,
+	 * bounded by the memory released by mergebuffer. */
+	memory_size_type m_backgroundMerges;
+	/** Number of fill jobs currently enqueued. */
+	memory_size_type m_activeFillJobs;
+	tpie::array<tpie::auto_ptr<fill_group_job> > m_fillJobs;
+	tpie::auto_ptr<write_slot_job> m_writeJob;
+	bool m_writeJobActive;
+
+	void start_background_refill();
+	void wait_for_background(bool rethrow = true);
 };
 
 #include "priority_queue.inl"
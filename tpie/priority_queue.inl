@@ -17,9 +17,127 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
-template<typename T, typename Comparator, typename OPQType>
-priority_queue<T, Comparator, OPQType>::priority_queue(double f, float b) :
-block_factor(b) { // constructor mem fraction
+///////////////////////////////////////////////////////////////////////////////
+// Background job refilling every stride'th group buffer starting from first
+// that has fewer than setting_mmark elements.
+///////////////////////////////////////////////////////////////////////////////
+template<typename T, typename Comparator, typename OPQType, typename Canceller>
+class priority_queue<T, Comparator, OPQType, Canceller>::fill_group_job : public job {
+public:
+	fill_group_job(priority_queue * pq) : pq(pq), failed(false) {}
+
+	void set_groups(group_type first, group_type stride, group_type end) {
+		this->first = first;
+		this->stride = stride;
+		this->end = end;
+		cancelled = 0;
+	}
+
+	virtual void operator()() {
+		try {
+			for(group_type i = first; i < end; i += stride) {
+				if(pq->group_size(i) < pq->setting_mmark)
+					cancelled += pq->fill_group_buffer(i);
+			}
+		} catch (const std::exception & e) {
+			error = e.what();
+			failed = true;
+		}
+	}
+
+	priority_queue * pq;
+	group_type first;
+	group_type stride;
+	group_type end;
+	/** Number of elements cancelled by the refills, subtracted from m_size
+	 * when the job is joined. */
+	stream_size_type cancelled;
+	bool failed;
+	std::string error;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Background job writing the first len elements of mergebuffer to a slot.
+///////////////////////////////////////////////////////////////////////////////
+template<typename T, typename Comparator, typename OPQType, typename Canceller>
+class priority_queue<T, Comparator, OPQType, Canceller>::write_slot_job : public job {
+public:
+	write_slot_job(priority_queue * pq) : pq(pq), failed(false) {}
+
+	void set_slot(temp_file * file, memory_size_type len) {
+		this->file = file;
+		this->len = len;
+	}
+
+	virtual void operator()() {
+		try {
+			file_stream<T> data(pq->block_factor);
+			data.open(*file);
+			data.write(pq->mergebuffer.get(), pq->mergebuffer.get()+len);
+		} catch (const std::exception & e) {
+			error = e.what();
+			failed = true;
+		}
+	}
+
+	priority_queue * pq;
+	temp_file * file;
+	memory_size_type len;
+	bool failed;
+	std::string error;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Holds back the last element output by a merge, so that it can be dropped
+// together with the next element if the two cancel.
+///////////////////////////////////////////////////////////////////////////////
+template<typename T, typename Comparator, typename OPQType, typename Canceller>
+class priority_queue<T, Comparator, OPQType, Canceller>::cancel_window {
+public:
+	cancel_window(const Canceller & cancel) : cancel(cancel), held(false), cancelled(0) {}
+
+	// Feed the next element of the merge. Returns true if an element is
+	// ready to be output in ready.
+	bool next(const T & x) {
+		if(!Canceller::enabled) {
+			ready = x;
+			return true;
+		}
+		if(held && cancel(item, x)) {
+			held = false;
+			cancelled += 2;
+			return false;
+		}
+		bool r = held;
+		if(r) ready = item;
+		item = x;
+		held = true;
+		return r;
+	}
+
+	// At the end of the merge, release the element held back, if any.
+	bool flush() {
+		if(!held) return false;
+		ready = item;
+		held = false;
+		return true;
+	}
+
+	memory_size_type held_back() const {
+		return held ? 1 : 0;
+	}
+
+	Canceller cancel;
+	T item;
+	T ready;
+	bool held;
+	stream_size_type cancelled;
+};
+
+template<typename T, typename Comparator, typename OPQType, typename Canceller>
+priority_queue<T, Comparator, OPQType, Canceller>::priority_queue(double f, float b, Comparator comp,
+																  Canceller cancel) :
+comp_(comp), cancel_(cancel), block_factor(b) { // constructor mem fraction
 	assert(f<= 1.0 && f > 0);
 	assert(b > 0.0);
 	memory_size_type mm_avail = consecutive_memory_available();
@@ -31,9 +149,10 @@ block_factor(b) { // constructor mem fraction
 }
 
 #ifndef DOXYGEN
-template<typename T, typename Comparator, typename OPQType>
-priority_queue<T, Comparator, OPQType>::priority_queue(memory_size_type mm_avail, float b) :
-block_factor(b) { // constructor absolute mem
+template<typename T, typename Comparator, typename OPQType, typename Canceller>
+priority_queue<T, Comparator, OPQType, Canceller>::priority_queue(memory_size_type mm_avail, float b, Comparator comp,
+																  Canceller cancel) :
+comp_(comp), cancel_(cancel), block_factor(b) { // constructor absolute mem
 	assert(mm_avail <= get_memory_manager().limit() && mm_avail > 0);
 	assert(b > 0.0);
 	TP_LOG_DEBUG("priority_queue: Memory limit: " 
@@ -43,8 +162,8 @@ block_factor(b) { // constructor absolute mem
 }
 #endif
 
-template<typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::init(memory_size_type mm_avail) { // init
+template<typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::init(memory_size_type mm_avail) { // init
 #ifdef _WIN32
 #ifndef _WIN64
 	mm_avail = std::min(mm_avail, static_cast<memory_size_type>(1024*1024*512));
@@ -78,7 +197,9 @@ void priority_queue<T, Comparator, OPQType>::init(memory_size_type mm_avail) { /
 		const memory_size_type extra_overhead =
 			  2*(usage+sizeof(file_stream<T>*)+alloc_overhead) //temporary streams
 			+ 2*(sizeof(T)+sizeof(group_type)); //mergeheap
-		const memory_size_type additional_overhead = 16*1024; //Just leave a bit unused
+		const memory_size_type job_overhead = default_worker_count()*(sizeof(fill_group_job)+sizeof(tpie::auto_ptr<fill_group_job>))
+			+ sizeof(write_slot_job); //background jobs
+		const memory_size_type additional_overhead = 16*1024 + job_overhead; //Just leave a bit unused
 		TP_LOG_DEBUG("fanout_overhead     " << fanout_overhead     << ",\n" <<
 		             "sq_fanout_overhead  " << sq_fanout_overhead  << ",\n" <<
 		             "heap_m_overhead     " << heap_m_overhead     << ",\n" <<
@@ -149,6 +270,14 @@ void priority_queue<T, Comparator, OPQType>::init(memory_size_type mm_avail) { /
 		assert(2*setting_m > sizeof(file_stream<T>) + setting_k*(sizeof(T) + sizeof(size_type)
 		                                                         + sizeof(file_stream<T>)));
 
+		// Each background group buffer refill uses up to setting_k+1 streams
+		// and a merge heap in the memory released by mergebuffer.
+		const memory_size_type merge_usage = (setting_k+1)*(usage+sizeof(file_stream<T>*))
+			+ setting_k*(sizeof(T)+sizeof(group_type));
+		m_backgroundMerges = (2*setting_m*sizeof(T))/merge_usage;
+		m_backgroundMerges = std::min(m_backgroundMerges, default_worker_count());
+		m_backgroundMerges = std::max(m_backgroundMerges, static_cast<memory_size_type>(1));
+
 	}
 
 	current_r = 0;
@@ -171,7 +300,7 @@ void priority_queue<T, Comparator, OPQType>::init(memory_size_type mm_avail) { /
 		throw exception("Priority queue: m < m'");
 	}
 
-	opq.reset(tpie_new<OPQType>(setting_m));
+	opq.reset(tpie_new<OPQType>(setting_m, comp_));
 	assert(OPQType::sorted_factor == 1);
 
 	// state arrays contain: start + size
@@ -198,12 +327,24 @@ void priority_queue<T, Comparator, OPQType>::init(memory_size_type mm_avail) { /
 	ss << tempname::tpie_name("pq_data");
 	datafiles.resize(setting_k*setting_k);
 	groupdatafiles.resize(setting_k);
+
+	m_background = job_manager_initialized();
+	m_activeFillJobs = 0;
+	m_writeJobActive = false;
+	m_fillJobs.resize(m_backgroundMerges);
+	for(memory_size_type i = 0; i < m_backgroundMerges; i++) {
+		m_fillJobs[i].reset(tpie_new<fill_group_job>(this));
+	}
+	m_writeJob.reset(tpie_new<write_slot_job>(this));
+	TP_LOG_DEBUG("background merges: " << m_backgroundMerges << "\n");
+
 	TP_LOG_DEBUG("memory after alloc: " 
 				 << get_memory_manager().available() << "b" << "\n");
 }
 
-template <typename T, typename Comparator, typename OPQType>
-priority_queue<T, Comparator, OPQType>::~priority_queue() { // destructor
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+priority_queue<T, Comparator, OPQType, Canceller>::~priority_queue() { // destructor
+	wait_for_background(false);
 	datafiles.resize(0); // unlink slots
 	groupdatafiles.resize(0); // unlink groups 
 
@@ -212,90 +353,108 @@ priority_queue<T, Comparator, OPQType>::~priority_queue() { // destructor
 	mergebuffer.resize(0);
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::push(const T& x) {
-
-	if(opq->full()) {
-		// When the overflow priority queue (aka. insertion buffer) is full,
-		// insert its contents into a new slot in group 0.
-		//
-		// To maintain the heap invariant
-		//     deletion buffer <= group buffer 0 <= group 0 slots
-		// we bubble lesser elements from insertion buffer down into
-		// deletion buffer and group buffer 0.
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::push(const T& x) {
+	if(opq->full()) flush_insertion_buffer();
 
-		slot_type slot = free_slot(0); // (if group 0 is full, we recursively empty group i
-		                               // by merging it into a slot in group i+1)
-
-		assert(opq->sorted_size() == setting_m);
-		T* arr = opq->sorted_array();
+	// insertion buffer is non-full. insert element.
+	opq->push(x);
+	m_size++;
+#ifndef NDEBUG
+	validate();
+#endif
+}
 
-		// Bubble lesser elements down into deletion buffer
-		if(buffer_size > 0) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::flush_insertion_buffer() {
+	// When the overflow priority queue (aka. insertion buffer) is full,
+	// insert its contents into a new slot in group 0.
+	//
+	// To maintain the heap invariant
+	//     deletion buffer <= group buffer 0 <= group 0 slots
+	// we bubble lesser elements from insertion buffer down into
+	// deletion buffer and group buffer 0.
 
-			// fetch insertion buffer
-			memcpy(&mergebuffer[0], &arr[0], sizeof(T)*opq->sorted_size());
+	wait_for_background();
 
-			// fetch deletion buffer
-			memcpy(&mergebuffer[opq->sorted_size()], &buffer[buffer_start], sizeof(T)*buffer_size);
+	slot_type slot = free_slot(0); // (if group 0 is full, we recursively empty group i
+	                               // by merging it into a slot in group i+1)
 
-			// sort buffer elements
-			std::sort(mergebuffer.get(), mergebuffer.get()+(buffer_size+opq->sorted_size()), comp_);
+	assert(opq->sorted_size() == setting_m);
+	T* arr = opq->sorted_array();
 
-			// smaller elements go in deletion buffer
-			memcpy(buffer.get()+buffer_start, mergebuffer.get(), sizeof(T)*buffer_size);
+	// Bubble lesser elements down into deletion buffer
+	if(buffer_size > 0) {
 
-			// larger elements go in insertion buffer
-			memcpy(&arr[0], mergebuffer.get()+buffer_size, sizeof(T)*opq->sorted_size());
-		}
+		// fetch insertion buffer
+		memcpy(&mergebuffer[0], &arr[0], sizeof(T)*opq->sorted_size());
 
-		// Bubble lesser elements down into group buffer 0
-		if(group_size(0)> 0) {
+		// fetch deletion buffer
+		memcpy(&mergebuffer[opq->sorted_size()], &buffer[buffer_start], sizeof(T)*buffer_size);
 
-			// Merge insertion buffer and group buffer 0
-			assert(group_size(0)+opq->sorted_size() <= setting_m*2);
-			memory_size_type j = 0;
+		// sort buffer elements
+		std::sort(mergebuffer.get(), mergebuffer.get()+(buffer_size+opq->sorted_size()), comp_);
 
-			// fetch gbuffer0
-			for(stream_size_type i = group_start(0); i < group_start(0)+group_size(0); i++) {
-				mergebuffer[j] = gbuffer0[static_cast<memory_size_type>(i%setting_m)];
-				++j;
-			}
+		// smaller elements go in deletion buffer
+		memcpy(buffer.get()+buffer_start, mergebuffer.get(), sizeof(T)*buffer_size);
 
-			// fetch insertion buffer
-			memcpy(&mergebuffer[j], &arr[0], sizeof(T)*opq->sorted_size());
+		// larger elements go in insertion buffer
+		memcpy(&arr[0], mergebuffer.get()+buffer_size, sizeof(T)*opq->sorted_size());
+	}
 
-			// sort
-			std::sort(mergebuffer.get(), mergebuffer.get()+(group_size(0)+opq->sorted_size()), comp_);
+	// Bubble lesser elements down into group buffer 0
+	if(group_size(0)> 0) {
 
-			// smaller elements go in gbuffer0
-			memcpy(gbuffer0.get(), mergebuffer.get(), static_cast<size_t>(sizeof(T)*group_size(0)));
-			group_start_set(0,0);
+		// Merge insertion buffer and group buffer 0
+		assert(group_size(0)+opq->sorted_size() <= setting_m*2);
+		memory_size_type j = 0;
 
-			// larger elements go in insertion buffer (actually a free group 0 slot)
-			memcpy(&arr[0], &mergebuffer[group_size(0)], sizeof(T)*opq->sorted_size());
+		// fetch gbuffer0
+		for(stream_size_type i = group_start(0); i < group_start(0)+group_size(0); i++) {
+			mergebuffer[j] = gbuffer0[static_cast<memory_size_type>(i%setting_m)];
+			++j;
 		}
 
-		// move insertion buffer (which has elements larger than all of
-		// gbuffer0 and deletion buffer) into a free group 0 slot
+		// fetch insertion buffer
+		memcpy(&mergebuffer[j], &arr[0], sizeof(T)*opq->sorted_size());
 
-		write_slot(slot, arr, opq->sorted_size());
-		opq->sorted_pop();
+		// sort
+		std::sort(mergebuffer.get(), mergebuffer.get()+(group_size(0)+opq->sorted_size()), comp_);
 
-		// insertion buffer is now empty
+		// smaller elements go in gbuffer0
+		memcpy(gbuffer0.get(), mergebuffer.get(), static_cast<size_t>(sizeof(T)*group_size(0)));
+		group_start_set(0,0);
 
+		// larger elements go in insertion buffer (actually a free group 0 slot)
+		memcpy(&arr[0], &mergebuffer[group_size(0)], sizeof(T)*opq->sorted_size());
 	}
 
-	// insertion buffer is non-full. insert element.
-	opq->push(x);
-	m_size++;
-#ifndef NDEBUG
-	validate();
-#endif
+	// move insertion buffer (which has elements larger than all of
+	// gbuffer0 and deletion buffer) into a free group 0 slot,
+	// dropping elements that cancel
+
+	memory_size_type len = cancel_sorted(arr, opq->sorted_size());
+	if(len == 0) {
+		// everything cancelled; leave the slot free
+	} else if(m_background) {
+		// Write the slot in the background. mergebuffer holds the
+		// elements until the next wait_for_background().
+		memcpy(mergebuffer.get(), &arr[0], sizeof(T)*len);
+		slot_data(slot).path(); // create the temporary name in this thread
+		m_writeJob->set_slot(&slot_data(slot), len);
+		m_writeJob->enqueue();
+		m_writeJobActive = true;
+		slot_written(slot, len);
+	} else {
+		write_slot(slot, arr, len);
+	}
+	opq->sorted_pop();
+
+	// insertion buffer is now empty
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::pop() {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::pop() {
 	if(empty()) {
 		throw priority_queue_error("pop() invoked on empty priority queue");
 	}
@@ -320,8 +479,8 @@ void priority_queue<T, Comparator, OPQType>::pop() {
 #endif
 }
 
-template <typename T, typename Comparator, typename OPQType>
-const T& priority_queue<T, Comparator, OPQType>::top() {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+const T& priority_queue<T, Comparator, OPQType, Canceller>::top() {
 	// If the deletion buffer is empty, refill it with elements from the group buffers
 	if(buffer_size == 0 && opq->size() != m_size) {
 		fill_buffer();
@@ -348,18 +507,18 @@ const T& priority_queue<T, Comparator, OPQType>::top() {
 	return min;
 }
 
-template <typename T, typename Comparator, typename OPQType>
-stream_size_type priority_queue<T, Comparator, OPQType>::size() const {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+stream_size_type priority_queue<T, Comparator, OPQType, Canceller>::size() const {
 	return m_size;
 }
 
-template <typename T, typename Comparator, typename OPQType>
-bool priority_queue<T, Comparator, OPQType>::empty() const {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+bool priority_queue<T, Comparator, OPQType, Canceller>::empty() const {
 	return m_size == 0;
 }
 
-template <typename T, typename Comparator, typename OPQType> template <typename F>
-F priority_queue<T, Comparator, OPQType>::pop_equals(F f) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller> template <typename F>
+F priority_queue<T, Comparator, OPQType, Canceller>::pop_equals(F f) {
 	T a = top();
 	f(a);
 	pop();
@@ -374,8 +533,76 @@ F priority_queue<T, Comparator, OPQType>::pop_equals(F f) {
 	return f;
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::dump() {
+template <typename T, typename Comparator, typename OPQType, typename Canceller> template <typename IT>
+void priority_queue<T, Comparator, OPQType, Canceller>::push_batch(IT first, IT last) {
+	while(first != last) {
+		if(opq->full()) flush_insertion_buffer();
+		stream_size_type before = opq->size();
+		first = opq->push_batch(first, last);
+		m_size += opq->size() - before;
+	}
+#ifndef NDEBUG
+	validate();
+#endif
+}
+
+template <typename T, typename Comparator, typename OPQType, typename Canceller> template <typename OutputIterator>
+stream_size_type priority_queue<T, Comparator, OPQType, Canceller>::pop_batch(OutputIterator out, stream_size_type n) {
+	return pop_batch_below(out, n, 0);
+}
+
+template <typename T, typename Comparator, typename OPQType, typename Canceller> template <typename OutputIterator>
+stream_size_type priority_queue<T, Comparator, OPQType, Canceller>::pop_batch(OutputIterator out, stream_size_type n, const T & bound) {
+	return pop_batch_below(out, n, &bound);
+}
+
+template <typename T, typename Comparator, typename OPQType, typename Canceller> template <typename OutputIterator>
+stream_size_type priority_queue<T, Comparator, OPQType, Canceller>::pop_batch_below(OutputIterator out, stream_size_type n, const T * bound) {
+	stream_size_type popped = 0;
+	while(popped < n && !empty()) {
+		// Call top() to freshen deletion buffer (if empty) and min_in_buffer
+		const T & t = top();
+		if(bound && !comp_(t, *bound)) break; // compare
+		if(!min_in_buffer) {
+			*out = opq->top();
+			++out;
+			opq->pop();
+			m_size--;
+			popped++;
+			continue;
+		}
+		// Take the run of deletion buffer elements that precede the top
+		// of the insertion buffer.
+		memory_size_type run = 1;
+		while(run < buffer_size && popped+run < n
+			  && (opq->size() == 0 || comp_(buffer[buffer_start+run], opq->top())) // compare
+			  && (!bound || comp_(buffer[buffer_start+run], *bound))) { // compare
+			run++;
+		}
+		out = std::copy(buffer.get()+buffer_start, buffer.get()+buffer_start+run, out);
+		buffer_size -= run;
+		buffer_start += run;
+		if(buffer_size == 0) {
+			buffer_start = 0;
+		}
+		m_size -= run;
+		popped += run;
+	}
+#ifndef NDEBUG
+	validate();
+#endif
+	return popped;
+}
+
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::set_background_merging(bool enabled) {
+	wait_for_background();
+	m_background = enabled && job_manager_initialized();
+}
+
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::dump() {
+	wait_for_background();
 	TP_LOG_DEBUG( "--------------------------------------------------------------" << "\n"
 			<< "DUMP:\tTotal size: "
 			<< m_size << ", OPQ size: "
@@ -464,9 +691,9 @@ void priority_queue<T, Comparator, OPQType>::dump() {
 // Find a free slot in given group.
 // If the group is full, call empty_group,
 // which calls remove_group_buffer, which calls free_slot(0)
-template <typename T, typename Comparator, typename OPQType>
-typename priority_queue<T, Comparator, OPQType>::slot_type
-priority_queue<T, Comparator, OPQType>::free_slot(group_type group) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+typename priority_queue<T, Comparator, OPQType, Canceller>::slot_type
+priority_queue<T, Comparator, OPQType, Canceller>::free_slot(group_type group) {
 
 	slot_type i;
 	if(group>=setting_k) {
@@ -499,8 +726,8 @@ priority_queue<T, Comparator, OPQType>::free_slot(group_type group) {
 	return i;
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::fill_buffer() {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::fill_buffer() {
 	if(buffer_size !=0) {
 		return;
 	}
@@ -508,10 +735,17 @@ void priority_queue<T, Comparator, OPQType>::fill_buffer() {
 		return;
 	}
 
+	wait_for_background();
+
+	//get rid of mergebuffer so that we enough memory
+	//for the heaps and misc structures below
+	//this array is reallocated below or in wait_for_background
+	mergebuffer.resize(0);
+
 	// refill group buffers, if needed
 	for(memory_size_type i=0;i<current_r;i++) {
 		if(group_size(i)<static_cast<stream_size_type>(setting_mmark)) {
-			fill_group_buffer(i);
+			m_size -= fill_group_buffer(i);
 		}
 		if(group_size(i) == 0 && i==current_r-1) {
 			current_r--;
@@ -519,14 +753,9 @@ void priority_queue<T, Comparator, OPQType>::fill_buffer() {
 	}
 
 	// merge to buffer
-	mergebuffer.resize(0);
-#ifndef TPIE_NDEBUG
-	std::cout << "memavail after mb free: "
-			  << get_memory_manager().available() << "b" << std::endl;
-#endif
 
 	{
-	pq_merge_heap<T, Comparator> heap(current_r);
+	pq_merge_heap<T, Comparator> heap(current_r, comp_);
 
 	tpie::array<tpie::auto_ptr<file_stream<T> > > data(current_r);
 	for(memory_size_type i = 0; i<current_r; i++) {
@@ -542,13 +771,16 @@ void priority_queue<T, Comparator, OPQType>::fill_buffer() {
 		}
 	}
 
-	while(!heap.empty() && buffer_size!=setting_mmark) {
+	cancel_window window(cancel_);
+	while(!heap.empty() && buffer_size+window.held_back()!=setting_mmark) {
 		group_type current_group = heap.top_run();
 		if(current_group!= 0 && data[current_group]->offset() == setting_m) {
 			data[current_group]->seek(0);
 		}
-		buffer[(buffer_size+buffer_start)%setting_m] = heap.top();
-		buffer_size++;
+		if(window.next(heap.top())) {
+			buffer[(buffer_size+buffer_start)%setting_m] = window.ready;
+			buffer_size++;
+		}
 
 		assert(group_size(current_group)-1 >= 0);
 		group_size_set(current_group, group_size(current_group)-1);
@@ -563,29 +795,93 @@ void priority_queue<T, Comparator, OPQType>::fill_buffer() {
 			}
 		}
 	}
+	if(window.flush()) {
+		buffer[(buffer_size+buffer_start)%setting_m] = window.ready;
+		buffer_size++;
+	}
+	m_size -= window.cancelled;
 	} // destruct and deallocate `heap'
-#ifndef TPIE_NDEBUG
-	std::cout << "memavail before mb alloc: "
-			  << get_memory_manager().available() << "b" << std::endl;
-#endif
+
+	if(m_background) {
+		// prefetch group buffers while the deletion buffer is consumed
+		start_background_refill();
+		return;
+	}
 	mergebuffer.resize(setting_m*2);
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::fill_group_buffer(group_type group) {
+// Refill the group buffers that have fewer than setting_mmark elements using
+// up to m_backgroundMerges jobs. mergebuffer must be deallocated; it is
+// reallocated when the jobs are done.
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::start_background_refill() {
+	assert(mergebuffer.size() == 0);
+	memory_size_type groups = 0;
+	for(group_type i = 0; i < current_r; i++) {
+		if(group_size(i) >= static_cast<stream_size_type>(setting_mmark)) continue;
+		bool nonempty = false;
+		for(slot_type j = i*setting_k; j < i*setting_k+setting_k; j++) {
+			if(slot_size(j) > 0) {
+				// create the temporary name in this thread
+				slot_data(j).path();
+				nonempty = true;
+			}
+		}
+		if(!nonempty) continue;
+		group_data(i).path();
+		groups++;
+	}
+	if(groups == 0) {
+		mergebuffer.resize(setting_m*2);
+		return;
+	}
+
+	m_activeFillJobs = std::min(groups, m_backgroundMerges);
+	for(memory_size_type i = 0; i < m_activeFillJobs; i++) {
+		m_fillJobs[i]->set_groups(i, m_activeFillJobs, current_r);
+		m_fillJobs[i]->enqueue();
+	}
+}
+
+// Wait for the background jobs to finish and reallocate mergebuffer.
+// If rethrow is true and a job failed, throw its error.
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::wait_for_background(bool rethrow) {
+	std::string error;
+	if(m_writeJobActive) {
+		m_writeJob->join();
+		m_writeJobActive = false;
+		if(m_writeJob->failed) {
+			error = m_writeJob->error;
+			m_writeJob->failed = false;
+		}
+	}
+	if(m_activeFillJobs > 0) {
+		for(memory_size_type i = 0; i < m_activeFillJobs; i++) {
+			m_fillJobs[i]->join();
+			m_size -= m_fillJobs[i]->cancelled;
+			if(m_fillJobs[i]->failed) {
+				error = m_fillJobs[i]->error;
+				m_fillJobs[i]->failed = false;
+			}
+		}
+		m_activeFillJobs = 0;
+		mergebuffer.resize(setting_m*2);
+	}
+	if(rethrow && !error.empty()) {
+		TP_LOG_FATAL_ID("Priority queue background job failed: " << error);
+		throw exception(error);
+	}
+}
+
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+stream_size_type priority_queue<T, Comparator, OPQType, Canceller>::fill_group_buffer(group_type group) {
 	assert(group_size(group) < static_cast<stream_size_type>(setting_mmark));
 	// max k + 1 open streams
 	// 1 merge heap
 	// opq still in action
-
-	//get rid of mergebuffer so that we enough memory
-	//for the heap and misc structures below
-	//this array is reallocated below
-	mergebuffer.resize(0);
-#ifndef TPIE_NDEBUG
-	std::cout << "memavail after mb free: "
-			  << get_memory_manager().available() << "b" << std::endl;
-#endif
+	// mergebuffer has been deallocated by the caller, fill_buffer or
+	// start_background_refill, which may run this in a background job.
 
 	// merge
 	{
@@ -599,7 +895,7 @@ void priority_queue<T, Comparator, OPQType>::fill_group_buffer(group_type group)
 		}
 
 		//merge heap for the setting_k slots
-		pq_merge_heap<T, Comparator> heap(setting_k);
+		pq_merge_heap<T, Comparator> heap(setting_k, comp_);
 
 		//Create streams for the non-empty slots and initialize
 		//internal heap with one element per slot
@@ -623,24 +919,27 @@ void priority_queue<T, Comparator, OPQType>::fill_group_buffer(group_type group)
 
 		//perform actual reading until group if full or all 
 		//the slots are empty
-		while(!heap.empty() && group_size(group)!=static_cast<stream_size_type>(setting_m)) {
+		cancel_window window(cancel_);
+		while(!heap.empty() && group_size(group)+window.held_back()!=static_cast<stream_size_type>(setting_m)) {
 			slot_type current_slot = heap.top_run();
 
-			if(group == 0) {
-				//use in-memory array for group 0
-				gbuffer0[(group_start(0)+group_size(0))%setting_m] = heap.top();
-			} else {
-				//write to disk for group >0
-				if(out.offset() == setting_m) {
-					out.seek(0);
+			if(window.next(heap.top())) {
+				if(group == 0) {
+					//use in-memory array for group 0
+					gbuffer0[(group_start(0)+group_size(0))%setting_m] = window.ready;
+				} else {
+					//write to disk for group >0
+					if(out.offset() == setting_m) {
+						out.seek(0);
+					}
+
+					out.write(window.ready);
 				}
 
-				out.write(heap.top());
+				//increase group size
+				group_size_set(group, group_size(group) + 1);
 			}
 
-			//increase group size
-			group_size_set(group, group_size(group) + 1);
-
 			//decrease slot size and increase starting index
 			slot_start_set(current_slot, slot_start(current_slot)+1);
 			slot_size_set(current_slot, slot_size(current_slot)-1);
@@ -653,14 +952,19 @@ void priority_queue<T, Comparator, OPQType>::fill_group_buffer(group_type group)
 			}
 		}
 
+		if(window.flush()) {
+			if(group == 0) {
+				gbuffer0[(group_start(0)+group_size(0))%setting_m] = window.ready;
+			} else {
+				if(out.offset() == setting_m) {
+					out.seek(0);
+				}
+				out.write(window.ready);
+			}
+			group_size_set(group, group_size(group) + 1);
+		}
+		return window.cancelled;
 	}
-
-	//restore mergebuffer
-#ifndef TPIE_NDEBUG
-	std::cout << "memavail before mb alloc: "
-			  << get_memory_manager().available() << "b" << std::endl;
-#endif
-	mergebuffer.resize(setting_m*2);;
 }
 
 // Memory usage:
@@ -670,8 +974,8 @@ void priority_queue<T, Comparator, OPQType>::fill_group_buffer(group_type group)
 // Opens old streams       : setting_k * sizeof(file_stream<T>)
 // Reallocates mergebuffer : +2*setting_m
 // (no net heap usage since 2*setting_m > temporary heap usage)
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::empty_group(group_type group) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::empty_group(group_type group) {
 	if(group > setting_k) {
 		TP_LOG_FATAL_ID("Error: Priority queue is full");
 		throw exception("Priority queue is full");
@@ -693,15 +997,11 @@ void priority_queue<T, Comparator, OPQType>::empty_group(group_type group) {
 	bool ret = false;
 
 	mergebuffer.resize(0);
-#ifndef TPIE_NDEBUG
-	std::cout << "memavail after mb free: "
-			  << get_memory_manager().available() << "b" << std::endl;
-#endif
 	{
 
 		file_stream<T> newstream(block_factor);
 		newstream.open(slot_data(newslot));
-		pq_merge_heap<T, Comparator> heap(setting_k);
+		pq_merge_heap<T, Comparator> heap(setting_k, comp_);
 
 		// Open streams to slots in group `group', push top element to merge heap
 		tpie::array<tpie::auto_ptr<file_stream<T> > > data(setting_k);
@@ -717,10 +1017,13 @@ void priority_queue<T, Comparator, OPQType>::empty_group(group_type group) {
 			heap.push(data[i]->read(), group*setting_k+i);
 		}
 
+		cancel_window window(cancel_);
 		while(!heap.empty() && !ret) {
 			slot_type current_slot = heap.top_run();
-			newstream.write(heap.top());
-			slot_size_set(newslot,slot_size(newslot)+1);
+			if(window.next(heap.top())) {
+				newstream.write(window.ready);
+				slot_size_set(newslot,slot_size(newslot)+1);
+			}
 			slot_start_set(current_slot, slot_start(current_slot)+1);
 			slot_size_set(current_slot, slot_size(current_slot)-1);
 			if(slot_size(current_slot) == 0) {
@@ -729,12 +1032,13 @@ void priority_queue<T, Comparator, OPQType>::empty_group(group_type group) {
 				heap.pop_and_push(data[current_slot-group*setting_k]->read(), current_slot);
 			}
 		}
+		if(window.flush()) {
+			newstream.write(window.ready);
+			slot_size_set(newslot,slot_size(newslot)+1);
+		}
+		m_size -= window.cancelled;
 	}
 
-#ifndef TPIE_NDEBUG
-	std::cout << "memavail before mb alloc: "
-			  << get_memory_manager().available() << "b" << std::endl;
-#endif
 	mergebuffer.resize(setting_m*2);;
 
 	if(group_size(group+1) > 0 && !ret) {
@@ -749,10 +1053,11 @@ void priority_queue<T, Comparator, OPQType>::empty_group(group_type group) {
 	}
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::validate() {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::validate() {
 #ifndef NDEBUG
 #ifdef PQ_VALIDATE
+	wait_for_background();
 	cout << "validate start" << "\n";
 	// validate size
 	stream_size_type size = 0;
@@ -880,8 +1185,8 @@ void priority_queue<T, Comparator, OPQType>::validate() {
 // To maintain the invariant
 //     group buffer 0 elements <= group 0 slot elements,
 // merge the given group buffer with group buffer 0 before writing the slot out.
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::remove_group_buffer(group_type group) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::remove_group_buffer(group_type group) {
 #ifndef NDEBUG
 	if(group == 0) {
 		TP_LOG_FATAL_ID("Attempt to remove group buffer 0");
@@ -937,77 +1242,97 @@ void priority_queue<T, Comparator, OPQType>::remove_group_buffer(group_type grou
 
 //////////////////
 // TPIE wrappers
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::slot_start_set(slot_type slot, memory_size_type n) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::slot_start_set(slot_type slot, memory_size_type n) {
 	slot_state[slot*3] = n;
 }
 
-template <typename T, typename Comparator, typename OPQType>
-memory_size_type priority_queue<T, Comparator, OPQType>::slot_start(slot_type slot) const {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+memory_size_type priority_queue<T, Comparator, OPQType, Canceller>::slot_start(slot_type slot) const {
 	return slot_state[slot*3];
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::slot_size_set(slot_type slot, memory_size_type n) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::slot_size_set(slot_type slot, memory_size_type n) {
 	assert(slot<setting_k*setting_k);
 	slot_state[slot*3+1] = n;
 }
 
-template <typename T, typename Comparator, typename OPQType>
-memory_size_type priority_queue<T, Comparator, OPQType>::slot_size(slot_type slot) const {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+memory_size_type priority_queue<T, Comparator, OPQType, Canceller>::slot_size(slot_type slot) const {
 	return slot_state[slot*3+1];
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::group_start_set(group_type group, memory_size_type n) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::group_start_set(group_type group, memory_size_type n) {
 	group_state[group*2] = n;
 }
 
-template <typename T, typename Comparator, typename OPQType>
-memory_size_type priority_queue<T, Comparator, OPQType>::group_start(group_type group) const {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+memory_size_type priority_queue<T, Comparator, OPQType, Canceller>::group_start(group_type group) const {
 	return group_state[group*2];
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::group_size_set(group_type group, memory_size_type n) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::group_size_set(group_type group, memory_size_type n) {
 	assert(group<setting_k);
 	group_state[group*2+1] = n;
 }
 
-template <typename T, typename Comparator, typename OPQType>
-memory_size_type priority_queue<T, Comparator, OPQType>::group_size(group_type group) const {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+memory_size_type priority_queue<T, Comparator, OPQType, Canceller>::group_size(group_type group) const {
 	return group_state[group*2+1];
 }
 
-template <typename T, typename Comparator, typename OPQType>
-temp_file & priority_queue<T, Comparator, OPQType>::slot_data(slot_type slotid) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+temp_file & priority_queue<T, Comparator, OPQType, Canceller>::slot_data(slot_type slotid) {
 	return datafiles[slot_state[slotid*3+2]];
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::slot_data_set(slot_type slotid, memory_size_type n) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::slot_data_set(slot_type slotid, memory_size_type n) {
 	slot_state[slotid*3+2] = n;
 }
 
-template <typename T, typename Comparator, typename OPQType>
-temp_file & priority_queue<T, Comparator, OPQType>::group_data(group_type groupid) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+temp_file & priority_queue<T, Comparator, OPQType, Canceller>::group_data(group_type groupid) {
 	return groupdatafiles[groupid];
 }
 
-template <typename T, typename Comparator, typename OPQType>
-memory_size_type priority_queue<T, Comparator, OPQType>::slot_max_size(slot_type slotid) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+memory_size_type priority_queue<T, Comparator, OPQType, Canceller>::slot_max_size(slot_type slotid) {
 	// todo, too many casts
 	return setting_m
 		*static_cast<memory_size_type>(pow((long double)setting_k,
 										   (long double)(slotid/setting_k)));
 }
 
-template <typename T, typename Comparator, typename OPQType>
-void priority_queue<T, Comparator, OPQType>::write_slot(slot_type slotid, T* arr, memory_size_type len) {
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::write_slot(slot_type slotid, T* arr, memory_size_type len) {
 	assert(len > 0);
 	file_stream<T> data(block_factor);
 	data.open(slot_data(slotid));
 	data.write(arr+0, arr+len);
+	slot_written(slotid, len);
+}
+
+// Drop the elements of the sorted array arr that cancel, moving the rest
+// to the front. Returns the number of elements left.
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+memory_size_type priority_queue<T, Comparator, OPQType, Canceller>::cancel_sorted(T * arr, memory_size_type len) {
+	if(!Canceller::enabled) return len;
+	cancel_window window(cancel_);
+	memory_size_type j = 0;
+	for(memory_size_type i = 0; i < len; i++) {
+		if(window.next(arr[i])) arr[j++] = window.ready;
+	}
+	if(window.flush()) arr[j++] = window.ready;
+	m_size -= window.cancelled;
+	return j;
+}
+
+template <typename T, typename Comparator, typename OPQType, typename Canceller>
+void priority_queue<T, Comparator, OPQType, Canceller>::slot_written(slot_type slotid, memory_size_type len) {
 	slot_start_set(slotid, 0);
 	slot_size_set(slotid, len);
 	if(current_r == 0 && slotid < setting_k) {
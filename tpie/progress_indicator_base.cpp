@@ -13,3 +13,21 @@ void tpie::progress_indicator_base::compute_threshold(){
 		m_threshold = elapsed(end, begin);
 	}
 }
+
+void tpie::progress_indicator_base::update() {
+	ticks currentTicks = getticks();
+#ifndef TPIE_NDEBUG
+	// The threshold is estimated to be reached one refresh interval after
+	// the previous one, so a much longer gap means that step was not called.
+	if (elapsed(currentTicks,m_lastCalled) > m_frequency * m_threshold * 5)
+		tpie::log_debug() << "Step was not called for an estimated "
+						  << (elapsed(currentTicks,m_lastCalled) / (m_frequency * m_threshold))
+						  << " seconds" << std::endl;
+	m_lastCalled = currentTicks;
+#endif
+	m_next = static_cast<stream_size_type>(
+		static_cast<double>(m_current) * (elapsed(currentTicks, m_start) + m_threshold)/
+		elapsed(currentTicks, m_start));
+	if (m_next > m_current *2) m_next=m_current*2; //For bad guestimation in the beginning
+	refresh();
+}
@@ -74,6 +74,10 @@ public:
 		m_next(0),
 		m_predictor(0) {
 		compute_threshold();
+		m_start = getticks();
+#ifndef TPIE_NDEBUG
+		m_lastCalled = m_start;
+#endif
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -85,28 +89,14 @@ public:
 
 	///////////////////////////////////////////////////////////////////////////
 	///  Record an increment to the indicator and advance the indicator.
+	///
+	/// The indicator is only refreshed when the counter passes a threshold
+	/// that is estimated to be reached after one refresh interval, so in
+	/// between refreshes a step is an addition and a comparison.
 	///////////////////////////////////////////////////////////////////////////
 	void step(stream_size_type step=1) {
 	    m_current += step;
- 		
-#ifndef TPIE_NDEBUG
-		{
-			ticks currentTicks = getticks();
-			if (elapsed(currentTicks,m_lastCalled) > m_frequency * m_threshold * 5)
-				tpie::log_debug() << "Step was not called for an estimated " 
-								  << (elapsed(currentTicks,m_lastCalled) / (m_frequency * m_threshold))
-								  << " seconds" << std::endl;;
-			m_lastCalled = currentTicks;
-		}
-#endif	
-		if (m_current > m_next) {
-			ticks currentTicks = getticks();
-			m_next = static_cast<stream_size_type>(
-				static_cast<double>(m_current) * (elapsed(currentTicks, m_start) + m_threshold)/
-				elapsed(currentTicks, m_start));
-			if (m_next > m_current *2) m_next=m_current*2; //For bad guestimation in the beginning
-			refresh();
-		}
+		if (m_current > m_next) update();
 	}
 
 	void raw_step(stream_size_type step) {
@@ -184,7 +174,7 @@ protected:
 	stream_size_type m_current;
 	
 private:
-	/**  The number of ticks elapsed when refresh was called last */
+	/**  The number of ticks elapsed when the counter was last checked */
 #ifndef TPIE_NDEBUG
 	ticks m_lastCalled;
 #endif
@@ -202,6 +192,13 @@ private:
 	static bool m_thresholdComputed;
 
 	execution_time_predictor * m_predictor;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Called by step() when the counter passes m_next. Refreshes the
+	/// indicator and computes the next threshold.
+	///////////////////////////////////////////////////////////////////////////
+	void update();
+
 	///////////////////////////////////////////////////////////////////////////
 	/// Makes sure m_threshold has been set.
 	///////////////////////////////////////////////////////////////////////////
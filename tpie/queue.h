@@ -26,29 +26,54 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include <tpie/portability.h>
 #include <tpie/deprecated.h>
-#include <tpie/file.h>
+#include <tpie/file_stream.h>
+#include <tpie/array.h>
+#include <tpie/job.h>
 #include <tpie/err.h>
+#include <tpie/tpie_assert.h>
 #include <tpie/tempname.h>
-#include <tpie/file.h>
+#include <tpie/tpie_log.h>
+#include <deque>
 #include <limits>
+#include <boost/filesystem.hpp>
 #include <tpie/persist.h>
 namespace tpie {
 
 ///////////////////////////////////////////////////////////////////
 /// \brief Basic Implementation of I/O Efficient FIFO queue
+///
+/// The newest and oldest items are kept in in-memory tail and head
+/// buffers of a block each. Full tail buffers are written to a sequence
+/// of segment files, each holding up to segmentBlocks blocks, and a
+/// segment file is deleted as soon as all of its items have been read,
+/// so the disk space used is proportional to the number of items in the
+/// queue rather than the number of items ever pushed. While the head
+/// buffer is consumed, the next block is read in the background.
+///
 /// \author The TPIE Project
 ///////////////////////////////////////////////////////////////////
 template<class T>
 class queue {
 public:
+	/** Number of blocks in a segment file. */
+	static const stream_size_type segmentBlocks = 16;
+
 	////////////////////////////////////////////////////////////////////
 	/// \brief Constructor for Temporary Queue
 	////////////////////////////////////////////////////////////////////
 	queue(stream_size_type elements=std::numeric_limits<stream_size_type>::max(), 
-		  double block_factor=1.0): m_size(0), m_file(block_factor) {
-		m_file.open(m_temp, access_read_write, sizeof(stream_size_type) );
-		m_back.attach(m_file);
-		m_front.attach(m_file);
+		  double block_factor=1.0)
+		: m_size(0)
+		, m_popped(0)
+		, m_named(false)
+		, m_persist(false)
+		, m_namedBegin(0)
+		, m_namedEnd(0)
+		, m_reader(block_factor)
+		, m_writer(block_factor)
+		, m_prefetchActive(false)
+	{
+		init(block_factor);
 		unused(elements);
 	}
 
@@ -66,9 +91,22 @@ public:
 	queue(const std::string& basename, double block_factor=1.0);
 
 	////////////////////////////////////////////////////////////////////
-	/// \brief Destructor, closes the underlying stream
+	/// \brief Destructor. Closes the queue unless it has been closed;
+	/// errors writing back a named queue are logged, not thrown.
+	////////////////////////////////////////////////////////////////////
+	~queue();
+
+	////////////////////////////////////////////////////////////////////
+	/// \brief Close the queue. A named queue writes its items back to
+	/// its file, and errors doing so are thrown. The queue may not be
+	/// used after it is closed.
+	///
+	/// The items pushed are appended to the named file, so closing takes
+	/// time proportional to the items pushed since it was opened. Only
+	/// when more items have been popped from the file than remain in the
+	/// queue are the remaining items written to a new file.
 	////////////////////////////////////////////////////////////////////
-	~queue() {m_file.write_user_data(m_front.offset());}
+	void close();
 
 	////////////////////////////////////////////////////////////////////
 	/// \brief Check if the queue is empty
@@ -88,8 +126,9 @@ public:
 	/// \param t The item to be enqueued
 	////////////////////////////////////////////////////////////////////
 	inline void push(const T & t) {
-		m_back.write(t);
+		m_tail[m_tailSize++] = t;
 		++m_size;
+		if (m_tailSize == m_tail.size()) flush_tail();
 	}
 	TPIE_DEPRECATED(ami::err enqueue(const T &t));
 	
@@ -98,9 +137,10 @@ public:
 	/// \return The dequeued item
 	////////////////////////////////////////////////////////////////////
 	const T & pop() {
-		const T & el = m_front.read();
+		if (m_headIndex == m_headSize) fill_head();
 		--m_size;
-		return el;
+		++m_popped;
+		return m_head[m_headIndex++];
 	}
 	TPIE_DEPRECATED(ami::err dequeue(const T **t));
 
@@ -109,9 +149,8 @@ public:
 	/// \return The front most item in the queue
 	////////////////////////////////////////////////////////////////////
 	const T & front() {
-		const T & el = m_front.read();
-		m_front.seek(-1, file_base::stream::current);
-		return el;
+		if (m_headIndex == m_headSize) fill_head();
+		return m_head[m_headIndex];
 	}
 	TPIE_DEPRECATED(ami::err peek(const T **t));
 
@@ -125,45 +164,347 @@ public:
 	////////////////////////////////////////////////////////////////////
 	static memory_size_type memory_usage(double blockFactor=1.0) {
 		return sizeof(queue<T>)
-			+ file<T>::memory_usage() - sizeof(file<T>)
-			+ 2*file<T>::stream::memory_usage(blockFactor) - 2*sizeof(typename file<T>::stream);
+			+ 3*array<T>::memory_usage(block_items(blockFactor))
+			+ 2*file_stream<T>::memory_usage(blockFactor) - 2*sizeof(file_stream<T>);
 	}
 
 	////////////////////////////////////////////////////////////////////
-	/// Set the persistence status of the (stacks underlying the) queue.
+	/// Set the persistence status of the queue. A persistent temporary
+	/// queue writes its items to a file in the temporary directory when
+	/// it is closed; a named queue that is not persistent deletes its
+	/// file.
 	/// \param p A persistence status.
 	////////////////////////////////////////////////////////////////////
 	TPIE_DEPRECATED(void persist(persistence p));
 private:
-	temp_file m_temp;
+	///////////////////////////////////////////////////////////////////
+	/// \brief A file holding the items from offset begin to end.
+	///////////////////////////////////////////////////////////////////
+	struct segment {
+		segment() : begin(0), end(0), userDataSize(0) {}
+		segment(const std::string & path)
+			: file(path, true), begin(0), end(0), userDataSize(sizeof(stream_size_type)) {}
+
+		temp_file file;
+		stream_size_type begin;
+		stream_size_type end;
+		memory_size_type userDataSize;
+	};
+
+	///////////////////////////////////////////////////////////////////
+	/// \brief Background job reading the next block of the front segment.
+	///////////////////////////////////////////////////////////////////
+	class prefetch_job : public job {
+	public:
+		prefetch_job() : q(0), failed(false) {}
+
+		virtual void operator()() {
+			try {
+				q->m_reader.read(q->m_prefetch.begin(), q->m_prefetch.begin() + q->m_prefetchSize);
+			} catch (const std::exception & e) {
+				error = e.what();
+				failed = true;
+			}
+		}
+
+		queue * q;
+		bool failed;
+		std::string error;
+	};
+
+	static memory_size_type block_items(double blockFactor) {
+		return std::max(file_stream<T>::block_size(blockFactor) / sizeof(T),
+						static_cast<memory_size_type>(1));
+	}
+
+	void init(double blockFactor) {
+		memory_size_type items = block_items(blockFactor);
+		m_head.resize(items);
+		m_prefetch.resize(items);
+		m_tail.resize(items);
+		m_headIndex = m_headSize = m_prefetchSize = m_tailSize = 0;
+		m_prefetchJob.q = this;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	/// \brief Write the tail buffer to the back segment.
+	///////////////////////////////////////////////////////////////////
+	void flush_tail() {
+		if (!m_writer.is_open()) {
+			m_segments.push_back(tpie_new<segment>());
+			m_writer.open(m_segments.back()->file, access_write);
+		}
+		m_writer.write(m_tail.begin(), m_tail.begin() + m_tailSize);
+		m_segments.back()->end += m_tailSize;
+		m_tailSize = 0;
+		if (m_segments.back()->end >= segmentBlocks * m_tail.size())
+			m_writer.close();
+	}
+
+	///////////////////////////////////////////////////////////////////
+	/// \brief Open the reader on the front segment unless it is open.
+	///
+	/// \param seal Whether to close the writer if it is writing the
+	/// front segment. Otherwise, such a segment is not read.
+	/// \returns Whether the reader is open.
+	///////////////////////////////////////////////////////////////////
+	bool open_reader(bool seal) {
+		if (m_reader.is_open()) return true;
+		if (m_segments.empty()) return false;
+		if (m_writer.is_open() && m_segments.size() == 1) {
+			if (!seal) return false;
+			m_writer.close();
+		}
+		segment & s = *m_segments.front();
+		m_reader.open(s.file, access_read, s.userDataSize);
+		m_reader.seek(s.begin);
+		return true;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	/// \brief Number of items in the next block of the front segment.
+	///////////////////////////////////////////////////////////////////
+	memory_size_type next_block_size() {
+		segment & s = *m_segments.front();
+		return static_cast<memory_size_type>(
+			std::min(s.end - m_reader.offset(), static_cast<stream_size_type>(m_head.size())));
+	}
+
+	///////////////////////////////////////////////////////////////////
+	/// \brief Delete the front segment if it has been read completely.
+	///////////////////////////////////////////////////////////////////
+	void finish_read() {
+		if (m_reader.offset() < m_segments.front()->end) return;
+		m_reader.close();
+		tpie_delete(m_segments.front());
+		m_segments.pop_front();
+	}
+
+	void start_prefetch() {
+		// Without a job manager, fill_head reads synchronously.
+		if (m_prefetchActive || !job_manager_initialized() || !open_reader(false)) return;
+		m_prefetchSize = next_block_size();
+		m_prefetchJob.enqueue();
+		m_prefetchActive = true;
+	}
+
+	void wait_for_prefetch() {
+		if (!m_prefetchActive) return;
+		m_prefetchJob.join();
+		m_prefetchActive = false;
+		if (m_prefetchJob.failed) {
+			m_prefetchJob.failed = false;
+			throw exception(m_prefetchJob.error);
+		}
+		finish_read();
+	}
+
+	///////////////////////////////////////////////////////////////////
+	/// \brief Refill the empty head buffer with the oldest items: the
+	/// prefetched block, the front segment, or the tail buffer.
+	///////////////////////////////////////////////////////////////////
+	void fill_head() {
+		tp_assert(m_size > 0, "fill_head: queue is empty");
+		if (m_prefetchActive) {
+			wait_for_prefetch();
+			m_head.swap(m_prefetch);
+			m_headSize = m_prefetchSize;
+		} else if (open_reader(true)) {
+			m_headSize = next_block_size();
+			m_reader.read(m_head.begin(), m_head.begin() + m_headSize);
+			finish_read();
+		} else {
+			m_head.swap(m_tail);
+			m_headSize = m_tailSize;
+			m_tailSize = 0;
+		}
+		m_headIndex = 0;
+		start_prefetch();
+	}
+
+	void close_named();
+	void write_items(file_stream<T> & out, stream_size_type skip);
+	template <typename IT>
+	static void write_range(file_stream<T> & out, IT begin, IT end, stream_size_type & skip);
+	void join_prefetch();
+	void free_segments();
+
 	stream_size_type m_size;
-	file<T> m_file;
-	typename file<T>::stream m_back;
-	typename file<T>::stream m_front;
+	/** Number of items popped since the queue was opened. */
+	stream_size_type m_popped;
+	bool m_named;
+	bool m_persist;
+	std::string m_path;
+	/** Items of the named file when it was opened. */
+	stream_size_type m_namedBegin;
+	stream_size_type m_namedEnd;
+
+	array<T> m_head;
+	memory_size_type m_headIndex;
+	memory_size_type m_headSize;
+	array<T> m_prefetch;
+	memory_size_type m_prefetchSize;
+	array<T> m_tail;
+	memory_size_type m_tailSize;
+
+	/** Segment files from oldest to newest. */
+	std::deque<segment *> m_segments;
+	/** Reads the front segment. */
+	file_stream<T> m_reader;
+	/** Writes the back segment. */
+	file_stream<T> m_writer;
+
+	prefetch_job m_prefetchJob;
+	bool m_prefetchActive;
 };
 
 
 template<class T>
 void queue<T>::persist(persistence p) {
-	m_temp.set_persistent(p != PERSIST_DELETE);
+	m_persist = (p != PERSIST_DELETE);
+}
+
+template<class T>
+queue<T>::queue(const std::string& basename, double blockFactor)
+	: m_size(0)
+	, m_popped(0)
+	, m_named(true)
+	, m_persist(true)
+	, m_path(basename)
+	, m_namedBegin(0)
+	, m_namedEnd(0)
+	, m_reader(blockFactor)
+	, m_writer(blockFactor)
+	, m_prefetchActive(false)
+{
+	init(blockFactor);
+	if (!boost::filesystem::exists(basename)) return;
+	// The items of the named file form the first segment.
+	segment * s = tpie_new<segment>(basename);
+	m_reader.open(s->file, access_read, sizeof(stream_size_type));
+	if (m_reader.size() != 0) m_reader.read_user_data(s->begin);
+	s->end = m_reader.size();
+	m_reader.close();
+	m_namedBegin = s->begin;
+	m_namedEnd = s->end;
+	m_size = s->end - s->begin;
+	if (m_size == 0) {
+		tpie_delete(s);
+		return;
+	}
+	m_segments.push_back(s);
+}
+
+template<class T>
+queue<T>::~queue() {
+	try {
+		close();
+	} catch (const std::exception & e) {
+		log_error() << "Failed to close queue: " << e.what() << std::endl;
+	}
+	join_prefetch();
+	// A stream that failed to close still refers to its segment file, so
+	// the segments cannot be freed before the streams are destroyed.
+	if (!m_reader.is_open() && !m_writer.is_open()) free_segments();
+}
+
+template<class T>
+void queue<T>::close() {
+	bool named = m_named;
+	bool persist = m_persist;
+	m_named = m_persist = false;
+	if (persist && !named) {
+		m_path = tempname::tpie_name("queue");
+		log_debug() << "Writing persistent queue to " << m_path << std::endl;
+	}
+	if (persist)
+		close_named();
+	else if (named && boost::filesystem::exists(m_path))
+		boost::filesystem::remove(m_path);
+	join_prefetch();
+	m_reader.close();
+	m_writer.close();
+	free_segments();
+	m_size = 0;
+	m_headIndex = m_headSize = m_prefetchSize = m_tailSize = 0;
 }
 
 template<class T>
-queue<T>::queue(const std::string& basename, double blockFactor): 
-	m_temp(basename), m_size(0), m_file(blockFactor) {
-	m_temp.set_persistent(true);
-	m_file.open(basename, access_read_write, sizeof(stream_size_type) );
-	m_front.attach(m_file);
-	m_back.attach(m_file);
-	if (m_file.size() != 0) {
-		stream_size_type t;
-		m_file.read_user_data(t);
-		m_front.seek(t);
-	}
-	m_back.seek(0, file_base::stream::end);
-	m_size = m_back.offset() - m_front.offset();
+void queue<T>::join_prefetch() {
+	if (!m_prefetchActive) return;
+	m_prefetchJob.join();
+	m_prefetchActive = false;
 }
 
+template<class T>
+void queue<T>::free_segments() {
+	while (!m_segments.empty()) {
+		tpie_delete(m_segments.front());
+		m_segments.pop_front();
+	}
+}
+
+////////////////////////////////////////////////////////////////////
+// Write the items of a named queue back to the named file. The file
+// still holds the items of the queue that were in it when it was
+// opened and have not been popped, so unless the popped prefix of the
+// file outweighs the items left, only the items pushed are appended.
+// Otherwise the items are written, oldest first, to a new file that
+// replaces the named file.
+////////////////////////////////////////////////////////////////////
+template<class T>
+void queue<T>::close_named() {
+	stream_size_type namedItems = m_namedEnd - m_namedBegin;
+	if (m_popped <= namedItems && m_namedBegin + m_popped <= m_size) {
+		file_stream<T> out;
+		out.open(m_path, access_read_write, sizeof(stream_size_type));
+		out.seek(0, file_stream<T>::end);
+		write_items(out, namedItems - m_popped);
+		out.write_user_data(m_namedBegin + m_popped);
+		return;
+	}
+	std::string newPath = m_path + ".new";
+	{
+		file_stream<T> out;
+		out.open(newPath, access_write, sizeof(stream_size_type));
+		write_items(out, 0);
+		out.write_user_data(static_cast<stream_size_type>(0));
+	}
+	boost::filesystem::rename(newPath, m_path);
+}
+
+////////////////////////////////////////////////////////////////////
+// Write the items of the queue, oldest first, to out, leaving out the
+// first skip items. Segments that are skipped entirely are not read.
+////////////////////////////////////////////////////////////////////
+template<class T>
+void queue<T>::write_items(file_stream<T> & out, stream_size_type skip) {
+	write_range(out, m_head.begin() + m_headIndex, m_head.begin() + m_headSize, skip);
+	if (m_prefetchActive) {
+		wait_for_prefetch();
+		write_range(out, m_prefetch.begin(), m_prefetch.begin() + m_prefetchSize, skip);
+	}
+	while (open_reader(true)) {
+		stream_size_type left = m_segments.front()->end - m_reader.offset();
+		if (skip >= left) {
+			skip -= left;
+			m_reader.seek(m_segments.front()->end);
+		} else {
+			memory_size_type n = next_block_size();
+			m_reader.read(m_prefetch.begin(), m_prefetch.begin() + n);
+			write_range(out, m_prefetch.begin(), m_prefetch.begin() + n, skip);
+		}
+		finish_read();
+	}
+	write_range(out, m_tail.begin(), m_tail.begin() + m_tailSize, skip);
+}
+
+template<class T> template <typename IT>
+void queue<T>::write_range(file_stream<T> & out, IT begin, IT end, stream_size_type & skip) {
+	stream_size_type n = std::min(skip, static_cast<stream_size_type>(end - begin));
+	skip -= n;
+	out.write(begin + n, end);
+}
 
 /////////////////////////////////////////////////////////////////////////
 
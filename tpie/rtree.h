@@ -0,0 +1,468 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __TPIE_RTREE_H__
+#define __TPIE_RTREE_H__
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file rtree.h
+/// \brief External memory R-tree of rectangles bulk loaded in Hilbert order.
+///
+/// The tree is built bottom-up from rectangles sorted by the Hilbert value
+/// of their centers (see pipelining/rtree.h), packing each node full, so
+/// the leaves are written sequentially and the tree occupies about N/B
+/// nodes. The nodes are stored in a file with one node per block, and a
+/// least recently used cache of nodes in memory serves the upper levels of
+/// the tree.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <tpie/file_stream.h>
+#include <tpie/array.h>
+#include <tpie/hash_map.h>
+#include <tpie/exception.h>
+#include <tpie/tpie_assert.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <string>
+
+namespace tpie {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The Hilbert value of the point (x, y) on a grid with the given
+/// side, which must be a power of two greater than x and y.
+///
+/// The code is taken from Jagadish, H.V.: "Linear Clustering of Objects
+/// with Multiple Attributes", in: Proceedings of the 1990 ACM SIGMOD
+/// International Conference on Management of Data (1990), 332-342.
+///////////////////////////////////////////////////////////////////////////////
+inline stream_size_type hilbert_value(stream_size_type x, stream_size_type y, stream_size_type side) {
+	static const int rotationTable[4] = {3, 0, 0, 1};
+	static const int senseTable[4] = {-1, 1, 1, -1};
+	static const int quadTable[4][2][2] = { {{0,1},{3,2}},
+											{{1,2},{0,3}},
+											{{2,3},{1,0}},
+											{{3,0},{2,1}} };
+	int rotation = 0;
+	int sense = 1;
+	stream_size_type num = 0;
+	for (stream_size_type k = side/2; k > 0; k = k/2) {
+		stream_size_type xbit = x/k;
+		stream_size_type ybit = y/k;
+		x -= k*xbit;
+		y -= k*ybit;
+		int quad = quadTable[rotation][xbit][ybit];
+		num += (sense == -1) ? k*k*(3-quad) : k*k*quad;
+		rotation += rotationTable[quad];
+		if (rotation >= 4) rotation -= 4;
+		sense *= senseTable[quad];
+	}
+	return num;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief An axis-parallel rectangle [xlo, xhi] x [ylo, yhi].
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+struct rtree_rectangle {
+	coord_t xlo;
+	coord_t ylo;
+	coord_t xhi;
+	coord_t yhi;
+
+	bool intersects(const rtree_rectangle & other) const {
+		return xlo <= other.xhi && other.xlo <= xhi
+			&& ylo <= other.yhi && other.ylo <= yhi;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Grow the rectangle to contain the other.
+	///////////////////////////////////////////////////////////////////////////
+	void extend(const rtree_rectangle & other) {
+		xlo = std::min(xlo, other.xlo);
+		ylo = std::min(ylo, other.ylo);
+		xhi = std::max(xhi, other.xhi);
+		yhi = std::max(yhi, other.yhi);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A rectangle stored in the tree. In an internal node, id is the
+/// index of the child node whose bounding rectangle is mbr.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t>
+struct rtree_entry {
+	rtree_rectangle<coord_t> mbr;
+	stream_size_type id;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A node of the tree as stored on disk.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t, memory_size_type fanout>
+struct rtree_node {
+	stream_size_type count;
+	rtree_entry<coord_t> entries[fanout];
+};
+
+namespace rtree_bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The contents of the user data of the node file.
+///////////////////////////////////////////////////////////////////////////////
+struct header {
+	/** Index of the root node. */
+	stream_size_type root;
+	/** Number of levels of nodes, or zero if the tree is empty. */
+	stream_size_type height;
+	/** Number of rectangles in the tree. */
+	stream_size_type size;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Least recently used cache of the nodes of a node file.
+///////////////////////////////////////////////////////////////////////////////
+template <typename node_t>
+class node_cache {
+public:
+	node_cache(memory_size_type capacity)
+		: m_nodes(std::max(capacity, static_cast<memory_size_type>(1)))
+		, m_keys(m_nodes.size())
+		, m_prev(m_nodes.size())
+		, m_next(m_nodes.size())
+	{
+		clear();
+	}
+
+	void clear() {
+		m_slots.resize(m_nodes.size());
+		m_used = 0;
+		m_head = m_tail = none();
+		m_hits = m_misses = 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Get the node of the given index, reading it from the file if it
+	/// is not cached. The reference is valid until the next call.
+	///////////////////////////////////////////////////////////////////////////
+	const node_t & get(file_stream<node_t> & file, stream_size_type index) {
+		typename hash_map<stream_size_type, memory_size_type>::iterator i = m_slots.find(index);
+		if (i != m_slots.end()) {
+			++m_hits;
+			memory_size_type slot = (*i).second;
+			unlink(slot);
+			push_front(slot);
+			return m_nodes[slot];
+		}
+		++m_misses;
+		memory_size_type slot;
+		if (m_used < m_nodes.size()) {
+			slot = m_used++;
+		} else {
+			slot = m_tail;
+			unlink(slot);
+			m_slots.erase(m_keys[slot]);
+		}
+		file.seek(index);
+		m_nodes[slot] = file.read();
+		m_keys[slot] = index;
+		m_slots.insert(index, slot);
+		push_front(slot);
+		return m_nodes[slot];
+	}
+
+	stream_size_type hits() const {return m_hits;}
+	stream_size_type misses() const {return m_misses;}
+
+private:
+	static memory_size_type none() {
+		return std::numeric_limits<memory_size_type>::max();
+	}
+
+	void unlink(memory_size_type slot) {
+		if (m_prev[slot] != none()) m_next[m_prev[slot]] = m_next[slot];
+		else m_head = m_next[slot];
+		if (m_next[slot] != none()) m_prev[m_next[slot]] = m_prev[slot];
+		else m_tail = m_prev[slot];
+	}
+
+	void push_front(memory_size_type slot) {
+		m_prev[slot] = none();
+		m_next[slot] = m_head;
+		if (m_head != none()) m_prev[m_head] = slot;
+		m_head = slot;
+		if (m_tail == none()) m_tail = slot;
+	}
+
+	array<node_t> m_nodes;
+	array<stream_size_type> m_keys;
+	array<memory_size_type> m_prev;
+	array<memory_size_type> m_next;
+	hash_map<stream_size_type, memory_size_type> m_slots;
+	memory_size_type m_used;
+	/** Most and least recently used slots. */
+	memory_size_type m_head;
+	memory_size_type m_tail;
+	stream_size_type m_hits;
+	stream_size_type m_misses;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Adapts a functor on entries to the functor of a batched query.
+///////////////////////////////////////////////////////////////////////////////
+template <typename F>
+struct single_query {
+	single_query(F & f) : f(f) {}
+
+	template <typename entry_t>
+	void operator()(memory_size_type, const entry_t & e) {
+		f(e);
+	}
+
+	F & f;
+};
+
+} // namespace rtree_bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Static R-tree of rectangles stored in a file.
+///
+/// \tparam coord_t  The coordinate type.
+/// \tparam fanout  The number of entries of a node.
+///////////////////////////////////////////////////////////////////////////////
+template <typename coord_t = double, memory_size_type fanout = 64>
+class rtree {
+public:
+	typedef rtree_rectangle<coord_t> rectangle_type;
+	typedef rtree_entry<coord_t> entry_type;
+	typedef rtree_node<coord_t, fanout> node_type;
+
+	static const memory_size_type defaultCacheNodes = 256;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Builds the tree from the entries pushed to it in Hilbert order.
+	///
+	/// The leaves are written as they fill up, and the internal levels are
+	/// built from the bounding rectangles of the level below in end().
+	///////////////////////////////////////////////////////////////////////////
+	class builder {
+	public:
+		builder(rtree & tree)
+			: m_tree(tree)
+		{
+		}
+
+		void begin() {
+			m_tree.m_nodes.truncate(0);
+			m_tree.m_cache.clear();
+			m_parents.open();
+			m_node.count = 0;
+			m_size = 0;
+		}
+
+		void push(const entry_type & e) {
+			m_node.entries[m_node.count++] = e;
+			++m_size;
+			if (m_node.count == fanout) flush(m_parents);
+		}
+
+		void end() {
+			rtree_bits::header h;
+			h.size = m_size;
+			h.height = 0;
+			h.root = 0;
+			if (m_node.count > 0) flush(m_parents);
+			if (m_parents.size() > 0) {
+				h.height = 1;
+				// Each level is built from the bounding rectangles of the
+				// level below until a single node remains.
+				while (m_parents.size() > 1) {
+					file_stream<entry_type> level;
+					level.open();
+					m_parents.seek(0);
+					while (m_parents.can_read()) {
+						m_node.entries[m_node.count++] = m_parents.read();
+						if (m_node.count == fanout) flush(level);
+					}
+					if (m_node.count > 0) flush(level);
+					m_parents.swap(level);
+					++h.height;
+				}
+				m_parents.seek(0);
+				h.root = m_parents.read().id;
+			}
+			m_parents.close();
+			m_tree.m_nodes.write_user_data(h);
+			m_tree.m_header = h;
+		}
+
+		static memory_size_type memory_usage() {
+			return 2 * file_stream<entry_type>::memory_usage() + sizeof(builder);
+		}
+
+	private:
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Write the current node and its bounding rectangle.
+		///////////////////////////////////////////////////////////////////////
+		void flush(file_stream<entry_type> & parents) {
+			entry_type parent;
+			parent.mbr = m_node.entries[0].mbr;
+			for (stream_size_type i = 1; i < m_node.count; ++i)
+				parent.mbr.extend(m_node.entries[i].mbr);
+			parent.id = m_tree.m_nodes.size();
+			m_tree.m_nodes.seek(0, file_stream<node_type>::end);
+			m_tree.m_nodes.write(m_node);
+			parents.write(parent);
+			m_node.count = 0;
+		}
+
+		rtree & m_tree;
+		file_stream<entry_type> m_parents;
+		node_type m_node;
+		stream_size_type m_size;
+	};
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \param cacheNodes  The number of nodes to cache in memory.
+	///////////////////////////////////////////////////////////////////////////
+	rtree(memory_size_type cacheNodes = defaultCacheNodes)
+		: m_nodes(file_stream<node_type>::calculate_block_factor(sizeof(node_type)))
+		, m_cache(cacheNodes)
+	{
+		m_header.root = m_header.height = m_header.size = 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Open the tree stored in the given file, or create an empty
+	/// tree if the file does not exist.
+	///////////////////////////////////////////////////////////////////////////
+	void open(const std::string & path) {
+		m_nodes.open(path, access_read_write, sizeof(rtree_bits::header), access_random);
+		read_header();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Open an empty tree in a temporary file.
+	///////////////////////////////////////////////////////////////////////////
+	void open() {
+		m_nodes.open(sizeof(rtree_bits::header), access_random);
+		read_header();
+	}
+
+	void close() {
+		m_nodes.close();
+		m_cache.clear();
+		m_header.root = m_header.height = m_header.size = 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief The number of rectangles in the tree.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type size() const {
+		return m_header.size;
+	}
+
+	bool empty() const {
+		return m_header.size == 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief The number of levels of nodes.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type height() const {
+		return m_header.height;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief The number of nodes stored.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type node_count() const {
+		return m_nodes.size();
+	}
+
+	stream_size_type cache_hits() const {return m_cache.hits();}
+	stream_size_type cache_misses() const {return m_cache.misses();}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Report the entries intersecting the given window.
+	///
+	/// \param f  Functor called with each entry found.
+	///////////////////////////////////////////////////////////////////////////
+	template <typename F>
+	void window_query(const rectangle_type & window, F & f) {
+		rtree_bits::single_query<F> q(f);
+		window_queries(&window, &window + 1, q);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Report the entries intersecting each of a batch of windows.
+	///
+	/// The windows are answered in a single traversal, so each node is read
+	/// at most once for the whole batch.
+	///
+	/// \param begin, end  Random access iterators to the windows.
+	/// \param f  Functor called as f(i, entry) for each entry found in the
+	/// i'th window.
+	///////////////////////////////////////////////////////////////////////////
+	template <typename IT, typename F>
+	void window_queries(IT begin, IT end, F & f) {
+		if (m_header.height == 0 || begin == end) return;
+		std::vector<memory_size_type> windows(end - begin);
+		for (memory_size_type i = 0; i < windows.size(); ++i) windows[i] = i;
+		query(m_header.root, m_header.height - 1, windows, begin, f);
+	}
+
+private:
+	void read_header() {
+		m_cache.clear();
+		if (m_nodes.user_data_size() == 0) {
+			m_header.root = m_header.height = m_header.size = 0;
+		} else {
+			m_nodes.read_user_data(m_header);
+		}
+	}
+
+	template <typename IT, typename F>
+	void query(stream_size_type index, stream_size_type level,
+			   const std::vector<memory_size_type> & windows, IT w, F & f) {
+		// The cached node may be evicted by the recursion.
+		node_type node = m_cache.get(m_nodes, index);
+		std::vector<memory_size_type> hits;
+		for (stream_size_type i = 0; i < node.count; ++i) {
+			const entry_type & e = node.entries[i];
+			if (level == 0) {
+				for (memory_size_type j = 0; j < windows.size(); ++j)
+					if (w[windows[j]].intersects(e.mbr)) f(windows[j], e);
+				continue;
+			}
+			hits.clear();
+			for (memory_size_type j = 0; j < windows.size(); ++j)
+				if (w[windows[j]].intersects(e.mbr)) hits.push_back(windows[j]);
+			if (!hits.empty()) query(e.id, level - 1, hits, w, f);
+		}
+	}
+
+	file_stream<node_type> m_nodes;
+	rtree_bits::node_cache<node_type> m_cache;
+	rtree_bits::header m_header;
+};
+
+} // namespace tpie
+
+#endif // __TPIE_RTREE_H__
@@ -36,6 +36,7 @@
 #include <boost/type_traits/is_pointer.hpp>
 #include <boost/utility/enable_if.hpp>
 #include <tpie/is_simple_iterator.h>
+#include <vector>
 
 namespace tpie {
 
@@ -178,6 +179,13 @@ struct counter {
 	size_t size;
 	counter(): size(0) {}
 	void write(const void *, size_t s) {size += s;}
+	char * reserve(size_t s) {
+		size += s;
+		scratch.resize(s);
+		return scratch.empty() ? 0 : &scratch[0];
+	}
+private:
+	std::vector<char> scratch;
 };
 
 } // namespace bits
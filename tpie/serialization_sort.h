@@ -21,6 +21,9 @@
 #define TPIE_SERIALIZATION_SORT_H
 
 #include <queue>
+#include <string>
+#include <vector>
+#include <functional>
 #include <boost/filesystem.hpp>
 
 #include <tpie/array.h>
@@ -29,12 +32,58 @@
 #include <tpie/tpie_log.h>
 #include <tpie/stats.h>
 #include <tpie/parallel_sort.h>
+#include <tpie/job.h>
 
 #include <tpie/serialization2.h>
 #include <tpie/serialization_stream.h>
 
 namespace tpie {
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Normalized key prefixes for serialization_sort.
+///
+/// Specialize this template to let serialization_sort compare fixed-size
+/// key prefixes before comparing items of type T with pred_t. If enabled is
+/// true, get(a) < get(b) must imply pred(a, b), and the items are only
+/// compared with pred when their prefixes are equal. The default does not
+/// use prefixes.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename pred_t>
+struct serialization_sort_key_prefix {
+	static const bool enabled = false;
+	static uint64_t get(const T &) { return 0; }
+};
+
+namespace serialization_bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  The first eight characters of s as a big-endian integer, so that
+/// integer order agrees with lexicographical order of unsigned characters.
+///////////////////////////////////////////////////////////////////////////////
+inline uint64_t string_prefix(const std::string & s) {
+	uint64_t res = 0;
+	const size_t n = std::min(s.size(), static_cast<size_t>(8));
+	for (size_t i = 0; i < 8; ++i) {
+		res <<= 8;
+		if (i < n) res |= static_cast<unsigned char>(s[i]);
+	}
+	return res;
+}
+
+} // namespace serialization_bits
+
+template <>
+struct serialization_sort_key_prefix<std::string, std::less<std::string> > {
+	static const bool enabled = true;
+	static uint64_t get(const std::string & s) { return serialization_bits::string_prefix(s); }
+};
+
+template <>
+struct serialization_sort_key_prefix<std::string, std::greater<std::string> > {
+	static const bool enabled = true;
+	static uint64_t get(const std::string & s) { return ~serialization_bits::string_prefix(s); }
+};
+
 namespace serialization_bits {
 
 struct sort_parameters {
@@ -46,22 +95,57 @@ struct sort_parameters {
 	memory_size_type memoryPhase3;
 	/** Minimum size of serialized items. */
 	memory_size_type minimumItemSize;
-	/** Directory in which temporary files are stored. */
-	std::string tempDir;
+	/** Directories in which temporary files are stored, typically one for
+	 * each temporary directory given to tempname::set_default_paths. */
+	std::vector<std::string> tempDirs;
 
 	void dump(std::ostream & out) const {
 		out << "Serialization merge sort parameters\n"
 			<< "Phase 1 memory:              " << memoryPhase1 << '\n'
 			<< "Phase 2 memory:              " << memoryPhase2 << '\n'
 			<< "Phase 3 memory:              " << memoryPhase3 << '\n'
-			<< "Minimum item size:           " << minimumItemSize << '\n'
-			<< "Temporary directory:         " << tempDir << '\n';
+			<< "Minimum item size:           " << minimumItemSize << '\n';
+		for (size_t i = 0; i < tempDirs.size(); ++i)
+			out << "Temporary directory:         " << tempDirs[i] << '\n';
 	}
 };
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Key prefix and buffer index of an item in internal_sort.
+///////////////////////////////////////////////////////////////////////////////
+struct prefix_entry {
+	uint64_t prefix;
+	memory_size_type index;
+};
+
 template <typename T, typename pred_t>
 class internal_sort {
+	typedef serialization_sort_key_prefix<T, pred_t> prefix_t;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Compares prefix entries by prefix, and by the items in the
+	/// buffer on ties.
+	///////////////////////////////////////////////////////////////////////////
+	class prefix_pred_t : public std::binary_function<prefix_entry, prefix_entry, bool> {
+		const T * m_items;
+		pred_t m_pred;
+
+	public:
+		prefix_pred_t(const T * items, const pred_t & pred)
+			: m_items(items)
+			, m_pred(pred)
+		{
+		}
+
+		bool operator()(const prefix_entry & a, const prefix_entry & b) const {
+			if (a.prefix != b.prefix) return a.prefix < b.prefix;
+			return m_pred(m_items[a.index], m_items[b.index]);
+		}
+	};
+
 	array<T> m_buffer;
+	/** When prefixes are enabled, the prefix of each item in m_buffer. */
+	array<prefix_entry> m_prefixes;
 	memory_size_type m_items;
 	memory_size_type m_serializedSize;
 	memory_size_type m_memAvail;
@@ -82,8 +166,13 @@ public:
 	{
 	}
 
+	static memory_size_type item_overhead() {
+		return sizeof(T) + (prefix_t::enabled ? sizeof(prefix_entry) : 0);
+	}
+
 	void begin(memory_size_type memAvail) {
-		m_buffer.resize(memAvail / sizeof(T) / 2);
+		m_buffer.resize(memAvail / item_overhead() / 2);
+		if (prefix_t::enabled) m_prefixes.resize(m_buffer.size());
 		m_items = m_serializedSize = 0;
 		m_largestItem = sizeof(T);
 		m_full = false;
@@ -124,6 +213,10 @@ public:
 
 		m_serializedSize += serSize;
 
+		if (prefix_t::enabled) {
+			m_prefixes[m_items].prefix = prefix_t::get(item);
+			m_prefixes[m_items].index = m_items;
+		}
 		m_buffer[m_items++] = item;
 
 		return true;
@@ -154,7 +247,7 @@ public:
 	/// calculations.
 	///////////////////////////////////////////////////////////////////////////
 	memory_size_type memory_usage() {
-		return m_buffer.size() * sizeof(T)
+		return m_buffer.size() * item_overhead()
 			+ (m_serializedSize - m_items * sizeof(T));
 	}
 
@@ -165,10 +258,42 @@ public:
 	void shrink_buffer() {
 		array<T> newBuffer(array_view<const T>(begin(), end()));
 		m_buffer.swap(newBuffer);
+		m_prefixes.resize(0);
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Sort the items in the buffer.
+	///
+	/// When key prefixes are enabled, the (prefix, index) pairs are sorted
+	/// instead, so most comparisons do not touch the items, and the items
+	/// are then permuted into sorted order by swapping.
+	///////////////////////////////////////////////////////////////////////////
 	void sort() {
-		parallel_sort(m_buffer.get(), m_buffer.get() + m_items, m_pred);
+		if (!prefix_t::enabled || m_prefixes.size() < m_items) {
+			parallel_sort(m_buffer.get(), m_buffer.get() + m_items, m_pred);
+			return;
+		}
+		parallel_sort(m_prefixes.get(), m_prefixes.get() + m_items,
+					  prefix_pred_t(m_buffer.get(), m_pred));
+
+		// Follow the cycles of the permutation; entry i is marked as done by
+		// setting its index to i.
+		for (memory_size_type i = 0; i < m_items; ++i) {
+			if (m_prefixes[i].index == i) continue;
+			T tmp;
+			std::swap(tmp, m_buffer[i]);
+			memory_size_type j = i;
+			for (;;) {
+				memory_size_type k = m_prefixes[j].index;
+				m_prefixes[j].index = j;
+				if (k == i) {
+					std::swap(m_buffer[j], tmp);
+					break;
+				}
+				std::swap(m_buffer[j], m_buffer[k]);
+				j = k;
+			}
+		}
 	}
 
 	const T * begin() const {
@@ -184,6 +309,7 @@ public:
 	///////////////////////////////////////////////////////////////////////////
 	void free() {
 		m_buffer.resize(0);
+		m_prefixes.resize(0);
 		reset();
 	}
 
@@ -195,6 +321,19 @@ public:
 		m_items = m_serializedSize = 0;
 		m_full = false;
 	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Exchange the buffers and state of two sorters.
+	///////////////////////////////////////////////////////////////////////////
+	void swap(internal_sort & other) {
+		m_buffer.swap(other.m_buffer);
+		m_prefixes.swap(other.m_prefixes);
+		std::swap(m_items, other.m_items);
+		std::swap(m_serializedSize, other.m_serializedSize);
+		std::swap(m_memAvail, other.m_memAvail);
+		std::swap(m_largestItem, other.m_largestItem);
+		std::swap(m_full, other.m_full);
+	}
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -235,6 +374,12 @@ public:
 ///
 /// See serialization_sort::merge_runs() for the logic involving
 /// next_level_runs() and remaining_runs() in a loop.
+///
+/// ## Temporary directories
+///
+/// Run files are spread over the temporary directories in turn by physical
+/// index, so the consecutive runs that are merged together are read from
+/// different directories.
 ///////////////////////////////////////////////////////////////////////////////
 template <typename T>
 class file_handler {
@@ -253,12 +398,12 @@ class file_handler {
 
 	array<serialization_reader> m_readers;
 
-	std::string m_tempDir;
+	std::vector<std::string> m_tempDirs;
 
 	std::string run_file(size_t physicalIndex) {
-		if (m_tempDir.size() == 0) throw exception("run_file: temp dir is the empty string");
+		if (m_tempDirs.empty()) throw exception("run_file: no temp dirs");
 		std::stringstream ss;
-		ss << m_tempDir << '/' << physicalIndex << ".tpie";
+		ss << m_tempDirs[physicalIndex % m_tempDirs.size()] << '/' << physicalIndex << ".tpie";
 		return ss.str();
 	}
 
@@ -278,12 +423,17 @@ public:
 
 	~file_handler() {
 		reset();
+		// Remove the run directories, unless something else was put there.
+		for (size_t i = 0; i < m_tempDirs.size(); ++i) {
+			boost::system::error_code ec;
+			boost::filesystem::remove(m_tempDirs[i], ec);
+		}
 	}
 
-	void set_temp_dir(const std::string & tempDir) {
+	void set_temp_dirs(const std::vector<std::string> & tempDirs) {
 		if (m_nextFileOffset != 0)
-			throw exception("set_temp_dir: trying to change path after files already open");
-		m_tempDir = tempDir;
+			throw exception("set_temp_dirs: trying to change path after files already open");
+		m_tempDirs = tempDirs;
 	}
 
 	void open_new_writer() {
@@ -400,18 +550,60 @@ private:
 	}
 };
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Background job serializing a sorted run to the open run writer.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename pred_t>
+class run_writer_job : public job {
+public:
+	run_writer_job() : sorter(0), files(0), failed(false) {}
+
+	void set_run(internal_sort<T, pred_t> * sorter, file_handler<T> * files) {
+		this->sorter = sorter;
+		this->files = files;
+	}
+
+	virtual void operator()() {
+		try {
+			for (const T * item = sorter->begin(); item != sorter->end(); ++item)
+				files->write(*item);
+		} catch (const std::exception & e) {
+			error = e.what();
+			failed = true;
+		}
+	}
+
+	internal_sort<T, pred_t> * sorter;
+	file_handler<T> * files;
+	bool failed;
+	std::string error;
+};
+
 template <typename T, typename pred_t>
 class merger {
+	typedef serialization_sort_key_prefix<T, pred_t> prefix_t;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  An item in the merge heap along with its key prefix and the
+	/// index of the run it came from.
+	///////////////////////////////////////////////////////////////////////////
+	struct heap_item {
+		uint64_t prefix;
+		T first;
+		size_t second;
+	};
+
 	class mergepred_t {
 		pred_t m_pred;
 
 	public:
-		typedef std::pair<T, size_t> item_type;
+		typedef heap_item item_type;
 
 		mergepred_t(const pred_t & pred) : m_pred(pred) {}
 
 		// Used with std::priority_queue, so invert the original relation.
 		bool operator()(const item_type & a, const item_type & b) const {
+			if (prefix_t::enabled && a.prefix != b.prefix) return b.prefix < a.prefix;
 			return m_pred(b.first, a.first);
 		}
 	};
@@ -465,7 +657,11 @@ public:
 private:
 	void push_from(size_t idx) {
 		if (files.can_read(idx)) {
-			pq.push(std::make_pair(files.read(idx), idx));
+			item_type item;
+			item.first = files.read(idx);
+			item.prefix = prefix_t::get(item.first);
+			item.second = idx;
+			pq.push(item);
 		}
 	}
 };
@@ -482,6 +678,17 @@ private:
 
 	sorter_state m_state;
 	serialization_bits::internal_sort<T, pred_t> m_sorter;
+	/** While forming runs in parallel, the run being written in the
+	 * background. */
+	serialization_bits::internal_sort<T, pred_t> m_backSorter;
+	serialization_bits::run_writer_job<T, pred_t> m_writeJob;
+	bool m_writeJobActive;
+	/** True if runs may be written in the background. */
+	bool m_parallelRuns;
+	/** True if run formation currently alternates between the two sorters. */
+	bool m_doubleBuffered;
+	/** Largest serialized item size in the runs written so far. */
+	memory_size_type m_largestItem;
 	serialization_bits::sort_parameters m_params;
 	bool m_parametersSet;
 	serialization_bits::file_handler<T> m_files;
@@ -495,6 +702,11 @@ public:
 	serialization_sort(memory_size_type minimumItemSize = sizeof(T), pred_t pred = pred_t())
 		: m_state(state_initial)
 		, m_sorter(pred)
+		, m_backSorter(pred)
+		, m_writeJobActive(false)
+		, m_parallelRuns(default_worker_count() > 1)
+		, m_doubleBuffered(false)
+		, m_largestItem(0)
 		, m_parametersSet(false)
 		, m_files()
 		, m_merger(m_files, pred)
@@ -508,6 +720,26 @@ public:
 		m_params.minimumItemSize = minimumItemSize;
 	}
 
+	~serialization_sort() {
+		if (m_writeJobActive) m_writeJob.join();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Enable or disable parallel run formation.
+	///
+	/// When enabled (the default on machines with more than one core), the
+	/// first run is formed using all of the phase 1 memory. If more runs are
+	/// needed, the memory is split between two buffers: while one buffer is
+	/// filled, the sorted run in the other is serialized to disk in a job.
+	/// This halves the length of the later runs. Without a job manager, runs
+	/// are always written synchronously.
+	///////////////////////////////////////////////////////////////////////////
+	void set_parallel_run_formation(bool enabled) {
+		if (m_state != state_initial)
+			throw tpie::exception("Bad state in set_parallel_run_formation");
+		m_parallelRuns = enabled;
+	}
+
 private:
 	// set_phase_?_memory helper
 	inline void maybe_calculate_parameters() {
@@ -619,8 +851,11 @@ private:
 			throw exception("Not enough memory for merging.");
 		}
 
-		m_params.tempDir = tempname::tpie_dir_name();
-		m_files.set_temp_dir(m_params.tempDir);
+		std::vector<std::string> paths = tempname::get_actual_paths();
+		m_params.tempDirs.resize(paths.size());
+		for (size_t i = 0; i < paths.size(); ++i)
+			m_params.tempDirs[i] = tempname::tpie_dir_name("", paths[i]);
+		m_files.set_temp_dirs(m_params.tempDirs);
 
 		log_info() << "Calculated serialization_sort parameters.\n";
 		m_params.dump(log_info());
@@ -642,7 +877,8 @@ public:
 		m_sorter.begin(m_params.memoryPhase1 - serialization_writer::memory_usage());
 		log_info() << "After internal sorter begin; mem usage = "
 			<< get_memory_manager().used() << std::endl;
-		boost::filesystem::create_directory(m_params.tempDir);
+		for (size_t i = 0; i < m_params.tempDirs.size(); ++i)
+			boost::filesystem::create_directory(m_params.tempDirs[i]);
 	}
 
 	void push(const T & item) {
@@ -662,6 +898,8 @@ public:
 		if (m_state != state_1)
 			throw tpie::exception("Bad state in end");
 
+		wait_for_run_writer();
+
 		memory_size_type internalThreshold =
 			std::min(m_params.memoryPhase2, m_params.memoryPhase3);
 
@@ -696,9 +934,12 @@ public:
 		} else {
 
 			end_run();
+			wait_for_run_writer();
 			log_debug() << "Got " << m_files.next_level_runs() << " runs. "
 				<< "External reporting mode." << std::endl;
 			m_sorter.free();
+			m_backSorter.free();
+			m_doubleBuffered = false;
 			m_reportInternal = false;
 		}
 
@@ -746,7 +987,7 @@ public:
 			return;
 		}
 
-		memory_size_type largestItem = m_sorter.get_largest_item_size();
+		memory_size_type largestItem = m_largestItem;
 		if (largestItem == 0) {
 			log_warning() << "Largest item is 0 bytes; doing nothing." << std::endl;
 			m_state = state_3;
@@ -810,12 +1051,55 @@ private:
 	void end_run() {
 		m_sorter.sort();
 		if (m_sorter.begin() == m_sorter.end()) return;
+		m_largestItem = std::max(m_largestItem, m_sorter.get_largest_item_size());
+		if (m_doubleBuffered) {
+			// The back buffer must be written out before it can be refilled.
+			wait_for_run_writer();
+			m_files.open_new_writer();
+			m_sorter.swap(m_backSorter);
+			m_writeJob.set_run(&m_backSorter, &m_files);
+			m_writeJob.enqueue();
+			m_writeJobActive = true;
+			return;
+		}
 		m_files.open_new_writer();
 		for (const T * item = m_sorter.begin(); item != m_sorter.end(); ++item) {
 			m_files.write(*item);
 		}
 		m_files.close_writer();
 		m_sorter.reset();
+		if (m_state == state_1) maybe_begin_double_buffering();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  After the first run, split the run formation memory between
+	/// two buffers if parallel run formation is enabled, the job manager is
+	/// running and each half can hold a reasonably sized run.
+	///////////////////////////////////////////////////////////////////////////
+	void maybe_begin_double_buffering() {
+		if (!m_parallelRuns || m_doubleBuffered || !job_manager_initialized()) return;
+		memory_size_type memAvail = m_params.memoryPhase1 - serialization_writer::memory_usage();
+		if (memAvail / 2 < serialization_writer::memory_usage()) return;
+		log_debug() << "Forming remaining runs in parallel." << std::endl;
+		m_sorter.free();
+		m_sorter.begin(memAvail / 2);
+		m_backSorter.begin(memAvail / 2);
+		m_doubleBuffered = true;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Wait for the background run writer and close its run.
+	///////////////////////////////////////////////////////////////////////////
+	void wait_for_run_writer() {
+		if (!m_writeJobActive) return;
+		m_writeJob.join();
+		m_writeJobActive = false;
+		m_files.close_writer();
+		m_backSorter.reset();
+		if (m_writeJob.failed) {
+			m_writeJob.failed = false;
+			throw exception(m_writeJob.error);
+		}
 	}
 
 	void initialize_merger(size_t fanout) {
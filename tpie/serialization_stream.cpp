@@ -248,9 +248,11 @@ void serialization_writer::close() {
 }
 
 void serialization_reverse_writer::write_block() {
-	// See note about m_index and its semantics.
-	std::reverse(m_block.get(), m_block.get() + block_size());
-	p_t::write_block(m_block.get(), m_index);
+	// See note about m_index and its semantics. Only the used part of the
+	// block is reversed, so a partial final block is cheap.
+	char * first = m_block.get() + (block_size() - m_index);
+	std::reverse(first, m_block.get() + block_size());
+	p_t::write_block(first, m_index);
 	m_index = 0;
 }
 
@@ -30,6 +30,10 @@
 #include <tpie/access_type.h>
 #include <tpie/array.h>
 #include <tpie/tempname.h>
+#include <tpie/array_view.h>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <vector>
 
 namespace tpie {
 
@@ -88,13 +92,21 @@ private:
 
 	void write_block();
 
+	/** Holds the bytes of a reservation that did not fit in m_block. */
+	std::vector<char> m_spill;
+
 	class serializer {
 		serialization_writer & wr;
+		/** Number of bytes in wr.m_spill not yet written. */
+		memory_size_type m_spilled;
 
-	public:
-		serializer(serialization_writer & wr) : wr(wr) {}
+		void write_inner(const char * const s, const memory_size_type n) {
+			if (wr.m_index + n <= wr.block_size()) {
+				std::copy(s, s + n, wr.m_block.get() + wr.m_index);
+				wr.m_index += n;
+				return;
+			}
 
-		void write(const char * const s, const memory_size_type n) {
 			const char * i = s;
 			memory_size_type written = 0;
 			while (written != n) {
@@ -111,6 +123,48 @@ private:
 				wr.m_index += writeSize;
 			}
 		}
+
+		void flush_spill() {
+			if (m_spilled == 0) return;
+			memory_size_type n = m_spilled;
+			m_spilled = 0;
+			write_inner(&wr.m_spill[0], n);
+		}
+
+	public:
+		serializer(serialization_writer & wr) : wr(wr), m_spilled(0) {}
+
+		~serializer() {
+			flush_spill();
+		}
+
+		void write(const char * const s, const memory_size_type n) {
+			flush_spill();
+			write_inner(s, n);
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief  Reserve the next n bytes of the stream for the caller to
+		/// fill in.
+		///
+		/// If the bytes fit in the current block, the returned pointer points
+		/// into the block, so the caller serializes in place. Otherwise, the
+		/// bytes are buffered and copied to the stream later. The pointer is
+		/// valid until the next call to write or reserve, or until the
+		/// serialize() call returns.
+		///////////////////////////////////////////////////////////////////////
+		char * reserve(const memory_size_type n) {
+			flush_spill();
+			if (wr.m_index >= wr.block_size()) wr.write_block();
+			if (wr.m_index + n <= wr.block_size()) {
+				char * res = wr.m_block.get() + wr.m_index;
+				wr.m_index += n;
+				return res;
+			}
+			wr.m_spill.resize(n);
+			m_spilled = n;
+			return &wr.m_spill[0];
+		}
 	};
 
 	friend class serializer;
@@ -155,8 +209,7 @@ class serialization_reverse_writer : public bits::serialization_writer_base {
 	/** Special m_index semantics:
 	 * In m_block, the indices [block_size() - m_index, block_size())
 	 * contain items that should be reversed before writing out.
-	 * After std::reversing all of m_block, the index range to write out becomes
-	 * [0, m_index). */
+	 * write_block std::reverses this range and writes it out. */
 	memory_size_type m_index;
 	std::vector<char> m_serializationBuffer;
 
@@ -169,10 +222,20 @@ class serialization_reverse_writer : public bits::serialization_writer_base {
 		serializer(serialization_reverse_writer & wr) : wr(wr) {}
 
 		void write(const char * const s, const memory_size_type n) {
+			std::copy(s, s + n, reserve(n));
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief  Reserve the next n bytes of the serialized item for the
+		/// caller to fill in. The pointer is valid until the next call to
+		/// write or reserve, or until the serialize() call returns.
+		///////////////////////////////////////////////////////////////////////
+		char * reserve(const memory_size_type n) {
 			std::vector<char> & data = wr.m_serializationBuffer;
 			memory_size_type offs = data.size();
-			data.resize(data.size() + n);
-			std::copy(s, s + n, &data[offs]);
+			data.resize(offs + n);
+			if (data.empty()) return 0;
+			return &data[0] + offs;
 		}
 
 		~serializer() {
@@ -255,6 +318,8 @@ protected:
 	stream_size_type m_size;
 	memory_size_type m_index;
 	memory_size_type m_blockSize;
+	/** Holds the bytes returned by read_in_place when they span blocks. */
+	std::vector<char> m_spill;
 
 	serialization_reader_base();
 
@@ -275,7 +340,12 @@ public:
 	/// \param n  Number of bytes to read.
 	///////////////////////////////////////////////////////////////////////////
 	void read(char * const s, const memory_size_type n) {
-		// TODO: inline some of this
+		if (m_index + n <= m_blockSize) {
+			std::copy(m_block.get() + m_index, m_block.get() + m_index + n, s);
+			m_index += n;
+			return;
+		}
+
 		char * i = s;
 		memory_size_type written = 0;
 		while (written != n) {
@@ -298,6 +368,63 @@ public:
 		}
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Read n bytes from the stream without copying them, if
+	/// possible.
+	///
+	/// If the bytes are contained in the current block, a pointer into the
+	/// block is returned. Otherwise, they are copied to a buffer owned by
+	/// the reader. The pointer is valid until the next read from the stream.
+	///////////////////////////////////////////////////////////////////////////
+	const char * read_in_place(const memory_size_type n) {
+		if (n > 0 && m_index >= m_blockSize) {
+			// virtual invocation
+			next_block();
+		}
+		if (m_index + n <= m_blockSize) {
+			const char * res = m_block.get() + m_index;
+			m_index += n;
+			return res;
+		}
+		m_spill.resize(n);
+		read(&m_spill[0], n);
+		return &m_spill[0];
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Read n trivially serializable items from the stream without
+	/// copying them, if possible. The view is valid until the next read from
+	/// the stream.
+	///////////////////////////////////////////////////////////////////////////
+	template <typename T>
+	array_view<const T> read_array_view(const memory_size_type n) {
+		BOOST_STATIC_ASSERT(is_trivially_serializable<T>::value);
+		if (n == 0) return array_view<const T>(static_cast<const T *>(0), static_cast<size_t>(0));
+		const memory_size_type bytes = n * sizeof(T);
+		const char * p = read_in_place(bytes);
+		if (reinterpret_cast<size_t>(p) % boost::alignment_of<T>::value != 0) {
+			// Unaligned in the block; copy to the spill buffer, which is
+			// allocated by operator new and hence suitably aligned.
+			m_spill.assign(p, p + bytes);
+			p = &m_spill[0];
+		}
+		return array_view<const T>(reinterpret_cast<const T *>(p), n);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Unserialize a std::basic_string or std::vector of trivially
+	/// serializable items as a view of its payload, without allocating.
+	///
+	/// The view is valid until the next read from the stream.
+	///////////////////////////////////////////////////////////////////////////
+	template <typename T>
+	array_view<const T> unserialize_view() {
+		size_t n;
+		using tpie::unserialize;
+		unserialize(*this, n);
+		return read_array_view<T>(n);
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief  Unserialize an unserializable item from the stream.
 	///
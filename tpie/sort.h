@@ -48,23 +48,39 @@
 
 #include <tpie/progress_indicator_base.h>
 #include <tpie/progress_indicator_null.h>
+#include <tpie/sortedness.h>
 
 namespace tpie {
 
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief Sort elements of a stream using the given STL-style comparator
 /// object.
+///
+/// If the comparator has an identity (see has_predicate_identity()) and the
+/// output stream has room for it in its user data, the stream is marked as
+/// sorted by the comparator (see tpie/sortedness.h). Sorting a marked stream
+/// in-place by the same comparator is a no-op.
 ///////////////////////////////////////////////////////////////////////////////
 template<typename T, typename Compare>
 void sort(file_stream<T> &instream, file_stream<T> &outstream,
 		  Compare comp, progress_indicator_base & indicator) {
 
+	if (&instream == &outstream && is_marked_sorted(instream, comp)) {
+		log_debug() << "Input stream is marked as sorted; skipping sort" << std::endl;
+		indicator.init(1);
+		indicator.step();
+		indicator.done();
+		instream.seek(0);
+		return;
+	}
+
 	ami::Internal_Sorter_Obj<T,Compare> myInternalSorter(comp);
 	ami::merge_heap_obj<T,Compare>      myMergeHeap(comp);
 	sort_manager< T, ami::Internal_Sorter_Obj<T,Compare>, ami::merge_heap_obj<T,Compare> > 
 	mySortManager(&myInternalSorter, &myMergeHeap);
 
 	mySortManager.sort(&instream, &outstream, &indicator);
+	mark_sorted(outstream, comp);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -74,7 +90,12 @@ template<typename T>
 void sort(file_stream<T> &instream, file_stream<T> &outstream,
 		  tpie::progress_indicator_base* indicator=NULL) {
 	std::less<T> comp;
-	sort(instream, outstream, comp, *indicator);
+	if (indicator == NULL) {
+		progress_indicator_null pi;
+		sort(instream, outstream, comp, pi);
+	} else {
+		sort(instream, outstream, comp, *indicator);
+	}
 }
 
 
@@ -0,0 +1,176 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file sortedness.h  Sortedness metadata stored in stream user data.
+///
+/// A stream that is known to be sorted by a given predicate can be marked as
+/// such by storing a sortedness_header in its user data. The predicate is
+/// identified by a hash of its type name, so marking is only done for
+/// predicate types that opt in through sortedness_predicate, which
+/// std::less and std::greater do. Function pointers and predicates with
+/// state are never marked, since predicates of the same type may then
+/// impose different orders.
+///
+/// The header records the number of items in the stream when it was marked,
+/// and file_stream removes the mark when it writes to the stream, so any
+/// change to a marked stream invalidates the mark.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TPIE_SORTEDNESS_H__
+#define __TPIE_SORTEDNESS_H__
+
+#include <tpie/types.h>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/is_empty.hpp>
+#include <functional>
+#include <typeinfo>
+
+namespace tpie {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Layout of the sortedness metadata in the stream user data.
+///////////////////////////////////////////////////////////////////////////////
+struct sortedness_header {
+	static const uint64_t magicConst = 0x7e2d51f0a9c3b864ull;
+
+	/** Must equal magicConst for the header to be valid. */
+	uint64_t magic;
+	/** Identity of the predicate, see predicate_identity(). */
+	uint64_t predicate;
+	/** Number of items in the stream when it was marked. */
+	uint64_t items;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Specialize to true_type for a comparator class whose type alone
+/// determines its order, to let streams be marked as sorted by it.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t>
+struct sortedness_predicate : public boost::false_type {};
+
+template <typename T>
+struct sortedness_predicate<std::less<T> > : public boost::true_type {};
+
+template <typename T>
+struct sortedness_predicate<std::greater<T> > : public boost::true_type {};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Whether streams may be marked as sorted by predicates of the given
+/// type: it must opt in and have no state.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t>
+bool has_predicate_identity() {
+	return sortedness_predicate<pred_t>::value && boost::is_empty<pred_t>::value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Compute the identity of a predicate type as a 64-bit FNV-1a hash
+/// of its type name.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t>
+uint64_t predicate_identity() {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (const char * c = typeid(pred_t).name(); *c; ++c) {
+		h ^= static_cast<unsigned char>(*c);
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Get the identity of the predicate of the given object.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t>
+uint64_t predicate_identity(const pred_t &) {
+	return predicate_identity<pred_t>();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Read the sortedness mark of a stream.
+///
+/// \param fs  An open stream.
+/// \param predicate  Set to the identity of the predicate by which the stream
+/// is sorted if the function returns true.
+/// \returns true if the stream carries a valid sortedness mark.
+///////////////////////////////////////////////////////////////////////////////
+template <typename stream_t>
+bool read_sortedness(stream_t & fs, uint64_t & predicate) {
+	// Writes still in the buffer remove the mark when flushed.
+	fs.flush();
+	if (fs.user_data_size() != sizeof(sortedness_header)) return false;
+	sortedness_header header;
+	fs.read_user_data(header);
+	if (header.magic != sortedness_header::magicConst) return false;
+	if (header.items != static_cast<uint64_t>(fs.size())) return false;
+	predicate = header.predicate;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Mark a stream as sorted by the predicate with the given identity.
+///
+/// The mark is only written if the stream has room for it in its user data
+/// and the user data is either empty or holds a previous sortedness mark,
+/// so user data written by the application is never overwritten. The next
+/// write to the stream removes the mark.
+///
+/// \returns true if the mark was written.
+///////////////////////////////////////////////////////////////////////////////
+template <typename stream_t>
+bool write_sortedness(stream_t & fs, uint64_t predicate) {
+	if (fs.max_user_data_size() < sizeof(sortedness_header)) return false;
+	if (fs.user_data_size() != 0) {
+		if (fs.user_data_size() != sizeof(sortedness_header)) return false;
+		sortedness_header old;
+		fs.read_user_data(old);
+		if (old.magic != sortedness_header::magicConst) return false;
+	}
+	sortedness_header header;
+	header.magic = sortedness_header::magicConst;
+	header.predicate = predicate;
+	header.items = static_cast<uint64_t>(fs.size());
+	fs.write_sortedness_mark(header);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Mark a stream as sorted by the given predicate, if its type has an
+/// identity.
+///////////////////////////////////////////////////////////////////////////////
+template <typename stream_t, typename pred_t>
+bool mark_sorted(stream_t & fs, const pred_t & pred) {
+	if (!has_predicate_identity<pred_t>()) return false;
+	return write_sortedness(fs, predicate_identity(pred));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Find out if a stream is marked as sorted by the given predicate.
+///////////////////////////////////////////////////////////////////////////////
+template <typename stream_t, typename pred_t>
+bool is_marked_sorted(stream_t & fs, const pred_t & pred) {
+	if (!has_predicate_identity<pred_t>()) return false;
+	uint64_t predicate;
+	return read_sortedness(fs, predicate)
+		&& predicate == predicate_identity(pred);
+}
+
+} // namespace tpie
+
+#endif // __TPIE_SORTEDNESS_H__
@@ -0,0 +1,457 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2013, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __TPIE_SPARSE_MATRIX_H__
+#define __TPIE_SPARSE_MATRIX_H__
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file sparse_matrix.h
+/// \brief External memory sparse matrix for repeated matrix-vector products.
+///
+/// The columns are cut into bands whose part of the vector fits in memory.
+/// When the matrix is assigned, its entries are sorted once by band and row
+/// into a file per band. A product then costs a scan of the entries and a
+/// merge of the partial results of the bands:
+///
+/// 1. For each band, the band of x is loaded, and the entries of the band
+///    are multiplied by it in parallel. Each worker sums the products of
+///    the rows of its batch of entries, and the sums of a row that spans
+///    batches are added into a partial result sorted by row.
+///
+/// 2. The partial results are merged by row into y.
+///
+/// pagerank() runs the power iteration on a matrix of transition
+/// probabilities.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <tpie/file_stream.h>
+#include <tpie/tempname.h>
+#include <tpie/array.h>
+#include <tpie/internal_priority_queue.h>
+#include <tpie/exception.h>
+#include <tpie/pipelining.h>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+namespace tpie {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A nonzero element of a sparse matrix.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+struct sparse_matrix_entry {
+	stream_size_type row;
+	stream_size_type col;
+	T value;
+};
+
+namespace sparse_matrix_bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A term of an element of the product.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+struct product {
+	stream_size_type row;
+	T value;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Orders entries by band, row and column.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class band_row_less
+	: public std::binary_function<sparse_matrix_entry<T>, sparse_matrix_entry<T>, bool> {
+public:
+	band_row_less(stream_size_type bandCols) : bandCols(bandCols) {}
+
+	bool operator()(const sparse_matrix_entry<T> & a, const sparse_matrix_entry<T> & b) const {
+		stream_size_type ba = a.col / bandCols;
+		stream_size_type bb = b.col / bandCols;
+		if (ba != bb) return ba < bb;
+		if (a.row != b.row) return a.row < b.row;
+		return a.col < b.col;
+	}
+
+private:
+	stream_size_type bandCols;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Multiplies each entry by the element of x of its column and sums
+/// the consecutive products of a row within a batch. x points to the
+/// element of the first column of the band.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class multiply_t {
+public:
+	template <typename dest_t>
+	class type : public pipelining::node {
+	public:
+		typedef sparse_matrix_entry<T> item_type;
+
+		type(const dest_t & dest, const T * x, stream_size_type firstCol)
+			: dest(dest)
+			, x(x)
+			, firstCol(firstCol)
+		{
+			add_push_destination(dest);
+			set_name("Multiply entries", pipelining::PRIORITY_INSIGNIFICANT);
+		}
+
+		void push(const item_type & e) {
+			product<T> p;
+			p.row = e.row;
+			p.value = e.value * x[e.col - firstCol];
+			dest.push(p);
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Push one sum for each run of entries of the same row.
+		///////////////////////////////////////////////////////////////////////
+		void push_batch(array_view<const item_type> entries) {
+			size_t i = 0;
+			while (i < entries.size()) {
+				product<T> p;
+				p.row = entries[i].row;
+				p.value = T();
+				for (; i < entries.size() && entries[i].row == p.row; ++i)
+					p.value += entries[i].value * x[entries[i].col - firstCol];
+				dest.push(p);
+			}
+		}
+
+	private:
+		dest_t dest;
+		const T * x;
+		stream_size_type firstCol;
+	};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sums the consecutive products of a row and writes the sums.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class row_sums_t : public pipelining::node {
+public:
+	typedef product<T> item_type;
+
+	row_sums_t(file_stream<product<T> > * out)
+		: out(out)
+		, pending(false)
+	{
+		set_name("Sum rows", pipelining::PRIORITY_INSIGNIFICANT);
+	}
+
+	void push(const item_type & p) {
+		if (pending && p.row == sum.row) {
+			sum.value += p.value;
+			return;
+		}
+		if (pending) out->write(sum);
+		sum = p;
+		pending = true;
+	}
+
+	virtual void end() override {
+		if (pending) out->write(sum);
+		pending = false;
+		pipelining::node::end();
+	}
+
+private:
+	file_stream<product<T> > * out;
+	product<T> sum;
+	bool pending;
+};
+
+} // namespace sparse_matrix_bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sparse matrix of elements of type T stored in temporary files.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class sparse_matrix {
+public:
+	typedef sparse_matrix_entry<T> entry_type;
+	typedef sparse_matrix_bits::product<T> product_type;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \param memory  Memory for a product, or zero to use the memory
+	/// available when the matrix is assigned. Half of it holds the band of
+	/// the vector, and the rest is left to the pipeline multiplying a band.
+	/// \param threads  Number of threads multiplying entries, or zero for
+	/// the default number of workers.
+	///////////////////////////////////////////////////////////////////////////
+	sparse_matrix(memory_size_type memory = 0, memory_size_type threads = 0)
+		: m_memory(memory)
+		, m_threads(threads == 0 ? default_worker_count() : threads)
+		, m_rows(0)
+		, m_cols(0)
+		, m_nonzeros(0)
+		, m_bandCols(1)
+		, m_pipelineMemory(0)
+	{
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Replace the matrix by the rows by cols matrix with the given
+	/// entries, in any order. Entries of the same position are added.
+	///////////////////////////////////////////////////////////////////////////
+	void assign(file_stream<entry_type> & entries, stream_size_type rows, stream_size_type cols) {
+		memory_size_type memory = m_memory == 0 ? get_memory_manager().available() : m_memory;
+		m_rows = rows;
+		m_cols = cols;
+		m_nonzeros = entries.size();
+		m_bandCols = std::max(static_cast<memory_size_type>(1), memory / 2 / sizeof(T));
+		if (m_bandCols > cols) m_bandCols = static_cast<memory_size_type>(std::max(cols, static_cast<stream_size_type>(1)));
+		m_pipelineMemory = memory - std::min(memory, m_bandCols * sizeof(T));
+		stream_size_type bands = (cols + m_bandCols - 1) / m_bandCols;
+		m_bands.resize(static_cast<memory_size_type>(bands));
+		for (memory_size_type i = 0; i < m_bands.size(); ++i) m_bands[i].reset(tpie_new<temp_file>());
+		if (bands == 0) {
+			if (m_nonzeros != 0) throw exception("sparse_matrix: entry outside the matrix");
+			return;
+		}
+
+		file_stream<entry_type> sorted;
+		sorted.open();
+		entries.seek(0);
+		pipelining::pipeline p = pipelining::input(entries)
+			| pipelining::pipesort(sparse_matrix_bits::band_row_less<T>(m_bandCols))
+			| pipelining::output(sorted);
+		p();
+
+		// Every band file is created, also those without entries.
+		sorted.seek(0);
+		file_stream<entry_type> band;
+		memory_size_type current = 0;
+		band.open(*m_bands[0]);
+		while (sorted.can_read()) {
+			const entry_type & e = sorted.read();
+			if (e.row >= rows || e.col >= cols)
+				throw exception("sparse_matrix: entry outside the matrix");
+			memory_size_type b = static_cast<memory_size_type>(e.col / m_bandCols);
+			while (current < b) {
+				band.close();
+				band.open(*m_bands[++current]);
+			}
+			band.write(e);
+		}
+		while (current + 1 < m_bands.size()) {
+			band.close();
+			band.open(*m_bands[++current]);
+		}
+	}
+
+	stream_size_type rows() const {return m_rows;}
+	stream_size_type cols() const {return m_cols;}
+	stream_size_type nonzeros() const {return m_nonzeros;}
+	memory_size_type bands() const {return m_bands.size();}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Compute y = A x. x must hold cols() items, and the contents of
+	/// y are replaced by the rows() items of the product.
+	///////////////////////////////////////////////////////////////////////////
+	void multiply(file_stream<T> & x, file_stream<T> & y) {
+		if (x.size() != m_cols)
+			throw exception("sparse_matrix: the vector does not match the columns");
+		array<auto_ptr<temp_file> > partials(m_bands.size());
+		{
+			array<T> xBand(m_bandCols);
+			x.seek(0);
+			for (memory_size_type b = 0; b < m_bands.size(); ++b) {
+				stream_size_type firstCol = static_cast<stream_size_type>(b) * m_bandCols;
+				memory_size_type n = static_cast<memory_size_type>(std::min<stream_size_type>(m_bandCols, m_cols - firstCol));
+				x.read(xBand.get(), xBand.get() + n);
+				partials[b].reset(tpie_new<temp_file>());
+				multiply_band(b, xBand.get(), firstCol, *partials[b]);
+			}
+		}
+		merge(partials, y);
+	}
+
+private:
+	typedef pipelining::factory_2<sparse_matrix_bits::multiply_t<T>::template type, const T *, stream_size_type> multiply_factory;
+	typedef pipelining::termfactory_1<sparse_matrix_bits::row_sums_t<T>, file_stream<product_type> *> row_sums_factory;
+
+	void multiply_band(memory_size_type b, const T * x, stream_size_type firstCol, temp_file & partial) {
+		file_stream<entry_type> in;
+		in.open(*m_bands[b], access_read);
+		file_stream<product_type> out;
+		out.open(partial, access_write);
+		if (in.size() == 0) return;
+		pipelining::pipeline p = pipelining::input(in)
+			| pipelining::parallel(pipelining::pipe_middle<multiply_factory>(multiply_factory(x, firstCol)),
+								   pipelining::maintain_order, m_threads)
+			| pipelining::pipe_end<row_sums_factory>(row_sums_factory(&out));
+		progress_indicator_null pi;
+		p(in.size(), pi, m_pipelineMemory);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Merge the partial results into y, first merging groups of them
+	/// while there are more than can be open at once.
+	///////////////////////////////////////////////////////////////////////////
+	void merge(array<auto_ptr<temp_file> > & partials, file_stream<T> & y) {
+		memory_size_type memory = m_memory == 0 ? get_memory_manager().available() : m_memory;
+		// One stream is written while the others are merged, each with its
+		// head and an element of the priority queue.
+		memory_size_type perInput = file_stream<product_type>::memory_usage()
+			+ sizeof(T) + sizeof(std::pair<stream_size_type, memory_size_type>);
+		memory_size_type streams = memory / perInput;
+		memory_size_type fanout = streams > 3 ? streams - 1 : 2;
+		while (partials.size() > fanout) {
+			memory_size_type groups = (partials.size() + fanout - 1) / fanout;
+			array<auto_ptr<temp_file> > merged(groups);
+			for (memory_size_type g = 0; g < groups; ++g) {
+				merged[g].reset(tpie_new<temp_file>());
+				file_stream<product_type> out;
+				out.open(*merged[g], access_write);
+				memory_size_type end = std::min(partials.size(), (g + 1) * fanout);
+				sparse_output output(out);
+				merge_group(partials, g * fanout, end, output);
+			}
+			partials.swap(merged);
+		}
+		y.truncate(0);
+		dense_output out(y, m_rows);
+		merge_group(partials, 0, partials.size(), out);
+		out.finish();
+	}
+
+	class sparse_output {
+	public:
+		sparse_output(file_stream<product_type> & out) : out(out) {}
+		void operator()(const product_type & p) {out.write(p);}
+	private:
+		file_stream<product_type> & out;
+	};
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Writes the sums with zeros for the missing rows.
+	///////////////////////////////////////////////////////////////////////////
+	class dense_output {
+	public:
+		dense_output(file_stream<T> & out, stream_size_type rows) : out(out), rows(rows), next(0) {}
+
+		void operator()(const product_type & p) {
+			while (next < p.row) {
+				out.write(T());
+				++next;
+			}
+			out.write(p.value);
+			++next;
+		}
+
+		void finish() {
+			while (next < rows) {
+				out.write(T());
+				++next;
+			}
+		}
+
+	private:
+		file_stream<T> & out;
+		stream_size_type rows;
+		stream_size_type next;
+	};
+
+	template <typename output_t>
+	void merge_group(array<auto_ptr<temp_file> > & partials, memory_size_type begin, memory_size_type end,
+					 output_t & out) {
+		memory_size_type n = end - begin;
+		array<file_stream<product_type> > in(n);
+		internal_priority_queue<std::pair<stream_size_type, memory_size_type> > pq(n);
+		array<T> heads(n);
+		for (memory_size_type i = 0; i < n; ++i) {
+			in[i].open(*partials[begin + i], access_read);
+			if (!in[i].can_read()) continue;
+			const product_type & p = in[i].read();
+			heads[i] = p.value;
+			pq.push(std::make_pair(p.row, i));
+		}
+		while (!pq.empty()) {
+			product_type sum;
+			sum.row = pq.top().first;
+			sum.value = T();
+			while (!pq.empty() && pq.top().first == sum.row) {
+				memory_size_type i = pq.top().second;
+				sum.value += heads[i];
+				if (in[i].can_read()) {
+					const product_type & p = in[i].read();
+					heads[i] = p.value;
+					pq.pop_and_push(std::make_pair(p.row, i));
+				} else {
+					pq.pop();
+				}
+			}
+			out(sum);
+		}
+	}
+
+	memory_size_type m_memory;
+	memory_size_type m_threads;
+	stream_size_type m_rows;
+	stream_size_type m_cols;
+	stream_size_type m_nonzeros;
+	memory_size_type m_bandCols;
+	memory_size_type m_pipelineMemory;
+	array<auto_ptr<temp_file> > m_bands;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Run the PageRank power iteration.
+///
+/// \param transitions  The matrix with the probability 1/outdegree(u) of
+/// following the link from u to v in row v and column u.
+/// \param ranks  The ranks of the vertices, which are replaced by the ranks
+/// after the iterations. If empty, the iteration starts from the uniform
+/// distribution.
+/// \param damping  The probability of following a link rather than jumping
+/// to a uniformly random vertex. The rank lost at vertices without links is
+/// spread over all vertices as well, so the ranks keep summing to one.
+///////////////////////////////////////////////////////////////////////////////
+inline void pagerank(sparse_matrix<double> & transitions, file_stream<double> & ranks,
+					 memory_size_type iterations, double damping = 0.85) {
+	if (transitions.rows() != transitions.cols())
+		throw exception("pagerank: the matrix is not square");
+	stream_size_type n = transitions.rows();
+	if (n == 0) return;
+	if (ranks.size() == 0) {
+		for (stream_size_type i = 0; i < n; ++i) ranks.write(1.0 / n);
+	}
+	file_stream<double> next;
+	next.open();
+	for (memory_size_type it = 0; it < iterations; ++it) {
+		transitions.multiply(ranks, next);
+		double linked = 0;
+		next.seek(0);
+		while (next.can_read()) linked += damping * next.read();
+		double jump = (1.0 - linked) / n;
+		ranks.truncate(0);
+		next.seek(0);
+		while (next.can_read()) ranks.write(damping * next.read() + jump);
+	}
+}
+
+} // namespace tpie
+
+#endif // __TPIE_SPARSE_MATRIX_H__
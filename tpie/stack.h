@@ -19,6 +19,14 @@
 
 ///////////////////////////////////////////////////////////////////////////////
 /// \file stack.h  External memory stack
+///
+/// The items on top of the stack are kept in a buffer of two blocks. A full
+/// buffer spills its bottom items to the file, so that the file ends on a
+/// block boundary, and an empty buffer is refilled with the topmost block of
+/// the file. Either way at least a block of items remains between the top
+/// of the stack and the next transfer, so alternating pushes and pops do
+/// not cause I/O. During long sequences of pops the topmost block of the
+/// file is read in the background before the buffer runs empty.
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifndef _TPIE_AMI_STACK_H
@@ -28,12 +36,20 @@
 #include <tpie/portability.h>
 #include <tpie/deprecated.h>
 #include <tpie/stream.h>
+#include <tpie/job.h>
+#include <tpie/exception.h>
 #include <tpie/tpie_assert.h>
+#include <algorithm>
+#include <string>
 
 namespace tpie {
 
 ///////////////////////////////////////////////////////////////////
 /// \brief  An implementation of an external-memory stack.
+///
+/// memory_usage() counts the stream block, the two-block buffer and the
+/// read-ahead block. Without a job manager, blocks are read when the buffer
+/// runs empty instead of in the background.
 ///////////////////////////////////////////////////////////////////
 template <typename T> 
 class stack {
@@ -44,10 +60,9 @@ public:
     ////////////////////////////////////////////////////////////////////
 	inline stack(double blockFactor = 1.0)
 		: m_file_stream(blockFactor)
-		, m_buffer(buffer_size(blockFactor))
-		, m_bufferItems(0)
 	{
 		m_file_stream.open(static_cast<memory_size_type>(0), access_normal);
+		init(blockFactor);
 	}
 
     ////////////////////////////////////////////////////////////////////
@@ -58,12 +73,9 @@ public:
     ////////////////////////////////////////////////////////////////////
 	inline stack(const std::string& path, double block_factor = 1.0)
 		: m_file_stream(block_factor)
-		, m_buffer(buffer_size(block_factor))
-		, m_bufferItems(0)
 	{
 		m_file_stream.open(path, access_read_write, static_cast<memory_size_type>(0), access_normal);
-		
-		m_file_stream.seek(0, file_stream_base::end);
+		init(block_factor);
 	}
 
     ////////////////////////////////////////////////////////////////////
@@ -74,13 +86,10 @@ public:
     ////////////////////////////////////////////////////////////////////
 	inline stack(temp_file & tempFile, double block_factor = 1.0)
 		: m_file_stream(block_factor)
-		, m_buffer(buffer_size(block_factor))
-		, m_bufferItems(0)
 	{
 		m_file_stream.open(tempFile, access_read_write, 
 						   static_cast<memory_size_type>(0), access_normal);
-		
-		m_file_stream.seek(0, file_stream_base::end);
+		init(block_factor);
 	}
 
 
@@ -89,7 +98,9 @@ public:
     /// end of the stack.
     ////////////////////////////////////////////////////////////////////
 	~stack() {
-		empty_buffer();
+		if (m_prefetchActive) m_prefetchJob.join();
+		m_file_stream.seek(m_fileItems);
+		m_file_stream.write(m_buffer.begin(), m_buffer.begin()+m_bufferItems);
 		m_file_stream.truncate(this->size());
 	}
 
@@ -108,8 +119,9 @@ public:
     /// \brief Pops one item from the stack.
     ////////////////////////////////////////////////////////////////////
 	inline const T & pop() throw(stream_exception) {
-		if (m_bufferItems) return m_buffer[--m_bufferItems];
-		const T & item = m_file_stream.read_back();
+		if (m_bufferItems == 0) fill_buffer();
+		const T & item = m_buffer[--m_bufferItems];
+		if (m_bufferItems < m_blockItems / 2) start_prefetch();
 		return item;
 	}
 
@@ -117,24 +129,22 @@ public:
     /// \brief Peeks at the topmost item on the stack.
     ////////////////////////////////////////////////////////////////////
 	inline const T & top() throw(stream_exception) {
-		if (m_bufferItems) return m_buffer[m_bufferItems-1];
-		m_buffer[0] = m_file_stream.read_back();
-		m_file_stream.read();
-		return m_buffer[0];
+		if (m_bufferItems == 0) fill_buffer();
+		return m_buffer[m_bufferItems-1];
 	}
 
     ////////////////////////////////////////////////////////////////////
     /// \brief Returns the number of items currently on the stack.
     ////////////////////////////////////////////////////////////////////
     inline stream_size_type size() const {
-		return m_file_stream.offset()+m_bufferItems;
+		return m_fileItems+m_bufferItems;
     }
 
     ////////////////////////////////////////////////////////////////////
     /// \brief Returns whether the stack is empty or not.
     ////////////////////////////////////////////////////////////////////
     inline bool empty() const {
-		return size()  == 0;//!m_file_stream.can_read_back();
+		return size() == 0;
     }
 
     ////////////////////////////////////////////////////////////////////
@@ -143,7 +153,7 @@ public:
 	inline static memory_size_type memory_usage(float blockFactor=1.0) {
 		return sizeof(stack<T>)
 			+ file_stream<T>::memory_usage(blockFactor)
-			+ array<T>::memory_usage(buffer_size(blockFactor));
+			+ array<T>::memory_usage(3*block_items(blockFactor));
 	}
 
 protected:
@@ -152,17 +162,123 @@ protected:
 	file_stream<T> m_file_stream;
 
 private:
+	///////////////////////////////////////////////////////////////////
+	/// \brief Background job reading the topmost block of the file.
+	///////////////////////////////////////////////////////////////////
+	class prefetch_job : public job {
+	public:
+		prefetch_job() : s(0), failed(false) {}
+
+		virtual void operator()() {
+			try {
+				s->m_file_stream.seek(s->m_fileItems - s->m_prefetchItems);
+				s->m_file_stream.read(s->m_prefetch.begin(), s->m_prefetch.begin() + s->m_prefetchItems);
+			} catch (const std::exception & e) {
+				error = e.what();
+				failed = true;
+			}
+		}
+
+		stack * s;
+		bool failed;
+		std::string error;
+	};
+
+	/** The top of the stack: up to two blocks of items. */
 	array<T> m_buffer;
 	size_t m_bufferItems;
-
-	inline void empty_buffer() {
-		if (m_bufferItems == 0) return;
-		m_file_stream.write(m_buffer.begin(), m_buffer.begin()+m_bufferItems);
+	/** The number of items in a block of the file. */
+	memory_size_type m_blockItems;
+	/** The number of items of the stack stored in the file. */
+	stream_size_type m_fileItems;
+
+	/** The topmost items of the file, read ahead by m_prefetchJob. */
+	array<T> m_prefetch;
+	memory_size_type m_prefetchItems;
+	prefetch_job m_prefetchJob;
+	bool m_prefetchActive;
+	/** Whether m_prefetch holds the topmost items of the file. */
+	bool m_prefetchValid;
+
+	stack(const stack &);
+	stack & operator=(const stack &);
+
+	void init(double blockFactor) {
+		m_blockItems = block_items(blockFactor);
+		m_buffer.resize(2*m_blockItems);
 		m_bufferItems = 0;
+		m_fileItems = m_file_stream.size();
+		m_prefetch.resize(m_blockItems);
+		m_prefetchItems = 0;
+		m_prefetchJob.s = this;
+		m_prefetchActive = false;
+		m_prefetchValid = false;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	/// \brief The number of items of the topmost block of the file.
+	///////////////////////////////////////////////////////////////////
+	memory_size_type top_block_items() const {
+		memory_size_type n = static_cast<memory_size_type>(m_fileItems % m_blockItems);
+		return n ? n : m_blockItems;
+	}
+
+	void start_prefetch() {
+		if (m_prefetchActive || m_prefetchValid || m_fileItems == 0) return;
+		if (!job_manager_initialized()) return;
+		m_prefetchItems = top_block_items();
+		m_prefetchJob.enqueue();
+		m_prefetchActive = true;
+	}
+
+	void wait_for_prefetch() {
+		if (!m_prefetchActive) return;
+		m_prefetchJob.join();
+		m_prefetchActive = false;
+		if (m_prefetchJob.failed) {
+			m_prefetchJob.failed = false;
+			throw exception(m_prefetchJob.error);
+		}
+		m_prefetchValid = true;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	/// \brief Write the bottom items of the full buffer to the file, up to
+	/// the next block boundary, and keep the rest.
+	///////////////////////////////////////////////////////////////////
+	void empty_buffer() {
+		wait_for_prefetch();
+		m_prefetchValid = false;
+		memory_size_type n = static_cast<memory_size_type>(m_blockItems - m_fileItems % m_blockItems);
+		m_file_stream.seek(m_fileItems);
+		m_file_stream.write(m_buffer.begin(), m_buffer.begin()+n);
+		m_fileItems += n;
+		std::copy(m_buffer.begin()+n, m_buffer.begin()+m_bufferItems, m_buffer.begin());
+		m_bufferItems -= n;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	/// \brief Refill the empty buffer with the topmost block of the file.
+	///////////////////////////////////////////////////////////////////
+	void fill_buffer() {
+		if (m_fileItems == 0) throw end_of_stream_exception();
+		wait_for_prefetch();
+		memory_size_type n = top_block_items();
+		if (m_prefetchValid) {
+			tp_assert(m_prefetchItems == n, "fill_buffer: prefetched block has the wrong size");
+			std::copy(m_prefetch.begin(), m_prefetch.begin()+n, m_buffer.begin());
+			m_prefetchValid = false;
+		} else {
+			m_file_stream.seek(m_fileItems - n);
+			m_file_stream.read(m_buffer.begin(), m_buffer.begin()+n);
+		}
+		m_fileItems -= n;
+		m_bufferItems = n;
 	}
 
-	inline static memory_size_type buffer_size(double blockFactor) {
-		return file<T>::block_size(blockFactor)/sizeof(T);
+	inline static memory_size_type block_items(double blockFactor) {
+		return std::max(file<T>::block_size(blockFactor)/sizeof(T),
+						static_cast<memory_size_type>(1));
 	}
 
 };
@@ -21,21 +21,86 @@
 // the number of statistics to be recorded.
 
 #include <tpie/stats.h>
+#include <tpie/exception.h>
+#include <tpie/tpie_log.h>
+#include <boost/thread/mutex.hpp>
+#include <limits>
+#include <sstream>
 
 namespace tpie {
 	
+	/** Guards the temp_file_ variables, which are updated by background jobs. */
+	static boost::mutex temp_file_mutex;
 	static stream_size_type temp_file_usage=0;
+	static stream_size_type temp_file_limit=0;
+	static stream_size_type temp_file_max_exceeded=0;
+	static temp_file_enforce_t temp_file_enforce=TEMP_FILE_ENFORCE_WARN;
 	static stream_size_type bytes_read=0;
 	static stream_size_type bytes_written=0;
 
 	stream_size_type get_temp_file_usage() {
+		boost::mutex::scoped_lock lock(temp_file_mutex);
 		return temp_file_usage;
 	}
 
 	void increment_temp_file_usage(stream_offset_type delta) {
-		stream_offset_type x=temp_file_usage+delta;
-		if (x < 0) temp_file_usage=0;
-		temp_file_usage=x;
+		stream_size_type usage;
+		stream_size_type limit;
+		{
+			boost::mutex::scoped_lock lock(temp_file_mutex);
+			stream_offset_type x=temp_file_usage+delta;
+			temp_file_usage = (x < 0) ? 0 : x;
+			if (delta <= 0 || temp_file_limit == 0 || temp_file_usage <= temp_file_limit) return;
+			if (temp_file_enforce == TEMP_FILE_ENFORCE_IGNORE) return;
+			if (temp_file_usage - temp_file_limit <= temp_file_max_exceeded + temp_file_max_exceeded/8) return;
+			temp_file_max_exceeded = temp_file_usage - temp_file_limit;
+			usage = temp_file_usage;
+			limit = temp_file_limit;
+		}
+		log_warning() << "Temporary file limit exceeded by " << usage - limit
+					  << " bytes. Limit is " << limit << ", but "
+					  << usage << " bytes are used." << std::endl;
+	}
+
+	void check_temp_file_space(stream_size_type bytes) {
+		std::stringstream ss;
+		{
+			boost::mutex::scoped_lock lock(temp_file_mutex);
+			if (temp_file_enforce != TEMP_FILE_ENFORCE_THROW || temp_file_limit == 0) return;
+			if (temp_file_usage + bytes <= temp_file_limit) return;
+			ss << "Temporary file limit exceeded: limit is " << temp_file_limit
+			   << ", " << temp_file_usage << " bytes are used, and "
+			   << bytes << " more are needed.";
+		}
+		throw out_of_space_exception(ss.str());
+	}
+
+	void set_temp_file_limit(stream_size_type limit) {
+		boost::mutex::scoped_lock lock(temp_file_mutex);
+		temp_file_limit = limit;
+		temp_file_max_exceeded = 0;
+	}
+
+	stream_size_type get_temp_file_limit() {
+		boost::mutex::scoped_lock lock(temp_file_mutex);
+		return temp_file_limit;
+	}
+
+	stream_size_type get_temp_file_available() {
+		boost::mutex::scoped_lock lock(temp_file_mutex);
+		if (temp_file_limit == 0) return std::numeric_limits<stream_size_type>::max();
+		if (temp_file_usage >= temp_file_limit) return 0;
+		return temp_file_limit - temp_file_usage;
+	}
+
+	void set_temp_file_enforcement(temp_file_enforce_t e) {
+		boost::mutex::scoped_lock lock(temp_file_mutex);
+		temp_file_enforce = e;
+	}
+
+	temp_file_enforce_t get_temp_file_enforcement() {
+		boost::mutex::scoped_lock lock(temp_file_mutex);
+		return temp_file_enforce;
 	}
 
 	stream_size_type get_bytes_read() {
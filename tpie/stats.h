@@ -35,9 +35,70 @@ namespace tpie {
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief Increment (possibly by a negative amount) the number of bytes being
     /// used by temporary files
+	///
+	/// This is called when temporary files have been written, flushed or
+	/// closed, so it never throws. When the usage grows beyond the limit set
+	/// using \ref set_temp_file_limit, a warning is logged unless the
+	/// enforcement policy is TEMP_FILE_ENFORCE_IGNORE.
 	///////////////////////////////////////////////////////////////////////////
 	void increment_temp_file_usage(stream_offset_type delta);
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Check that temporary files may grow by the given number of
+	/// bytes before allocating the space.
+	///
+	/// With TEMP_FILE_ENFORCE_THROW, an out_of_space_exception is thrown if
+	/// the growth would exceed the temporary file limit. The usage is not
+	/// changed; it is recorded by increment_temp_file_usage when the data is
+	/// written.
+	///////////////////////////////////////////////////////////////////////////
+	void check_temp_file_space(stream_size_type bytes);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Temporary file usage limit enforcement policies.
+	///////////////////////////////////////////////////////////////////////////
+	enum temp_file_enforce_t {
+		/** Ignore when the temporary file limit is exceeded. */
+		TEMP_FILE_ENFORCE_IGNORE,
+		/** \brief Log a warning when the temporary file limit is exceeded.
+		 * Note that not all violations will be logged. */
+		TEMP_FILE_ENFORCE_WARN,
+		/** Throw an out_of_space_exception when a temporary file is about to
+		 * grow beyond the limit, as if the disk were full. The limit is
+		 * checked when a stream starts a new block at the end of a temporary
+		 * file and when a sort plans its merges. */
+		TEMP_FILE_ENFORCE_THROW
+	};
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Set the number of bytes temporary files may use in total.
+	/// \param limit The limit in bytes, or 0 for no limit (the default).
+	///////////////////////////////////////////////////////////////////////////
+	void set_temp_file_limit(stream_size_type limit);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return the temporary file limit, or 0 if there is none.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type get_temp_file_limit();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return the number of bytes temporary files may grow by before
+	/// the limit is exceeded. Without a limit, this is the largest
+	/// stream_size_type.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type get_temp_file_available();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Set the temporary file limit enforcement policy. The default is
+	/// TEMP_FILE_ENFORCE_WARN.
+	///////////////////////////////////////////////////////////////////////////
+	void set_temp_file_enforcement(temp_file_enforce_t e);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return the temporary file limit enforcement policy.
+	///////////////////////////////////////////////////////////////////////////
+	temp_file_enforce_t get_temp_file_enforcement();
+
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief Return the number of bytes read from disk since program start.
 	///////////////////////////////////////////////////////////////////////////
@@ -22,6 +22,7 @@
 #include <cstdlib>
 #include <time.h>
 #include <cstring>
+#include <algorithm>
 #include <tpie/tempname.h>
 #include <tpie/tpie_log.h>
 #include <string>
@@ -29,6 +30,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/random.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/mutex.hpp>
 #include <stdexcept>
 #include <tpie/util.h>
 #include <tpie/err.h>
@@ -45,6 +47,13 @@ boost::rand48 prng(42);
 namespace {
 
 std::string default_path;
+// Directories set using set_default_paths along with their placement weights
+// and the number of files placed in each.
+std::vector<std::string> default_paths;
+std::vector<double> path_weights;
+std::vector<stream_size_type> path_uses;
+// Guards the directories above, since temp files are named from jobs too.
+boost::mutex paths_mutex;
 std::string default_base_name;
 std::string default_extension;
 std::string tpie_mktemp();
@@ -79,7 +88,7 @@ std::string gen_temp(const std::string& post_base, const std::string& dir, const
 	if(!dir.empty())
 		base_dir = dir;
 	else
-		base_dir = tempname::get_actual_path();
+		base_dir = tempname::get_next_path();
 
 	boost::filesystem::path p;
 	for(int i=0; i < 42; ++i) {
@@ -123,6 +132,26 @@ std::string tempname::get_actual_path() {
 	return dir;
 }
 
+std::vector<std::string> tempname::get_actual_paths() {
+	boost::mutex::scoped_lock lock(paths_mutex);
+	if (default_paths.size() > 1) return default_paths;
+	return std::vector<std::string>(1, get_actual_path());
+}
+
+std::string tempname::get_next_path() {
+	boost::mutex::scoped_lock lock(paths_mutex);
+	if (default_paths.size() <= 1) return get_actual_path();
+	// Pick the directory whose share of the placed files is furthest below
+	// its weight; with equal weights this is round robin.
+	size_t best = 0;
+	for (size_t i = 1; i < default_paths.size(); ++i) {
+		if ((path_uses[i]+1) / path_weights[i] < (path_uses[best]+1) / path_weights[best])
+			best = i;
+	}
+	++path_uses[best];
+	return default_paths[best];
+}
+
 namespace {
 std::string tpie_mktemp()
 {
@@ -154,6 +183,10 @@ std::string tpie_mktemp()
 
 
 void tempname::set_default_path(const std::string&  path, const std::string& subdir) {
+	boost::mutex::scoped_lock lock(paths_mutex);
+	default_paths.clear();
+	path_weights.clear();
+	path_uses.clear();
 	if (subdir=="") {
 		default_path = path;
 		return;
@@ -174,12 +207,30 @@ void tempname::set_default_path(const std::string&  path, const std::string& sub
 #else
 		default_path = p.directory_string();
 #endif
-	} catch (boost::filesystem::filesystem_error) { 
+	} catch (const boost::filesystem::filesystem_error &) { 
 		TP_LOG_WARNING_ID("Could not use " << p << " as directory for temporary files, trying " << path);
 		default_path = path; 
 	}	
 }
 
+void tempname::set_default_paths(const std::vector<std::string> & paths, placement_policy policy) {
+	boost::mutex::scoped_lock lock(paths_mutex);
+	default_paths = paths;
+	default_path = paths.empty() ? std::string() : paths[0];
+	path_weights.assign(paths.size(), 1.0);
+	path_uses.assign(paths.size(), 0);
+	if (policy != placement_capacity_weighted) return;
+	for (size_t i = 0; i < paths.size(); ++i) {
+		try {
+			boost::filesystem::space_info s = boost::filesystem::space(paths[i]);
+			// Keep a nonzero weight so that full devices are merely avoided.
+			path_weights[i] = std::max(static_cast<double>(s.available), 1.0);
+		} catch (const boost::filesystem::filesystem_error &) {
+			TP_LOG_WARNING_ID("Could not get free space of " << paths[i] << "; weighting it as empty");
+		}
+	}
+}
+
 void tempname::set_default_base_name(const std::string& name) {
 	default_base_name = name;
 }
@@ -28,6 +28,8 @@
 #include <tpie/portability.h>
 #include <tpie/stats.h>
 #include <stdexcept>
+#include <string>
+#include <vector>
 #include <boost/utility.hpp>
 // The name of the environment variable pointing to a tmp directory.
 #define TMPDIR_ENV "TMPDIR"
@@ -48,6 +50,18 @@ namespace tpie {
 	///////////////////////////////////////////////////////////////////////////
 	class tempname {
 	public:
+		///////////////////////////////////////////////////////////////////////
+		/// \brief How new temporary files are spread over the directories
+		/// given to \ref set_default_paths.
+		///////////////////////////////////////////////////////////////////////
+		enum placement_policy {
+			/** Use the directories in turn. */
+			placement_round_robin,
+			/** Place files in proportion to the free space of each directory
+			 * when the directories were set. */
+			placement_capacity_weighted
+		};
+
 		///////////////////////////////////////////////////////////////////////
 		/// \brief Generate path for a new temporary file.
 		///
@@ -61,7 +75,7 @@ namespace tpie {
 		///
 		/// This file name is suffixed a temporary directory passed as a
 		/// parameter. If no temporary directory is passed, the directory
-		/// reported by \ref get_actual_path is used instead.
+		/// reported by \ref get_next_path is used instead.
 		///
 		/// The path returned does not already exist on the filesystem.
 		///////////////////////////////////////////////////////////////////////
@@ -91,6 +105,21 @@ namespace tpie {
 		///////////////////////////////////////////////////////////////////////
 		static void set_default_path(const std::string& path, const std::string& subdir="");
 
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Sets several default temporary paths, typically one on
+		/// each of several devices.
+		///
+		/// New temporary files are placed in these directories according to
+		/// the given policy, so that files used together, such as the runs
+		/// of a merge sort, end up on different devices. Calling
+		/// \ref set_default_path afterwards reverts to a single directory.
+		///
+		/// \param paths The directories to use; they must exist.
+		/// \param policy How to spread new files over the directories.
+		///////////////////////////////////////////////////////////////////////
+		static void set_default_paths(const std::vector<std::string> & paths,
+									  placement_policy policy = placement_round_robin);
+
 		///////////////////////////////////////////////////////////////////////
 		/// \brief Set default base name for temporary files.
 		/// \sa tpie_name
@@ -142,6 +171,20 @@ namespace tpie {
 		/// \return A string containing the path.
 		///////////////////////////////////////////////////////////////////////
 		static std::string get_actual_path();
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Get all directories used for temporary files.
+		///
+		/// \return The paths set using \ref set_default_paths, or if
+		/// fewer than two are set, the path from \ref get_actual_path.
+		///////////////////////////////////////////////////////////////////////
+		static std::vector<std::string> get_actual_paths();
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Get the directory in which to place the next temporary
+		/// file, according to the placement policy.
+		///////////////////////////////////////////////////////////////////////
+		static std::string get_next_path();
 	};
 
 	///////////////////////////////////////////////////////////////////////////